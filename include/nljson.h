@@ -53,6 +53,12 @@
 
 /**
  * nljson handle.
+ *
+ * The handle is read-only after it has been initialized (and configured,
+ * e.g. with nljson_enable_encode_cache), so one handle can be shared by
+ * any number of threads calling the encode and decode functions
+ * concurrently. nljson_deinit and the configuration functions must not
+ * be called while other threads are using the handle.
  */
 typedef struct _nljson nljson_t;
 
@@ -218,6 +224,235 @@ int nljson_init_cb(nljson_t **hdl,
  */
 void nljson_deinit(nljson_t **hdl);
 
+/**
+ * \defgroup alloc_functions Memory allocation
+ * @{
+ *
+ * Memory allocation functions.
+ *
+ * By default, the library (and jansson) uses malloc and free.
+ * nljson_set_alloc_funcs replaces the allocator for all library
+ * allocations, including the ones made by jansson.
+ *
+ * In addition, a thread can use an arena for all temporary allocations
+ * (the JSON DOM and the intermediate attribute lists) made by the encode
+ * and decode functions. Arena allocations are simple pointer bumps and
+ * all of them are released at once at the end of each call.
+ * If the arena is full, the regular allocator is used instead.
+ * Memory returned to the caller (e.g. the output of the *_alloc
+ * functions) is never allocated from the arena.
+ */
+
+/**
+ * Memory allocation function. Same semantics as malloc.
+ */
+typedef void *(*nljson_malloc_t)(size_t size);
+
+/**
+ * Memory free function. Same semantics as free.
+ */
+typedef void (*nljson_free_t)(void *ptr);
+
+/**
+ * nljson arena handle.
+ */
+typedef struct _nljson_arena nljson_arena_t;
+
+/**
+ * Sets the memory allocation functions used by the library.
+ * The functions are installed in jansson as well (using
+ * json_set_alloc_funcs).
+ *
+ * This function must be called before any other library function,
+ * since memory allocated with one allocator must not be freed with
+ * another. Memory returned by the library must be freed with free_func.
+ *
+ * @param[in] malloc_func  Allocation function. NULL means malloc.
+ *
+ * @param[in] free_func    Free function. NULL means free.
+ */
+void nljson_set_alloc_funcs(nljson_malloc_t malloc_func,
+			    nljson_free_t free_func);
+
+/**
+ * Creates an arena for temporary allocations.
+ * The arena is not used until it has been activated with nljson_arena_use.
+ *
+ * Note that creating an arena installs the library allocation functions
+ * in jansson (see nljson_set_alloc_funcs).
+ *
+ * @param[inout] arena  Arena that will be allocated.
+ *
+ * @param[in] size      Size of the arena in bytes.
+ *
+ * @param[out] error    Error output. The struct must be allocated by
+ *                      the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_arena_init(nljson_arena_t **arena,
+		      size_t size,
+		      struct nljson_error *error);
+
+/**
+ * Frees an arena and sets the arena pointer to NULL.
+ * The arena must not be in use by any other thread.
+ *
+ * @param[inout] arena  The arena that will be freed
+ */
+void nljson_arena_deinit(nljson_arena_t **arena);
+
+/**
+ * Sets the arena used by the calling thread.
+ * An arena must only be used by one thread at a time.
+ * Any jansson allocation made from within an encode callback will also
+ * be made from the arena.
+ *
+ * @param[in] arena  The arena. NULL disables arena allocations.
+ *
+ * @return The previous arena of the calling thread (or NULL).
+ */
+nljson_arena_t *nljson_arena_use(nljson_arena_t *arena);
+
+/**
+ * Returns the maximum number of arena bytes used by a single call.
+ * Useful for sizing the arena.
+ *
+ * @param[in] arena  The arena.
+ */
+size_t nljson_arena_peak(const nljson_arena_t *arena);
+
+/** @} */
+
+/**
+ * \defgroup ctx_functions Per thread contexts
+ * @{
+ *
+ * Encode and decode functions using a per thread context.
+ *
+ * A context holds a scratch arena for all temporary allocations and an
+ * output buffer that is reused by every call. Once the output buffer has
+ * grown to the size of the largest message, encoding and decoding with a
+ * context requires no memory allocation.
+ *
+ * A context must only be used by one thread at a time, but any number of
+ * contexts can share the same nljson handle.
+ */
+
+/**
+ * nljson context handle.
+ */
+typedef struct _nljson_ctx nljson_ctx_t;
+
+/**
+ * Creates a context.
+ *
+ * @param[inout] ctx        Context that will be allocated.
+ *
+ * @param[in] scratch_size  Size of the scratch arena in bytes. 0 means that
+ *                          no arena is used (only the output buffer is
+ *                          reused).
+ *
+ * @param[out] error        Error output. The struct must be allocated by
+ *                          the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_ctx_init(nljson_ctx_t **ctx,
+		    size_t scratch_size,
+		    struct nljson_error *error);
+
+/**
+ * Frees a context and sets the context pointer to NULL.
+ *
+ * @param[inout] ctx   The context that will be freed
+ */
+void nljson_ctx_deinit(nljson_ctx_t **ctx);
+
+/**
+ * Encodes a stream of netlink attributes into a JSON string stored in the
+ * output buffer of the context.
+ *
+ * @param[in] hdl               nljson handle.
+ *
+ * @param[in] ctx               Context.
+ *
+ * @param[in] nla_stream        Stream of bytes containing netlink attributes.
+ *
+ * @param[in] nla_stream_len    The length of nla_stream.
+ *
+ * @param[out] output           Set to the NUL terminated output string.
+ *                              The string is valid until the next call
+ *                              using the same context.
+ *
+ * @param[out] bytes_consumed   The number of bytes read (consumed) from
+ *                              nla_stream.
+ *
+ * @param[out] bytes_produced   The length of the output string.
+ *
+ * @param[in] json_format_flags Flags for the JSON output formatting.
+ *                              Passed directly to the jansson library.
+ *                              See jansson documentation for more info.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+int nljson_encode_nla_ctx(nljson_t *hdl,
+			  nljson_ctx_t *ctx,
+			  const void *nla_stream,
+			  size_t nla_stream_len,
+			  const char **output,
+			  size_t *bytes_consumed,
+			  size_t *bytes_produced,
+			  uint32_t json_format_flags,
+			  struct nljson_error *error);
+
+/**
+ * Decodes a JSON encoded string into a stream of netlink attributes
+ * stored in the output buffer of the context.
+ *
+ * @param[in] ctx               Context.
+ *
+ * @param[in] input             JSON encoded input. Does not have to be NUL
+ *                              terminated.
+ *
+ * @param[in] input_len         The length of input.
+ *
+ * @param[out] nla_stream       Set to the output nla stream. The stream is
+ *                              valid until the next call using the same
+ *                              context.
+ *
+ * @param[out] bytes_consumed   The number of bytes read (consumed) from
+ *                              input.
+ *
+ * @param[out] bytes_produced   The length of the output nla stream.
+ *
+ * @param[in] json_decode_flags Flags for the JSON input parsing.
+ *                              Passed directly to the jansson library.
+ *                              See jansson documentation for more info.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+int nljson_decode_nla_ctx(nljson_ctx_t *ctx,
+			  const char *input,
+			  size_t input_len,
+			  const void **nla_stream,
+			  size_t *bytes_consumed,
+			  size_t *bytes_produced,
+			  uint32_t json_decode_flags,
+			  struct nljson_error *error);
+
+/** @} */
+
 /**
  * \defgroup encode_functions Encode family of functions
  * @{
@@ -365,6 +600,353 @@ int nljson_encode_nla_cb(nljson_t *hdl,
 
 /** @} */
 
+/**
+ * \defgroup encode_cache Encode cache
+ * @{
+ *
+ * Encode cache.
+ *
+ * Periodic events often contain exactly the same attributes. When the
+ * encode cache is enabled, the JSON output of each encoded nla stream is
+ * stored in a per handle cache keyed by a hash of the nla stream and
+ * the JSON format flags. If the same nla stream is encoded again, the
+ * output is taken from the cache instead of being encoded. When the
+ * memory budget is reached, entries are evicted with the CLOCK (second
+ * chance) algorithm.
+ *
+ * The cache can be shared by several threads encoding with the same
+ * handle. Large caches are split into shards with one lock each, and
+ * lookups only take the lock of their shard for reading.
+ *
+ * Nothing is cached if NLJSON_FLAG_ADD_TIMESTAMP is set since the output
+ * is unique for each encoded stream in this case. The cache is not used
+ * while policy coverage profiling is enabled (see nljson_enable_profile).
+ */
+
+/**
+ * Encode cache statistics.
+ */
+struct nljson_cache_stats {
+	/** Number of encoded streams found in the cache */
+	uint64_t hits;
+	/** Number of encoded streams not found in the cache */
+	uint64_t misses;
+	/** Number of entries added to the cache */
+	uint64_t insertions;
+	/** Number of entries removed from the cache */
+	uint64_t evictions;
+	/** Current number of entries in the cache */
+	size_t entries;
+	/** Current memory used by the cache entries */
+	size_t mem_used;
+	/** Max memory that can be used by the cache entries */
+	size_t mem_budget;
+};
+
+/**
+ * Enables (or disables) the encode cache of a handle.
+ * Any previously cached entries are dropped.
+ * Must not be called while other threads are encoding with the handle.
+ *
+ * @param[inout] hdl     The nljson handle. Must be allocated by one
+ *                       of the init functions.
+ *
+ * @param[in] mem_budget Max number of bytes used by the cache (including
+ *                       the cached nla streams and JSON output).
+ *                       Entries are evicted (CLOCK order) when
+ *                       the budget is exceeded.
+ *                       If 0, the cache is disabled.
+ *
+ * @param[out] error     Error output. The struct must be allocated by
+ *                       the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+int nljson_enable_encode_cache(nljson_t *hdl,
+			       size_t mem_budget,
+			       struct nljson_error *error);
+
+/**
+ * Reads the encode cache statistics of a handle.
+ *
+ * @param[in] hdl        The nljson handle.
+ *
+ * @param[out] stats     Statistics output. The struct must be allocated by
+ *                       the caller.
+ *
+ * @return 0 on success or -1 if the handle has no encode cache.
+ */
+int nljson_get_encode_cache_stats(nljson_t *hdl,
+				  struct nljson_cache_stats *stats);
+
+/** @} */
+
+/**
+ * \defgroup stats_functions Runtime statistics
+ * @{
+ *
+ * Runtime statistics of the encode functions.
+ *
+ * When statistics are enabled on a handle, each encode function called
+ * with the handle (nljson_encode_nla, nljson_encode_nla_alloc,
+ * nljson_encode_nla_cb and nljson_encode_nla_ctx) adds the number of
+ * messages, attributes, bytes etc. to the counters of the handle.
+ *
+ * The counters are sharded per thread (each shard on a cache line of its
+ * own), so threads encoding with the same handle do not contend on the
+ * counters. nljson_get_stats adds up all shards.
+ *
+ * The decode functions do not take a handle and are not counted.
+ */
+
+/** Number of buckets in the nesting depth histogram */
+#define NLJSON_STATS_DEPTH_BUCKETS (8)
+
+/** Error kinds counted in struct nljson_stats */
+enum nljson_stats_error {
+	/** The nla stream could not be encoded */
+	NLJSON_STATS_ERR_PARSE,
+	/** The JSON output could not be written (e.g. the output buffer
+	 *  was too small or the encode callback failed)
+	 */
+	NLJSON_STATS_ERR_OUTPUT,
+	/** Memory allocation failure */
+	NLJSON_STATS_ERR_NOMEM,
+	NLJSON_STATS_ERR_MAX,
+};
+
+/**
+ * Runtime statistics.
+ *
+ * Messages taken from the encode cache are counted in the same way as
+ * encoded messages (the attribute counts are stored in the cache),
+ * except for the phase times since they are not parsed.
+ */
+struct nljson_stats {
+	/** Number of successfully encoded messages */
+	uint64_t messages;
+	/** Number of parsed attributes (including nested and skipped
+	 *  attributes)
+	 */
+	uint64_t attrs;
+	/** Number of unknown attributes skipped because of
+	 *  NLJSON_FLAG_SKIP_UNKNOWN_ATTRS
+	 */
+	uint64_t unknown_attrs_skipped;
+	/** Number of nla stream bytes encoded */
+	uint64_t bytes_in;
+	/** Number of JSON bytes produced */
+	uint64_t bytes_out;
+	/** Number of messages by nesting depth. depth[0] counts messages
+	 *  without nested attributes, depth[1] messages with one level of
+	 *  nested attributes etc. The last bucket also counts all deeper
+	 *  messages.
+	 */
+	uint64_t depth[NLJSON_STATS_DEPTH_BUCKETS];
+	/** Number of failed encode calls by kind of error */
+	uint64_t errors[NLJSON_STATS_ERR_MAX];
+	/** Number of heap allocations made by the calling threads (the
+	 *  allocations of the parallel encode threads are not included)
+	 */
+	uint64_t allocs;
+	/** Time spent parsing nla streams into JSON objects */
+	uint64_t parse_ns;
+	/** Time spent writing the JSON output */
+	uint64_t dump_ns;
+};
+
+/**
+ * Enables (or disables) runtime statistics of a handle.
+ * The counters start from zero when enabled.
+ * Must not be called while other threads are encoding with the handle.
+ *
+ * @param[inout] hdl     The nljson handle. Must be allocated by one
+ *                       of the init functions.
+ *
+ * @param[in] enable     Non-zero to enable statistics, zero to disable.
+ *
+ * @param[out] error     Error output. The struct must be allocated by
+ *                       the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+int nljson_enable_stats(nljson_t *hdl,
+			int enable,
+			struct nljson_error *error);
+
+/**
+ * Reads the runtime statistics of a handle.
+ * May be called while other threads are encoding with the handle.
+ *
+ * @param[in] hdl        The nljson handle.
+ *
+ * @param[out] stats     Statistics output. The struct must be allocated by
+ *                       the caller.
+ *
+ * @return 0 on success or -1 if statistics are not enabled.
+ */
+int nljson_get_stats(nljson_t *hdl, struct nljson_stats *stats);
+
+/**
+ * Sets all runtime statistics counters of a handle to zero.
+ * May be called while other threads are encoding with the handle. The
+ * messages encoded concurrently may then be partially counted.
+ *
+ * @param[in] hdl        The nljson handle.
+ */
+void nljson_reset_stats(nljson_t *hdl);
+
+/** @} */
+
+/**
+ * \defgroup profile_functions Policy coverage profiling
+ * @{
+ *
+ * Policy coverage profiling.
+ *
+ * When profiling is enabled on a handle, the encode functions count how
+ * many times each attribute type is encoded at each level of the policy
+ * (the top level and each nested policy). Attribute types that are not
+ * in the policy are counted as well. The counts can be used to find the
+ * attributes that dominate the traffic, policy entries that are never
+ * used and unknown attributes sent by the kernel.
+ *
+ * Attributes inside nested attributes without a nested policy are not
+ * counted (only the nested attribute itself is). The encode cache is not
+ * used while profiling is enabled, so that every message is parsed and
+ * counted.
+ *
+ * The counters are shared by all threads encoding with the handle and
+ * are updated atomically.
+ */
+
+/** nla_type of the entry counting unknown attribute types that could not
+ *  be counted separately (see struct nljson_profile_entry)
+ */
+#define NLJSON_PROFILE_OTHER_TYPE (UINT32_MAX)
+
+/**
+ * Profile entry, i.e. the number of encoded attributes of one type at
+ * one policy level.
+ */
+struct nljson_profile_entry {
+	/** Path of the policy level. "/" is the top level. Nested levels
+	 *  are named by the attributes leading to the level, e.g.
+	 *  "/NL80211_ATTR_BSS/NL80211_BSS_IES".
+	 */
+	const char *level;
+	/** Attribute type. NLJSON_PROFILE_OTHER_TYPE counts the unknown
+	 *  attribute types above the max attribute type of the level that
+	 *  did not fit in the (fixed size) per level table.
+	 */
+	uint32_t nla_type;
+	/** Attribute name or NULL if the attribute is not in the policy */
+	const char *name;
+	/** Data type name from the policy (e.g. "NLA_U32") */
+	const char *data_type;
+	/** Number of encoded attributes */
+	uint64_t hits;
+};
+
+/**
+ * Enables (or disables) policy coverage profiling of a handle.
+ * The counters start from zero when enabled.
+ * Must not be called while other threads are encoding with the handle.
+ *
+ * @param[inout] hdl     The nljson handle. Must be allocated by one
+ *                       of the init functions with a policy.
+ *
+ * @param[in] enable     Non-zero to enable profiling, zero to disable.
+ *
+ * @param[out] error     Error output. The struct must be allocated by
+ *                       the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+int nljson_enable_profile(nljson_t *hdl,
+			  int enable,
+			  struct nljson_error *error);
+
+/**
+ * Calls profile_cb for each profile entry of a handle.
+ * All attributes in the policy are reported (also the ones that have not
+ * been encoded). Unknown attributes are only reported if they have been
+ * encoded. The levels are reported depth first in policy order.
+ * May be called while other threads are encoding with the handle.
+ *
+ * @param[in] hdl        The nljson handle.
+ *
+ * @param[in] profile_cb Callback function. The entry (and its strings)
+ *                       are only valid during the call. If the callback
+ *                       returns non-zero, no more entries are reported.
+ *
+ * @param[in] cb_data    User data passed to profile_cb.
+ *
+ * @return 0 on success or -1 if profiling is not enabled or profile_cb
+ *         returned non-zero.
+ */
+int nljson_get_profile(nljson_t *hdl,
+		       int (*profile_cb)(const struct nljson_profile_entry *entry,
+					 void *data),
+		       void *cb_data);
+
+/**
+ * Sets all profile counters of a handle to zero.
+ * May be called while other threads are encoding with the handle.
+ *
+ * @param[in] hdl        The nljson handle.
+ */
+void nljson_reset_profile(nljson_t *hdl);
+
+/** @} */
+
+/**
+ * \defgroup encode_threads Parallel encoding
+ * @{
+ *
+ * Parallel encoding of large messages.
+ *
+ * Large messages (e.g. scan or survey dumps) typically consist of a few
+ * NLA_NESTED attributes containing a large number of nested entries.
+ * When encode threads are enabled on a handle, messages larger than
+ * min_len are split into independent tasks: the values of the nested
+ * attributes are encoded in parallel by the encode threads (and the
+ * calling thread) and then combined in the original order. The output is
+ * identical to the output of the serial encoder.
+ */
+
+/**
+ * Enables (or disables) parallel encoding of large messages.
+ * All encode functions using hdl are affected.
+ *
+ * Must not be called while other threads are using the handle.
+ *
+ * @param[in] hdl          The nljson handle.
+ *
+ * @param[in] num_threads  Number of encode threads (in addition to the
+ *                         calling thread). 0 disables parallel encoding.
+ *
+ * @param[in] min_len      Messages shorter than min_len bytes are always
+ *                         encoded serially.
+ *
+ * @param[out] error       Error output. The struct must be allocated by
+ *                         the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_set_encode_threads(nljson_t *hdl,
+			      unsigned int num_threads,
+			      size_t min_len,
+			      struct nljson_error *error);
+
+/** @} */
+
 /**
  * \defgroup decode_functions Decode family of functions
  * @{
@@ -479,5 +1061,1108 @@ int nljson_decode_nla_cb(const char *input,
 
 /** @} */
 
+/**
+ * \defgroup record_functions Framed records
+ * @{
+ *
+ * Framed records.
+ *
+ * A raw nla stream has no message boundaries. A framed record stream
+ * consists of records, each one made up of a fixed size header
+ * (struct nljson_record_hdr) followed by an nla stream. The nla stream
+ * is padded to a multiple of NLJSON_RECORD_ALIGN bytes, so a reader can
+ * skip records without parsing the attributes.
+ *
+ * All header fields are in host byte order (like the nla streams).
+ */
+
+/** Magic number of record headers ("NLJR") */
+#define NLJSON_RECORD_MAGIC (0x524a4c4e)
+/** The family and cmd fields of the header are valid */
+#define NLJSON_RECORD_FLAG_GENL (1)
+/** Alignment of records */
+#define NLJSON_RECORD_ALIGN (4)
+
+struct nljson_record_hdr {
+	/** NLJSON_RECORD_MAGIC */
+	uint32_t magic;
+	/** Length of the nla stream (excluding padding) */
+	uint32_t len;
+	/** Time stamp (nanoseconds since the epoch) */
+	uint64_t timestamp;
+	/** Generic netlink family id (if NLJSON_RECORD_FLAG_GENL is set) */
+	uint16_t family;
+	/** Generic netlink command (if NLJSON_RECORD_FLAG_GENL is set) */
+	uint8_t cmd;
+	/** NLJSON_RECORD_FLAG_* */
+	uint8_t flags;
+	uint32_t reserved;
+};
+
+/**
+ * Returns the total length of a record (header, nla stream and padding)
+ * with an nla stream of nla_stream_len bytes.
+ */
+size_t nljson_record_len(size_t nla_stream_len);
+
+/**
+ * Initializes a record header. The time stamp is set to the current time.
+ *
+ * @param[out] hdr            Header to initialize.
+ *
+ * @param[in] nla_stream_len  Length of the nla stream of the record.
+ *
+ * @param[in] family          Generic netlink family id. If both family and
+ *                            cmd are 0, NLJSON_RECORD_FLAG_GENL is not set.
+ *
+ * @param[in] cmd             Generic netlink command.
+ *
+ * @param[out] error          Error output. The struct must be allocated by
+ *                            the caller.
+ *
+ * @return 0 on success or -1 on error (nla stream too long).
+ */
+int nljson_record_hdr_init(struct nljson_record_hdr *hdr,
+			   size_t nla_stream_len,
+			   uint16_t family,
+			   uint8_t cmd,
+			   struct nljson_error *error);
+
+/**
+ * Parses the first record in buf.
+ *
+ * buf does not need to be aligned. The header is copied to hdr.
+ *
+ * @param[in] buf              Buffer containing framed records.
+ *
+ * @param[in] buf_len          Length of buf.
+ *
+ * @param[out] hdr             Header of the record.
+ *
+ * @param[out] nla_stream      Set to point at the nla stream of the record
+ *                             (inside buf).
+ *
+ * @param[out] bytes_consumed  Length of the whole record (including
+ *                             padding). 0 if buf does not contain a
+ *                             complete record.
+ *
+ * @param[out] error           Error output. The struct must be allocated
+ *                             by the caller.
+ *
+ * @return 0 on success (or if the record is incomplete) or -1 if the
+ *         header is invalid.
+ */
+int nljson_record_next(const void *buf,
+		       size_t buf_len,
+		       struct nljson_record_hdr *hdr,
+		       const void **nla_stream,
+		       size_t *bytes_consumed,
+		       struct nljson_error *error);
+
+/** @} */
+
+/**
+ * \defgroup binary_functions Binary encoding
+ * @{
+ *
+ * CBOR (RFC 8949) and MessagePack encoding.
+ *
+ * The binary documents have the same logical structure as the JSON
+ * documents produced by the encode functions: a map of attributes where
+ * each attribute is a map with the same keys as in JSON. The only
+ * difference is that the values of NLA_UNSPEC attributes are byte strings
+ * (CBOR major type 2, MessagePack bin) instead of arrays of integers.
+ *
+ * The decoder accepts byte strings and arrays of integers alike. CBOR
+ * indefinite length items and MessagePack extension types are not
+ * supported. CBOR tags are ignored.
+ */
+
+enum nljson_bin_format {
+	/** CBOR (RFC 8949) */
+	NLJSON_BIN_CBOR,
+	/** MessagePack */
+	NLJSON_BIN_MSGPACK,
+};
+
+/**
+ * Similar to nljson_encode_nla_alloc but the output is a CBOR or
+ * MessagePack document.
+ * The caller is responsible for deallocating the buffer.
+ *
+ * The encode cache of the handle (if any) is not used. Runtime statistics
+ * and profiling are updated as for the JSON encode functions.
+ *
+ * @param[inout] hdl            The nljson handle. Must be allocated by one
+ *                              of the init functions.
+ *
+ * @param[in] nla_stream        Stream of bytes containing netlink attributes
+ *
+ * @param[in] nla_stream_len    The length of the netlink attribute byte stream.
+ *
+ * @param[in] format            Output format.
+ *
+ * @param[out] bytes_consumed   The number of bytes read (consumed) from
+ *                              nla_stream.
+ *
+ * @param[out] bytes_produced   The number of output bytes produced, i.e. the
+ *                              length of the binary output.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return pointer to output buffer on success or NULL on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+void *nljson_encode_nla_bin_alloc(nljson_t *hdl,
+				  const void *nla_stream,
+				  size_t nla_stream_len,
+				  enum nljson_bin_format format,
+				  size_t *bytes_consumed,
+				  size_t *bytes_produced,
+				  struct nljson_error *error);
+
+/**
+ * Decodes the first CBOR or MessagePack document in input into an nla
+ * stream. The output buffer is allocated by the function and returned to
+ * the caller.
+ * The caller is responsible for deallocating the buffer.
+ *
+ * @param[in] input             Binary encoded input.
+ *
+ * @param[in] input_len         Length of input. input may contain more
+ *                              than one document.
+ *
+ * @param[in] format            Input format.
+ *
+ * @param[out] bytes_consumed   The number of bytes read (consumed) from
+ *                              input, i.e. the length of the document.
+ *
+ * @param[out] bytes_produced   The number of output bytes produced, i.e. the
+ *                              length of the nla_stream.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return pointer to output buffer on success or NULL on error (including
+ *         an incomplete document).
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+void *nljson_decode_nla_bin_alloc(const void *input,
+				  size_t input_len,
+				  enum nljson_bin_format format,
+				  size_t *bytes_consumed,
+				  size_t *bytes_produced,
+				  struct nljson_error *error);
+
+/** @} */
+
+/**
+ * \defgroup generate_functions Generation of nla streams
+ * @{
+ *
+ * Generation of synthetic nla streams.
+ *
+ * nljson_generate_nla creates randomized nla streams from the policy of
+ * a handle, e.g. for load testing. The generated streams are valid
+ * according to nljson_validate_nla:
+ *
+ * - Integer attributes have the size of their data type.
+ * - NLA_STRING attributes are NUL terminated strings of random letters and
+ *   digits.
+ * - NLA_STRING and NLA_UNSPEC payload lengths are chosen between minlen and
+ *   maxlen (or NLJSON_GEN_DEFAULT_MAXLEN if the policy has no maxlen).
+ * - NLA_NESTED attributes contain attributes of their nested policy.
+ * - Messages and nested attributes contain at least one attribute.
+ *
+ * The output only depends on the policy and the seed, i.e. the same seed
+ * always gives the same sequence of nla streams.
+ */
+
+/** Payload length limit of attributes without maxlen */
+#define NLJSON_GEN_DEFAULT_MAXLEN (32)
+/** Include all attributes of the policy. Otherwise each attribute is
+ * included with a probability of 50%.
+ */
+#define NLJSON_GEN_FLAG_ALL_ATTRS (1)
+
+/**
+ * Generates a random nla stream using the policy of hdl.
+ *
+ * @param[in] hdl               The nljson handle. Must have a policy.
+ *
+ * @param[inout] seed           State of the pseudo random number
+ *                              generator. Initialize it with a seed before
+ *                              the first call. It is updated by each call,
+ *                              so consecutive calls give different streams.
+ *
+ * @param[out] nla_stream       Output buffer.
+ *
+ * @param[in] nla_stream_len    Length of the output buffer.
+ *
+ * @param[out] bytes_produced   Length of the generated nla stream.
+ *
+ * @param[in] flags             NLJSON_GEN_FLAG_* flags.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return 0 on success or -1 on error (e.g. if the buffer is too small).
+ */
+int nljson_generate_nla(nljson_t *hdl,
+			uint64_t *seed,
+			void *nla_stream,
+			size_t nla_stream_len,
+			size_t *bytes_produced,
+			uint32_t flags,
+			struct nljson_error *error);
+
+/** @} */
+
+/**
+ * \defgroup pool_functions Asynchronous encoding and decoding
+ * @{
+ *
+ * Asynchronous encode and decode functions.
+ *
+ * Jobs are submitted to a pool of worker threads managed by the library.
+ * The workers use nljson_encode_nla_cb and nljson_decode_nla_cb.
+ * Completed jobs are signaled through an eventfd (see nljson_pool_fd) that
+ * can be added to the poll/epoll set of an event loop.
+ * The completion callbacks are called from nljson_pool_process_completions,
+ * i.e. in the thread of the event loop.
+ *
+ * Every job belongs to a submission stream (identified by a caller
+ * supplied stream id). The completions of a stream are delivered in the
+ * same order as the jobs were submitted. Jobs from different streams are
+ * delivered as soon as they are completed.
+ */
+
+/**
+ * nljson pool handle.
+ */
+typedef struct _nljson_pool nljson_pool_t;
+
+/**
+ * Completion of an asynchronous job.
+ */
+struct nljson_completion {
+	/**
+	 * The stream id of the job
+	 */
+	uint64_t stream_id;
+	/**
+	 * The user_data passed to the submit function
+	 */
+	void *user_data;
+	/**
+	 * 0 on success or -1 on error
+	 */
+	int status;
+	/**
+	 * The output of the job: a NUL terminated JSON string (encode) or an
+	 * nla stream (decode). Only valid during the completion callback.
+	 */
+	const void *output;
+	/**
+	 * The length of the output (excluding the NUL terminator)
+	 */
+	size_t output_len;
+	/**
+	 * The number of input bytes consumed
+	 */
+	size_t bytes_consumed;
+	/**
+	 * Description of the error if status is -1
+	 */
+	struct nljson_error error;
+};
+
+/**
+ * Completion callback.
+ */
+typedef void (*nljson_completion_cb_t)(const struct nljson_completion *completion);
+
+/**
+ * Creates a pool of worker threads.
+ *
+ * @param[inout] pool        Pool that will be allocated.
+ *
+ * @param[in] num_threads    Number of worker threads.
+ *
+ * @param[in] scratch_size   Size of the scratch arena of each worker (see
+ *                           nljson_arena_init). 0 means no arena.
+ *
+ * @param[out] error         Error output. The struct must be allocated by
+ *                           the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_pool_init(nljson_pool_t **pool,
+		     unsigned int num_threads,
+		     size_t scratch_size,
+		     struct nljson_error *error);
+
+/**
+ * Waits for all submitted jobs to finish, stops the worker threads and
+ * frees the pool. Completions that have not been delivered with
+ * nljson_pool_process_completions are dropped.
+ * The pool pointer is set to NULL.
+ *
+ * @param[inout] pool   The pool that will be freed
+ */
+void nljson_pool_deinit(nljson_pool_t **pool);
+
+/**
+ * Returns a file descriptor (eventfd) that becomes readable when there
+ * are completions to process.
+ *
+ * @param[in] pool   The pool.
+ */
+int nljson_pool_fd(nljson_pool_t *pool);
+
+/**
+ * Submits an encode job.
+ * nla_stream is not copied and must be valid until the completion has
+ * been delivered. hdl is shared with the worker threads (see nljson_t).
+ *
+ * @param[in] pool              The pool.
+ *
+ * @param[in] hdl               nljson handle.
+ *
+ * @param[in] stream_id         Submission stream id.
+ *
+ * @param[in] nla_stream        Stream of bytes containing netlink attributes.
+ *
+ * @param[in] nla_stream_len    The length of nla_stream.
+ *
+ * @param[in] json_format_flags Flags for the JSON output formatting.
+ *                              Passed directly to the jansson library.
+ *
+ * @param[in] cb                Completion callback.
+ *
+ * @param[in] user_data         Passed to cb in the completion.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_submit_encode(nljson_pool_t *pool,
+			 nljson_t *hdl,
+			 uint64_t stream_id,
+			 const void *nla_stream,
+			 size_t nla_stream_len,
+			 uint32_t json_format_flags,
+			 nljson_completion_cb_t cb,
+			 void *user_data,
+			 struct nljson_error *error);
+
+/**
+ * Submits a decode job.
+ * input is not copied and must be valid until the completion has been
+ * delivered.
+ *
+ * @param[in] pool              The pool.
+ *
+ * @param[in] stream_id         Submission stream id.
+ *
+ * @param[in] input             JSON encoded input string.
+ *
+ * @param[in] json_decode_flags Flags for the JSON input parsing.
+ *                              Passed directly to the jansson library.
+ *
+ * @param[in] cb                Completion callback.
+ *
+ * @param[in] user_data         Passed to cb in the completion.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_submit_decode(nljson_pool_t *pool,
+			 uint64_t stream_id,
+			 const char *input,
+			 uint32_t json_decode_flags,
+			 nljson_completion_cb_t cb,
+			 void *user_data,
+			 struct nljson_error *error);
+
+/**
+ * Delivers all deliverable completions by calling their completion
+ * callbacks. Must only be called from one thread at a time.
+ * New jobs can be submitted from the completion callbacks.
+ *
+ * @param[in] pool   The pool.
+ *
+ * @return The number of delivered completions.
+ */
+int nljson_pool_process_completions(nljson_pool_t *pool);
+
+/** @} */
+
+/**
+ * \defgroup validate_functions Validate functions
+ * @{
+ *
+ * Validate functions.
+ *
+ * These functions check an nla stream against the policy of a handle
+ * without producing any output. No memory is allocated.
+ */
+
+/**
+ * Validates a stream of netlink attributes against the policy of hdl.
+ *
+ * The following is checked:
+ * - All attribute headers are valid and fit inside the stream (or the
+ *   enclosing nested attribute).
+ * - The payload length is at least the minimum length of the data type
+ *   (or minlen if set in the policy).
+ * - The payload length is not greater than maxlen (if set in the policy).
+ * - NLA_STRING attributes are NUL terminated.
+ * - The attributes inside NLA_NESTED attributes are valid (recursively).
+ *
+ * The length and string checks follow the same rules as libnl's
+ * nla_validate. Attributes not present in the policy are only checked
+ * for valid headers.
+ *
+ * @param[in] hdl             The nljson handle. Can be NULL, in which case
+ *                            only the attribute headers are checked.
+ *
+ * @param[in] nla_stream      Stream of bytes containing netlink attributes.
+ *
+ * @param[in] nla_stream_len  The length of the netlink attribute byte
+ *                            stream.
+ *
+ * @param[out] error_offset   Offset in nla_stream of the first invalid
+ *                            attribute. Only written if the stream is
+ *                            invalid. Can be NULL.
+ *
+ * @param[out] error          Error output. The struct must be allocated by
+ *                            the caller.
+ *
+ * @return 0 if the stream is valid or -1 if it is not.
+ *
+ * If the stream is invalid, *error will be written with the path of the
+ * offending attribute (e.g. "ATTR_1/ATTR_2") and a description of the
+ * violation.
+ */
+int nljson_validate_nla(nljson_t *hdl,
+			const void *nla_stream,
+			size_t nla_stream_len,
+			size_t *error_offset,
+			struct nljson_error *error);
+
+/** @} */
+
+/**
+ * \defgroup patch_functions Patch functions
+ * @{
+ *
+ * Patch functions.
+ *
+ * These functions will modify an existing nla stream in place using a
+ * small JSON document (a patch) describing the attributes that should
+ * be changed. Only the bytes following a modified attribute are moved,
+ * the rest of the stream is left untouched.
+ */
+
+/**
+ * Patches the attributes in nla_stream with the values in patch.
+ *
+ * The patch is a JSON object where each key identifies an attribute and
+ * each value is the new value of the attribute.
+ *
+ * The keys are the attribute names from the policy of the handle, or
+ * UNKNOWN_ATTR_<attr_type> for attributes not present in the policy.
+ * Attributes in nested attributes can be addressed with a path where the
+ * attribute names are separated with '/' (e.g. "ATTR_1/ATTR_2"), or by
+ * using a JSON object (containing another patch) as value for the
+ * nested attribute.
+ * If there are several attributes with the same type, the first one
+ * will be patched.
+ *
+ * The value determines how the attribute is patched:
+ * - integer: the payload is overwritten with the integer value. The
+ *            length of the attribute is not changed, so the value must
+ *            fit in the payload (error code ERANGE otherwise).
+ * - string:  the payload is replaced with the string.
+ * - array:   the payload is replaced with the array bytes (same format
+ *            as NLA_UNSPEC values).
+ * - object:  the value is applied as a patch on the nested attributes.
+ * - null:    the attribute is removed from the stream.
+ *
+ * If the length of an attribute changes, all enclosing (nested)
+ * attributes will have their nla_len adjusted.
+ *
+ * @param[in] hdl                The nljson handle. Used for resolving
+ *                               attribute names. Can be NULL, in which case
+ *                               only UNKNOWN_ATTR_<attr_type> names can be
+ *                               used.
+ *
+ * @param[inout] nla_stream      Stream of bytes containing netlink
+ *                               attributes. Will be modified in place.
+ *
+ * @param[in] nla_stream_len     The length of the netlink attribute byte
+ *                               stream.
+ *
+ * @param[in] nla_stream_buf_len The size of the nla_stream buffer.
+ *                               Must be big enough to hold the patched
+ *                               stream if any attribute grows.
+ *
+ * @param[in] patch              JSON encoded patch.
+ *
+ * @param[out] bytes_produced    The length of the patched nla stream.
+ *
+ * @param[in] json_decode_flags  Flags for the JSON patch parsing.
+ *                               Passed directly to the jansson library.
+ *                               See jansson documentation for more info.
+ *
+ * @param[out] error             Error output. The struct must be allocated by
+ *                               the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ * The nla stream might have been partially patched in this case.
+ */
+int nljson_patch_nla(nljson_t *hdl,
+		     void *nla_stream,
+		     size_t nla_stream_len,
+		     size_t nla_stream_buf_len,
+		     const char *patch,
+		     size_t *bytes_produced,
+		     uint32_t json_decode_flags,
+		     struct nljson_error *error);
+
+/** @} */
+
+/**
+ * \defgroup template_functions Template functions
+ * @{
+ *
+ * Template functions.
+ *
+ * A template is a pre-decoded nla stream with a set of integer value
+ * slots. It is created once from a JSON document (using the same format
+ * as the decode functions) and can then be filled with new slot values
+ * any number of times without any JSON parsing or memory allocation.
+ *
+ * Slots are defined by adding a "$slot" key (with the slot name as value)
+ * to integer attributes (NLA_U8 to NLA_U64) in the JSON document.
+ * The "value" key is optional for slot attributes.
+ * Several attributes can share the same slot name, in which case they
+ * will all be written with the same value.
+ *
+ * Example:
+ * \code{.json}
+ * {
+ *     "QCA_WLAN_VENDOR_ATTR_TEST": {
+ *         "data_type": "NLA_U32",
+ *         "nla_type": 8,
+ *         "$slot": "test_value"
+ *     }
+ * }
+ * \endcode
+ */
+
+/**
+ * nljson template handle.
+ */
+typedef struct _nljson_template nljson_template_t;
+
+/**
+ * Creates a template from a JSON encoded string of nl attributes.
+ *
+ * @param[inout] tmpl           Template that will be allocated.
+ *
+ * @param[in] input             JSON encoded input string.
+ *
+ * @param[out] bytes_consumed   The number of bytes read (consumed) from
+ *                              input.
+ *
+ * @param[in] json_decode_flags Flags for the JSON input parsing.
+ *                              Passed directly to the jansson library.
+ *                              See jansson documentation for more info.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+int nljson_prepare(nljson_template_t **tmpl,
+		   const char *input,
+		   size_t *bytes_consumed,
+		   uint32_t json_decode_flags,
+		   struct nljson_error *error);
+
+/**
+ * Returns the number of distinct slots in the template.
+ * The slots are indexed in the order they appear in the JSON document.
+ *
+ * @param[in] tmpl     The template.
+ */
+size_t nljson_template_num_slots(const nljson_template_t *tmpl);
+
+/**
+ * Returns the index of a named slot.
+ *
+ * @param[in] tmpl      The template.
+ *
+ * @param[in] slot_name The slot name (the value of the "$slot" key).
+ *
+ * @return The slot index or -1 if there is no slot with the name.
+ */
+int nljson_template_slot_index(const nljson_template_t *tmpl,
+			       const char *slot_name);
+
+/**
+ * Returns the length of the nla stream produced by the template.
+ *
+ * @param[in] tmpl     The template.
+ */
+size_t nljson_template_len(const nljson_template_t *tmpl);
+
+/**
+ * Fills the template with slot values and writes the resulting nla stream
+ * to nla_stream.
+ * Only the first bytes of each value (as many as the attribute length)
+ * will be used.
+ *
+ * @param[in] tmpl               The template.
+ *
+ * @param[in] values             Slot values, indexed by slot index.
+ *
+ * @param[in] num_values         Number of elements in values. Must be at
+ *                               least the number of slots in the template.
+ *
+ * @param[out] nla_stream        Output: stream of bytes containing netlink
+ *                               attributes
+ *
+ * @param[in] nla_stream_buf_len The length of the output buffer.
+ *
+ * @param[out] bytes_produced    The number of output bytes produced, i.e. the
+ *                               length of the nla_stream.
+ *
+ * @param[out] error             Error output. The struct must be allocated by
+ *                               the caller.
+ *
+ * @return 0 on success or -1 on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+int nljson_template_fill(const nljson_template_t *tmpl,
+			 const int64_t *values,
+			 size_t num_values,
+			 void *nla_stream,
+			 size_t nla_stream_buf_len,
+			 size_t *bytes_produced,
+			 struct nljson_error *error);
+
+/**
+ * Frees a template created by nljson_prepare and sets the template
+ * pointer to NULL.
+ *
+ * @param[inout] tmpl   The template that will be freed
+ */
+void nljson_template_free(nljson_template_t **tmpl);
+
+/** @} */
+
+
+/**
+ * \defgroup delta_functions Delta functions
+ * @{
+ *
+ * Delta encoding of nla streams.
+ *
+ * Consecutive messages belonging to the same stream (identified by a
+ * caller supplied stream key, e.g. the netlink family and command) often
+ * differ in only a few attributes. The delta encoder only writes the
+ * top level attributes that have changed or been added since the previous
+ * message with the same stream key. Removed attributes are listed by
+ * nla_type.
+ *
+ * Each encoded message starts with a "delta" object:
+ * \code{.json}
+ * {
+ *     "delta": {
+ *         "stream_key": 1,
+ *         "keyframe": false,
+ *         "removed": [ 3 ]
+ *     },
+ *     "QCA_WLAN_VENDOR_ATTR_TEST": {
+ *         "data_type": "NLA_U32",
+ *         "nla_type": 8,
+ *         "value": 10
+ *     }
+ * }
+ * \endcode
+ *
+ * A keyframe contains all attributes of the message. Keyframes are written
+ * for the first message of each stream, every keyframe_interval messages
+ * and whenever the message can't be expressed as a delta (duplicate
+ * attribute types or reordered attributes).
+ *
+ * The decoder must see the messages in the same order as they were
+ * encoded. The reconstructed nla stream is identical to the encoded one
+ * as long as the encoder handle doesn't skip any attributes and the
+ * attribute types are unique. A message with duplicate attribute types is
+ * decoded in the same way as the output of nljson_encode_nla_alloc (only
+ * one attribute per name is kept).
+ */
+
+/**
+ * nljson delta state handle.
+ */
+typedef struct _nljson_delta nljson_delta_t;
+
+/**
+ * Creates a delta state. The same state type is used for both encoding
+ * and decoding, but a state must not be shared between an encoder and
+ * a decoder.
+ *
+ * @param[inout] delta          Delta state that will be allocated.
+ *
+ * @param[in] keyframe_interval Number of messages between keyframes (per
+ *                              stream key). 0 means that keyframes are only
+ *                              written when needed.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_delta_init(nljson_delta_t **delta,
+		      uint32_t keyframe_interval,
+		      struct nljson_error *error);
+
+/**
+ * Frees a delta state and sets the delta pointer to NULL.
+ *
+ * @param[inout] delta  The delta state that will be freed
+ */
+void nljson_delta_deinit(nljson_delta_t **delta);
+
+/**
+ * Delta encodes a stream of netlink attributes into a JSON string.
+ * The output string is allocated by the function and must be freed by the
+ * caller.
+ *
+ * @param[in] hdl               nljson handle.
+ *
+ * @param[in] delta             Delta state.
+ *
+ * @param[in] stream_key        Key identifying the stream the message
+ *                              belongs to.
+ *
+ * @param[in] nla_stream        Stream of bytes containing netlink attributes.
+ *
+ * @param[in] nla_stream_len    The length of nla_stream.
+ *
+ * @param[out] bytes_consumed   The number of bytes read (consumed) from
+ *                              nla_stream.
+ *
+ * @param[out] bytes_produced   The number of output bytes produced, i.e. the
+ *                              length of the output string.
+ *
+ * @param[in] json_format_flags Flags for the JSON output formatting.
+ *                              Passed directly to the jansson library.
+ *                              See jansson documentation for more info.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return A pointer to the allocated JSON string or NULL on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+char *nljson_encode_nla_delta_alloc(nljson_t *hdl,
+				    nljson_delta_t *delta,
+				    uint64_t stream_key,
+				    const void *nla_stream,
+				    size_t nla_stream_len,
+				    size_t *bytes_consumed,
+				    size_t *bytes_produced,
+				    uint32_t json_format_flags,
+				    struct nljson_error *error);
+
+/**
+ * Decodes a delta encoded JSON string into a complete stream of netlink
+ * attributes.
+ * The output stream is allocated by the function and must be freed by the
+ * caller.
+ *
+ * @param[in] delta             Delta state.
+ *
+ * @param[in] input             JSON encoded input string.
+ *
+ * @param[out] bytes_consumed   The number of bytes read (consumed) from
+ *                              input.
+ *
+ * @param[out] bytes_produced   The number of output bytes produced, i.e. the
+ *                              length of the returned nla stream.
+ *
+ * @param[in] json_decode_flags Flags for the JSON input parsing.
+ *                              Passed directly to the jansson library.
+ *                              See jansson documentation for more info.
+ *
+ * @param[out] error            Error output. The struct must be allocated by
+ *                              the caller.
+ *
+ * @return A pointer to the allocated nla stream or NULL on error.
+ *
+ * In case of error, *error will be written with a description of the error.
+ */
+void *nljson_decode_nla_delta_alloc(nljson_delta_t *delta,
+				    const char *input,
+				    size_t *bytes_consumed,
+				    size_t *bytes_produced,
+				    uint32_t json_decode_flags,
+				    struct nljson_error *error);
+
+/** @} */
+
+/**
+ * \defgroup archive_functions Archives
+ * @{
+ *
+ * Seekable, time indexed archives of framed records.
+ *
+ * An archive file consists of a file header, a sequence of blocks and an
+ * index. Each block holds a number of framed records (see
+ * \ref record_functions) and is compressed with zlib (if the library is
+ * built with zlib support and NLJSON_ARCHIVE_FLAG_COMPRESS is set).
+ * The index is written when the archive is closed and lists, for each
+ * block, its file offset, the time range of its records and the
+ * (family, cmd) pairs of its generic netlink records.
+ *
+ * A query only reads and decompresses the blocks whose time range and
+ * (family, cmd) pairs match the query.
+ *
+ * If the index is missing (e.g. the writer was killed), it is rebuilt
+ * from the blocks when the archive is opened. The records that had not
+ * been written in a block are lost.
+ *
+ * All fields are stored in host byte order (like the record headers).
+ */
+
+/** Default size of the (uncompressed) blocks */
+#define NLJSON_ARCHIVE_DEFAULT_BLOCK_SIZE (1024 * 1024)
+/** Compress the blocks (ignored if the library is built without zlib) */
+#define NLJSON_ARCHIVE_FLAG_COMPRESS (1)
+
+/** Only return records of the family of the query */
+#define NLJSON_ARCHIVE_MATCH_FAMILY (1)
+/** Only return records with the cmd of the query */
+#define NLJSON_ARCHIVE_MATCH_CMD (2)
+
+/** The index was rebuilt from the blocks when the archive was opened */
+#define NLJSON_ARCHIVE_INFO_RECOVERED (1)
+
+/**
+ * nljson archive handle.
+ */
+typedef struct _nljson_archive nljson_archive_t;
+
+struct nljson_archive_query {
+	/** Start of the time range (nanoseconds since the epoch, inclusive) */
+	uint64_t start;
+	/** End of the time range (exclusive). UINT64_MAX means no limit */
+	uint64_t end;
+	/** Generic netlink family id (if NLJSON_ARCHIVE_MATCH_FAMILY is set) */
+	uint16_t family;
+	/** Generic netlink command (if NLJSON_ARCHIVE_MATCH_CMD is set) */
+	uint8_t cmd;
+	/** NLJSON_ARCHIVE_MATCH_* */
+	uint8_t match;
+};
+
+/** A (family, cmd) pair of the records of a block */
+struct nljson_archive_key {
+	uint16_t family;
+	uint8_t cmd;
+	/** NLJSON_RECORD_FLAG_GENL if family and cmd are valid */
+	uint8_t flags;
+	/** Number of records in the block with this key */
+	uint32_t count;
+};
+
+struct nljson_archive_block {
+	/** File offset of the block */
+	uint64_t offset;
+	/** Time range of the records of the block */
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+	uint32_t num_records;
+	/** Length of the records (uncompressed) */
+	uint32_t raw_len;
+	/** Length of the block data in the file */
+	uint32_t stored_len;
+	uint32_t num_keys;
+	/** The keys of the block. Valid until the archive is closed */
+	const struct nljson_archive_key *keys;
+};
+
+struct nljson_archive_info {
+	uint64_t num_records;
+	uint32_t num_blocks;
+	/** NLJSON_ARCHIVE_INFO_* */
+	uint32_t flags;
+	/** Time range of all records (0 if the archive is empty) */
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+	/** Total length of the records (uncompressed) and of the blocks */
+	uint64_t raw_bytes;
+	uint64_t stored_bytes;
+	/** Number of blocks read by the queries made with the handle */
+	uint64_t blocks_read;
+};
+
+/**
+ * Creates (or truncates) an archive file for writing.
+ *
+ * @param[inout] archive    Archive handle that will be allocated.
+ *
+ * @param[in] path          Path of the archive file.
+ *
+ * @param[in] block_size    Size of the (uncompressed) blocks. 0 means
+ *                          NLJSON_ARCHIVE_DEFAULT_BLOCK_SIZE. Records
+ *                          larger than the block size get a block of
+ *                          their own.
+ *
+ * @param[in] flags         NLJSON_ARCHIVE_FLAG_*
+ *
+ * @param[out] error        Error output. The struct must be allocated by
+ *                          the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_archive_create(nljson_archive_t **archive,
+			  const char *path,
+			  size_t block_size,
+			  uint32_t flags,
+			  struct nljson_error *error);
+
+/**
+ * Appends a record to an archive created with nljson_archive_create.
+ * The record is written to the file when its block is full (or when the
+ * archive is closed).
+ *
+ * @param[in] archive       The archive.
+ *
+ * @param[in] hdr           Header of the record (see
+ *                          nljson_record_hdr_init). hdr->len is the length
+ *                          of nla_stream.
+ *
+ * @param[in] nla_stream    The nla stream of the record.
+ *
+ * @param[out] error        Error output. The struct must be allocated by
+ *                          the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_archive_append(nljson_archive_t *archive,
+			  const struct nljson_record_hdr *hdr,
+			  const void *nla_stream,
+			  struct nljson_error *error);
+
+/**
+ * Opens an archive file for reading. The index is read from the end of
+ * the file (or rebuilt from the blocks if it is missing).
+ *
+ * @param[inout] archive    Archive handle that will be allocated.
+ *
+ * @param[in] path          Path of the archive file.
+ *
+ * @param[out] error        Error output. The struct must be allocated by
+ *                          the caller.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int nljson_archive_open(nljson_archive_t **archive,
+			const char *path,
+			struct nljson_error *error);
+
+/**
+ * Calls record_cb for each record of an archive opened with
+ * nljson_archive_open that matches query. The records are passed in
+ * archive order.
+ *
+ * @param[in] archive       The archive.
+ *
+ * @param[in] query         The query. NULL matches all records.
+ *
+ * @param[in] record_cb     Function called with the header and nla stream
+ *                          of each matching record. The pointers are only
+ *                          valid during the call. If record_cb returns
+ *                          non-zero, the query is stopped.
+ *
+ * @param[in] cb_data       Pointer passed to record_cb.
+ *
+ * @param[out] error        Error output. The struct must be allocated by
+ *                          the caller.
+ *
+ * @return 0 on success (or if the query was stopped by record_cb) or -1
+ *         on error.
+ */
+int nljson_archive_query(nljson_archive_t *archive,
+			 const struct nljson_archive_query *query,
+			 int (*record_cb)(const struct nljson_record_hdr *hdr,
+					  const void *nla_stream,
+					  void *data),
+			 void *cb_data,
+			 struct nljson_error *error);
+
+/**
+ * Reads the summary of an archive (both when reading and writing).
+ *
+ * @param[in] archive       The archive.
+ *
+ * @param[out] info         Summary output. The struct must be allocated by
+ *                          the caller.
+ */
+void nljson_archive_get_info(nljson_archive_t *archive,
+			     struct nljson_archive_info *info);
+
+/**
+ * Reads the index entry of a block.
+ *
+ * @param[in] archive       The archive.
+ *
+ * @param[in] index         Index of the block, 0 <= index < num_blocks.
+ *
+ * @param[out] block        Index entry output. The struct must be allocated
+ *                          by the caller.
+ *
+ * @return 0 on success or -1 if index is out of range.
+ */
+int nljson_archive_get_block(nljson_archive_t *archive,
+			     uint32_t index,
+			     struct nljson_archive_block *block);
+
+/**
+ * Closes an archive and sets the archive pointer to NULL. If the archive
+ * was created for writing, the last block and the index are written.
+ *
+ * @param[inout] archive    The archive that will be closed.
+ *
+ * @param[out] error        Error output. The struct must be allocated by
+ *                          the caller.
+ *
+ * @return 0 on success or -1 if the archive could not be written (the
+ *         handle is freed anyway).
+ */
+int nljson_archive_close(nljson_archive_t **archive,
+			 struct nljson_error *error);
+
+/** @} */
+
 #endif
 
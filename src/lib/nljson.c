@@ -18,6 +18,7 @@
 
 #include "nljson.h"
 #include "nljson_internal.h"
+#include "nljson_trace.h"
 
 #define NL_ID_TO_STR_ELEMENT(id) \
 [id] = #id
@@ -71,8 +72,8 @@ static void free_attr_list(struct policy_list_item *head)
 		tmp = iter;
 		iter = iter->next;
 		if (tmp->key)
-			free(tmp->key);
-		free(tmp);
+			nljson_free(tmp->key);
+		nljson_free(tmp);
 	}
 }
 
@@ -150,7 +151,7 @@ static struct policy_list_item *create_attr_list(json_t *policy_json,
 			nested_policy_json = NULL;
 		}
 
-		cur_item = calloc(sizeof(struct policy_list_item), 1);
+		cur_item = nljson_calloc(sizeof(struct policy_list_item), 1);
 		if (!cur_item)
 			goto err;
 		cur_item->attr_type = attr_type;
@@ -158,12 +159,11 @@ static struct policy_list_item *create_attr_list(json_t *policy_json,
 		cur_item->maxlen = maxlen;
 		cur_item->minlen = minlen;
 		cur_item->nested_policy = nested_policy_json;
-		cur_item->key = calloc(1, strlen(key));
-		if (!cur_item->key)
-			goto err;
-		strcpy(cur_item->key, key);
 		prev_item->next = cur_item;
 		prev_item = cur_item;
+		cur_item->key = nljson_strdup(key);
+		if (!cur_item->key)
+			goto err;
 	}
 
 	return head.next;
@@ -194,16 +194,16 @@ static int populate_policy_and_free_list(struct policy_list_item *head,
 		if (iter->nested_policy) {
 			int rc = 0;
 
+			/* nested_policy is a borrowed reference */
 			rc = parse_policy_json(iter->nested_policy,
 					       &policy->nested[iter->attr_type]);
-			json_decref(iter->nested_policy);
 			if (rc)
 				goto err;
 		}
 
 		tmp = iter;
 		iter = iter->next;
-		free(tmp);
+		nljson_free(tmp);
 	}
 
 	return 0;
@@ -219,22 +219,22 @@ static struct nljson_nla_policy *alloc_nljson_nla_policy(nljson_int_t max_attr_t
 {
 	struct nljson_nla_policy *policy;
 
-	policy = calloc(sizeof(*policy), 1);
+	policy = nljson_calloc(sizeof(*policy), 1);
 	if (!policy)
 		goto err;
 
-	policy->policy = calloc(sizeof(struct nla_policy), max_attr_type + 1);
+	policy->policy = nljson_calloc(sizeof(struct nla_policy), max_attr_type + 1);
 	if (!policy->policy)
 		goto err;
 
-	policy->id_to_str_map = calloc(sizeof(char *), max_attr_type + 1);
+	policy->id_to_str_map = nljson_calloc(sizeof(char *), max_attr_type + 1);
 	if (!policy->id_to_str_map)
 		goto err;
 
 	policy->max_attr_type = max_attr_type;
 
 	if (max_nested_attr_type > 0) {
-		policy->nested = calloc(sizeof(struct nljson_nla_policy *),
+		policy->nested = nljson_calloc(sizeof(struct nljson_nla_policy *),
 					max_nested_attr_type + 1);
 		if (!policy->nested)
 			goto err;
@@ -287,9 +287,9 @@ static void free_id_to_str_map(char **id_to_str_map, size_t len)
 
 	for (i = 0; i < len; i++) {
 		if (id_to_str_map[i])
-			free(id_to_str_map[i]);
+			nljson_free(id_to_str_map[i]);
 	}
-	free(id_to_str_map);
+	nljson_free(id_to_str_map);
 }
 
 static void free_nested_policy(struct nljson_nla_policy **policy, size_t len)
@@ -300,13 +300,13 @@ static void free_nested_policy(struct nljson_nla_policy **policy, size_t len)
 		if (policy[i])
 			free_policy(policy[i]);
 	}
-	free(policy);
+	nljson_free(policy);
 }
 
 static void free_policy(struct nljson_nla_policy *policy)
 {
 	if (policy->policy)
-		free(policy->policy);
+		nljson_free(policy->policy);
 
 	if (policy->id_to_str_map)
 		free_id_to_str_map(policy->id_to_str_map,
@@ -316,7 +316,10 @@ static void free_policy(struct nljson_nla_policy *policy)
 		free_nested_policy(policy->nested,
 				   policy->max_nested_attr_type + 1);
 
-	free(policy);
+	if (policy->profile)
+		nljson_profile_level_free(policy->profile);
+
+	nljson_free(policy);
 }
 
 static void free_handle(nljson_t **hdl)
@@ -324,7 +327,16 @@ static void free_handle(nljson_t **hdl)
 	if ((*hdl)->policy)
 		free_policy((*hdl)->policy);
 
-	free(*hdl);
+	if ((*hdl)->cache)
+		nljson_cache_destroy((*hdl)->cache);
+
+	if ((*hdl)->par)
+		nljson_par_destroy((*hdl)->par);
+
+	if ((*hdl)->stats)
+		nljson_stats_destroy((*hdl)->stats);
+
+	nljson_free(*hdl);
 	*hdl = NULL;
 }
 
@@ -345,10 +357,12 @@ int nljson_init(nljson_t **hdl,
 	json_error_t json_error;
 
 	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE1(init__entry, nljson_flags);
 
-	*hdl = calloc(sizeof(struct _nljson), 1);
+	*hdl = nljson_calloc(sizeof(struct _nljson), 1);
 	if (!*hdl) {
 		SET_ERR(error, ENOMEM, "Unable to allocate nljson handle");
+		NLJSON_TRACE2(init__return, -1, NULL);
 		return -1;
 	}
 
@@ -374,11 +388,13 @@ int nljson_init(nljson_t **hdl,
 
 	if (policy_json_obj)
 		json_decref(policy_json_obj);
+	NLJSON_TRACE2(init__return, 0, *hdl);
 	return 0;
 err:
 	if (policy_json_obj)
 		json_decref(policy_json_obj);
 	free_handle(hdl);
+	NLJSON_TRACE2(init__return, -1, NULL);
 	return -1;
 }
 
@@ -393,10 +409,12 @@ int nljson_init_file(nljson_t **hdl,
 	json_error_t json_error;
 
 	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE1(init__entry, nljson_flags);
 
-	*hdl = calloc(sizeof(struct _nljson), 1);
+	*hdl = nljson_calloc(sizeof(struct _nljson), 1);
 	if (!*hdl) {
 		SET_ERR(error, ENOMEM, "Unable to allocate nljson handle");
+		NLJSON_TRACE2(init__return, -1, NULL);
 		return -1;
 	}
 
@@ -423,11 +441,13 @@ int nljson_init_file(nljson_t **hdl,
 
 	if (policy_json_obj)
 		json_decref(policy_json_obj);
+	NLJSON_TRACE2(init__return, 0, *hdl);
 	return 0;
 err:
 	if (policy_json_obj)
 		json_decref(policy_json_obj);
 	free_handle(hdl);
+	NLJSON_TRACE2(init__return, -1, NULL);
 	return -1;
 }
 
@@ -443,10 +463,12 @@ int nljson_init_cb(nljson_t **hdl,
 	json_error_t json_error;
 
 	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE1(init__entry, nljson_flags);
 
-	*hdl = calloc(sizeof(struct _nljson), 1);
+	*hdl = nljson_calloc(sizeof(struct _nljson), 1);
 	if (!*hdl) {
 		SET_ERR(error, ENOMEM, "Unable to allocate nljson handle");
+		NLJSON_TRACE2(init__return, -1, NULL);
 		return -1;
 	}
 
@@ -474,11 +496,13 @@ int nljson_init_cb(nljson_t **hdl,
 
 	if (policy_json_obj)
 		json_decref(policy_json_obj);
+	NLJSON_TRACE2(init__return, 0, *hdl);
 	return 0;
 err:
 	if (policy_json_obj)
 		json_decref(policy_json_obj);
 	free_handle(hdl);
+	NLJSON_TRACE2(init__return, -1, NULL);
 	return -1;
 }
 
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#define ARENA_ALIGN (16)
+
+struct _nljson_arena {
+	uint8_t *buf;
+	size_t size;
+	size_t used;
+	size_t peak;
+};
+
+static nljson_malloc_t malloc_fn = malloc;
+static nljson_free_t free_fn = free;
+
+/* The arena used by the calling thread (see nljson_arena_use) */
+static __thread nljson_arena_t *cur_arena;
+/* Greater than zero while inside an encode or decode call.
+ * Temporary allocations are only made from the arena in this case.
+ */
+static __thread unsigned int tmp_scope;
+/* Number of heap allocations made by this thread */
+static __thread uint64_t num_allocs;
+
+static inline bool in_arena(nljson_arena_t *arena, const void *ptr)
+{
+	return arena && ((const uint8_t *) ptr >= arena->buf) &&
+	       ((const uint8_t *) ptr < arena->buf + arena->size);
+}
+
+static void *arena_alloc(nljson_arena_t *arena, size_t size)
+{
+	size_t offset = (arena->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if ((offset > arena->size) || (size > arena->size - offset))
+		return NULL;
+
+	arena->used = offset + size;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+
+	return arena->buf + offset;
+}
+
+/* Allocation functions installed in jansson. All jansson allocations
+ * (i.e. the JSON DOM) made in a temporary scope are made from the arena.
+ */
+static void *json_malloc_hook(size_t size)
+{
+	return nljson_tmp_malloc(size);
+}
+
+static void json_free_hook(void *ptr)
+{
+	nljson_free(ptr);
+}
+
+void nljson_install_json_hooks(void)
+{
+	json_set_alloc_funcs(json_malloc_hook, json_free_hook);
+}
+
+static inline void *heap_alloc(size_t size)
+{
+	num_allocs++;
+	return malloc_fn(size);
+}
+
+void *nljson_malloc(size_t size)
+{
+	return heap_alloc(size);
+}
+
+void *nljson_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size && (nmemb > SIZE_MAX / size))
+		return NULL;
+
+	ptr = heap_alloc(nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+
+	return ptr;
+}
+
+void *nljson_realloc(void *ptr, size_t old_size, size_t size)
+{
+	void *tmp;
+
+	tmp = heap_alloc(size);
+	if (!tmp)
+		return NULL;
+
+	if (ptr) {
+		memcpy(tmp, ptr, old_size < size ? old_size : size);
+		nljson_free(ptr);
+	}
+
+	return tmp;
+}
+
+char *nljson_strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *tmp;
+
+	tmp = heap_alloc(len);
+	if (tmp)
+		memcpy(tmp, str, len);
+
+	return tmp;
+}
+
+void nljson_free(void *ptr)
+{
+	/* Arena memory is released all at once (see nljson_tmp_end) */
+	if (!ptr || in_arena(cur_arena, ptr))
+		return;
+
+	free_fn(ptr);
+}
+
+void *nljson_tmp_malloc(size_t size)
+{
+	void *ptr = NULL;
+
+	if (cur_arena && tmp_scope)
+		ptr = arena_alloc(cur_arena, size);
+
+	/* Fall back to the regular allocator if the arena is full */
+	if (!ptr)
+		ptr = heap_alloc(size);
+
+	return ptr;
+}
+
+void *nljson_tmp_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size && (nmemb > SIZE_MAX / size))
+		return NULL;
+
+	ptr = nljson_tmp_malloc(nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+
+	return ptr;
+}
+
+size_t nljson_tmp_begin(void)
+{
+	tmp_scope++;
+	return cur_arena ? cur_arena->used : 0;
+}
+
+void nljson_tmp_end(size_t mark)
+{
+	tmp_scope--;
+	if (cur_arena)
+		cur_arena->used = mark;
+}
+
+unsigned int nljson_tmp_suspend(void)
+{
+	unsigned int scope = tmp_scope;
+
+	tmp_scope = 0;
+	return scope;
+}
+
+void nljson_tmp_resume(unsigned int scope)
+{
+	tmp_scope = scope;
+}
+
+uint64_t nljson_alloc_count(void)
+{
+	return num_allocs;
+}
+
+void nljson_set_alloc_funcs(nljson_malloc_t malloc_func,
+			    nljson_free_t free_func)
+{
+	malloc_fn = malloc_func ? malloc_func : malloc;
+	free_fn = free_func ? free_func : free;
+	nljson_install_json_hooks();
+}
+
+int nljson_arena_init(nljson_arena_t **arena,
+		      size_t size,
+		      struct nljson_error *error)
+{
+	memset(error, 0, sizeof(*error));
+
+	*arena = nljson_calloc(sizeof(nljson_arena_t), 1);
+	if (!*arena) {
+		SET_ERR(error, ENOMEM, "Unable to allocate arena");
+		return -1;
+	}
+
+	(*arena)->buf = nljson_malloc(size);
+	if (!(*arena)->buf) {
+		SET_ERR(error, ENOMEM, "Unable to allocate arena buffer");
+		nljson_free(*arena);
+		*arena = NULL;
+		return -1;
+	}
+	(*arena)->size = size;
+
+	nljson_install_json_hooks();
+	return 0;
+}
+
+void nljson_arena_deinit(nljson_arena_t **arena)
+{
+	if (!arena || !*arena)
+		return;
+
+	if (cur_arena == *arena)
+		cur_arena = NULL;
+
+	nljson_free((*arena)->buf);
+	nljson_free(*arena);
+	*arena = NULL;
+}
+
+nljson_arena_t *nljson_arena_use(nljson_arena_t *arena)
+{
+	nljson_arena_t *prev = cur_arena;
+
+	cur_arena = arena;
+	return prev;
+}
+
+size_t nljson_arena_peak(const nljson_arena_t *arena)
+{
+	return arena->peak;
+}
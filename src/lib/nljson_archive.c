@@ -0,0 +1,882 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Archives can be larger than 2 GB also on 32 bit systems */
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+ * File layout:
+ *
+ * struct archive_file_hdr
+ * struct archive_block_hdr, block data (records, possibly compressed)
+ * ...
+ * struct archive_index_entry[num_blocks]
+ * struct nljson_archive_key[num_keys]
+ * struct archive_footer
+ */
+
+/* "NLJA", "NLJB" and "NLJF" */
+#define ARCHIVE_MAGIC (0x414a4c4e)
+#define ARCHIVE_BLOCK_MAGIC (0x424a4c4e)
+#define ARCHIVE_FOOTER_MAGIC (0x464a4c4e)
+#define ARCHIVE_VERSION (1)
+
+#define COMPRESSION_NONE (0)
+#define COMPRESSION_ZLIB (1)
+
+/* Max (uncompressed) length of a block accepted by the reader */
+#define MAX_BLOCK_LEN (UINT32_MAX / 2)
+/* deflate can't compress more than 1032:1 */
+#define ZLIB_MAX_RATIO (1032)
+
+struct archive_file_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t block_size;
+	uint32_t reserved;
+};
+
+struct archive_block_hdr {
+	uint32_t magic;
+	uint8_t compression;
+	uint8_t reserved[3];
+	uint32_t raw_len;
+	uint32_t stored_len;
+	uint32_t num_records;
+	uint32_t reserved2;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+};
+
+struct archive_index_entry {
+	uint64_t offset;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+	uint32_t num_records;
+	uint32_t raw_len;
+	uint32_t stored_len;
+	/* The keys of the block are keys[first_key, first_key + num_keys) */
+	uint32_t first_key;
+	uint32_t num_keys;
+	uint32_t reserved;
+};
+
+struct archive_footer {
+	uint32_t magic;
+	uint32_t num_blocks;
+	uint32_t num_keys;
+	uint32_t reserved;
+	uint64_t index_offset;
+	uint64_t num_records;
+};
+
+struct _nljson_archive {
+	FILE *file;
+	bool writing;
+	/* The index was rebuilt by recover_index */
+	bool recovered;
+	uint32_t flags;
+	size_t block_size;
+	/* Offset of the end of the last block */
+	uint64_t offset;
+	struct archive_index_entry *blocks;
+	uint32_t num_blocks;
+	uint32_t max_blocks;
+	struct nljson_archive_key *keys;
+	uint32_t num_keys;
+	uint32_t max_keys;
+	/* Uncompressed records of the current block */
+	uint8_t *raw;
+	size_t raw_len;
+	size_t raw_size;
+	/* Compressed block data */
+	uint8_t *stored;
+	size_t stored_size;
+	/* The current block (being written) */
+	struct archive_index_entry cur;
+	uint64_t blocks_read;
+};
+
+/* Grows *buf to at least len bytes */
+static int grow_buf(uint8_t **buf, size_t *size, size_t len)
+{
+	size_t new_size = *size ? *size : 4096;
+	uint8_t *tmp;
+
+	if (len <= *size)
+		return 0;
+
+	while (new_size < len)
+		new_size *= 2;
+
+	tmp = nljson_realloc(*buf, *size, new_size);
+	if (!tmp)
+		return -1;
+
+	*buf = tmp;
+	*size = new_size;
+	return 0;
+}
+
+static struct archive_index_entry *add_block(nljson_archive_t *ar)
+{
+	if (ar->num_blocks == ar->max_blocks) {
+		uint32_t max = ar->max_blocks ? ar->max_blocks * 2 : 64;
+		struct archive_index_entry *tmp;
+
+		tmp = nljson_realloc(ar->blocks,
+				     ar->max_blocks * sizeof(*tmp),
+				     max * sizeof(*tmp));
+		if (!tmp)
+			return NULL;
+
+		ar->blocks = tmp;
+		ar->max_blocks = max;
+	}
+
+	return &ar->blocks[ar->num_blocks++];
+}
+
+/* Counts a record with hdr in the keys of the block entry */
+static int add_key(nljson_archive_t *ar, struct archive_index_entry *entry,
+		   const struct nljson_record_hdr *hdr)
+{
+	struct nljson_archive_key *key;
+	uint8_t flags = hdr->flags & NLJSON_RECORD_FLAG_GENL;
+	uint16_t family = flags ? hdr->family : 0;
+	uint8_t cmd = flags ? hdr->cmd : 0;
+	uint32_t i;
+
+	/* The number of distinct keys of a block is small */
+	for (i = 0; i < entry->num_keys; i++) {
+		key = &ar->keys[entry->first_key + i];
+		if ((key->family == family) && (key->cmd == cmd) &&
+		    (key->flags == flags)) {
+			key->count++;
+			return 0;
+		}
+	}
+
+	if (ar->num_keys == ar->max_keys) {
+		uint32_t max = ar->max_keys ? ar->max_keys * 2 : 256;
+		struct nljson_archive_key *tmp;
+
+		tmp = nljson_realloc(ar->keys, ar->max_keys * sizeof(*tmp),
+				     max * sizeof(*tmp));
+		if (!tmp)
+			return -1;
+
+		ar->keys = tmp;
+		ar->max_keys = max;
+	}
+
+	key = &ar->keys[ar->num_keys++];
+	key->family = family;
+	key->cmd = cmd;
+	key->flags = flags;
+	key->count = 1;
+	entry->num_keys++;
+	return 0;
+}
+
+static void add_timestamp(struct archive_index_entry *entry, uint64_t ts)
+{
+	if (!entry->num_records || (ts < entry->min_timestamp))
+		entry->min_timestamp = ts;
+	if (!entry->num_records || (ts > entry->max_timestamp))
+		entry->max_timestamp = ts;
+	entry->num_records++;
+}
+
+static int write_all(nljson_archive_t *ar, const void *data, size_t len)
+{
+	if (len && (fwrite(data, 1, len, ar->file) != len))
+		return -1;
+
+	ar->offset += len;
+	return 0;
+}
+
+/* Compresses the current block into ar->stored. Returns the compressed
+ * length or 0 if the block is stored uncompressed.
+ */
+static size_t compress_block(nljson_archive_t *ar)
+{
+#ifdef HAVE_ZLIB
+	uLongf len = compressBound(ar->raw_len);
+
+	if (!(ar->flags & NLJSON_ARCHIVE_FLAG_COMPRESS) ||
+	    grow_buf(&ar->stored, &ar->stored_size, len))
+		return 0;
+
+	if ((compress(ar->stored, &len, ar->raw, ar->raw_len) != Z_OK) ||
+	    (len >= ar->raw_len))
+		return 0;
+
+	return len;
+#else
+	(void) ar;
+	return 0;
+#endif
+}
+
+static int flush_block(nljson_archive_t *ar, struct nljson_error *error)
+{
+	struct archive_block_hdr hdr;
+	struct archive_index_entry *entry;
+	const uint8_t *data = ar->raw;
+	size_t stored_len;
+
+	if (!ar->cur.num_records)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = ARCHIVE_BLOCK_MAGIC;
+	hdr.compression = COMPRESSION_NONE;
+	hdr.raw_len = ar->raw_len;
+	hdr.stored_len = ar->raw_len;
+	hdr.num_records = ar->cur.num_records;
+	hdr.min_timestamp = ar->cur.min_timestamp;
+	hdr.max_timestamp = ar->cur.max_timestamp;
+
+	stored_len = compress_block(ar);
+	if (stored_len) {
+		hdr.compression = COMPRESSION_ZLIB;
+		hdr.stored_len = stored_len;
+		data = ar->stored;
+	}
+
+	entry = add_block(ar);
+	if (!entry) {
+		SET_ERR(error, ENOMEM, "Unable to allocate index");
+		return -1;
+	}
+
+	*entry = ar->cur;
+	entry->offset = ar->offset;
+	entry->raw_len = hdr.raw_len;
+	entry->stored_len = hdr.stored_len;
+
+	if (write_all(ar, &hdr, sizeof(hdr)) ||
+	    write_all(ar, data, hdr.stored_len)) {
+		SET_ERR(error, errno, "Unable to write block: %s",
+			strerror(errno));
+		return -1;
+	}
+
+	memset(&ar->cur, 0, sizeof(ar->cur));
+	ar->cur.first_key = ar->num_keys;
+	ar->raw_len = 0;
+	return 0;
+}
+
+int nljson_archive_create(nljson_archive_t **archive,
+			  const char *path,
+			  size_t block_size,
+			  uint32_t flags,
+			  struct nljson_error *error)
+{
+	struct archive_file_hdr hdr;
+	nljson_archive_t *ar;
+
+	memset(error, 0, sizeof(*error));
+	*archive = NULL;
+
+	if (!block_size)
+		block_size = NLJSON_ARCHIVE_DEFAULT_BLOCK_SIZE;
+	if (block_size > MAX_BLOCK_LEN) {
+		SET_ERR(error, EINVAL, "Block size too large (%zu bytes)",
+			block_size);
+		return -1;
+	}
+
+	ar = nljson_calloc(1, sizeof(*ar));
+	if (!ar) {
+		SET_ERR(error, ENOMEM, "Unable to allocate archive");
+		return -1;
+	}
+
+	ar->writing = true;
+	ar->flags = flags;
+	ar->block_size = block_size;
+	if (grow_buf(&ar->raw, &ar->raw_size, block_size)) {
+		SET_ERR(error, ENOMEM, "Unable to allocate block buffer");
+		goto err;
+	}
+
+	ar->file = fopen(path, "wb");
+	if (!ar->file) {
+		SET_ERR(error, errno, "Unable to open %s: %s", path,
+			strerror(errno));
+		goto err;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = ARCHIVE_MAGIC;
+	hdr.version = ARCHIVE_VERSION;
+	hdr.block_size = block_size;
+	if (write_all(ar, &hdr, sizeof(hdr))) {
+		SET_ERR(error, errno, "Unable to write %s: %s", path,
+			strerror(errno));
+		goto err;
+	}
+
+	*archive = ar;
+	return 0;
+err:
+	if (ar->file)
+		fclose(ar->file);
+	nljson_free(ar->raw);
+	nljson_free(ar);
+	return -1;
+}
+
+int nljson_archive_append(nljson_archive_t *archive,
+			  const struct nljson_record_hdr *hdr,
+			  const void *nla_stream,
+			  struct nljson_error *error)
+{
+	nljson_archive_t *ar = archive;
+	size_t record_len = nljson_record_len(hdr->len);
+	struct nljson_record_hdr rec_hdr;
+
+	memset(error, 0, sizeof(*error));
+
+	if (!ar->writing) {
+		SET_ERR(error, EINVAL, "Archive not opened for writing");
+		return -1;
+	}
+
+	if (record_len > MAX_BLOCK_LEN) {
+		SET_ERR(error, EINVAL, "Record too long (%u bytes)", hdr->len);
+		return -1;
+	}
+
+	/* Records never span blocks. The block buffer grows for records
+	 * that are larger than the block size.
+	 */
+	if ((ar->raw_len + record_len > ar->block_size) &&
+	    flush_block(ar, error))
+		return -1;
+
+	if (grow_buf(&ar->raw, &ar->raw_size, record_len)) {
+		SET_ERR(error, ENOMEM, "Unable to allocate block buffer");
+		return -1;
+	}
+
+	if (add_key(ar, &ar->cur, hdr)) {
+		SET_ERR(error, ENOMEM, "Unable to allocate index");
+		return -1;
+	}
+	add_timestamp(&ar->cur, hdr->timestamp);
+
+	rec_hdr = *hdr;
+	rec_hdr.magic = NLJSON_RECORD_MAGIC;
+	memcpy(ar->raw + ar->raw_len, &rec_hdr, sizeof(rec_hdr));
+	memcpy(ar->raw + ar->raw_len + sizeof(rec_hdr), nla_stream, hdr->len);
+	memset(ar->raw + ar->raw_len + sizeof(rec_hdr) + hdr->len, 0,
+	       record_len - sizeof(rec_hdr) - hdr->len);
+	ar->raw_len += record_len;
+	return 0;
+}
+
+static int write_index(nljson_archive_t *ar, struct nljson_error *error)
+{
+	struct archive_footer footer;
+	uint32_t i;
+
+	memset(&footer, 0, sizeof(footer));
+	footer.magic = ARCHIVE_FOOTER_MAGIC;
+	footer.num_blocks = ar->num_blocks;
+	footer.num_keys = ar->num_keys;
+	footer.index_offset = ar->offset;
+	for (i = 0; i < ar->num_blocks; i++)
+		footer.num_records += ar->blocks[i].num_records;
+
+	if (write_all(ar, ar->blocks, ar->num_blocks * sizeof(*ar->blocks)) ||
+	    write_all(ar, ar->keys, ar->num_keys * sizeof(*ar->keys)) ||
+	    write_all(ar, &footer, sizeof(footer))) {
+		SET_ERR(error, errno, "Unable to write index: %s",
+			strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int read_at(nljson_archive_t *ar, uint64_t offset, void *buf,
+		   size_t len)
+{
+	if (fseeko(ar->file, offset, SEEK_SET) ||
+	    (fread(buf, 1, len, ar->file) != len))
+		return -1;
+
+	return 0;
+}
+
+/* Reads the data of a block into ar->raw (decompressing it if needed) */
+static int read_block(nljson_archive_t *ar, uint64_t offset,
+		      const struct archive_block_hdr *hdr,
+		      struct nljson_error *error)
+{
+	bool valid;
+
+	switch (hdr->compression) {
+	case COMPRESSION_NONE:
+		valid = hdr->stored_len == hdr->raw_len;
+		break;
+#ifdef HAVE_ZLIB
+	case COMPRESSION_ZLIB:
+		valid = hdr->raw_len / ZLIB_MAX_RATIO <= hdr->stored_len;
+		break;
+#endif
+	default:
+		SET_ERR(error, EINVAL,
+			"Unsupported compression %u at offset %llu",
+			hdr->compression, (unsigned long long) offset);
+		return -1;
+	}
+
+	/* The lengths are checked before the buffer is allocated, so a
+	 * corrupted raw_len can't allocate more than the stored data can
+	 * expand to.
+	 */
+	if (!valid || (hdr->raw_len > MAX_BLOCK_LEN) ||
+	    (hdr->stored_len > MAX_BLOCK_LEN) ||
+	    grow_buf(&ar->raw, &ar->raw_size, hdr->raw_len)) {
+		SET_ERR(error, EINVAL, "Bad block at offset %llu",
+			(unsigned long long) offset);
+		return -1;
+	}
+
+	ar->blocks_read++;
+	ar->raw_len = hdr->raw_len;
+
+	if (hdr->compression == COMPRESSION_NONE) {
+		if (read_at(ar, offset + sizeof(*hdr), ar->raw, hdr->raw_len))
+			goto err;
+		return 0;
+	}
+
+#ifdef HAVE_ZLIB
+	{
+		uLongf len = hdr->raw_len;
+
+		if (grow_buf(&ar->stored, &ar->stored_size, hdr->stored_len) ||
+		    read_at(ar, offset + sizeof(*hdr), ar->stored,
+			    hdr->stored_len) ||
+		    (uncompress(ar->raw, &len, ar->stored,
+				hdr->stored_len) != Z_OK) ||
+		    (len != hdr->raw_len))
+			goto err;
+	}
+#endif
+	return 0;
+err:
+	SET_ERR(error, EINVAL, "Unable to read block at offset %llu",
+		(unsigned long long) offset);
+	return -1;
+}
+
+/* Reads the index written by nljson_archive_close.
+ * Returns 0 on success or -1 if there is no valid index.
+ */
+static int read_index(nljson_archive_t *ar, uint64_t file_len)
+{
+	struct archive_footer footer;
+	uint64_t blocks_len, keys_len;
+	uint32_t i;
+
+	if ((file_len < sizeof(struct archive_file_hdr) + sizeof(footer)) ||
+	    read_at(ar, file_len - sizeof(footer), &footer, sizeof(footer)) ||
+	    (footer.magic != ARCHIVE_FOOTER_MAGIC))
+		return -1;
+
+	blocks_len = (uint64_t) footer.num_blocks * sizeof(*ar->blocks);
+	keys_len = (uint64_t) footer.num_keys * sizeof(*ar->keys);
+	if ((footer.index_offset < sizeof(struct archive_file_hdr)) ||
+	    (footer.index_offset > file_len) ||
+	    (footer.index_offset + blocks_len + keys_len + sizeof(footer) !=
+	     file_len))
+		return -1;
+
+	ar->blocks = nljson_malloc(blocks_len ? blocks_len : 1);
+	ar->keys = nljson_malloc(keys_len ? keys_len : 1);
+	if (!ar->blocks || !ar->keys ||
+	    read_at(ar, footer.index_offset, ar->blocks, blocks_len) ||
+	    read_at(ar, footer.index_offset + blocks_len, ar->keys, keys_len))
+		goto err;
+
+	for (i = 0; i < footer.num_blocks; i++) {
+		struct archive_index_entry *entry = &ar->blocks[i];
+
+		if ((entry->offset > footer.index_offset) ||
+		    (footer.index_offset - entry->offset <
+		     sizeof(struct archive_block_hdr) +
+		     (uint64_t) entry->stored_len) ||
+		    ((uint64_t) entry->first_key + entry->num_keys >
+		     footer.num_keys))
+			goto err;
+	}
+
+	ar->num_blocks = footer.num_blocks;
+	ar->max_blocks = footer.num_blocks;
+	ar->num_keys = footer.num_keys;
+	ar->max_keys = footer.num_keys;
+	ar->offset = footer.index_offset;
+	return 0;
+err:
+	nljson_free(ar->blocks);
+	nljson_free(ar->keys);
+	ar->blocks = NULL;
+	ar->keys = NULL;
+	return -1;
+}
+
+/* Rebuilds the index by reading all complete blocks of the file */
+static int recover_index(nljson_archive_t *ar, uint64_t file_len,
+			 struct nljson_error *error)
+{
+	struct nljson_error tmp_error;
+	uint64_t offset = sizeof(struct archive_file_hdr);
+
+	for (;;) {
+		struct archive_block_hdr hdr;
+		struct archive_index_entry *entry;
+		size_t pos = 0;
+
+		if ((file_len - offset < sizeof(hdr)) ||
+		    read_at(ar, offset, &hdr, sizeof(hdr)) ||
+		    (hdr.magic != ARCHIVE_BLOCK_MAGIC) ||
+		    (file_len - offset - sizeof(hdr) < hdr.stored_len) ||
+		    read_block(ar, offset, &hdr, &tmp_error))
+			break;
+
+		entry = add_block(ar);
+		if (!entry) {
+			SET_ERR(error, ENOMEM, "Unable to allocate index");
+			return -1;
+		}
+
+		memset(entry, 0, sizeof(*entry));
+		entry->offset = offset;
+		entry->raw_len = hdr.raw_len;
+		entry->stored_len = hdr.stored_len;
+		entry->first_key = ar->num_keys;
+
+		while (pos < ar->raw_len) {
+			struct nljson_record_hdr rec_hdr;
+			const void *nla_stream;
+			size_t consumed;
+
+			if (nljson_record_next(ar->raw + pos,
+					       ar->raw_len - pos, &rec_hdr,
+					       &nla_stream, &consumed,
+					       &tmp_error) || !consumed)
+				break;
+
+			if (add_key(ar, entry, &rec_hdr)) {
+				SET_ERR(error, ENOMEM,
+					"Unable to allocate index");
+				return -1;
+			}
+			add_timestamp(entry, rec_hdr.timestamp);
+			pos += consumed;
+		}
+
+		offset += sizeof(hdr) + hdr.stored_len;
+	}
+
+	/* The blocks are read again by the queries */
+	ar->blocks_read = 0;
+	ar->offset = offset;
+	ar->recovered = true;
+	return 0;
+}
+
+int nljson_archive_open(nljson_archive_t **archive,
+			const char *path,
+			struct nljson_error *error)
+{
+	struct archive_file_hdr hdr;
+	nljson_archive_t *ar;
+	off_t file_len;
+
+	memset(error, 0, sizeof(*error));
+	*archive = NULL;
+
+	ar = nljson_calloc(1, sizeof(*ar));
+	if (!ar) {
+		SET_ERR(error, ENOMEM, "Unable to allocate archive");
+		return -1;
+	}
+
+	ar->file = fopen(path, "rb");
+	if (!ar->file) {
+		SET_ERR(error, errno, "Unable to open %s: %s", path,
+			strerror(errno));
+		goto err;
+	}
+
+	if (read_at(ar, 0, &hdr, sizeof(hdr)) ||
+	    (hdr.magic != ARCHIVE_MAGIC)) {
+		SET_ERR(error, EINVAL, "%s is not an nljson archive", path);
+		goto err;
+	}
+
+	if (hdr.version != ARCHIVE_VERSION) {
+		SET_ERR(error, EINVAL, "Unsupported archive version %u",
+			hdr.version);
+		goto err;
+	}
+
+	if (fseeko(ar->file, 0, SEEK_END) ||
+	    ((file_len = ftello(ar->file)) < 0)) {
+		SET_ERR(error, errno, "Unable to read %s: %s", path,
+			strerror(errno));
+		goto err;
+	}
+
+	if (read_index(ar, file_len) && recover_index(ar, file_len, error))
+		goto err;
+
+	*archive = ar;
+	return 0;
+err:
+	if (ar->file)
+		fclose(ar->file);
+	nljson_free(ar->blocks);
+	nljson_free(ar->keys);
+	nljson_free(ar->raw);
+	nljson_free(ar->stored);
+	nljson_free(ar);
+	return -1;
+}
+
+static bool key_matches(const struct nljson_archive_query *query,
+			uint8_t flags, uint16_t family, uint8_t cmd)
+{
+	if (!query->match)
+		return true;
+
+	if (!(flags & NLJSON_RECORD_FLAG_GENL))
+		return false;
+
+	if ((query->match & NLJSON_ARCHIVE_MATCH_FAMILY) &&
+	    (family != query->family))
+		return false;
+
+	if ((query->match & NLJSON_ARCHIVE_MATCH_CMD) && (cmd != query->cmd))
+		return false;
+
+	return true;
+}
+
+/* Returns true if the block may contain records matching query */
+static bool block_matches(nljson_archive_t *ar,
+			  const struct archive_index_entry *entry,
+			  const struct nljson_archive_query *query)
+{
+	uint32_t i;
+
+	if ((entry->max_timestamp < query->start) ||
+	    (entry->min_timestamp >= query->end))
+		return false;
+
+	for (i = 0; i < entry->num_keys; i++) {
+		const struct nljson_archive_key *key =
+			&ar->keys[entry->first_key + i];
+
+		if (key_matches(query, key->flags, key->family, key->cmd))
+			return true;
+	}
+
+	return false;
+}
+
+int nljson_archive_query(nljson_archive_t *archive,
+			 const struct nljson_archive_query *query,
+			 int (*record_cb)(const struct nljson_record_hdr *hdr,
+					  const void *nla_stream,
+					  void *data),
+			 void *cb_data,
+			 struct nljson_error *error)
+{
+	nljson_archive_t *ar = archive;
+	struct nljson_archive_query all = {
+		.start = 0,
+		.end = UINT64_MAX,
+	};
+	uint32_t i;
+
+	memset(error, 0, sizeof(*error));
+
+	if (ar->writing) {
+		SET_ERR(error, EINVAL, "Archive not opened for reading");
+		return -1;
+	}
+
+	if (!record_cb) {
+		SET_ERR(error, EINVAL, "record_cb == NULL");
+		return -1;
+	}
+
+	if (!query)
+		query = &all;
+
+	for (i = 0; i < ar->num_blocks; i++) {
+		const struct archive_index_entry *entry = &ar->blocks[i];
+		struct archive_block_hdr hdr;
+		size_t pos = 0;
+
+		if (!block_matches(ar, entry, query))
+			continue;
+
+		if (read_at(ar, entry->offset, &hdr, sizeof(hdr)) ||
+		    (hdr.magic != ARCHIVE_BLOCK_MAGIC) ||
+		    (hdr.raw_len != entry->raw_len) ||
+		    (hdr.stored_len != entry->stored_len)) {
+			SET_ERR(error, EINVAL, "Bad block at offset %llu",
+				(unsigned long long) entry->offset);
+			return -1;
+		}
+
+		if (read_block(ar, entry->offset, &hdr, error))
+			return -1;
+
+		while (pos < ar->raw_len) {
+			struct nljson_record_hdr rec_hdr;
+			const void *nla_stream;
+			size_t consumed;
+
+			if (nljson_record_next(ar->raw + pos,
+					       ar->raw_len - pos, &rec_hdr,
+					       &nla_stream, &consumed, error))
+				return -1;
+			if (!consumed) {
+				SET_ERR(error, EINVAL,
+					"Truncated record in block at offset %llu",
+					(unsigned long long) entry->offset);
+				return -1;
+			}
+			pos += consumed;
+
+			if ((rec_hdr.timestamp < query->start) ||
+			    (rec_hdr.timestamp >= query->end) ||
+			    !key_matches(query, rec_hdr.flags, rec_hdr.family,
+					 rec_hdr.cmd))
+				continue;
+
+			if (record_cb(&rec_hdr, nla_stream, cb_data))
+				return 0;
+		}
+	}
+
+	return 0;
+}
+
+void nljson_archive_get_info(nljson_archive_t *archive,
+			     struct nljson_archive_info *info)
+{
+	nljson_archive_t *ar = archive;
+	uint32_t i;
+
+	memset(info, 0, sizeof(*info));
+	info->num_blocks = ar->num_blocks;
+	if (ar->recovered)
+		info->flags |= NLJSON_ARCHIVE_INFO_RECOVERED;
+	info->blocks_read = ar->blocks_read;
+
+	for (i = 0; i < ar->num_blocks; i++) {
+		const struct archive_index_entry *entry = &ar->blocks[i];
+
+		if (!entry->num_records)
+			continue;
+
+		if (!info->num_records ||
+		    (entry->min_timestamp < info->min_timestamp))
+			info->min_timestamp = entry->min_timestamp;
+		if (!info->num_records ||
+		    (entry->max_timestamp > info->max_timestamp))
+			info->max_timestamp = entry->max_timestamp;
+		info->num_records += entry->num_records;
+		info->raw_bytes += entry->raw_len;
+		info->stored_bytes += entry->stored_len;
+	}
+}
+
+int nljson_archive_get_block(nljson_archive_t *archive,
+			     uint32_t index,
+			     struct nljson_archive_block *block)
+{
+	const struct archive_index_entry *entry;
+
+	if (index >= archive->num_blocks)
+		return -1;
+
+	entry = &archive->blocks[index];
+	block->offset = entry->offset;
+	block->min_timestamp = entry->min_timestamp;
+	block->max_timestamp = entry->max_timestamp;
+	block->num_records = entry->num_records;
+	block->raw_len = entry->raw_len;
+	block->stored_len = entry->stored_len;
+	block->num_keys = entry->num_keys;
+	block->keys = &archive->keys[entry->first_key];
+	return 0;
+}
+
+int nljson_archive_close(nljson_archive_t **archive,
+			 struct nljson_error *error)
+{
+	nljson_archive_t *ar = *archive;
+	int rc = 0;
+
+	memset(error, 0, sizeof(*error));
+
+	if (!ar)
+		return 0;
+
+	if (ar->writing &&
+	    (flush_block(ar, error) || write_index(ar, error)))
+		rc = -1;
+
+	if (fclose(ar->file) && ar->writing && !rc) {
+		SET_ERR(error, errno, "Unable to write archive: %s",
+			strerror(errno));
+		rc = -1;
+	}
+
+	nljson_free(ar->blocks);
+	nljson_free(ar->keys);
+	nljson_free(ar->raw);
+	nljson_free(ar->stored);
+	nljson_free(ar);
+	*archive = NULL;
+	return rc;
+}
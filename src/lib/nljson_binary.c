@@ -0,0 +1,786 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * CBOR (RFC 8949) and MessagePack serialization of the JSON DOM.
+ *
+ * The binary documents have the same structure as the JSON documents,
+ * except that the "value" arrays of NLA_UNSPEC attributes are written as
+ * byte strings. Byte strings are read back as arrays of integers, so the
+ * decoded DOM can be handled by the ordinary JSON decoder.
+ */
+
+#include <string.h>
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#define BIN_INITIAL_SIZE (256)
+/* Max nesting of arrays and maps accepted by the reader */
+#define BIN_MAX_DEPTH (64)
+
+/* CBOR major types */
+#define CBOR_UINT   (0)
+#define CBOR_NINT   (1)
+#define CBOR_BYTES  (2)
+#define CBOR_TEXT   (3)
+#define CBOR_ARRAY  (4)
+#define CBOR_MAP    (5)
+#define CBOR_TAG    (6)
+#define CBOR_SIMPLE (7)
+
+#define CBOR_FALSE     (0xf4)
+#define CBOR_TRUE      (0xf5)
+#define CBOR_NULL      (0xf6)
+#define CBOR_UNDEFINED (0xf7)
+#define CBOR_FLOAT16   (0xf9)
+#define CBOR_FLOAT32   (0xfa)
+#define CBOR_FLOAT64   (0xfb)
+
+#define MSGPACK_NIL     (0xc0)
+#define MSGPACK_FALSE   (0xc2)
+#define MSGPACK_TRUE    (0xc3)
+#define MSGPACK_BIN8    (0xc4)
+#define MSGPACK_BIN16   (0xc5)
+#define MSGPACK_BIN32   (0xc6)
+#define MSGPACK_FLOAT32 (0xca)
+#define MSGPACK_FLOAT64 (0xcb)
+#define MSGPACK_UINT8   (0xcc)
+#define MSGPACK_UINT16  (0xcd)
+#define MSGPACK_UINT32  (0xce)
+#define MSGPACK_UINT64  (0xcf)
+#define MSGPACK_INT8    (0xd0)
+#define MSGPACK_INT16   (0xd1)
+#define MSGPACK_INT32   (0xd2)
+#define MSGPACK_INT64   (0xd3)
+#define MSGPACK_STR8    (0xd9)
+#define MSGPACK_STR16   (0xda)
+#define MSGPACK_STR32   (0xdb)
+#define MSGPACK_ARRAY16 (0xdc)
+#define MSGPACK_ARRAY32 (0xdd)
+#define MSGPACK_MAP16   (0xde)
+#define MSGPACK_MAP32   (0xdf)
+
+struct bin_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	enum nljson_bin_format format;
+};
+
+struct bin_reader {
+	const uint8_t *buf;
+	size_t len;
+	size_t pos;
+	enum nljson_bin_format format;
+	char *err_msg;
+	size_t err_msg_len;
+};
+
+/*
+ * Writer
+ */
+
+static int bin_reserve(struct bin_writer *w, size_t len)
+{
+	size_t size = w->size ? w->size : BIN_INITIAL_SIZE;
+	uint8_t *tmp;
+
+	if (w->len + len <= w->size)
+		return 0;
+
+	while (size < w->len + len)
+		size *= 2;
+
+	tmp = nljson_realloc(w->buf, w->size, size);
+	if (!tmp)
+		return -1;
+
+	w->buf = tmp;
+	w->size = size;
+	return 0;
+}
+
+static int bin_put(struct bin_writer *w, const void *data, size_t len)
+{
+	if (bin_reserve(w, len))
+		return -1;
+
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+	return 0;
+}
+
+/* Writes the lead byte followed by the len bytes of val (big endian) */
+static int bin_put_be(struct bin_writer *w, uint8_t lead, uint64_t val,
+		      unsigned int len)
+{
+	uint8_t tmp[9];
+	unsigned int i;
+
+	tmp[0] = lead;
+	for (i = 0; i < len; i++)
+		tmp[len - i] = (uint8_t) (val >> (8 * i));
+
+	return bin_put(w, tmp, len + 1);
+}
+
+/* Writes a CBOR head (major type and argument) */
+static int cbor_put_head(struct bin_writer *w, uint8_t major, uint64_t arg)
+{
+	uint8_t lead = major << 5;
+
+	if (arg < 24)
+		return bin_put_be(w, lead | (uint8_t) arg, 0, 0);
+	if (arg <= UINT8_MAX)
+		return bin_put_be(w, lead | 24, arg, 1);
+	if (arg <= UINT16_MAX)
+		return bin_put_be(w, lead | 25, arg, 2);
+	if (arg <= UINT32_MAX)
+		return bin_put_be(w, lead | 26, arg, 4);
+	return bin_put_be(w, lead | 27, arg, 8);
+}
+
+static int msgpack_put_int(struct bin_writer *w, int64_t val)
+{
+	if (val >= 0) {
+		if (val <= 0x7f)
+			return bin_put_be(w, (uint8_t) val, 0, 0);
+		if (val <= UINT8_MAX)
+			return bin_put_be(w, MSGPACK_UINT8, val, 1);
+		if (val <= UINT16_MAX)
+			return bin_put_be(w, MSGPACK_UINT16, val, 2);
+		if (val <= UINT32_MAX)
+			return bin_put_be(w, MSGPACK_UINT32, val, 4);
+		return bin_put_be(w, MSGPACK_UINT64, val, 8);
+	}
+
+	if (val >= -32)
+		return bin_put_be(w, (uint8_t) val, 0, 0);
+	if (val >= INT8_MIN)
+		return bin_put_be(w, MSGPACK_INT8, (uint64_t) val, 1);
+	if (val >= INT16_MIN)
+		return bin_put_be(w, MSGPACK_INT16, (uint64_t) val, 2);
+	if (val >= INT32_MIN)
+		return bin_put_be(w, MSGPACK_INT32, (uint64_t) val, 4);
+	return bin_put_be(w, MSGPACK_INT64, (uint64_t) val, 8);
+}
+
+/* Writes the head of a string, byte string, array or map. fix is the
+ * MessagePack fix type (0 if there is none) and fix_max its max length.
+ */
+static int msgpack_put_len(struct bin_writer *w, uint8_t fix, size_t fix_max,
+			   uint8_t type8, uint8_t type16, uint8_t type32,
+			   size_t len)
+{
+	if (fix && (len <= fix_max))
+		return bin_put_be(w, fix | (uint8_t) len, 0, 0);
+	if (type8 && (len <= UINT8_MAX))
+		return bin_put_be(w, type8, len, 1);
+	if (len <= UINT16_MAX)
+		return bin_put_be(w, type16, len, 2);
+	if (len <= UINT32_MAX)
+		return bin_put_be(w, type32, len, 4);
+	return -1;
+}
+
+static int bin_put_int(struct bin_writer *w, json_int_t val)
+{
+	if (w->format == NLJSON_BIN_MSGPACK)
+		return msgpack_put_int(w, val);
+
+	if (val >= 0)
+		return cbor_put_head(w, CBOR_UINT, val);
+	return cbor_put_head(w, CBOR_NINT, -1 - (int64_t) val);
+}
+
+static int bin_put_real(struct bin_writer *w, double val)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	if (w->format == NLJSON_BIN_MSGPACK)
+		return bin_put_be(w, MSGPACK_FLOAT64, bits, 8);
+	return bin_put_be(w, CBOR_FLOAT64, bits, 8);
+}
+
+static int bin_put_simple(struct bin_writer *w, json_t *json)
+{
+	bool msgpack = (w->format == NLJSON_BIN_MSGPACK);
+	uint8_t val;
+
+	if (json_is_true(json))
+		val = msgpack ? MSGPACK_TRUE : CBOR_TRUE;
+	else if (json_is_false(json))
+		val = msgpack ? MSGPACK_FALSE : CBOR_FALSE;
+	else
+		val = msgpack ? MSGPACK_NIL : CBOR_NULL;
+
+	return bin_put_be(w, val, 0, 0);
+}
+
+static int bin_put_text(struct bin_writer *w, const char *str)
+{
+	size_t len = strlen(str);
+	int rc;
+
+	if (w->format == NLJSON_BIN_MSGPACK)
+		rc = msgpack_put_len(w, 0xa0, 31, MSGPACK_STR8, MSGPACK_STR16,
+				     MSGPACK_STR32, len);
+	else
+		rc = cbor_put_head(w, CBOR_TEXT, len);
+	if (rc)
+		return rc;
+
+	return bin_put(w, str, len);
+}
+
+static int bin_put_array_head(struct bin_writer *w, size_t len)
+{
+	if (w->format == NLJSON_BIN_MSGPACK)
+		return msgpack_put_len(w, 0x90, 15, 0, MSGPACK_ARRAY16,
+				       MSGPACK_ARRAY32, len);
+	return cbor_put_head(w, CBOR_ARRAY, len);
+}
+
+static int bin_put_map_head(struct bin_writer *w, size_t len)
+{
+	if (w->format == NLJSON_BIN_MSGPACK)
+		return msgpack_put_len(w, 0x80, 15, 0, MSGPACK_MAP16,
+				       MSGPACK_MAP32, len);
+	return cbor_put_head(w, CBOR_MAP, len);
+}
+
+/* Returns true if all elements of array are integers 0..255 */
+static bool is_byte_array(json_t *array)
+{
+	size_t i;
+
+	for (i = 0; i < json_array_size(array); i++) {
+		json_t *item = json_array_get(array, i);
+		json_int_t val;
+
+		if (!json_is_integer(item))
+			return false;
+		val = json_integer_value(item);
+		if ((val < 0) || (val > UINT8_MAX))
+			return false;
+	}
+
+	return true;
+}
+
+static int bin_put_bytes(struct bin_writer *w, json_t *array)
+{
+	size_t i, len = json_array_size(array);
+	int rc;
+
+	if (w->format == NLJSON_BIN_MSGPACK)
+		rc = msgpack_put_len(w, 0, 0, MSGPACK_BIN8, MSGPACK_BIN16,
+				     MSGPACK_BIN32, len);
+	else
+		rc = cbor_put_head(w, CBOR_BYTES, len);
+	if (rc || bin_reserve(w, len))
+		return -1;
+
+	for (i = 0; i < len; i++)
+		w->buf[w->len++] = (uint8_t)
+			json_integer_value(json_array_get(array, i));
+
+	return 0;
+}
+
+static int bin_put_json(struct bin_writer *w, json_t *json, bool is_value)
+{
+	const char *key;
+	json_t *item;
+	size_t i;
+
+	switch (json_typeof(json)) {
+	case JSON_OBJECT:
+		if (bin_put_map_head(w, json_object_size(json)))
+			return -1;
+		json_object_foreach(json, key, item) {
+			if (bin_put_text(w, key) ||
+			    bin_put_json(w, item, !strcmp(key, VALUE_STR)))
+				return -1;
+		}
+		return 0;
+	case JSON_ARRAY:
+		/* The payload of NLA_UNSPEC attributes */
+		if (is_value && is_byte_array(json))
+			return bin_put_bytes(w, json);
+
+		if (bin_put_array_head(w, json_array_size(json)))
+			return -1;
+		json_array_foreach(json, i, item) {
+			if (bin_put_json(w, item, false))
+				return -1;
+		}
+		return 0;
+	case JSON_STRING:
+		return bin_put_text(w, json_string_value(json));
+	case JSON_INTEGER:
+		return bin_put_int(w, json_integer_value(json));
+	case JSON_REAL:
+		return bin_put_real(w, json_real_value(json));
+	default:
+		return bin_put_simple(w, json);
+	}
+}
+
+void *nljson_bin_dump(json_t *obj, enum nljson_bin_format format,
+		      size_t *output_len)
+{
+	struct bin_writer w = {
+		.format = format,
+	};
+
+	if (bin_put_json(&w, obj, false)) {
+		nljson_free(w.buf);
+		return NULL;
+	}
+
+	*output_len = w.len;
+	return w.buf;
+}
+
+/*
+ * Reader
+ */
+
+#define READ_ERR(r, fmt, ...) \
+	snprintf((r)->err_msg, (r)->err_msg_len, "offset %zu: " fmt, \
+		 (r)->pos, ##__VA_ARGS__)
+
+static int bin_get(struct bin_reader *r, size_t len, const uint8_t **data)
+{
+	if (r->len - r->pos < len) {
+		READ_ERR(r, "Unexpected end of input");
+		return -1;
+	}
+
+	*data = r->buf + r->pos;
+	r->pos += len;
+	return 0;
+}
+
+/* Reads a big endian unsigned integer of len bytes */
+static int bin_get_be(struct bin_reader *r, unsigned int len, uint64_t *val)
+{
+	const uint8_t *data;
+	unsigned int i;
+
+	if (bin_get(r, len, &data))
+		return -1;
+
+	*val = 0;
+	for (i = 0; i < len; i++)
+		*val = (*val << 8) | data[i];
+
+	return 0;
+}
+
+static json_t *new_uint(struct bin_reader *r, uint64_t val)
+{
+	if (val > INT64_MAX) {
+		READ_ERR(r, "Integer out of range");
+		return NULL;
+	}
+
+	return json_integer((json_int_t) val);
+}
+
+static json_t *new_real(struct bin_reader *r, double val)
+{
+	json_t *json;
+
+	/* NaN and infinity can't be represented in JSON */
+	json = json_real(val);
+	if (!json)
+		READ_ERR(r, "Invalid floating point value");
+
+	return json;
+}
+
+static json_t *new_float32(struct bin_reader *r, uint64_t bits)
+{
+	uint32_t bits32 = (uint32_t) bits;
+	float val;
+
+	memcpy(&val, &bits32, sizeof(val));
+	return new_real(r, val);
+}
+
+static json_t *new_float64(struct bin_reader *r, uint64_t bits)
+{
+	double val;
+
+	memcpy(&val, &bits, sizeof(val));
+	return new_real(r, val);
+}
+
+/* Half precision floats (only written by CBOR encoders) */
+static json_t *new_float16(struct bin_reader *r, uint64_t bits)
+{
+	uint32_t sign = (bits >> 15) & 1;
+	uint32_t exp = (bits >> 10) & 0x1f;
+	uint32_t mant = bits & 0x3ff;
+	double val;
+
+	if (exp == 0) {
+		/* Subnormal: mant * 2^-24 */
+		val = mant / 16777216.0;
+		return new_real(r, sign ? -val : val);
+	}
+
+	if (exp == 0x1f)
+		return new_float32(r, (sign << 31) | (0xffU << 23) |
+				   (mant << 13));
+
+	return new_float32(r, (sign << 31) | ((exp + 112) << 23) |
+			   (mant << 13));
+}
+
+static json_t *new_text(struct bin_reader *r, uint64_t len)
+{
+	const uint8_t *data;
+	json_t *json;
+	char *tmp;
+
+	if ((len > r->len) || bin_get(r, len, &data)) {
+		READ_ERR(r, "Unexpected end of input");
+		return NULL;
+	}
+
+	tmp = nljson_tmp_malloc(len + 1);
+	if (!tmp)
+		return NULL;
+
+	memcpy(tmp, data, len);
+	tmp[len] = '\0';
+	/* Fails for invalid UTF-8 and embedded NUL characters */
+	json = json_string(tmp);
+	nljson_free(tmp);
+	if (!json)
+		READ_ERR(r, "Invalid text string");
+
+	return json;
+}
+
+/* Byte strings are read as arrays of integers */
+static json_t *new_bytes(struct bin_reader *r, uint64_t len)
+{
+	const uint8_t *data;
+	json_t *array;
+	uint64_t i;
+
+	if ((len > r->len) || bin_get(r, len, &data)) {
+		READ_ERR(r, "Unexpected end of input");
+		return NULL;
+	}
+
+	array = json_array();
+	if (!array)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		if (json_array_append_new(array, json_integer(data[i]))) {
+			json_decref(array);
+			return NULL;
+		}
+	}
+
+	return array;
+}
+
+static json_t *bin_get_json(struct bin_reader *r, unsigned int depth);
+
+static json_t *new_array(struct bin_reader *r, uint64_t len,
+			 unsigned int depth)
+{
+	json_t *array, *item;
+	uint64_t i;
+
+	/* Each element is at least one byte */
+	if (len > r->len - r->pos) {
+		READ_ERR(r, "Unexpected end of input");
+		return NULL;
+	}
+
+	array = json_array();
+	if (!array)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		item = bin_get_json(r, depth + 1);
+		if (!item || json_array_append_new(array, item)) {
+			json_decref(array);
+			return NULL;
+		}
+	}
+
+	return array;
+}
+
+static json_t *new_map(struct bin_reader *r, uint64_t len,
+		       unsigned int depth)
+{
+	json_t *obj, *key, *item;
+	uint64_t i;
+
+	/* Each key and value is at least one byte */
+	if (len > (r->len - r->pos) / 2) {
+		READ_ERR(r, "Unexpected end of input");
+		return NULL;
+	}
+
+	obj = json_object();
+	if (!obj)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		key = bin_get_json(r, depth + 1);
+		if (!key)
+			goto err;
+		if (!json_is_string(key)) {
+			READ_ERR(r, "Map key is not a text string");
+			json_decref(key);
+			goto err;
+		}
+
+		item = bin_get_json(r, depth + 1);
+		if (!item) {
+			json_decref(key);
+			goto err;
+		}
+
+		if (json_object_set_new(obj, json_string_value(key), item)) {
+			json_decref(key);
+			goto err;
+		}
+		json_decref(key);
+	}
+
+	return obj;
+err:
+	json_decref(obj);
+	return NULL;
+}
+
+static json_t *cbor_get_json(struct bin_reader *r, unsigned int depth)
+{
+	const uint8_t *lead;
+	uint8_t major, info;
+	uint64_t arg = 0;
+
+	if (bin_get(r, 1, &lead))
+		return NULL;
+
+	major = *lead >> 5;
+	info = *lead & 0x1f;
+
+	if (major == CBOR_SIMPLE) {
+		switch (*lead) {
+		case CBOR_FALSE:
+			return json_false();
+		case CBOR_TRUE:
+			return json_true();
+		case CBOR_NULL:
+		case CBOR_UNDEFINED:
+			return json_null();
+		case CBOR_FLOAT16:
+			if (bin_get_be(r, 2, &arg))
+				return NULL;
+			return new_float16(r, arg);
+		case CBOR_FLOAT32:
+			if (bin_get_be(r, 4, &arg))
+				return NULL;
+			return new_float32(r, arg);
+		case CBOR_FLOAT64:
+			if (bin_get_be(r, 8, &arg))
+				return NULL;
+			return new_float64(r, arg);
+		default:
+			r->pos--;
+			READ_ERR(r, "Unsupported simple value 0x%02x", *lead);
+			return NULL;
+		}
+	}
+
+	if (info < 24) {
+		arg = info;
+	} else if (info <= 27) {
+		if (bin_get_be(r, 1U << (info - 24), &arg))
+			return NULL;
+	} else {
+		r->pos--;
+		READ_ERR(r, "Indefinite length items are not supported");
+		return NULL;
+	}
+
+	switch (major) {
+	case CBOR_UINT:
+		return new_uint(r, arg);
+	case CBOR_NINT:
+		if (arg > INT64_MAX) {
+			READ_ERR(r, "Integer out of range");
+			return NULL;
+		}
+		return json_integer(-1 - (json_int_t) arg);
+	case CBOR_BYTES:
+		return new_bytes(r, arg);
+	case CBOR_TEXT:
+		return new_text(r, arg);
+	case CBOR_ARRAY:
+		return new_array(r, arg, depth);
+	case CBOR_MAP:
+		return new_map(r, arg, depth);
+	default:
+		/* Tags carry no information used by the decoder */
+		return bin_get_json(r, depth + 1);
+	}
+}
+
+static json_t *msgpack_get_json(struct bin_reader *r, unsigned int depth)
+{
+	const uint8_t *lead;
+	uint64_t arg;
+
+	if (bin_get(r, 1, &lead))
+		return NULL;
+
+	if (*lead <= 0x7f)
+		return json_integer(*lead);
+	if (*lead >= 0xe0)
+		return json_integer((int8_t) *lead);
+	if ((*lead & 0xf0) == 0x80)
+		return new_map(r, *lead & 0x0f, depth);
+	if ((*lead & 0xf0) == 0x90)
+		return new_array(r, *lead & 0x0f, depth);
+	if ((*lead & 0xe0) == 0xa0)
+		return new_text(r, *lead & 0x1f);
+
+	switch (*lead) {
+	case MSGPACK_NIL:
+		return json_null();
+	case MSGPACK_FALSE:
+		return json_false();
+	case MSGPACK_TRUE:
+		return json_true();
+	case MSGPACK_BIN8:
+	case MSGPACK_BIN16:
+	case MSGPACK_BIN32:
+		if (bin_get_be(r, 1U << (*lead - MSGPACK_BIN8), &arg))
+			return NULL;
+		return new_bytes(r, arg);
+	case MSGPACK_FLOAT32:
+		if (bin_get_be(r, 4, &arg))
+			return NULL;
+		return new_float32(r, arg);
+	case MSGPACK_FLOAT64:
+		if (bin_get_be(r, 8, &arg))
+			return NULL;
+		return new_float64(r, arg);
+	case MSGPACK_UINT8:
+	case MSGPACK_UINT16:
+	case MSGPACK_UINT32:
+	case MSGPACK_UINT64:
+		if (bin_get_be(r, 1U << (*lead - MSGPACK_UINT8), &arg))
+			return NULL;
+		return new_uint(r, arg);
+	case MSGPACK_INT8:
+		if (bin_get_be(r, 1, &arg))
+			return NULL;
+		return json_integer((int8_t) arg);
+	case MSGPACK_INT16:
+		if (bin_get_be(r, 2, &arg))
+			return NULL;
+		return json_integer((int16_t) arg);
+	case MSGPACK_INT32:
+		if (bin_get_be(r, 4, &arg))
+			return NULL;
+		return json_integer((int32_t) arg);
+	case MSGPACK_INT64:
+		if (bin_get_be(r, 8, &arg))
+			return NULL;
+		return json_integer((int64_t) arg);
+	case MSGPACK_STR8:
+	case MSGPACK_STR16:
+	case MSGPACK_STR32:
+		if (bin_get_be(r, 1U << (*lead - MSGPACK_STR8), &arg))
+			return NULL;
+		return new_text(r, arg);
+	case MSGPACK_ARRAY16:
+	case MSGPACK_ARRAY32:
+		if (bin_get_be(r, 2U << (*lead - MSGPACK_ARRAY16), &arg))
+			return NULL;
+		return new_array(r, arg, depth);
+	case MSGPACK_MAP16:
+	case MSGPACK_MAP32:
+		if (bin_get_be(r, 2U << (*lead - MSGPACK_MAP16), &arg))
+			return NULL;
+		return new_map(r, arg, depth);
+	default:
+		/* Extension types and the unused 0xc1 */
+		r->pos--;
+		READ_ERR(r, "Unsupported type 0x%02x", *lead);
+		return NULL;
+	}
+}
+
+static json_t *bin_get_json(struct bin_reader *r, unsigned int depth)
+{
+	if (depth > BIN_MAX_DEPTH) {
+		READ_ERR(r, "Max nesting depth exceeded");
+		return NULL;
+	}
+
+	if (r->format == NLJSON_BIN_MSGPACK)
+		return msgpack_get_json(r, depth);
+	return cbor_get_json(r, depth);
+}
+
+json_t *nljson_bin_load(const void *input, size_t input_len,
+			enum nljson_bin_format format, size_t *bytes_consumed,
+			char *err_msg, size_t err_msg_len)
+{
+	struct bin_reader r = {
+		.buf = (const uint8_t *) input,
+		.len = input_len,
+		.format = format,
+		.err_msg = err_msg,
+		.err_msg_len = err_msg_len,
+	};
+	json_t *obj;
+
+	snprintf(err_msg, err_msg_len, "offset 0: Out of memory");
+	obj = bin_get_json(&r, 1);
+	if (!obj)
+		return NULL;
+
+	if (!json_is_object(obj)) {
+		snprintf(err_msg, err_msg_len,
+			 "offset 0: Top level item is not a map");
+		json_decref(obj);
+		return NULL;
+	}
+
+	*bytes_consumed = r.pos;
+	return obj;
+}
@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#define CACHE_MIN_BUCKETS      (64)
+#define CACHE_MAX_BUCKETS      (1 << 20)
+#define CACHE_BYTES_PER_BUCKET (512)
+/* The cache is split into up to CACHE_MAX_SHARDS shards (selected by the
+ * hash), each with its own lock, as long as each shard gets at least
+ * CACHE_MIN_SHARD_BUDGET bytes.
+ */
+#define CACHE_MAX_SHARDS       (16)
+#define CACHE_MIN_SHARD_BUDGET (256 * 1024)
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+
+/*
+ * Lookups only take the lock of the shard for reading, so they don't
+ * block each other. Entries are immutable once inserted (except for refs
+ * and referenced, which are atomic), so a hit only takes a reference and
+ * sets the referenced bit. Entries are evicted with the CLOCK (second
+ * chance) algorithm: the hand skips (and clears) referenced entries and
+ * evicts the first entry that has not been used since the last pass.
+ */
+struct cache_shard {
+	pthread_rwlock_t lock;
+	struct nljson_cache_entry **buckets;
+	size_t num_buckets;
+	/* Next entry considered for eviction (NULL if the shard is empty).
+	 * New entries are inserted just before the hand.
+	 */
+	struct nljson_cache_entry *hand;
+	size_t num_entries;
+	size_t mem_used;
+	size_t mem_budget;
+	uint64_t insertions;
+	uint64_t evictions;
+	/* Updated atomically (by lookups holding the read lock) */
+	uint64_t hits;
+	uint64_t misses;
+};
+
+struct nljson_cache {
+	struct cache_shard *shards;
+	unsigned int num_shards;
+	size_t mem_budget;
+};
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t h, uint64_t k)
+{
+	k *= HASH_PRIME_2;
+	k = rotl64(k, 31);
+	k *= HASH_PRIME_1;
+	h ^= k;
+	return rotl64(h, 27) * HASH_PRIME_1 + HASH_PRIME_3;
+}
+
+/* Fast 64 bit hash of a byte buffer (xxh64 style rounds) */
+static uint64_t hash_bytes(const uint8_t *data, size_t len, uint64_t seed)
+{
+	uint64_t h = seed + HASH_PRIME_3 + len;
+	uint64_t k;
+
+	while (len >= sizeof(k)) {
+		memcpy(&k, data, sizeof(k));
+		h = hash_round(h, k);
+		data += sizeof(k);
+		len -= sizeof(k);
+	}
+
+	if (len > 0) {
+		k = 0;
+		memcpy(&k, data, len);
+		h = hash_round(h, k);
+	}
+
+	h ^= h >> 33;
+	h *= HASH_PRIME_2;
+	h ^= h >> 29;
+	h *= HASH_PRIME_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static size_t entry_size(struct nljson_cache_entry *entry)
+{
+	return sizeof(*entry) + entry->nla_len + entry->output_len;
+}
+
+/* The shard is selected by the high bits of the hash and the bucket by
+ * the low bits.
+ */
+static struct cache_shard *get_shard(struct nljson_cache *cache,
+				     uint64_t hash)
+{
+	return &cache->shards[(hash >> 48) & (cache->num_shards - 1)];
+}
+
+static struct nljson_cache_entry **get_bucket(struct cache_shard *shard,
+					      uint64_t hash)
+{
+	return &shard->buckets[hash & (shard->num_buckets - 1)];
+}
+
+/* Returns the first entry of the shard with the same hash, flags and
+ * length (the stream itself is not compared). Must be called with the
+ * lock held.
+ */
+static struct nljson_cache_entry *find_entry(struct cache_shard *shard,
+					     uint64_t hash, uint32_t flags,
+					     size_t nla_stream_len)
+{
+	struct nljson_cache_entry *entry = *get_bucket(shard, hash);
+
+	while (entry) {
+		if ((entry->hash == hash) && (entry->flags == flags) &&
+		    (entry->nla_len == nla_stream_len))
+			break;
+		entry = entry->hash_next;
+	}
+
+	return entry;
+}
+
+static void clock_insert(struct cache_shard *shard,
+			 struct nljson_cache_entry *entry)
+{
+	struct nljson_cache_entry *hand = shard->hand;
+
+	if (!hand) {
+		entry->clock_next = entry;
+		entry->clock_prev = entry;
+		shard->hand = entry;
+		return;
+	}
+
+	entry->clock_next = hand;
+	entry->clock_prev = hand->clock_prev;
+	hand->clock_prev->clock_next = entry;
+	hand->clock_prev = entry;
+}
+
+static void clock_unlink(struct cache_shard *shard,
+			 struct nljson_cache_entry *entry)
+{
+	if (entry->clock_next == entry) {
+		shard->hand = NULL;
+		return;
+	}
+
+	if (shard->hand == entry)
+		shard->hand = entry->clock_next;
+	entry->clock_prev->clock_next = entry->clock_next;
+	entry->clock_next->clock_prev = entry->clock_prev;
+}
+
+static void hash_unlink(struct cache_shard *shard,
+			struct nljson_cache_entry *entry)
+{
+	struct nljson_cache_entry **iter = get_bucket(shard, entry->hash);
+
+	while (*iter) {
+		if (*iter == entry) {
+			*iter = entry->hash_next;
+			break;
+		}
+		iter = &(*iter)->hash_next;
+	}
+}
+
+/* Removes an entry from the shard. Must be called with the lock held for
+ * writing. The entry is freed when the last reference is dropped.
+ */
+static void evict_entry(struct cache_shard *shard,
+			struct nljson_cache_entry *entry)
+{
+	hash_unlink(shard, entry);
+	clock_unlink(shard, entry);
+	shard->num_entries--;
+	shard->mem_used -= entry_size(entry);
+	shard->evictions++;
+	nljson_cache_put(entry);
+}
+
+/* Returns the entry the clock hand stops at, i.e. the first entry that
+ * has not been referenced since the hand passed it last time. Must be
+ * called with the lock held for writing (and the shard must not be
+ * empty).
+ */
+static struct nljson_cache_entry *clock_victim(struct cache_shard *shard)
+{
+	struct nljson_cache_entry *entry = shard->hand;
+
+	while (__atomic_exchange_n(&entry->referenced, 0, __ATOMIC_RELAXED)) {
+		entry = entry->clock_next;
+		shard->hand = entry;
+	}
+
+	return entry;
+}
+
+static void shard_destroy(struct cache_shard *shard)
+{
+	while (shard->hand)
+		evict_entry(shard, shard->hand);
+
+	pthread_rwlock_destroy(&shard->lock);
+	nljson_free(shard->buckets);
+}
+
+static int shard_init(struct cache_shard *shard, size_t mem_budget)
+{
+	size_t num_buckets = CACHE_MIN_BUCKETS;
+
+	while ((num_buckets < CACHE_MAX_BUCKETS) &&
+	       (num_buckets * CACHE_BYTES_PER_BUCKET < mem_budget))
+		num_buckets <<= 1;
+
+	shard->buckets = nljson_calloc(sizeof(struct nljson_cache_entry *),
+				       num_buckets);
+	if (!shard->buckets)
+		return -1;
+
+	if (pthread_rwlock_init(&shard->lock, NULL)) {
+		nljson_free(shard->buckets);
+		return -1;
+	}
+
+	shard->num_buckets = num_buckets;
+	shard->mem_budget = mem_budget;
+	return 0;
+}
+
+struct nljson_cache *nljson_cache_create(size_t mem_budget)
+{
+	struct nljson_cache *cache;
+	unsigned int i, num_shards = 1;
+
+	while ((num_shards < CACHE_MAX_SHARDS) &&
+	       (mem_budget / (2 * num_shards) >= CACHE_MIN_SHARD_BUDGET))
+		num_shards <<= 1;
+
+	cache = nljson_calloc(sizeof(*cache), 1);
+	if (!cache)
+		return NULL;
+
+	cache->shards = nljson_calloc(sizeof(struct cache_shard), num_shards);
+	if (!cache->shards) {
+		nljson_free(cache);
+		return NULL;
+	}
+
+	for (i = 0; i < num_shards; i++) {
+		if (shard_init(&cache->shards[i], mem_budget / num_shards))
+			goto err;
+	}
+
+	cache->num_shards = num_shards;
+	cache->mem_budget = mem_budget;
+	return cache;
+err:
+	while (i > 0)
+		shard_destroy(&cache->shards[--i]);
+	nljson_free(cache->shards);
+	nljson_free(cache);
+	return NULL;
+}
+
+void nljson_cache_destroy(struct nljson_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->num_shards; i++)
+		shard_destroy(&cache->shards[i]);
+
+	nljson_free(cache->shards);
+	nljson_free(cache);
+}
+
+struct nljson_cache_entry *nljson_cache_get(struct nljson_cache *cache,
+					    const void *nla_stream,
+					    size_t nla_stream_len,
+					    uint32_t flags)
+{
+	struct nljson_cache_entry *entry;
+	struct cache_shard *shard;
+	uint64_t hash;
+
+	hash = hash_bytes(nla_stream, nla_stream_len, flags);
+	shard = get_shard(cache, hash);
+
+	pthread_rwlock_rdlock(&shard->lock);
+	entry = find_entry(shard, hash, flags, nla_stream_len);
+	if (entry)
+		__atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&shard->lock);
+
+	/* The entry can't change (or be freed) while we hold a reference,
+	 * so the stream is compared without holding the lock.
+	 */
+	if (entry && memcmp(entry->nla, nla_stream, nla_stream_len)) {
+		nljson_cache_put(entry);
+		entry = NULL;
+	}
+
+	if (!entry) {
+		__atomic_add_fetch(&shard->misses, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	/* Avoid writing to the entry if the bit is already set */
+	if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED))
+		__atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&shard->hits, 1, __ATOMIC_RELAXED);
+
+	return entry;
+}
+
+void nljson_cache_put(struct nljson_cache_entry *entry)
+{
+	if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		nljson_free(entry);
+}
+
+void nljson_cache_insert(struct nljson_cache *cache,
+			 const void *nla_stream,
+			 size_t nla_stream_len,
+			 uint32_t flags,
+			 size_t bytes_consumed,
+			 const struct nljson_encode_count *count,
+			 const char *output,
+			 size_t output_len)
+{
+	struct nljson_cache_entry *entry;
+	struct cache_shard *shard;
+	size_t size;
+
+	size = sizeof(*entry) + nla_stream_len + output_len;
+	if (size > cache->mem_budget / cache->num_shards)
+		return;
+
+	/* The nla stream and the output are stored in the same
+	 * allocation, directly after the entry.
+	 */
+	entry = nljson_malloc(size);
+	if (!entry)
+		return;
+
+	entry->hash = hash_bytes(nla_stream, nla_stream_len, flags);
+	entry->flags = flags;
+	entry->refs = 1; /* The reference held by the cache */
+	entry->referenced = 0;
+	entry->nla = (uint8_t *) (entry + 1);
+	entry->nla_len = nla_stream_len;
+	entry->output = (char *) entry->nla + nla_stream_len;
+	entry->output_len = output_len;
+	entry->bytes_consumed = bytes_consumed;
+	entry->count = *count;
+	memcpy(entry->nla, nla_stream, nla_stream_len);
+	memcpy(entry->output, output, output_len);
+
+	shard = get_shard(cache, entry->hash);
+	pthread_rwlock_wrlock(&shard->lock);
+
+	/* Another thread might have inserted the same stream already (or,
+	 * very unlikely, a different stream with the same hash)
+	 */
+	if (find_entry(shard, entry->hash, flags, nla_stream_len)) {
+		pthread_rwlock_unlock(&shard->lock);
+		nljson_free(entry);
+		return;
+	}
+
+	while (shard->mem_used + size > shard->mem_budget)
+		evict_entry(shard, clock_victim(shard));
+
+	entry->hash_next = *get_bucket(shard, entry->hash);
+	*get_bucket(shard, entry->hash) = entry;
+	clock_insert(shard, entry);
+	shard->num_entries++;
+	shard->mem_used += size;
+	shard->insertions++;
+
+	pthread_rwlock_unlock(&shard->lock);
+}
+
+void nljson_cache_get_stats(struct nljson_cache *cache,
+			    struct nljson_cache_stats *stats)
+{
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < cache->num_shards; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+
+		pthread_rwlock_rdlock(&shard->lock);
+		stats->insertions += shard->insertions;
+		stats->evictions += shard->evictions;
+		stats->entries += shard->num_entries;
+		stats->mem_used += shard->mem_used;
+		pthread_rwlock_unlock(&shard->lock);
+
+		stats->hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+		stats->misses += __atomic_load_n(&shard->misses,
+						 __ATOMIC_RELAXED);
+	}
+	stats->mem_budget = cache->mem_budget;
+}
+
+int nljson_enable_encode_cache(nljson_t *hdl,
+			       size_t mem_budget,
+			       struct nljson_error *error)
+{
+	memset(error, 0, sizeof(*error));
+
+	if (!hdl) {
+		SET_ERR(error, EINVAL, "hdl == NULL");
+		return -1;
+	}
+
+	if (hdl->cache) {
+		nljson_cache_destroy(hdl->cache);
+		hdl->cache = NULL;
+	}
+
+	if (mem_budget == 0)
+		return 0;
+
+	hdl->cache = nljson_cache_create(mem_budget);
+	if (!hdl->cache) {
+		SET_ERR(error, ENOMEM, "Unable to allocate encode cache");
+		return -1;
+	}
+
+	return 0;
+}
+
+int nljson_get_encode_cache_stats(nljson_t *hdl,
+				  struct nljson_cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!hdl || !hdl->cache)
+		return -1;
+
+	nljson_cache_get_stats(hdl->cache, stats);
+	return 0;
+}
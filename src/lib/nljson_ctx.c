@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+#include "nljson_trace.h"
+
+#define CTX_MIN_BUF_SIZE (1024)
+
+struct _nljson_ctx {
+	nljson_arena_t *arena;
+	/* Output buffer. Reused (and grown if necessary) by every call */
+	uint8_t *buf;
+	size_t buf_len;
+	size_t buf_size;
+	bool failed;
+};
+
+static int ctx_append(nljson_ctx_t *ctx, const void *data, size_t size)
+{
+	if (ctx->failed)
+		return -1;
+
+	if (ctx->buf_len + size > ctx->buf_size) {
+		size_t new_size = ctx->buf_size ? ctx->buf_size : CTX_MIN_BUF_SIZE;
+		uint8_t *tmp;
+
+		while (new_size < ctx->buf_len + size)
+			new_size *= 2;
+
+		tmp = nljson_realloc(ctx->buf, ctx->buf_len, new_size);
+		if (!tmp) {
+			ctx->failed = true;
+			return -1;
+		}
+		ctx->buf = tmp;
+		ctx->buf_size = new_size;
+	}
+
+	memcpy(ctx->buf + ctx->buf_len, data, size);
+	ctx->buf_len += size;
+	return 0;
+}
+
+static int ctx_encode_cb(const char *buf, size_t size, void *data)
+{
+	return ctx_append((nljson_ctx_t *) data, buf, size);
+}
+
+static int ctx_decode_cb(const void *buf, size_t size, void *data)
+{
+	return ctx_append((nljson_ctx_t *) data, buf, size);
+}
+
+int nljson_ctx_init(nljson_ctx_t **ctx,
+		    size_t scratch_size,
+		    struct nljson_error *error)
+{
+	memset(error, 0, sizeof(*error));
+
+	*ctx = nljson_calloc(sizeof(nljson_ctx_t), 1);
+	if (!*ctx) {
+		SET_ERR(error, ENOMEM, "Unable to allocate nljson context");
+		return -1;
+	}
+
+	if (scratch_size > 0 &&
+	    nljson_arena_init(&(*ctx)->arena, scratch_size, error)) {
+		nljson_free(*ctx);
+		*ctx = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void nljson_ctx_deinit(nljson_ctx_t **ctx)
+{
+	if (!ctx || !*ctx)
+		return;
+
+	nljson_arena_deinit(&(*ctx)->arena);
+	if ((*ctx)->buf)
+		nljson_free((*ctx)->buf);
+	nljson_free(*ctx);
+	*ctx = NULL;
+}
+
+int nljson_encode_nla_ctx(nljson_t *hdl,
+			  nljson_ctx_t *ctx,
+			  const void *nla_stream,
+			  size_t nla_stream_len,
+			  const char **output,
+			  size_t *bytes_consumed,
+			  size_t *bytes_produced,
+			  uint32_t json_format_flags,
+			  struct nljson_error *error)
+{
+	nljson_arena_t *prev_arena;
+	int rc;
+
+	ctx->buf_len = 0;
+	ctx->failed = false;
+	*bytes_produced = 0;
+
+	prev_arena = nljson_arena_use(ctx->arena);
+	rc = nljson_encode_nla_cb(hdl, nla_stream, nla_stream_len,
+				  bytes_consumed, ctx_encode_cb, ctx,
+				  json_format_flags, error);
+	nljson_arena_use(prev_arena);
+	if (rc)
+		return -1;
+
+	/* NUL terminate the output */
+	if (ctx_append(ctx, "", 1)) {
+		SET_ERR(error, ENOMEM, "Unable to allocate output buffer");
+		return -1;
+	}
+
+	*output = (const char *) ctx->buf;
+	*bytes_produced = ctx->buf_len - 1;
+	return 0;
+}
+
+int nljson_decode_nla_ctx(nljson_ctx_t *ctx,
+			  const char *input,
+			  size_t input_len,
+			  const void **nla_stream,
+			  size_t *bytes_consumed,
+			  size_t *bytes_produced,
+			  uint32_t json_decode_flags,
+			  struct nljson_error *error)
+{
+	nljson_arena_t *prev_arena;
+	json_t *obj = NULL;
+	json_error_t json_error;
+	size_t mark;
+
+	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE2(decode__entry, input, input_len);
+
+	ctx->buf_len = 0;
+	ctx->failed = false;
+
+	prev_arena = nljson_arena_use(ctx->arena);
+	mark = nljson_tmp_begin();
+
+	/*We must have JSON_DISABLE_EOF_CHECK set in order to handle
+	 *the case where not all bytes in input are consumed
+	 */
+	json_decode_flags |= JSON_DISABLE_EOF_CHECK;
+	obj = json_loadb(input, input_len, json_decode_flags, &json_error);
+	if (!obj) {
+		SET_ERR(error, EINVAL,
+			"JSON error line %d, column %d, offset %u: %s",
+			json_error.line, json_error.column,
+			json_error.position, json_error.text);
+		goto err;
+	}
+
+	if (nljson_parse_json_attrs_cb(obj, ctx_decode_cb, ctx) ||
+	    ctx->failed) {
+		SET_ERR(error, EINVAL, "Parse error");
+		goto err;
+	}
+
+	json_decref(obj);
+	nljson_tmp_end(mark);
+	nljson_arena_use(prev_arena);
+
+	*nla_stream = ctx->buf;
+	*bytes_consumed = json_error.position;
+	*bytes_produced = ctx->buf_len;
+	NLJSON_TRACE3(decode__return, 0, *bytes_consumed, *bytes_produced);
+	return 0;
+err:
+	if (obj)
+		json_decref(obj);
+	nljson_tmp_end(mark);
+	nljson_arena_use(prev_arena);
+	*bytes_consumed = 0;
+	*bytes_produced = 0;
+	NLJSON_TRACE3(decode__return, -1, 0, 0);
+	return -1;
+}
@@ -18,6 +18,7 @@
 
 #include "nljson.h"
 #include "nljson_internal.h"
+#include "nljson_trace.h"
 
 #define KEY_MATCH(key, fixed_key) \
 ((strlen(key) == fixed_key ## _LEN) && (strncmp(key, fixed_key, fixed_key ## _LEN) == 0))
@@ -57,7 +58,8 @@ static int attr_type_lengths[NLA_TYPE_MAX + 1] = {
 };
 
 static struct nlattr_list_item *create_attr_list(json_t *attrs_json,
-						 size_t *tot_attr_len);
+						 size_t *tot_attr_len,
+						 unsigned int depth);
 
 static void free_attr_list(struct nlattr_list_item *head)
 {
@@ -71,8 +73,8 @@ static void free_attr_list(struct nlattr_list_item *head)
 		tmp = iter;
 		iter = iter->next;
 		if (tmp->attr)
-			free(tmp->attr);
-		free(tmp);
+			nljson_free(tmp->attr);
+		nljson_free(tmp);
 	}
 }
 
@@ -81,7 +83,8 @@ static int get_data_type_from_string(const char *str)
 	unsigned int i;
 
 	for (i = 0; i < NLA_TYPE_MAX + 1; i++) {
-		if (STR_MATCH(str, data_type_strings[i]))
+		if (data_type_strings[i] &&
+		    STR_MATCH(str, data_type_strings[i]))
 			break;
 	}
 
@@ -154,8 +157,8 @@ static void populate_nla_stream_and_free_attr_list(struct nlattr_list_item *head
 
 		tmp = iter;
 		iter = iter->next;
-		free(tmp->attr);
-		free(tmp);
+		nljson_free(tmp->attr);
+		nljson_free(tmp);
 	}
 }
 
@@ -214,7 +217,8 @@ static int populate_attr(void *attr_buf, size_t attr_len, int attr_type,
 }
 
 static struct nlattr *parse_json_attr(json_t *attr_json,
-				      size_t *attr_len)
+				      size_t *attr_len,
+				      unsigned int depth)
 {
 	const char *key;
 	json_t *value;
@@ -274,6 +278,8 @@ static struct nlattr *parse_json_attr(json_t *attr_json,
 			attr_data_len = strlen(attr_value.str);
 	}
 
+	NLJSON_TRACE4(decode__attr, attr_type, data_type, attr_data_len, depth);
+
 	if (!attr_data_is_valid(attr_type, data_type, attr_data_len,
 	    attr_json_type))
 		return NULL;
@@ -281,7 +287,8 @@ static struct nlattr *parse_json_attr(json_t *attr_json,
 	if (data_type == NLA_NESTED) {
 		size_t nested_len;
 
-		nested_head = create_attr_list(attr_value.obj, &nested_len);
+		nested_head = create_attr_list(attr_value.obj, &nested_len,
+					       depth + 1);
 		if (!nested_head)
 			return NULL;
 
@@ -289,7 +296,7 @@ static struct nlattr *parse_json_attr(json_t *attr_json,
 	}
 
 	*attr_len = attr_data_len + NLA_HDR_LEN;
-	attr_buf = calloc(1, NLA_ALIGN(*attr_len));
+	attr_buf = nljson_tmp_calloc(1, NLA_ALIGN(*attr_len));
 	if (!attr_buf)
 		return NULL;
 
@@ -301,12 +308,13 @@ static struct nlattr *parse_json_attr(json_t *attr_json,
 	return (struct nlattr *) attr_buf;
 err:
 	if (attr_buf)
-		free(attr_buf);
+		nljson_free(attr_buf);
 	return NULL;
 }
 
 static struct nlattr_list_item *create_attr_list(json_t *attrs_json,
-						 size_t *tot_attr_len)
+						 size_t *tot_attr_len,
+						 unsigned int depth)
 {
 	const char *key;
 	json_t *value;
@@ -323,12 +331,16 @@ static struct nlattr_list_item *create_attr_list(json_t *attrs_json,
 		if (!json_is_object(value))
 			goto err;
 
-		cur_attr = parse_json_attr(value, &cur_attr_len);
+		cur_attr = parse_json_attr(value, &cur_attr_len, depth);
 		if (!cur_attr)
 			goto err;
 
 		*tot_attr_len += NLA_ALIGN(cur_attr_len);
-		cur_item = calloc(sizeof(struct nlattr_list_item), 1);
+		cur_item = nljson_tmp_calloc(sizeof(struct nlattr_list_item), 1);
+		if (!cur_item) {
+			nljson_free(cur_attr);
+			goto err;
+		}
 		cur_item->attr = cur_attr;
 		prev_item->next = cur_item;
 		prev_item = cur_item;
@@ -340,7 +352,7 @@ err:
 	return NULL;
 }
 
-static int parse_json_attrs_cb(json_t *attrs_json,
+int nljson_parse_json_attrs_cb(json_t *attrs_json,
 			       int (*decode_cb)(const void *buf,
 						size_t size,
 						void *data),
@@ -349,7 +361,7 @@ static int parse_json_attrs_cb(json_t *attrs_json,
 	size_t tot_attr_len;
 	struct nlattr_list_item *head;
 
-	head = create_attr_list(attrs_json, &tot_attr_len);
+	head = create_attr_list(attrs_json, &tot_attr_len, 1);
 	if (!head)
 		return -ENOMEM;
 
@@ -358,19 +370,21 @@ static int parse_json_attrs_cb(json_t *attrs_json,
 	return 0;
 }
 
-static int parse_json_attrs_alloc(json_t *attrs_json, void **nla_stream,
+int nljson_parse_json_attrs_alloc(json_t *attrs_json, void **nla_stream,
 				  size_t *nla_stream_len)
 {
 	size_t tot_attr_len;
 	struct nlattr_list_item *head;
 
-	head = create_attr_list(attrs_json, &tot_attr_len);
+	head = create_attr_list(attrs_json, &tot_attr_len, 1);
 	if (!head)
 		return -ENOMEM;
 
-	*nla_stream = calloc(1, tot_attr_len);
-	if (!*nla_stream)
+	*nla_stream = nljson_calloc(1, tot_attr_len);
+	if (!*nla_stream) {
+		free_attr_list(head);
 		return -ENOMEM;
+	}
 
 	*nla_stream_len = tot_attr_len;
 
@@ -385,7 +399,7 @@ static int parse_json_attrs(json_t *attrs_json, void *nla_stream,
 	size_t tot_attr_len;
 	struct nlattr_list_item *head;
 
-	head = create_attr_list(attrs_json, &tot_attr_len);
+	head = create_attr_list(attrs_json, &tot_attr_len, 1);
 	if (!head)
 		return -ENOMEM;
 
@@ -412,8 +426,11 @@ int nljson_decode_nla(const char *input,
 	int rc;
 	json_t *obj = NULL;
 	json_error_t json_error;
+	size_t mark;
 
 	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE2(decode__entry, input, 0);
+	mark = nljson_tmp_begin();
 
 	/*We must have JSON_DISABLE_EOF_CHECK set in order to handle
 	 *the case where not all bytes in input are consumed
@@ -436,14 +453,18 @@ int nljson_decode_nla(const char *input,
 	}
 
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	*bytes_consumed = json_error.position;
 
+	NLJSON_TRACE3(decode__return, 0, *bytes_consumed, *bytes_produced);
 	return 0;
 err:
 	*bytes_consumed = 0;
 	*bytes_produced = 0;
 	if (obj)
 		json_decref(obj);
+	nljson_tmp_end(mark);
+	NLJSON_TRACE3(decode__return, -1, 0, 0);
 	return -1;
 
 }
@@ -457,9 +478,12 @@ void *nljson_decode_nla_alloc(const char *input,
 	int rc;
 	json_t *obj = NULL;
 	json_error_t json_error;
+	size_t mark;
 	void *nla_stream;
 
 	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE2(decode__entry, input, 0);
+	mark = nljson_tmp_begin();
 
 	/*We must have JSON_DISABLE_EOF_CHECK set in order to handle
 	 *the case where not all bytes in input are consumed
@@ -474,25 +498,82 @@ void *nljson_decode_nla_alloc(const char *input,
 		goto err;
 	}
 
-	rc = parse_json_attrs_alloc(obj, &nla_stream, bytes_produced);
+	rc = nljson_parse_json_attrs_alloc(obj, &nla_stream, bytes_produced);
 	if (rc) {
 		SET_ERR(error, EINVAL, "Parse error");
 		goto err;
 	}
 
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	*bytes_consumed = json_error.position;
 
+	NLJSON_TRACE3(decode__return, 0, *bytes_consumed, *bytes_produced);
 	return nla_stream;
 err:
 	*bytes_consumed = 0;
 	*bytes_produced = 0;
 	if (obj)
 		json_decref(obj);
+	nljson_tmp_end(mark);
+	NLJSON_TRACE3(decode__return, -1, 0, 0);
 	return NULL;
 }
 
 
+void *nljson_decode_nla_bin_alloc(const void *input,
+				  size_t input_len,
+				  enum nljson_bin_format format,
+				  size_t *bytes_consumed,
+				  size_t *bytes_produced,
+				  struct nljson_error *error)
+{
+	int rc;
+	json_t *obj = NULL;
+	char err_msg[NLJSON_ERR_STR_LEN / 2];
+	size_t mark, consumed;
+	void *nla_stream;
+
+	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE2(decode__entry, input, 0);
+	mark = nljson_tmp_begin();
+
+	if ((format != NLJSON_BIN_CBOR) && (format != NLJSON_BIN_MSGPACK)) {
+		SET_ERR(error, EINVAL, "Invalid binary format %d", format);
+		goto err;
+	}
+
+	obj = nljson_bin_load(input, input_len, format, &consumed, err_msg,
+			      sizeof(err_msg));
+	if (!obj) {
+		SET_ERR(error, EINVAL, "%s error %s",
+			format == NLJSON_BIN_CBOR ? "CBOR" : "MessagePack",
+			err_msg);
+		goto err;
+	}
+
+	rc = nljson_parse_json_attrs_alloc(obj, &nla_stream, bytes_produced);
+	if (rc) {
+		SET_ERR(error, EINVAL, "Parse error");
+		goto err;
+	}
+
+	json_decref(obj);
+	nljson_tmp_end(mark);
+	*bytes_consumed = consumed;
+
+	NLJSON_TRACE3(decode__return, 0, *bytes_consumed, *bytes_produced);
+	return nla_stream;
+err:
+	*bytes_consumed = 0;
+	*bytes_produced = 0;
+	if (obj)
+		json_decref(obj);
+	nljson_tmp_end(mark);
+	NLJSON_TRACE3(decode__return, -1, 0, 0);
+	return NULL;
+}
+
 int nljson_decode_nla_cb(const char *input,
 			 size_t *bytes_consumed,
 			 int (*decode_cb)(const void *buf,
@@ -505,8 +586,11 @@ int nljson_decode_nla_cb(const char *input,
 	int rc;
 	json_t *obj = NULL;
 	json_error_t json_error;
+	size_t mark;
 
 	memset(error, 0, sizeof(*error));
+	NLJSON_TRACE2(decode__entry, input, 0);
+	mark = nljson_tmp_begin();
 
 	/*We must have JSON_DISABLE_EOF_CHECK set in order to handle
 	 *the case where not all bytes in input are consumed
@@ -521,20 +605,25 @@ int nljson_decode_nla_cb(const char *input,
 		goto err;
 	}
 
-	rc = parse_json_attrs_cb(obj, decode_cb, cb_data);
+	rc = nljson_parse_json_attrs_cb(obj, decode_cb, cb_data);
 	if (rc) {
 		SET_ERR(error, EINVAL, "Parse error");
 		goto err;
 	}
 
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	*bytes_consumed = json_error.position;
 
+	/* The size of the output is only known by the callback */
+	NLJSON_TRACE3(decode__return, 0, *bytes_consumed, 0);
 	return 0;
 err:
 	*bytes_consumed = 0;
 	if (obj)
 		json_decref(obj);
+	nljson_tmp_end(mark);
+	NLJSON_TRACE3(decode__return, -1, 0, 0);
 	return -1;
 }
 
@@ -0,0 +1,561 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#define DELTA_NUM_BUCKETS (256)
+
+/* The last message of a stream */
+struct delta_stream {
+	struct delta_stream *next;
+	uint64_t key;
+	uint8_t *nla_stream;
+	size_t nla_stream_len;
+	/* Number of messages since the last keyframe */
+	uint32_t count;
+};
+
+struct _nljson_delta {
+	struct delta_stream *buckets[DELTA_NUM_BUCKETS];
+	uint32_t keyframe_interval;
+};
+
+/* Reference to a top level attribute in an nla stream */
+struct attr_ref {
+	const uint8_t *attr;
+	/* Length of the attribute including padding */
+	size_t len;
+	int type;
+	/* Index of the matching attribute in the other stream or -1 */
+	int match;
+};
+
+static struct delta_stream *get_stream(nljson_delta_t *delta, uint64_t key)
+{
+	struct delta_stream **bucket, *stream;
+
+	bucket = &delta->buckets[key % DELTA_NUM_BUCKETS];
+	for (stream = *bucket; stream; stream = stream->next) {
+		if (stream->key == key)
+			return stream;
+	}
+
+	stream = nljson_calloc(sizeof(*stream), 1);
+	if (!stream)
+		return NULL;
+
+	stream->key = key;
+	stream->next = *bucket;
+	*bucket = stream;
+	return stream;
+}
+
+static int set_stream_data(struct delta_stream *stream,
+			   const void *nla_stream, size_t nla_stream_len)
+{
+	uint8_t *tmp = NULL;
+
+	if (nla_stream_len > 0) {
+		tmp = nljson_malloc(nla_stream_len);
+		if (!tmp)
+			return -1;
+		memcpy(tmp, nla_stream, nla_stream_len);
+	}
+
+	if (stream->nla_stream)
+		nljson_free(stream->nla_stream);
+	stream->nla_stream = tmp;
+	stream->nla_stream_len = nla_stream_len;
+	return 0;
+}
+
+/* Creates a list of all complete top level attributes in buf.
+ * *bytes_consumed is calculated in the same way as in the encode
+ * functions.
+ */
+static struct attr_ref *collect_attrs(const uint8_t *buf, size_t buflen,
+				      size_t *num_attrs, size_t *bytes_consumed)
+{
+	struct nlattr *cur_attr = (struct nlattr *) buf;
+	int remaining = buflen;
+	struct attr_ref *refs;
+	size_t n = 0;
+
+	/* Each attribute is at least NLA_HDR_LEN bytes */
+	refs = nljson_tmp_calloc(sizeof(*refs), buflen / NLA_HDR_LEN + 1);
+	if (!refs)
+		return NULL;
+
+	if (bytes_consumed)
+		*bytes_consumed = 0;
+
+	while (nla_ok(cur_attr, remaining)) {
+		size_t offset = (uint8_t *) cur_attr - buf;
+
+		refs[n].attr = (uint8_t *) cur_attr;
+		refs[n].len = NLA_ALIGN(cur_attr->nla_len);
+		if (offset + refs[n].len > buflen)
+			refs[n].len = buflen - offset;
+		refs[n].type = nla_type(cur_attr);
+		refs[n].match = -1;
+		n++;
+
+		if (bytes_consumed)
+			*bytes_consumed += refs[n - 1].len;
+		cur_attr = nla_next(cur_attr, &remaining);
+	}
+
+	*num_attrs = n;
+	return refs;
+}
+
+static bool attrs_equal(const struct attr_ref *a, const struct attr_ref *b)
+{
+	const struct nlattr *attr_a = (const struct nlattr *) a->attr;
+	const struct nlattr *attr_b = (const struct nlattr *) b->attr;
+
+	return (attr_a->nla_len == attr_b->nla_len) &&
+	       !memcmp(a->attr, b->attr, attr_a->nla_len);
+}
+
+/* Matches the attributes in cur with the attributes in prev (by type).
+ * Returns true if cur can be expressed as a delta against prev, i.e. if
+ * all attribute types are unique in both streams, all common attributes
+ * have the same order in both streams and all new attributes are located
+ * at the end. The decoder then rebuilds the same stream from the delta as
+ * it would from a keyframe of cur.
+ *
+ * Note that a stream with duplicate attribute types can't be represented
+ * exactly in JSON (only one attribute per name is kept), so it is always
+ * sent as a keyframe. The message after it is a keyframe as well, since
+ * the decoder never saw the duplicates.
+ */
+static bool match_attrs(struct attr_ref *prev, size_t num_prev,
+			struct attr_ref *cur, size_t num_cur)
+{
+	size_t i, j;
+	int last_match = -1;
+	bool added = false;
+
+	for (i = 0; i < num_prev; i++) {
+		for (j = 0; j < i; j++) {
+			if (prev[j].type == prev[i].type)
+				return false;
+		}
+	}
+
+	for (i = 0; i < num_cur; i++) {
+		for (j = 0; j < i; j++) {
+			if (cur[j].type == cur[i].type)
+				return false;
+		}
+
+		for (j = 0; j < num_prev; j++) {
+			if (prev[j].type == cur[i].type)
+				break;
+		}
+
+		if (j == num_prev) {
+			added = true;
+			continue;
+		}
+
+		if (added || ((int) j < last_match) || (prev[j].match >= 0))
+			return false;
+
+		cur[i].match = j;
+		prev[j].match = i;
+		last_match = j;
+	}
+
+	return true;
+}
+
+int nljson_delta_init(nljson_delta_t **delta,
+		      uint32_t keyframe_interval,
+		      struct nljson_error *error)
+{
+	memset(error, 0, sizeof(*error));
+
+	*delta = nljson_calloc(sizeof(nljson_delta_t), 1);
+	if (!*delta) {
+		SET_ERR(error, ENOMEM, "Unable to allocate delta state");
+		return -1;
+	}
+
+	(*delta)->keyframe_interval = keyframe_interval;
+	return 0;
+}
+
+void nljson_delta_deinit(nljson_delta_t **delta)
+{
+	size_t i;
+
+	if (!delta || !*delta)
+		return;
+
+	for (i = 0; i < DELTA_NUM_BUCKETS; i++) {
+		struct delta_stream *stream = (*delta)->buckets[i];
+
+		while (stream) {
+			struct delta_stream *tmp = stream;
+
+			stream = stream->next;
+			if (tmp->nla_stream)
+				nljson_free(tmp->nla_stream);
+			nljson_free(tmp);
+		}
+	}
+
+	nljson_free(*delta);
+	*delta = NULL;
+}
+
+char *nljson_encode_nla_delta_alloc(nljson_t *hdl,
+				    nljson_delta_t *delta,
+				    uint64_t stream_key,
+				    const void *nla_stream,
+				    size_t nla_stream_len,
+				    size_t *bytes_consumed,
+				    size_t *bytes_produced,
+				    uint32_t json_format_flags,
+				    struct nljson_error *error)
+{
+	struct attr_ref *cur = NULL, *prev = NULL;
+	size_t num_cur, num_prev = 0, filtered_len = 0, consumed, i;
+	json_t *obj = NULL, *out = NULL, *meta, *removed;
+	struct delta_stream *stream;
+	uint8_t *filtered = NULL;
+	char *output = NULL;
+	unsigned int scope;
+	bool keyframe;
+	size_t mark;
+
+	memset(error, 0, sizeof(*error));
+	*bytes_produced = 0;
+	mark = nljson_tmp_begin();
+
+	/*We add JSON_PRESERVE_ORDER in order to make sure the encoded
+	 *attributes are written in the same order as in nla_stream.
+	 */
+	json_format_flags |= JSON_PRESERVE_ORDER;
+
+	stream = get_stream(delta, stream_key);
+	if (!stream)
+		goto err_nomem;
+
+	cur = collect_attrs(nla_stream, nla_stream_len, &num_cur,
+			    bytes_consumed);
+	if (!cur)
+		goto err_nomem;
+
+	keyframe = !stream->nla_stream ||
+		   (delta->keyframe_interval &&
+		    (stream->count >= delta->keyframe_interval));
+
+	if (!keyframe) {
+		prev = collect_attrs(stream->nla_stream, stream->nla_stream_len,
+				     &num_prev, NULL);
+		if (!prev)
+			goto err_nomem;
+
+		keyframe = !match_attrs(prev, num_prev, cur, num_cur);
+	}
+
+	/* Create a stream with all attributes that must be encoded.
+	 * This is all attributes in case of a keyframe, otherwise only
+	 * the new and changed attributes.
+	 */
+	filtered = nljson_tmp_malloc(nla_stream_len + 1);
+	if (!filtered)
+		goto err_nomem;
+
+	for (i = 0; i < num_cur; i++) {
+		if (!keyframe && (cur[i].match >= 0) &&
+		    attrs_equal(&cur[i], &prev[cur[i].match]))
+			continue;
+
+		memcpy(filtered + filtered_len, cur[i].attr, cur[i].len);
+		filtered_len += cur[i].len;
+	}
+
+	obj = nljson_encode_nla_json(hdl, filtered, filtered_len, &consumed);
+	if (!obj) {
+		SET_ERR(error, EINVAL, "Parse error");
+		goto err;
+	}
+
+	out = json_object();
+	meta = json_object();
+	if (!out || !meta) {
+		if (meta)
+			json_decref(meta);
+		goto err_nomem;
+	}
+
+	json_object_set_new(out, DELTA_STR, meta);
+	json_object_set_new(meta, DELTA_KEY_STR, json_integer(stream_key));
+	json_object_set_new(meta, DELTA_KEYFRAME_STR, json_boolean(keyframe));
+
+	if (!keyframe) {
+		removed = json_array();
+		for (i = 0; i < num_prev; i++) {
+			if (prev[i].match < 0)
+				json_array_append_new(removed,
+						      json_integer(prev[i].type));
+		}
+		json_object_set_new(meta, DELTA_REMOVED_STR, removed);
+	}
+
+	json_object_update(out, obj);
+
+	scope = nljson_tmp_suspend();
+	output = json_dumps(out, json_format_flags);
+	nljson_tmp_resume(scope);
+	if (!output) {
+		SET_ERR(error, EINVAL, "JSON dump error");
+		goto err;
+	}
+
+	/* Store the (unfiltered) stream for the next delta */
+	filtered_len = 0;
+	for (i = 0; i < num_cur; i++)
+		filtered_len += cur[i].len;
+
+	if (set_stream_data(stream, nla_stream, filtered_len)) {
+		nljson_free(output);
+		goto err_nomem;
+	}
+	stream->count = keyframe ? 1 : stream->count + 1;
+
+	*bytes_produced = strlen(output);
+	goto out;
+
+err_nomem:
+	SET_ERR(error, ENOMEM, "Out of memory");
+err:
+	output = NULL;
+	*bytes_consumed = 0;
+out:
+	if (out)
+		json_decref(out);
+	if (obj)
+		json_decref(obj);
+	if (filtered)
+		nljson_free(filtered);
+	if (prev)
+		nljson_free(prev);
+	if (cur)
+		nljson_free(cur);
+	nljson_tmp_end(mark);
+	return output;
+}
+
+/* Recreates a full stream from the previous stream and a delta.
+ * The attribute order is the same as the one the encoder expects
+ * (see match_attrs).
+ */
+static uint8_t *merge_delta(struct delta_stream *stream,
+			    const uint8_t *attrs, size_t attrs_len,
+			    json_t *removed, size_t *out_len)
+{
+	struct attr_ref *prev = NULL, *changed = NULL;
+	size_t num_prev, num_changed, i, j, len = 0;
+	uint8_t *out;
+
+	out = nljson_malloc(stream->nla_stream_len + attrs_len + 1);
+	if (!out)
+		return NULL;
+
+	prev = collect_attrs(stream->nla_stream, stream->nla_stream_len,
+			     &num_prev, NULL);
+	changed = collect_attrs(attrs, attrs_len, &num_changed, NULL);
+	if (!prev || !changed)
+		goto err;
+
+	for (i = 0; i < num_prev; i++) {
+		const struct attr_ref *ref = &prev[i];
+		bool is_removed = false;
+		size_t index;
+		json_t *value;
+
+		json_array_foreach(removed, index, value) {
+			if (json_is_integer(value) &&
+			    (json_integer_value(value) == prev[i].type))
+				is_removed = true;
+		}
+
+		if (is_removed)
+			continue;
+
+		for (j = 0; j < num_changed; j++) {
+			if ((changed[j].match < 0) &&
+			    (changed[j].type == prev[i].type)) {
+				changed[j].match = i;
+				ref = &changed[j];
+				break;
+			}
+		}
+
+		memcpy(out + len, ref->attr, ref->len);
+		len += ref->len;
+	}
+
+	/* Added attributes */
+	for (j = 0; j < num_changed; j++) {
+		if (changed[j].match >= 0)
+			continue;
+
+		memcpy(out + len, changed[j].attr, changed[j].len);
+		len += changed[j].len;
+	}
+
+	nljson_free(prev);
+	nljson_free(changed);
+	*out_len = len;
+	return out;
+err:
+	if (prev)
+		nljson_free(prev);
+	if (changed)
+		nljson_free(changed);
+	nljson_free(out);
+	return NULL;
+}
+
+void *nljson_decode_nla_delta_alloc(nljson_delta_t *delta,
+				    const char *input,
+				    size_t *bytes_consumed,
+				    size_t *bytes_produced,
+				    uint32_t json_decode_flags,
+				    struct nljson_error *error)
+{
+	json_t *obj = NULL, *meta = NULL, *key_json, *removed;
+	json_error_t json_error;
+	struct delta_stream *stream;
+	void *attrs = NULL;
+	uint8_t *output = NULL;
+	size_t attrs_len = 0, output_len, mark;
+	bool keyframe;
+
+	memset(error, 0, sizeof(*error));
+	mark = nljson_tmp_begin();
+
+	/*We must have JSON_DISABLE_EOF_CHECK set in order to handle
+	 *the case where not all bytes in input are consumed
+	 */
+	json_decode_flags |= JSON_DISABLE_EOF_CHECK;
+	obj = json_loads(input, json_decode_flags, &json_error);
+	if (!obj) {
+		SET_ERR(error, EINVAL,
+			"JSON error line %d, column %d, offset %u: %s",
+			json_error.line, json_error.column,
+			json_error.position, json_error.text);
+		goto err;
+	}
+
+	meta = json_incref(json_object_get(obj, DELTA_STR));
+	if (!json_is_object(meta)) {
+		SET_ERR(error, EINVAL, "Missing %s object", DELTA_STR);
+		goto err;
+	}
+
+	key_json = json_object_get(meta, DELTA_KEY_STR);
+	if (!json_is_integer(key_json)) {
+		SET_ERR(error, EINVAL, "Missing %s", DELTA_KEY_STR);
+		goto err;
+	}
+
+	keyframe = json_is_true(json_object_get(meta, DELTA_KEYFRAME_STR));
+	removed = json_object_get(meta, DELTA_REMOVED_STR);
+
+	/* The remaining keys are the attributes */
+	json_object_del(obj, DELTA_STR);
+	json_object_del(obj, TS_STR);
+
+	if (json_object_size(obj) > 0) {
+		if (nljson_parse_json_attrs_alloc(obj, &attrs, &attrs_len)) {
+			SET_ERR(error, EINVAL, "Parse error");
+			goto err;
+		}
+	}
+
+	stream = get_stream(delta, json_integer_value(key_json));
+	if (!stream) {
+		SET_ERR(error, ENOMEM, "Out of memory");
+		goto err;
+	}
+
+	if (keyframe) {
+		output = attrs;
+		output_len = attrs_len;
+		attrs = NULL;
+	} else {
+		if (!stream->nla_stream && (stream->count == 0)) {
+			SET_ERR(error, ENOENT,
+				"No keyframe received for stream key %" JSON_INTEGER_FORMAT,
+				json_integer_value(key_json));
+			goto err;
+		}
+
+		output = merge_delta(stream, attrs, attrs_len, removed,
+				     &output_len);
+		if (!output) {
+			SET_ERR(error, ENOMEM, "Out of memory");
+			goto err;
+		}
+	}
+
+	if (set_stream_data(stream, output, output_len)) {
+		SET_ERR(error, ENOMEM, "Out of memory");
+		goto err;
+	}
+	stream->count++;
+
+	/* An empty stream is returned as a zero length allocation */
+	if (!output) {
+		output = nljson_malloc(1);
+		if (!output) {
+			SET_ERR(error, ENOMEM, "Out of memory");
+			goto err;
+		}
+	}
+
+	if (attrs)
+		nljson_free(attrs);
+	json_decref(meta);
+	json_decref(obj);
+	nljson_tmp_end(mark);
+	*bytes_consumed = json_error.position;
+	*bytes_produced = output_len;
+	return output;
+err:
+	if (output)
+		nljson_free(output);
+	if (attrs)
+		nljson_free(attrs);
+	if (meta)
+		json_decref(meta);
+	if (obj)
+		json_decref(obj);
+	nljson_tmp_end(mark);
+	*bytes_consumed = 0;
+	*bytes_produced = 0;
+	return NULL;
+}
@@ -18,6 +18,7 @@
 
 #include "nljson.h"
 #include "nljson_internal.h"
+#include "nljson_trace.h"
 #include <sys/time.h>
 #include <time.h>
 
@@ -27,15 +28,75 @@ struct local_encode_cb_data {
 	size_t bytes_consumed;
 };
 
+/* Used by nljson_encode_nla_cb in order to collect the output chunks
+ * passed to the user callback so that they can be added to the cache
+ * (if collect is set) and to count the produced bytes.
+ */
+struct cache_encode_cb_data {
+	int (*encode_cb)(const char *buf, size_t size, void *data);
+	void *cb_data;
+	char *output;
+	size_t output_len;
+	size_t output_size;
+	size_t bytes_produced;
+	bool collect;
+	bool failed;
+};
+
+/* Tracing and runtime statistics of one encode call */
+struct encode_stats {
+	nljson_t *hdl;
+	struct nljson_stats_shards *shards;
+	struct nljson_stats delta;
+	struct nljson_encode_count count;
+	uint64_t allocs;
+	uint64_t time;
+};
+
+/* A nested attribute whose value is encoded by the encode threads */
+struct split_item {
+	struct nlattr *attr;
+	struct nljson_nla_policy *policy;
+	/* The attribute object (without value) and the object containing it */
+	json_t *obj;
+	json_t *parent;
+	json_t *value;
+	/* Nesting depth of the attribute */
+	unsigned int depth;
+};
+
+/* A range of split items encoded by one thread */
+struct split_unit {
+	size_t first;
+	size_t last;
+	struct nljson_encode_count count;
+};
+
+/* State used when a message is split into several encode tasks */
+struct encode_split {
+	struct split_item *items;
+	size_t num_items;
+	size_t items_size;
+	struct split_unit *units;
+	/* Nested attributes larger than this are split further */
+	size_t max_len;
+	uint32_t flags;
+	/* Attributes are counted */
+	bool count;
+};
+
 static json_t *parse_nl_attrs(uint8_t *buf, size_t buflen,
 			      struct nljson_nla_policy *nljson_policy,
-			      size_t *bytes_consumed, uint32_t flags);
+			      size_t *bytes_consumed, uint32_t flags,
+			      struct encode_split *split,
+			      struct nljson_encode_count *count,
+			      unsigned int depth);
 
 static void add_timestamp(json_t *obj)
 {
 	int rc;
 	struct timeval tval;
-	struct tm *tm;
+	struct tm tm;
 	char timestr[256];
 	size_t timestr_len;
 
@@ -43,11 +104,11 @@ static void add_timestamp(json_t *obj)
 	if (rc)
 		return;
 
-	tm = localtime(&tval.tv_sec);
-	if (!tm)
+	/* localtime is not thread safe */
+	if (!localtime_r(&tval.tv_sec, &tm))
 		return;
 
-	timestr_len = strftime(timestr, sizeof(timestr), "%F %T", tm);
+	timestr_len = strftime(timestr, sizeof(timestr), "%F %T", &tm);
 	if (!timestr_len)
 		return;
 
@@ -74,17 +135,68 @@ static json_t *create_unspec_attr_object(const uint8_t *data, size_t data_len)
 	return obj;
 }
 
+/* NLA_STRING attributes are not necessarily NUL terminated */
+static json_t *create_string(const char *str, size_t len)
+{
+	json_t *json;
+	char *tmp;
+
+	if (memchr(str, '\0', len))
+		return json_string_nocheck(str);
+
+	tmp = nljson_tmp_malloc(len + 1);
+	if (!tmp)
+		return NULL;
+
+	memcpy(tmp, str, len);
+	tmp[len] = '\0';
+	json = json_string_nocheck(tmp);
+	nljson_free(tmp);
+	return json;
+}
+
+static int add_split_item(struct encode_split *split, struct nlattr *attr,
+			  struct nljson_nla_policy *policy, json_t *obj,
+			  unsigned int depth)
+{
+	struct split_item *item;
+
+	if (split->num_items == split->items_size) {
+		size_t new_size = split->items_size ? 2 * split->items_size : 64;
+		struct split_item *tmp;
+
+		tmp = nljson_realloc(split->items,
+				     split->items_size * sizeof(*tmp),
+				     new_size * sizeof(*tmp));
+		if (!tmp)
+			return -1;
+		split->items = tmp;
+		split->items_size = new_size;
+	}
+
+	item = &split->items[split->num_items++];
+	item->attr = attr;
+	item->policy = policy;
+	item->obj = json_incref(obj);
+	item->parent = NULL;
+	item->value = NULL;
+	item->depth = depth;
+	return 0;
+}
+
 static json_t *create_attr_object(struct nlattr *attr, int data_type,
 				  struct nljson_nla_policy *policy,
-				  uint32_t flags)
+				  uint32_t flags,
+				  struct encode_split *split,
+				  struct nljson_encode_count *count,
+				  unsigned int depth)
 {
 	json_t *obj;
 	union {
 		uint8_t u8;
 		uint16_t u16;
-		uint16_t u32;
-		uint16_t u64;
-		char *str;
+		uint32_t u32;
+		uint64_t u64;
 		void *unspec;
 	} data;
 
@@ -114,19 +226,30 @@ static json_t *create_attr_object(struct nlattr *attr, int data_type,
 		json_object_set_new(obj, VALUE_STR, json_integer(data.u64));
 		break;
 	case NLA_STRING:
-		data.str = nla_get_string(attr);
-		json_object_set_new(obj, VALUE_STR, json_string_nocheck(data.str));
+		json_object_set_new(obj, VALUE_STR,
+				    create_string(nla_data(attr), nla_len(attr)));
 		break;
 	case NLA_NESTED:
 	{
 		json_t *nested;
 		size_t bytes_consumed;
 
+		/* The value is added when the split items have been encoded */
+		if (split && ((size_t) nla_len(attr) <= split->max_len)) {
+			if (add_split_item(split, attr, policy, obj, depth))
+				goto err;
+			break;
+		}
+
 		nested = parse_nl_attrs(nla_data(attr), nla_len(attr),
 					policy,
 					&bytes_consumed,
-					flags);
-		if (!nested || (bytes_consumed != (size_t) nla_len(attr)))
+					flags, split, count, depth + 1);
+		if (nested && (bytes_consumed != (size_t) nla_len(attr))) {
+			json_decref(nested);
+			nested = NULL;
+		}
+		if (!nested)
 			goto err;
 
 		json_object_set_new(obj, VALUE_STR, nested);
@@ -156,13 +279,17 @@ err:
 /* buf is assumed to point directly at the attribute stream */
 static json_t *parse_nl_attrs(uint8_t *buf, size_t buflen,
 			      struct nljson_nla_policy *nljson_policy,
-			      size_t *bytes_consumed, uint32_t flags)
+			      size_t *bytes_consumed, uint32_t flags,
+			      struct encode_split *split,
+			      struct nljson_encode_count *count,
+			      unsigned int depth)
 {
 	struct nlattr *cur_attr;
 	json_t *obj = NULL, *cur_attr_obj;
 	int remaining, max_attr_type = 0, max_nested_attr_type = 0;
 	struct nla_policy *policy = NULL;
 	struct nljson_nla_policy **nested = NULL;
+	struct nljson_profile_level *profile = NULL;
 	char **attr_type_to_str_map = NULL;
 
 	cur_attr = (struct nlattr *) buf;
@@ -174,6 +301,7 @@ static json_t *parse_nl_attrs(uint8_t *buf, size_t buflen,
 		policy = nljson_policy->policy;
 		attr_type_to_str_map = nljson_policy->id_to_str_map;
 		nested = nljson_policy->nested;
+		profile = nljson_policy->profile;
 	}
 
 	*bytes_consumed = 0;
@@ -184,37 +312,353 @@ static json_t *parse_nl_attrs(uint8_t *buf, size_t buflen,
 	if (flags & NLJSON_FLAG_ADD_TIMESTAMP)
 		add_timestamp(obj);
 
+	if (count && (depth > count->max_depth))
+		count->max_depth = depth;
+
 	while (nla_ok(cur_attr, remaining)) {
 		int data_type = NLA_UNSPEC, type = nla_type(cur_attr);
 		struct nljson_nla_policy *cur_nested = NULL;
 
-		*bytes_consumed += (nla_len(cur_attr) + NLA_HDR_LEN);
+		*bytes_consumed += NLA_ALIGN(nla_len(cur_attr) + NLA_HDR_LEN);
 		if (policy && (type <= max_attr_type))
 			data_type = policy[type].type;
 		if (nested && (type <= max_nested_attr_type))
 			cur_nested = nested[type];
+		NLJSON_TRACE4(encode__attr, type, data_type,
+			      nla_len(cur_attr), depth);
+		if (profile)
+			nljson_profile_hit(profile, type);
 		cur_attr_obj = create_attr_object(cur_attr, data_type,
 						  cur_nested,
-						  flags);
+						  flags, split, count, depth);
 		if (cur_attr_obj) {
+			struct split_item *item = NULL;
+
+			if (split && split->num_items &&
+			    (split->items[split->num_items - 1].obj == cur_attr_obj))
+				item = &split->items[split->num_items - 1];
+
 			if (attr_type_to_str_map && (type <= max_attr_type) &&
 			    attr_type_to_str_map[type]) {
 				json_object_set(obj, attr_type_to_str_map[type],
 						cur_attr_obj);
+				if (item)
+					item->parent = json_incref(obj);
 			} else if (!(flags & NLJSON_FLAG_SKIP_UNKNOWN_ATTRS)) {
 				char tmp[20];
 
 				snprintf(tmp, sizeof(tmp), "UNKNOWN_ATTR_%d", type);
 				json_object_set(obj, tmp, cur_attr_obj);
+				if (item)
+					item->parent = json_incref(obj);
+			} else if (count) {
+				count->unknown++;
 			}
 			json_decref(cur_attr_obj);
+			if (count)
+				count->attrs++;
 		}
 		cur_attr = nla_next(cur_attr, &remaining);
 	}
 
+	/* The padding of the last attribute may be missing */
+	if (*bytes_consumed > buflen)
+		*bytes_consumed = buflen;
+
+	return obj;
+}
+
+/* Returns the encode cache of the handle if the output can be cached.
+ * Time stamps makes every output unique, so nothing is cached if
+ * NLJSON_FLAG_ADD_TIMESTAMP is set. The cache is bypassed while profiling
+ * as well, since the attributes are only counted when they are parsed.
+ */
+static struct nljson_cache *get_cache(nljson_t *hdl)
+{
+	if (!hdl || !hdl->cache ||
+	    (hdl->encode_flags & NLJSON_FLAG_ADD_TIMESTAMP) ||
+	    (hdl->policy && hdl->policy->profile))
+		return NULL;
+
+	return hdl->cache;
+}
+
+/* Called at the start of each encode call (tracing and runtime
+ * statistics). Returns the attribute counters to use (NULL if neither
+ * statistics nor the cache are enabled on the handle). The counters are
+ * needed for the cache as well, since they are stored with the cached
+ * output.
+ */
+static struct nljson_encode_count *encode_begin(struct encode_stats *st,
+						nljson_t *hdl,
+						struct nljson_cache *cache,
+						size_t nla_stream_len)
+{
+	/* Only used by the trace probe */
+	(void) nla_stream_len;
+	NLJSON_TRACE2(encode__entry, hdl, nla_stream_len);
+
+	st->hdl = hdl;
+	memset(&st->count, 0, sizeof(st->count));
+	st->shards = hdl ? hdl->stats : NULL;
+	if (!st->shards)
+		return cache ? &st->count : NULL;
+
+	memset(&st->delta, 0, sizeof(st->delta));
+	st->allocs = nljson_alloc_count();
+	st->time = 0;
+	return &st->count;
+}
+
+/* Adds the time since the previous call to *phase_ns (if not NULL) */
+static void stats_phase(struct encode_stats *st, uint64_t *phase_ns)
+{
+	uint64_t now;
+
+	if (!st->shards)
+		return;
+
+	now = nljson_stats_now();
+	if (phase_ns)
+		*phase_ns += now - st->time;
+	st->time = now;
+}
+
+static void stats_end(struct encode_stats *st)
+{
+	st->delta.allocs = nljson_alloc_count() - st->allocs;
+	nljson_stats_add(st->shards, &st->delta);
+}
+
+/* Called when an encode call has succeeded */
+static void encode_done(struct encode_stats *st, size_t bytes_consumed,
+			size_t bytes_produced)
+{
+	unsigned int bucket;
+
+	NLJSON_TRACE4(encode__return, st->hdl, 0, bytes_consumed,
+		      bytes_produced);
+
+	if (!st->shards)
+		return;
+
+	st->delta.messages = 1;
+	st->delta.bytes_in = bytes_consumed;
+	st->delta.bytes_out = bytes_produced;
+	st->delta.attrs = st->count.attrs;
+	st->delta.unknown_attrs_skipped = st->count.unknown;
+	/* The top level attributes are at depth 1, so max_depth is only 0
+	 * if nothing was counted
+	 */
+	if (st->count.max_depth) {
+		bucket = st->count.max_depth - 1;
+		if (bucket >= NLJSON_STATS_DEPTH_BUCKETS)
+			bucket = NLJSON_STATS_DEPTH_BUCKETS - 1;
+		st->delta.depth[bucket] = 1;
+	}
+	stats_end(st);
+}
+
+/* Called when an encode call has failed */
+static void encode_error(struct encode_stats *st, enum nljson_stats_error err)
+{
+	NLJSON_TRACE4(encode__return, st->hdl, -1, 0, 0);
+
+	if (!st->shards)
+		return;
+
+	st->delta.errors[err] = 1;
+	stats_end(st);
+}
+
+static int cache_encode_cb(const char *buf, size_t size, void *data)
+{
+	struct cache_encode_cb_data *cb_data =
+		(struct cache_encode_cb_data *) data;
+
+	cb_data->bytes_produced += size;
+	if (!cb_data->collect)
+		return cb_data->encode_cb(buf, size, cb_data->cb_data);
+
+	if (!cb_data->failed &&
+	    (cb_data->output_len + size > cb_data->output_size)) {
+		size_t new_size = 2 * (cb_data->output_len + size);
+		char *tmp;
+
+		tmp = nljson_realloc(cb_data->output, cb_data->output_size,
+				     new_size);
+		if (tmp) {
+			cb_data->output = tmp;
+			cb_data->output_size = new_size;
+		} else {
+			cb_data->failed = true;
+		}
+	}
+
+	if (!cb_data->failed) {
+		memcpy(cb_data->output + cb_data->output_len, buf, size);
+		cb_data->output_len += size;
+	}
+
+	return cb_data->encode_cb(buf, size, cb_data->cb_data);
+}
+
+static void encode_split_unit(size_t index, void *data)
+{
+	struct encode_split *split = (struct encode_split *) data;
+	struct split_unit *unit = &split->units[index];
+	size_t i;
+
+	for (i = unit->first; i <= unit->last; i++) {
+		struct split_item *item = &split->items[i];
+		size_t bytes_consumed;
+
+		item->value = parse_nl_attrs(nla_data(item->attr),
+					     nla_len(item->attr),
+					     item->policy, &bytes_consumed,
+					     split->flags, NULL,
+					     split->count ? &unit->count : NULL,
+					     item->depth + 1);
+		if (item->value &&
+		    (bytes_consumed != (size_t) nla_len(item->attr))) {
+			json_decref(item->value);
+			item->value = NULL;
+		}
+	}
+}
+
+/* Removes the attribute object of a failed split item from its parent,
+ * i.e. the same thing that happens with invalid nested attributes when
+ * encoding serially.
+ */
+static void remove_split_item(struct split_item *item)
+{
+	const char *key;
+	char *key_copy = NULL;
+	json_t *value;
+
+	json_object_foreach(item->parent, key, value) {
+		if (value == item->obj) {
+			key_copy = nljson_strdup(key);
+			break;
+		}
+	}
+
+	if (key_copy) {
+		json_object_del(item->parent, key_copy);
+		nljson_free(key_copy);
+	}
+}
+
+/* Encodes a large nla stream using the encode threads of hdl.
+ * The structure of the message is encoded serially, except for the
+ * values of nested attributes that are small enough (see max_len).
+ * These are grouped into units of roughly max_len bytes and encoded in
+ * parallel. Finally, the values are added to the attribute objects in
+ * the original order.
+ */
+static json_t *encode_nla_json_split(nljson_t *hdl, const void *nla_stream,
+				     size_t nla_stream_len,
+				     size_t *bytes_consumed,
+				     struct nljson_encode_count *count)
+{
+	struct encode_split split;
+	size_t i, first = 0, num_units = 0, unit_len = 0;
+	json_t *obj;
+
+	memset(&split, 0, sizeof(split));
+	split.flags = hdl->encode_flags;
+	split.count = (count != NULL);
+	split.max_len = nla_stream_len /
+			(4 * (nljson_par_num_threads(hdl->par) + 1));
+
+	obj = parse_nl_attrs((uint8_t *) nla_stream, nla_stream_len,
+			     hdl->policy, bytes_consumed, hdl->encode_flags,
+			     &split, count, 1);
+	if (!obj || !split.num_items)
+		goto out;
+
+	split.units = nljson_calloc(split.num_items, sizeof(*split.units));
+	if (!split.units) {
+		json_decref(obj);
+		obj = NULL;
+		goto out;
+	}
+
+	/* Empty nested attributes add nothing to unit_len, so the start of
+	 * each unit is tracked separately.
+	 */
+	for (i = 0; i < split.num_items; i++) {
+		unit_len += nla_len(split.items[i].attr);
+		if ((unit_len >= split.max_len) || (i == split.num_items - 1)) {
+			split.units[num_units].first = first;
+			split.units[num_units++].last = i;
+			first = i + 1;
+			unit_len = 0;
+		}
+	}
+
+	nljson_par_for(hdl->par, num_units, encode_split_unit, &split);
+
+	for (i = 0; count && (i < num_units); i++) {
+		count->attrs += split.units[i].count.attrs;
+		count->unknown += split.units[i].count.unknown;
+		if (split.units[i].count.max_depth > count->max_depth)
+			count->max_depth = split.units[i].count.max_depth;
+	}
+
+out:
+	for (i = 0; i < split.num_items; i++) {
+		struct split_item *item = &split.items[i];
+
+		if (item->value)
+			json_object_set_new(item->obj, VALUE_STR, item->value);
+		else if (item->parent)
+			remove_split_item(item);
+
+		json_decref(item->obj);
+		if (item->parent)
+			json_decref(item->parent);
+	}
+
+	if (split.units)
+		nljson_free(split.units);
+	if (split.items)
+		nljson_free(split.items);
 	return obj;
 }
 
+static json_t *encode_nla_json_count(nljson_t *hdl, const void *nla_stream,
+				     size_t nla_stream_len,
+				     size_t *bytes_consumed,
+				     struct nljson_encode_count *count)
+{
+	struct nljson_nla_policy *policy = NULL;
+	uint32_t encode_flags = 0;
+
+	if (hdl) {
+		if (hdl->par &&
+		    (nla_stream_len >= nljson_par_min_len(hdl->par)))
+			return encode_nla_json_split(hdl, nla_stream,
+						     nla_stream_len,
+						     bytes_consumed, count);
+
+		policy = hdl->policy;
+		encode_flags = hdl->encode_flags;
+	}
+
+	return parse_nl_attrs((uint8_t *) nla_stream, nla_stream_len,
+			      policy, bytes_consumed, encode_flags, NULL,
+			      count, 1);
+}
+
+json_t *nljson_encode_nla_json(nljson_t *hdl, const void *nla_stream,
+			       size_t nla_stream_len, size_t *bytes_consumed)
+{
+	return encode_nla_json_count(hdl, nla_stream, nla_stream_len,
+				     bytes_consumed, NULL);
+}
+
 static int local_encode_cb(const char *buf, size_t size, void *data)
 {
 	struct local_encode_cb_data *cb_data =
@@ -240,8 +684,10 @@ int nljson_encode_nla(nljson_t *hdl,
 {
 	json_t *obj;
 	int rc;
-	struct nljson_nla_policy *policy = NULL;
-	uint32_t encode_flags = 0;
+	struct nljson_cache *cache;
+	struct encode_stats st;
+	struct nljson_encode_count *count;
+	size_t mark;
 	struct local_encode_cb_data cb_data = {
 		.output = output,
 		.output_len = output_len,
@@ -249,34 +695,70 @@ int nljson_encode_nla(nljson_t *hdl,
 
 	memset(error, 0, sizeof(*error));
 
-	if (hdl) {
-		policy = hdl->policy;
-		encode_flags = hdl->encode_flags;
-	}
-
 	/*We add JSON_PRESERVE_ORDER in order to make sure the encoded
 	 *attributes are written in the same order as in nla_stream.
 	 */
 	json_format_flags |= JSON_PRESERVE_ORDER;
 
-	obj = parse_nl_attrs((uint8_t *) nla_stream, nla_stream_len,
-			     policy, bytes_consumed, encode_flags);
+	cache = get_cache(hdl);
+	count = encode_begin(&st, hdl, cache, nla_stream_len);
+	if (cache) {
+		struct nljson_cache_entry *entry;
+
+		entry = nljson_cache_get(cache, nla_stream, nla_stream_len,
+					 json_format_flags);
+		if (entry) {
+			rc = local_encode_cb(entry->output, entry->output_len,
+					     &cb_data);
+			*bytes_consumed = entry->bytes_consumed;
+			st.count = entry->count;
+			nljson_cache_put(entry);
+			if (rc) {
+				SET_ERR(error, EINVAL, "JSON dump error");
+				encode_error(&st, NLJSON_STATS_ERR_OUTPUT);
+				*bytes_produced = 0;
+				return -1;
+			}
+			*bytes_produced = cb_data.bytes_consumed;
+			encode_done(&st, *bytes_consumed, *bytes_produced);
+			return 0;
+		}
+	}
+
+	/* The JSON DOM is only needed during this call */
+	mark = nljson_tmp_begin();
+	stats_phase(&st, NULL);
+	obj = encode_nla_json_count(hdl, nla_stream, nla_stream_len,
+				    bytes_consumed, count);
+	stats_phase(&st, &st.delta.parse_ns);
 	if (!obj) {
 		SET_ERR(error, EINVAL, "Parse error");
+		encode_error(&st, NLJSON_STATS_ERR_PARSE);
+		nljson_tmp_end(mark);
 		return -1;
 	}
 
 	rc = json_dump_callback(obj, local_encode_cb, &cb_data,
 				json_format_flags);
+	stats_phase(&st, &st.delta.dump_ns);
 	if (rc) {
 		SET_ERR(error, EINVAL, "JSON dump error");
+		encode_error(&st, NLJSON_STATS_ERR_OUTPUT);
 		goto err;
 	}
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	*bytes_produced = cb_data.bytes_consumed;
+	encode_done(&st, *bytes_consumed, *bytes_produced);
+
+	if (cache)
+		nljson_cache_insert(cache, nla_stream, nla_stream_len,
+				    json_format_flags, *bytes_consumed, count,
+				    output, *bytes_produced);
 	return rc;
 err:
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	*bytes_produced = 0;
 	return -1;
 }
@@ -291,42 +773,149 @@ char *nljson_encode_nla_alloc(nljson_t *hdl,
 {
 	json_t *obj;
 	char *output;
-	struct nljson_nla_policy *policy = NULL;
-	uint32_t encode_flags = 0;
+	struct nljson_cache *cache;
+	struct encode_stats st;
+	struct nljson_encode_count *count;
+	unsigned int scope;
+	size_t mark;
 
 	memset(error, 0, sizeof(*error));
 
-	if (hdl) {
-		policy = hdl->policy;
-		encode_flags = hdl->encode_flags;
-	}
-
 	/*We add JSON_PRESERVE_ORDER in order to make sure the encoded
 	 *attributes are written in the same order as in nla_stream.
 	 */
 	json_format_flags |= JSON_PRESERVE_ORDER;
 
-	obj = parse_nl_attrs((uint8_t *) nla_stream, nla_stream_len,
-			     policy, bytes_consumed, encode_flags);
+	cache = get_cache(hdl);
+	count = encode_begin(&st, hdl, cache, nla_stream_len);
+	if (cache) {
+		struct nljson_cache_entry *entry;
+
+		entry = nljson_cache_get(cache, nla_stream, nla_stream_len,
+					 json_format_flags);
+		if (entry) {
+			output = nljson_malloc(entry->output_len + 1);
+			if (output) {
+				memcpy(output, entry->output,
+				       entry->output_len);
+				output[entry->output_len] = '\0';
+				*bytes_consumed = entry->bytes_consumed;
+				*bytes_produced = entry->output_len;
+			}
+			st.count = entry->count;
+			nljson_cache_put(entry);
+			if (!output) {
+				SET_ERR(error, ENOMEM,
+					"Unable to allocate output buffer");
+				encode_error(&st, NLJSON_STATS_ERR_NOMEM);
+				*bytes_produced = 0;
+			} else {
+				encode_done(&st, *bytes_consumed,
+					    *bytes_produced);
+			}
+			return output;
+		}
+	}
+
+	/* The JSON DOM is only needed during this call */
+	mark = nljson_tmp_begin();
+	stats_phase(&st, NULL);
+	obj = encode_nla_json_count(hdl, nla_stream, nla_stream_len,
+				    bytes_consumed, count);
+	stats_phase(&st, &st.delta.parse_ns);
 	if (!obj) {
 		SET_ERR(error, EINVAL, "Parse error");
+		encode_error(&st, NLJSON_STATS_ERR_PARSE);
+		nljson_tmp_end(mark);
 		return NULL;
 	}
 
+	/* The output is returned to the caller and must not be allocated
+	 * from the arena.
+	 */
+	scope = nljson_tmp_suspend();
 	output = json_dumps(obj, json_format_flags);
+	nljson_tmp_resume(scope);
+	stats_phase(&st, &st.delta.dump_ns);
 	if (!output) {
 		SET_ERR(error, EINVAL, "JSON dump error");
+		encode_error(&st, NLJSON_STATS_ERR_OUTPUT);
 		goto err;
 	}
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	*bytes_produced = strlen(output);
+	encode_done(&st, *bytes_consumed, *bytes_produced);
+
+	if (cache)
+		nljson_cache_insert(cache, nla_stream, nla_stream_len,
+				    json_format_flags, *bytes_consumed, count,
+				    output, *bytes_produced);
 	return output;
 err:
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	*bytes_produced = 0;
 	return NULL;
 }
 
+void *nljson_encode_nla_bin_alloc(nljson_t *hdl,
+				  const void *nla_stream,
+				  size_t nla_stream_len,
+				  enum nljson_bin_format format,
+				  size_t *bytes_consumed,
+				  size_t *bytes_produced,
+				  struct nljson_error *error)
+{
+	json_t *obj;
+	void *output;
+	struct encode_stats st;
+	struct nljson_encode_count *count;
+	unsigned int scope;
+	size_t mark;
+
+	memset(error, 0, sizeof(*error));
+	*bytes_produced = 0;
+
+	if ((format != NLJSON_BIN_CBOR) && (format != NLJSON_BIN_MSGPACK)) {
+		SET_ERR(error, EINVAL, "Invalid binary format %d", format);
+		return NULL;
+	}
+
+	count = encode_begin(&st, hdl, NULL, nla_stream_len);
+
+	/* The JSON DOM is only needed during this call */
+	mark = nljson_tmp_begin();
+	stats_phase(&st, NULL);
+	obj = encode_nla_json_count(hdl, nla_stream, nla_stream_len,
+				    bytes_consumed, count);
+	stats_phase(&st, &st.delta.parse_ns);
+	if (!obj) {
+		SET_ERR(error, EINVAL, "Parse error");
+		encode_error(&st, NLJSON_STATS_ERR_PARSE);
+		nljson_tmp_end(mark);
+		return NULL;
+	}
+
+	/* The output is returned to the caller and must not be allocated
+	 * from the arena.
+	 */
+	scope = nljson_tmp_suspend();
+	output = nljson_bin_dump(obj, format, bytes_produced);
+	nljson_tmp_resume(scope);
+	stats_phase(&st, &st.delta.dump_ns);
+	json_decref(obj);
+	nljson_tmp_end(mark);
+	if (!output) {
+		SET_ERR(error, ENOMEM, "Binary dump error");
+		encode_error(&st, NLJSON_STATS_ERR_OUTPUT);
+		return NULL;
+	}
+
+	encode_done(&st, *bytes_consumed, *bytes_produced);
+	return output;
+}
+
 int nljson_encode_nla_cb(nljson_t *hdl,
 			 const void *nla_stream,
 			 size_t nla_stream_len,
@@ -340,16 +929,17 @@ int nljson_encode_nla_cb(nljson_t *hdl,
 {
 	json_t *obj;
 	int rc;
-	struct nljson_nla_policy *policy = NULL;
-	uint32_t encode_flags = 0;
+	struct nljson_cache *cache;
+	struct encode_stats st;
+	struct nljson_encode_count *count;
+	size_t mark;
+	struct cache_encode_cb_data cache_cb_data = {
+		.encode_cb = encode_cb,
+		.cb_data = cb_data,
+	};
 
 	memset(error, 0, sizeof(*error));
 
-	if (hdl) {
-		policy = hdl->policy;
-		encode_flags = hdl->encode_flags;
-	}
-
 	/*We add JSON_PRESERVE_ORDER in order to make sure the encoded
 	 *attributes are written in the same order as in nla_stream.
 	 */
@@ -360,24 +950,78 @@ int nljson_encode_nla_cb(nljson_t *hdl,
 		return -EINVAL;
 	}
 
-	obj = parse_nl_attrs((uint8_t *) nla_stream, nla_stream_len,
-			     policy, bytes_consumed, encode_flags);
+	cache = get_cache(hdl);
+	count = encode_begin(&st, hdl, cache, nla_stream_len);
+	if (cache) {
+		struct nljson_cache_entry *entry;
+		size_t output_len;
+
+		entry = nljson_cache_get(cache, nla_stream, nla_stream_len,
+					 json_format_flags);
+		if (entry) {
+			rc = encode_cb(entry->output, entry->output_len,
+				       cb_data);
+			*bytes_consumed = entry->bytes_consumed;
+			output_len = entry->output_len;
+			st.count = entry->count;
+			nljson_cache_put(entry);
+			if (rc) {
+				SET_ERR(error, EINVAL, "JSON dump error");
+				encode_error(&st, NLJSON_STATS_ERR_OUTPUT);
+				return -1;
+			}
+			encode_done(&st, *bytes_consumed, output_len);
+			return 0;
+		}
+	}
+
+	/* The JSON DOM is only needed during this call */
+	mark = nljson_tmp_begin();
+	stats_phase(&st, NULL);
+	obj = encode_nla_json_count(hdl, nla_stream, nla_stream_len,
+				    bytes_consumed, count);
+	stats_phase(&st, &st.delta.parse_ns);
 	if (!obj) {
 		SET_ERR(error, EINVAL, "Parse error");
+		encode_error(&st, NLJSON_STATS_ERR_PARSE);
+		nljson_tmp_end(mark);
 		return -1;
 	}
 
-	rc = json_dump_callback(obj, encode_cb, cb_data,
-				json_format_flags);
+	/* The output is passed through cache_encode_cb if it is needed for
+	 * the cache or the statistics.
+	 */
+	cache_cb_data.collect = (cache != NULL);
+	if (cache || count)
+		rc = json_dump_callback(obj, cache_encode_cb, &cache_cb_data,
+					json_format_flags);
+	else
+		rc = json_dump_callback(obj, encode_cb, cb_data,
+					json_format_flags);
+	stats_phase(&st, &st.delta.dump_ns);
 	if (rc) {
 		SET_ERR(error, EINVAL, "JSON dump error");
+		encode_error(&st, NLJSON_STATS_ERR_OUTPUT);
 		goto err;
 	}
 
 	json_decref(obj);
+	nljson_tmp_end(mark);
+	encode_done(&st, *bytes_consumed, cache_cb_data.bytes_produced);
+
+	if (cache && !cache_cb_data.failed)
+		nljson_cache_insert(cache, nla_stream, nla_stream_len,
+				    json_format_flags, *bytes_consumed, count,
+				    cache_cb_data.output,
+				    cache_cb_data.output_len);
+	if (cache_cb_data.output)
+		nljson_free(cache_cb_data.output);
 	return 0;
 err:
+	if (cache_cb_data.output)
+		nljson_free(cache_cb_data.output);
 	json_decref(obj);
+	nljson_tmp_end(mark);
 	return -1;
 }
 
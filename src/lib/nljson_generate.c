@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+/* Max nesting depth of generated streams */
+#define GEN_MAX_DEPTH (32)
+
+/* Payload lengths of the fixed size data types */
+static const uint16_t data_type_len[NLA_TYPE_MAX + 1] = {
+	[NLA_U8]    = sizeof(uint8_t),
+	[NLA_U16]   = sizeof(uint16_t),
+	[NLA_U32]   = sizeof(uint32_t),
+	[NLA_U64]   = sizeof(uint64_t),
+	[NLA_MSECS] = sizeof(uint64_t),
+};
+
+/* Characters of generated strings (64 so that a random byte can be used
+ * as index)
+ */
+static const char string_chars[64] =
+	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+
+struct gen_ctx {
+	uint64_t state;
+	uint8_t *buf;
+	size_t buf_len;
+	size_t len;
+	uint32_t flags;
+	struct nljson_error *error;
+};
+
+/* xorshift64* */
+static uint64_t gen_rand(struct gen_ctx *ctx)
+{
+	uint64_t x = ctx->state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	ctx->state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t gen_range(struct gen_ctx *ctx, size_t min, size_t max)
+{
+	if (max <= min)
+		return min;
+
+	return min + gen_rand(ctx) % (max - min + 1);
+}
+
+static int gen_reserve(struct gen_ctx *ctx, size_t len)
+{
+	if (ctx->buf_len - ctx->len < len) {
+		SET_ERR(ctx->error, ENOSPC, "nla stream buffer too small");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void gen_bytes(struct gen_ctx *ctx, uint8_t *buf, size_t len)
+{
+	uint64_t r;
+
+	while (len >= sizeof(r)) {
+		r = gen_rand(ctx);
+		memcpy(buf, &r, sizeof(r));
+		buf += sizeof(r);
+		len -= sizeof(r);
+	}
+
+	if (len > 0) {
+		r = gen_rand(ctx);
+		memcpy(buf, &r, len);
+	}
+}
+
+static void gen_string(struct gen_ctx *ctx, uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	gen_bytes(ctx, buf, len);
+	for (i = 0; i < len; i++)
+		buf[i] = string_chars[buf[i] & 63];
+}
+
+/* Payload length of NLA_STRING and NLA_UNSPEC attributes */
+static size_t gen_payload_len(struct gen_ctx *ctx, const struct nla_policy *pt,
+			      size_t min)
+{
+	size_t max;
+
+	if (pt->minlen > min)
+		min = pt->minlen;
+
+	max = pt->maxlen ? pt->maxlen : NLJSON_GEN_DEFAULT_MAXLEN;
+	if (max < min)
+		max = min;
+
+	return gen_range(ctx, min, max);
+}
+
+static int gen_attrs(struct gen_ctx *ctx, struct nljson_nla_policy *policy,
+		     unsigned int depth);
+
+static int gen_attr(struct gen_ctx *ctx, struct nljson_nla_policy *policy,
+		    int type, unsigned int depth)
+{
+	const struct nla_policy *pt = &policy->policy[type];
+	size_t start = ctx->len, len, pad;
+	struct nlattr hdr;
+
+	if (gen_reserve(ctx, NLA_HDR_LEN))
+		return -1;
+	ctx->len += NLA_HDR_LEN;
+
+	switch (pt->type) {
+	case NLA_NESTED:
+	{
+		struct nljson_nla_policy *nested = NULL;
+
+		if (policy->nested && (type <= policy->max_nested_attr_type))
+			nested = policy->nested[type];
+
+		if (nested && (depth < GEN_MAX_DEPTH) &&
+		    gen_attrs(ctx, nested, depth + 1))
+			return -1;
+		break;
+	}
+	case NLA_STRING:
+		len = gen_payload_len(ctx, pt, 1);
+		if (gen_reserve(ctx, len))
+			return -1;
+		gen_string(ctx, ctx->buf + ctx->len, len - 1);
+		ctx->buf[ctx->len + len - 1] = '\0';
+		ctx->len += len;
+		break;
+	case NLA_FLAG:
+		len = pt->minlen;
+		if (gen_reserve(ctx, len))
+			return -1;
+		memset(ctx->buf + ctx->len, 0, len);
+		ctx->len += len;
+		break;
+	default:
+		if ((pt->type <= NLA_TYPE_MAX) && data_type_len[pt->type])
+			len = pt->minlen > data_type_len[pt->type] ?
+			      pt->minlen : data_type_len[pt->type];
+		else
+			len = gen_payload_len(ctx, pt, 0);
+		if (gen_reserve(ctx, len))
+			return -1;
+		gen_bytes(ctx, ctx->buf + ctx->len, len);
+		ctx->len += len;
+		break;
+	}
+
+	len = ctx->len - start;
+	if (len > UINT16_MAX) {
+		SET_ERR(ctx->error, EMSGSIZE, "%s: attribute too long (%zu bytes)",
+			policy->id_to_str_map[type], len);
+		return -1;
+	}
+
+	hdr.nla_len = len;
+	hdr.nla_type = type;
+	memcpy(ctx->buf + start, &hdr, sizeof(hdr));
+
+	pad = NLA_ALIGN(len) - len;
+	if (gen_reserve(ctx, pad))
+		return -1;
+	memset(ctx->buf + ctx->len, 0, pad);
+	ctx->len += pad;
+
+	return 0;
+}
+
+/* Generates the attributes of a policy. At least one attribute is
+ * generated (if the policy has any), since empty messages and nested
+ * attributes are of little use for testing.
+ */
+static int gen_attrs(struct gen_ctx *ctx, struct nljson_nla_policy *policy,
+		     unsigned int depth)
+{
+	nljson_int_t type, first = -1;
+	size_t start = ctx->len;
+
+	for (type = 0; type <= policy->max_attr_type; type++) {
+		if (!policy->id_to_str_map[type])
+			continue;
+
+		if (first < 0)
+			first = type;
+
+		if (!(ctx->flags & NLJSON_GEN_FLAG_ALL_ATTRS) &&
+		    (gen_rand(ctx) & 1))
+			continue;
+
+		if (gen_attr(ctx, policy, type, depth))
+			return -1;
+	}
+
+	if ((ctx->len == start) && (first >= 0))
+		return gen_attr(ctx, policy, first, depth);
+
+	return 0;
+}
+
+int nljson_generate_nla(nljson_t *hdl,
+			uint64_t *seed,
+			void *nla_stream,
+			size_t nla_stream_len,
+			size_t *bytes_produced,
+			uint32_t flags,
+			struct nljson_error *error)
+{
+	struct gen_ctx ctx;
+	int rc;
+
+	memset(error, 0, sizeof(*error));
+	*bytes_produced = 0;
+
+	if (!hdl || !hdl->policy) {
+		SET_ERR(error, EINVAL, "A policy is needed to generate nla streams");
+		return -1;
+	}
+
+	/* xorshift gets stuck at 0 */
+	ctx.state = *seed ? *seed : 0x9e3779b97f4a7c15ULL;
+	ctx.buf = nla_stream;
+	ctx.buf_len = nla_stream_len;
+	ctx.len = 0;
+	ctx.flags = flags;
+	ctx.error = error;
+
+	rc = gen_attrs(&ctx, hdl->policy, 0);
+	if (rc)
+		return -1;
+
+	*seed = ctx.state;
+	*bytes_produced = ctx.len;
+	return 0;
+}
@@ -7,6 +7,7 @@
 #include <netlink/genl/ctrl.h>
 #include <netlink/msg.h>
 #include <netlink/attr.h>
+#include <pthread.h>
 
 #define ARRAY_SIZE(A) (sizeof(A) / sizeof((A)[0]))
 
@@ -44,23 +45,177 @@
 #define POLICY_STR_LEN            (sizeof(POLICY_STR) - 1)
 #define TS_STR                    ("timestamp")
 #define TS_STR_LEN                (sizeof(TS_STR) - 1)
+#define SLOT_STR                  ("$slot")
+#define SLOT_STR_LEN              (sizeof(SLOT_STR) - 1)
+#define DELTA_STR                 ("delta")
+#define DELTA_STR_LEN             (sizeof(DELTA_STR) - 1)
+#define DELTA_KEY_STR             ("stream_key")
+#define DELTA_KEY_STR_LEN         (sizeof(DELTA_KEY_STR) - 1)
+#define DELTA_KEYFRAME_STR        ("keyframe")
+#define DELTA_KEYFRAME_STR_LEN    (sizeof(DELTA_KEYFRAME_STR) - 1)
+#define DELTA_REMOVED_STR         ("removed")
+#define DELTA_REMOVED_STR_LEN     (sizeof(DELTA_REMOVED_STR) - 1)
 
 #define NLA_HDR_LEN 4
 
+struct nljson_profile_level;
+
 struct nljson_nla_policy {
 	struct nla_policy *policy;
 	char **id_to_str_map;
 	struct nljson_nla_policy **nested;
 	nljson_int_t max_attr_type;
 	nljson_int_t max_nested_attr_type;
+	/* Profile counters of the level (NULL unless profiling is enabled) */
+	struct nljson_profile_level *profile;
+};
+
+/* Attributes counted while encoding (for the runtime statistics).
+ * The counts are stored in the cache entries, so that messages taken
+ * from the cache are counted in the same way as encoded ones.
+ */
+struct nljson_encode_count {
+	uint64_t attrs;
+	uint64_t unknown;
+	unsigned int max_depth;
 };
 
+struct nljson_cache_entry {
+	struct nljson_cache_entry *hash_next;
+	/* CLOCK ring of the cache shard */
+	struct nljson_cache_entry *clock_prev;
+	struct nljson_cache_entry *clock_next;
+	uint64_t hash;
+	uint32_t flags;
+	uint32_t refs;
+	/* Set on each hit, cleared by the clock hand */
+	uint32_t referenced;
+	uint8_t *nla;
+	size_t nla_len;
+	char *output;
+	size_t output_len;
+	size_t bytes_consumed;
+	struct nljson_encode_count count;
+};
+
+struct nljson_cache;
+struct nljson_par;
+struct nljson_stats_shards;
+
 struct _nljson {
 	struct nljson_nla_policy *policy;
 	uint32_t encode_flags;
+	struct nljson_cache *cache;
+	struct nljson_par *par;
+	struct nljson_stats_shards *stats;
 };
 
 extern const char *data_type_strings[NLA_TYPE_MAX + 1];
 
+/* Memory allocation. Implemented in nljson_alloc.c
+ * All library allocations must use these functions so that the functions
+ * set with nljson_set_alloc_funcs are used.
+ * nljson_tmp_malloc/calloc are used for temporaries that are freed before
+ * the end of the encode/decode call. They are made from the arena of the
+ * calling thread (if any) when called between nljson_tmp_begin and
+ * nljson_tmp_end. nljson_free handles both kinds of allocations.
+ */
+void *nljson_malloc(size_t size);
+void *nljson_calloc(size_t nmemb, size_t size);
+void *nljson_realloc(void *ptr, size_t old_size, size_t size);
+char *nljson_strdup(const char *str);
+void nljson_free(void *ptr);
+void *nljson_tmp_malloc(size_t size);
+void *nljson_tmp_calloc(size_t nmemb, size_t size);
+size_t nljson_tmp_begin(void);
+void nljson_tmp_end(size_t mark);
+unsigned int nljson_tmp_suspend(void);
+void nljson_tmp_resume(unsigned int scope);
+/* Number of heap allocations made by the calling thread */
+uint64_t nljson_alloc_count(void);
+/* Makes jansson use the nljson allocation functions */
+void nljson_install_json_hooks(void);
+
+/* Decodes a JSON object of attributes into an allocated nla stream.
+ * Implemented in nljson_decode.c
+ */
+int nljson_parse_json_attrs_alloc(json_t *attrs_json, void **nla_stream,
+				  size_t *nla_stream_len);
+
+/* Decodes a JSON object of attributes and passes each attribute to
+ * decode_cb. Implemented in nljson_decode.c
+ */
+int nljson_parse_json_attrs_cb(json_t *attrs_json,
+			       int (*decode_cb)(const void *buf,
+						size_t size,
+						void *data),
+			       void *cb_data);
+
+/* Encodes an nla stream into a JSON object using the policy and flags
+ * of hdl. Implemented in nljson_encode.c
+ */
+json_t *nljson_encode_nla_json(nljson_t *hdl, const void *nla_stream,
+			       size_t nla_stream_len, size_t *bytes_consumed);
+
+/* Encode cache. Implemented in nljson_cache.c
+ * nljson_cache_get returns a referenced entry (or NULL if there is no
+ * matching entry). The reference must be dropped with nljson_cache_put.
+ */
+struct nljson_cache *nljson_cache_create(size_t mem_budget);
+void nljson_cache_destroy(struct nljson_cache *cache);
+struct nljson_cache_entry *nljson_cache_get(struct nljson_cache *cache,
+					    const void *nla_stream,
+					    size_t nla_stream_len,
+					    uint32_t flags);
+void nljson_cache_put(struct nljson_cache_entry *entry);
+void nljson_cache_insert(struct nljson_cache *cache,
+			 const void *nla_stream,
+			 size_t nla_stream_len,
+			 uint32_t flags,
+			 size_t bytes_consumed,
+			 const struct nljson_encode_count *count,
+			 const char *output,
+			 size_t output_len);
+
+/* Encode threads. Implemented in nljson_parallel.c
+ * nljson_par_for runs fn for each index in [0, num_tasks) using the
+ * threads of par (and the calling thread) and returns when all tasks
+ * are done.
+ */
+struct nljson_par *nljson_par_create(unsigned int num_threads,
+				     size_t min_len);
+void nljson_par_destroy(struct nljson_par *par);
+unsigned int nljson_par_num_threads(struct nljson_par *par);
+size_t nljson_par_min_len(struct nljson_par *par);
+void nljson_par_for(struct nljson_par *par, size_t num_tasks,
+		    void (*fn)(size_t index, void *data), void *data);
+
+/* Runtime statistics. Implemented in nljson_stats.c
+ * nljson_stats_add adds delta to the shard of the calling thread.
+ */
+struct nljson_stats_shards *nljson_stats_create(void);
+void nljson_stats_destroy(struct nljson_stats_shards *stats);
+void nljson_stats_add(struct nljson_stats_shards *stats,
+		      const struct nljson_stats *delta);
+uint64_t nljson_stats_now(void);
+
+/* CBOR and MessagePack serialization of the JSON DOM. Implemented in
+ * nljson_binary.c
+ * nljson_bin_dump returns an nljson_malloc'ed buffer (or NULL on error).
+ * nljson_bin_load writes a description of the error to err_msg if it
+ * fails.
+ */
+void *nljson_bin_dump(json_t *obj, enum nljson_bin_format format,
+		      size_t *output_len);
+json_t *nljson_bin_load(const void *input, size_t input_len,
+			enum nljson_bin_format format, size_t *bytes_consumed,
+			char *err_msg, size_t err_msg_len);
+
+/* Policy coverage profiling. Implemented in nljson_profile.c
+ * nljson_profile_hit counts one encoded attribute of type type.
+ */
+void nljson_profile_hit(struct nljson_profile_level *level, int type);
+void nljson_profile_level_free(struct nljson_profile_level *level);
+
 #endif /*_NLJSON_INTERNAL_H_*/
 
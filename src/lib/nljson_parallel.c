@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+/* A set of tasks run by nljson_par_for. Several threads can run
+ * nljson_par_for concurrently on the same nljson_par, in which case the
+ * workers will process the batches in order.
+ */
+struct par_batch {
+	struct par_batch *next;
+	void (*fn)(size_t index, void *data);
+	void *data;
+	size_t num_tasks;
+	size_t next_task;
+	size_t num_done;
+};
+
+struct nljson_par {
+	pthread_mutex_t lock;
+	/* Signaled when a new batch is added (or on stop) */
+	pthread_cond_t work_cond;
+	/* Signaled when a task is done */
+	pthread_cond_t done_cond;
+	struct par_batch *batches;
+	pthread_t *threads;
+	unsigned int num_threads;
+	size_t min_len;
+	bool stop;
+};
+
+/* Returns a batch with unstarted tasks. Must be called with the lock held */
+static struct par_batch *get_batch(struct nljson_par *par)
+{
+	struct par_batch *batch;
+
+	for (batch = par->batches; batch; batch = batch->next) {
+		if (batch->next_task < batch->num_tasks)
+			return batch;
+	}
+
+	return NULL;
+}
+
+/* Runs one task of batch. Must be called with the lock held */
+static void run_task(struct nljson_par *par, struct par_batch *batch)
+{
+	size_t index = batch->next_task++;
+
+	pthread_mutex_unlock(&par->lock);
+	batch->fn(index, batch->data);
+	pthread_mutex_lock(&par->lock);
+
+	if (++batch->num_done == batch->num_tasks)
+		pthread_cond_broadcast(&par->done_cond);
+}
+
+static void *par_worker(void *data)
+{
+	struct nljson_par *par = (struct nljson_par *) data;
+	struct par_batch *batch;
+
+	pthread_mutex_lock(&par->lock);
+	while (!par->stop) {
+		batch = get_batch(par);
+		if (batch)
+			run_task(par, batch);
+		else
+			pthread_cond_wait(&par->work_cond, &par->lock);
+	}
+	pthread_mutex_unlock(&par->lock);
+
+	return NULL;
+}
+
+struct nljson_par *nljson_par_create(unsigned int num_threads,
+				     size_t min_len)
+{
+	struct nljson_par *par;
+	unsigned int i;
+
+	par = nljson_calloc(sizeof(*par), 1);
+	if (!par)
+		return NULL;
+
+	par->min_len = min_len;
+	par->threads = nljson_calloc(sizeof(pthread_t), num_threads);
+	if (!par->threads)
+		goto err_threads;
+
+	if (pthread_mutex_init(&par->lock, NULL))
+		goto err_mutex;
+
+	if (pthread_cond_init(&par->work_cond, NULL))
+		goto err_work_cond;
+
+	if (pthread_cond_init(&par->done_cond, NULL))
+		goto err_done_cond;
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&par->threads[i], NULL, par_worker, par)) {
+			nljson_par_destroy(par);
+			return NULL;
+		}
+		par->num_threads++;
+	}
+
+	return par;
+
+err_done_cond:
+	pthread_cond_destroy(&par->work_cond);
+err_work_cond:
+	pthread_mutex_destroy(&par->lock);
+err_mutex:
+	nljson_free(par->threads);
+err_threads:
+	nljson_free(par);
+	return NULL;
+}
+
+void nljson_par_destroy(struct nljson_par *par)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&par->lock);
+	par->stop = true;
+	pthread_cond_broadcast(&par->work_cond);
+	pthread_mutex_unlock(&par->lock);
+
+	for (i = 0; i < par->num_threads; i++)
+		pthread_join(par->threads[i], NULL);
+
+	pthread_cond_destroy(&par->done_cond);
+	pthread_cond_destroy(&par->work_cond);
+	pthread_mutex_destroy(&par->lock);
+	nljson_free(par->threads);
+	nljson_free(par);
+}
+
+unsigned int nljson_par_num_threads(struct nljson_par *par)
+{
+	return par->num_threads;
+}
+
+size_t nljson_par_min_len(struct nljson_par *par)
+{
+	return par->min_len;
+}
+
+void nljson_par_for(struct nljson_par *par, size_t num_tasks,
+		    void (*fn)(size_t index, void *data), void *data)
+{
+	struct par_batch batch = {
+		.fn = fn,
+		.data = data,
+		.num_tasks = num_tasks,
+	};
+	struct par_batch **iter;
+
+	if (num_tasks == 0)
+		return;
+
+	pthread_mutex_lock(&par->lock);
+
+	iter = &par->batches;
+	while (*iter)
+		iter = &(*iter)->next;
+	*iter = &batch;
+	pthread_cond_broadcast(&par->work_cond);
+
+	/* The calling thread takes part in the work as well */
+	while (batch.next_task < batch.num_tasks)
+		run_task(par, &batch);
+
+	while (batch.num_done < batch.num_tasks)
+		pthread_cond_wait(&par->done_cond, &par->lock);
+
+	for (iter = &par->batches; *iter != &batch; iter = &(*iter)->next)
+		;
+	*iter = batch.next;
+
+	pthread_mutex_unlock(&par->lock);
+}
+
+int nljson_set_encode_threads(nljson_t *hdl,
+			      unsigned int num_threads,
+			      size_t min_len,
+			      struct nljson_error *error)
+{
+	memset(error, 0, sizeof(*error));
+
+	if (!hdl) {
+		SET_ERR(error, EINVAL, "hdl == NULL");
+		return -1;
+	}
+
+	if (hdl->par) {
+		nljson_par_destroy(hdl->par);
+		hdl->par = NULL;
+	}
+
+	if (num_threads == 0)
+		return 0;
+
+	hdl->par = nljson_par_create(num_threads, min_len);
+	if (!hdl->par) {
+		SET_ERR(error, ENOMEM, "Unable to create encode threads");
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#define PATCH_MAX_DEPTH    (32)
+#define PATCH_PATH_SEP     '/'
+#define UNKNOWN_ATTR_STR   ("UNKNOWN_ATTR_")
+#define UNKNOWN_ATTR_STR_LEN (sizeof(UNKNOWN_ATTR_STR) - 1)
+
+struct patch_ctx {
+	uint8_t *buf;
+	size_t stream_len;
+	size_t buf_len;
+	/* Offsets of the headers of all attributes enclosing the level
+	 * currently being patched. These are the headers that must have
+	 * their nla_len adjusted when the size of an attribute changes.
+	 */
+	size_t ancestors[PATCH_MAX_DEPTH];
+	unsigned int depth;
+	struct nljson_error *error;
+};
+
+static int patch_object(struct patch_ctx *ctx, json_t *patch_json,
+			struct nljson_nla_policy *policy);
+
+static struct nlattr *attr_at(struct patch_ctx *ctx, size_t offset)
+{
+	return (struct nlattr *) (ctx->buf + offset);
+}
+
+/* Returns the offset of the first attribute in the current level */
+static size_t level_start(struct patch_ctx *ctx)
+{
+	if (ctx->depth == 0)
+		return 0;
+
+	return ctx->ancestors[ctx->depth - 1] + NLA_HDR_LEN;
+}
+
+/* Returns the offset of the first byte after the current level */
+static size_t level_end(struct patch_ctx *ctx)
+{
+	size_t parent;
+
+	if (ctx->depth == 0)
+		return ctx->stream_len;
+
+	parent = ctx->ancestors[ctx->depth - 1];
+	return parent + attr_at(ctx, parent)->nla_len;
+}
+
+/* Resolves an attribute name into an attribute type.
+ * The name is either one of the names in the policy or on the form
+ * UNKNOWN_ATTR_<attr_type> (the same names the encoder produces).
+ * Returns the attribute type or -1 if the name could not be resolved.
+ */
+static int lookup_attr_type(struct nljson_nla_policy *policy,
+			    const char *name, size_t name_len)
+{
+	nljson_int_t i;
+
+	if (policy) {
+		for (i = 0; i <= policy->max_attr_type; i++) {
+			const char *str = policy->id_to_str_map[i];
+
+			if (str && (strlen(str) == name_len) &&
+			    !strncmp(str, name, name_len))
+				return i;
+		}
+	}
+
+	if ((name_len > UNKNOWN_ATTR_STR_LEN) &&
+	    !strncmp(name, UNKNOWN_ATTR_STR, UNKNOWN_ATTR_STR_LEN)) {
+		int type = 0;
+		size_t j;
+
+		for (j = UNKNOWN_ATTR_STR_LEN; j < name_len; j++) {
+			if ((name[j] < '0') || (name[j] > '9'))
+				return -1;
+			type = type * 10 + (name[j] - '0');
+			/* NLA_TYPE_MASK is ~(flags), i.e. negative as an int */
+			if (type > (NLA_TYPE_MASK & 0xFFFF))
+				return -1;
+		}
+		return type;
+	}
+
+	return -1;
+}
+
+static struct nljson_nla_policy *get_nested_policy(struct nljson_nla_policy *policy,
+						   int type)
+{
+	if (policy && policy->nested && (type <= policy->max_nested_attr_type))
+		return policy->nested[type];
+
+	return NULL;
+}
+
+static int get_data_type(struct nljson_nla_policy *policy, int type)
+{
+	if (policy && (type <= policy->max_attr_type))
+		return policy->policy[type].type;
+
+	return NLA_UNSPEC;
+}
+
+/* Finds the first attribute with nla_type type in the current level.
+ * Returns 0 and sets *offset on success, -1 otherwise.
+ */
+static int find_attr(struct patch_ctx *ctx, int type, size_t *offset)
+{
+	size_t cur, end;
+
+	cur = level_start(ctx);
+	end = level_end(ctx);
+
+	while (cur + NLA_HDR_LEN <= end) {
+		struct nlattr *attr = attr_at(ctx, cur);
+
+		if ((attr->nla_len < NLA_HDR_LEN) || (cur + attr->nla_len > end)) {
+			SET_ERR(ctx->error, EINVAL,
+				"Malformed attribute at offset %zu", cur);
+			return -1;
+		}
+
+		if ((attr->nla_type & NLA_TYPE_MASK) == type) {
+			*offset = cur;
+			return 0;
+		}
+
+		cur += NLA_ALIGN(attr->nla_len);
+	}
+
+	SET_ERR(ctx->error, ENOENT, "Attribute %d not found", type);
+	return -1;
+}
+
+/* Replaces the payload of the attribute at offset with data.
+ * If data is NULL the whole attribute is removed.
+ * Only the bytes following the attribute are moved, and the nla_len
+ * of all enclosing attributes are adjusted with the size difference.
+ */
+static int replace_payload(struct patch_ctx *ctx, size_t offset,
+			   const void *data, size_t data_len)
+{
+	struct nlattr *attr = attr_at(ctx, offset);
+	size_t old_end, new_end;
+	ssize_t delta;
+	unsigned int i;
+
+	old_end = offset + NLA_ALIGN(attr->nla_len);
+	if (old_end > ctx->stream_len)
+		old_end = ctx->stream_len;
+
+	if (data)
+		new_end = offset + NLA_ALIGN(data_len + NLA_HDR_LEN);
+	else
+		new_end = offset;
+
+	if (data && (data_len + NLA_HDR_LEN > 0xFFFF)) {
+		SET_ERR(ctx->error, ERANGE, "Attribute too long");
+		return -1;
+	}
+
+	delta = (ssize_t) new_end - (ssize_t) old_end;
+
+	if ((delta > 0) && (ctx->stream_len + delta > ctx->buf_len)) {
+		SET_ERR(ctx->error, ENOSPC,
+			"nla stream buffer too small (%zu bytes needed)",
+			ctx->stream_len + delta);
+		return -1;
+	}
+
+	for (i = 0; i < ctx->depth; i++) {
+		ssize_t len = attr_at(ctx, ctx->ancestors[i])->nla_len + delta;
+
+		if (len > 0xFFFF) {
+			SET_ERR(ctx->error, ERANGE,
+				"Enclosing attribute too long");
+			return -1;
+		}
+	}
+
+	if (delta)
+		memmove(ctx->buf + new_end, ctx->buf + old_end,
+			ctx->stream_len - old_end);
+
+	if (data) {
+		attr->nla_len = (uint16_t) (data_len + NLA_HDR_LEN);
+		memcpy(ctx->buf + offset + NLA_HDR_LEN, data, data_len);
+		memset(ctx->buf + offset + NLA_HDR_LEN + data_len, 0,
+		       new_end - (offset + NLA_HDR_LEN + data_len));
+	}
+
+	for (i = 0; i < ctx->depth; i++)
+		attr_at(ctx, ctx->ancestors[i])->nla_len += delta;
+
+	ctx->stream_len += delta;
+	return 0;
+}
+
+static int patch_integer(struct patch_ctx *ctx, size_t offset, json_t *value)
+{
+	struct nlattr *attr = attr_at(ctx, offset);
+	nljson_int_t integer;
+	size_t len;
+
+	/* Integers are written in the existing payload, so there is never
+	 * any need to move data.
+	 */
+	len = attr->nla_len - NLA_HDR_LEN;
+	if ((len == 0) || (len > sizeof(integer))) {
+		SET_ERR(ctx->error, EINVAL,
+			"Attribute %d can't hold an integer",
+			attr->nla_type & NLA_TYPE_MASK);
+		return -1;
+	}
+
+	/* The value must fit in the payload, either as a signed or as an
+	 * unsigned integer of len bytes.
+	 */
+	integer = json_integer_value(value);
+	if ((len < sizeof(integer)) &&
+	    ((integer < -((nljson_int_t) 1 << (8 * len - 1))) ||
+	     (integer > ((nljson_int_t) 1 << (8 * len)) - 1))) {
+		SET_ERR(ctx->error, ERANGE,
+			"Value %lld out of range for attribute %d (%zu bytes)",
+			(long long) integer, attr->nla_type & NLA_TYPE_MASK,
+			len);
+		return -1;
+	}
+
+	memcpy(ctx->buf + offset + NLA_HDR_LEN, &integer, len);
+	return 0;
+}
+
+static int patch_array(struct patch_ctx *ctx, size_t offset, json_t *value)
+{
+	size_t index, len = json_array_size(value);
+	uint8_t *data;
+	json_t *elem;
+	int rc = -1;
+
+	if (len > 0xFFFF - NLA_HDR_LEN) {
+		SET_ERR(ctx->error, ERANGE, "Array too long");
+		return -1;
+	}
+
+	/* +1 since the array can be empty */
+	data = nljson_tmp_malloc(len + 1);
+	if (!data) {
+		SET_ERR(ctx->error, ENOMEM, "Out of memory");
+		return -1;
+	}
+
+	json_array_foreach(value, index, elem) {
+		nljson_int_t val;
+
+		/* Same rules as for NLA_UNSPEC arrays in the decoder */
+		if (!json_is_integer(elem)) {
+			SET_ERR(ctx->error, EINVAL, "Array element not an integer");
+			goto out;
+		}
+
+		val = json_integer_value(elem);
+		if ((val < 0) || (val > 255)) {
+			SET_ERR(ctx->error, EINVAL, "Array element out of range");
+			goto out;
+		}
+		data[index] = (uint8_t) val;
+	}
+
+	rc = replace_payload(ctx, offset, data, len);
+out:
+	nljson_free(data);
+	return rc;
+}
+
+/* Applies value to the attribute at offset.
+ * policy is the policy of the level the attribute belongs to.
+ */
+static int patch_value(struct patch_ctx *ctx, size_t offset,
+		       struct nljson_nla_policy *policy, json_t *value)
+{
+	int rc, type = attr_at(ctx, offset)->nla_type & NLA_TYPE_MASK;
+
+	if (json_is_integer(value))
+		return patch_integer(ctx, offset, value);
+	else if (json_is_string(value))
+		/* Strings are written without a terminating NULL character,
+		 * in the same way as the decoder does it.
+		 */
+		return replace_payload(ctx, offset, json_string_value(value),
+				       strlen(json_string_value(value)));
+	else if (json_is_array(value))
+		return patch_array(ctx, offset, value);
+	else if (json_is_null(value))
+		return replace_payload(ctx, offset, NULL, 0);
+	else if (!json_is_object(value))
+		goto err;
+
+	if ((get_data_type(policy, type) != NLA_NESTED) &&
+	    (get_data_type(policy, type) != NLA_UNSPEC))
+		goto err;
+
+	if (ctx->depth >= PATCH_MAX_DEPTH) {
+		SET_ERR(ctx->error, ERANGE, "Max nesting depth exceeded");
+		return -1;
+	}
+
+	ctx->ancestors[ctx->depth++] = offset;
+	rc = patch_object(ctx, value, get_nested_policy(policy, type));
+	ctx->depth--;
+	return rc;
+err:
+	SET_ERR(ctx->error, EINVAL, "Bad value type for attribute %d", type);
+	return -1;
+}
+
+/* Patches the current level with all keys in patch_json.
+ * A key can either be a single attribute name or a path of attribute
+ * names separated with '/'.
+ */
+static int patch_object(struct patch_ctx *ctx, json_t *patch_json,
+			struct nljson_nla_policy *policy)
+{
+	const char *key;
+	json_t *value;
+
+	json_object_foreach(patch_json, key, value) {
+		struct nljson_nla_policy *cur_policy = policy;
+		unsigned int saved_depth = ctx->depth;
+		const char *name = key;
+		size_t offset;
+		int rc, type;
+
+		for (;;) {
+			const char *sep = strchr(name, PATCH_PATH_SEP);
+			size_t name_len = sep ? (size_t) (sep - name) : strlen(name);
+
+			type = lookup_attr_type(cur_policy, name, name_len);
+			if (type < 0) {
+				SET_ERR(ctx->error, ENOENT,
+					"Unknown attribute: %s", key);
+				goto err;
+			}
+
+			if (find_attr(ctx, type, &offset))
+				goto err;
+
+			if (!sep)
+				break;
+
+			/* Descend into the nested attribute */
+			if (ctx->depth >= PATCH_MAX_DEPTH) {
+				SET_ERR(ctx->error, ERANGE,
+					"Max nesting depth exceeded");
+				goto err;
+			}
+			ctx->ancestors[ctx->depth++] = offset;
+			cur_policy = get_nested_policy(cur_policy, type);
+			name = sep + 1;
+		}
+
+		rc = patch_value(ctx, offset, cur_policy, value);
+		ctx->depth = saved_depth;
+		if (rc)
+			return -1;
+		continue;
+err:
+		ctx->depth = saved_depth;
+		return -1;
+	}
+
+	return 0;
+}
+
+int nljson_patch_nla(nljson_t *hdl,
+		     void *nla_stream,
+		     size_t nla_stream_len,
+		     size_t nla_stream_buf_len,
+		     const char *patch,
+		     size_t *bytes_produced,
+		     uint32_t json_decode_flags,
+		     struct nljson_error *error)
+{
+	json_t *obj;
+	json_error_t json_error;
+	struct patch_ctx ctx = {
+		.buf = nla_stream,
+		.stream_len = nla_stream_len,
+		.buf_len = nla_stream_buf_len,
+		.error = error,
+	};
+
+	memset(error, 0, sizeof(*error));
+
+	if (nla_stream_len > nla_stream_buf_len) {
+		SET_ERR(error, EINVAL, "nla_stream_len > nla_stream_buf_len");
+		return -1;
+	}
+
+	obj = json_loads(patch, json_decode_flags, &json_error);
+	if (!obj) {
+		SET_ERR(error, EINVAL,
+			"JSON error line %d, column %d, offset %u: %s",
+			json_error.line, json_error.column,
+			json_error.position, json_error.text);
+		return -1;
+	}
+
+	if (!json_is_object(obj)) {
+		SET_ERR(error, EINVAL, "Patch must be a JSON object");
+		goto err;
+	}
+
+	if (patch_object(&ctx, obj, hdl ? hdl->policy : NULL))
+		goto err;
+
+	json_decref(obj);
+	*bytes_produced = ctx.stream_len;
+	return 0;
+err:
+	json_decref(obj);
+	*bytes_produced = 0;
+	return -1;
+}
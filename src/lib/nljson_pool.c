@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define POOL_NUM_BUCKETS  (256)
+#define POOL_MIN_BUF_SIZE (1024)
+
+enum pool_job_type {
+	POOL_JOB_ENCODE,
+	POOL_JOB_DECODE
+};
+
+struct pool_stream;
+
+struct pool_job {
+	struct pool_job *next;
+	enum pool_job_type type;
+	nljson_t *hdl;
+	const void *input;
+	size_t input_len;
+	uint32_t flags;
+	struct pool_stream *stream;
+	uint64_t seq;
+	nljson_completion_cb_t cb;
+	uint8_t *output;
+	size_t output_size;
+	bool failed;
+	struct nljson_completion completion;
+};
+
+/* Jobs belonging to the same submission stream are delivered in the same
+ * order as they were submitted.
+ */
+struct pool_stream {
+	struct pool_stream *next;
+	struct pool_stream *ready_next;
+	uint64_t id;
+	/* Sequence number of the next submitted job */
+	uint64_t next_seq;
+	/* Sequence number of the next job to deliver */
+	uint64_t next_deliver;
+	/* Completed jobs, sorted by sequence number */
+	struct pool_job *done;
+	bool ready;
+};
+
+struct _nljson_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Submitted jobs waiting for a worker */
+	struct pool_job *queue_head;
+	struct pool_job *queue_tail;
+	struct pool_stream *streams[POOL_NUM_BUCKETS];
+	/* Streams with deliverable completions */
+	struct pool_stream *ready_head;
+	struct pool_stream *ready_tail;
+	pthread_t *threads;
+	unsigned int num_threads;
+	size_t scratch_size;
+	bool stop;
+	int efd;
+};
+
+static int job_append(struct pool_job *job, const void *data, size_t size)
+{
+	size_t len = job->completion.output_len;
+
+	if (job->failed)
+		return -1;
+
+	if (len + size > job->output_size) {
+		size_t new_size = job->output_size ? job->output_size :
+						     POOL_MIN_BUF_SIZE;
+		uint8_t *tmp;
+
+		while (new_size < len + size)
+			new_size *= 2;
+
+		tmp = nljson_realloc(job->output, len, new_size);
+		if (!tmp) {
+			job->failed = true;
+			return -1;
+		}
+		job->output = tmp;
+		job->output_size = new_size;
+	}
+
+	memcpy(job->output + len, data, size);
+	job->completion.output_len += size;
+	return 0;
+}
+
+static int job_encode_cb(const char *buf, size_t size, void *data)
+{
+	return job_append((struct pool_job *) data, buf, size);
+}
+
+static int job_decode_cb(const void *buf, size_t size, void *data)
+{
+	return job_append((struct pool_job *) data, buf, size);
+}
+
+static void run_job(struct pool_job *job)
+{
+	struct nljson_completion *completion = &job->completion;
+	int rc;
+
+	if (job->type == POOL_JOB_ENCODE) {
+		rc = nljson_encode_nla_cb(job->hdl, job->input, job->input_len,
+					  &completion->bytes_consumed,
+					  job_encode_cb, job, job->flags,
+					  &completion->error);
+		/* NUL terminate the output */
+		if (!rc && job_append(job, "", 1) == 0)
+			completion->output_len--;
+	} else {
+		rc = nljson_decode_nla_cb(job->input,
+					  &completion->bytes_consumed,
+					  job_decode_cb, job, job->flags,
+					  &completion->error);
+	}
+
+	if (!rc && job->failed) {
+		SET_ERR(&completion->error, ENOMEM,
+			"Unable to allocate output buffer");
+		rc = -1;
+	}
+
+	completion->status = rc ? -1 : 0;
+	completion->output = job->output;
+}
+
+/* Must be called with the lock held */
+static void stream_add_done(nljson_pool_t *pool, struct pool_job *job)
+{
+	struct pool_stream *stream = job->stream;
+	struct pool_job **iter = &stream->done;
+
+	while (*iter && ((*iter)->seq < job->seq))
+		iter = &(*iter)->next;
+
+	job->next = *iter;
+	*iter = job;
+
+	if (!stream->ready && (stream->done->seq == stream->next_deliver)) {
+		stream->ready = true;
+		stream->ready_next = NULL;
+		if (pool->ready_tail)
+			pool->ready_tail->ready_next = stream;
+		else
+			pool->ready_head = stream;
+		pool->ready_tail = stream;
+	}
+}
+
+static void *worker(void *data)
+{
+	nljson_pool_t *pool = (nljson_pool_t *) data;
+	nljson_arena_t *arena = NULL;
+	struct nljson_error error;
+	uint64_t val = 1;
+
+	if (pool->scratch_size &&
+	    !nljson_arena_init(&arena, pool->scratch_size, &error))
+		nljson_arena_use(arena);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		struct pool_job *job;
+		ssize_t rc;
+
+		while (!pool->queue_head && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+
+		job = pool->queue_head;
+		if (!job)
+			break;
+
+		pool->queue_head = job->next;
+		if (!pool->queue_head)
+			pool->queue_tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_job(job);
+
+		pthread_mutex_lock(&pool->lock);
+		stream_add_done(pool, job);
+
+		rc = write(pool->efd, &val, sizeof(val));
+		(void) rc;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	nljson_arena_use(NULL);
+	nljson_arena_deinit(&arena);
+	return NULL;
+}
+
+static struct pool_stream *get_stream(nljson_pool_t *pool, uint64_t id)
+{
+	struct pool_stream **bucket, *stream;
+
+	bucket = &pool->streams[id % POOL_NUM_BUCKETS];
+	for (stream = *bucket; stream; stream = stream->next) {
+		if (stream->id == id)
+			return stream;
+	}
+
+	stream = nljson_calloc(sizeof(*stream), 1);
+	if (!stream)
+		return NULL;
+
+	stream->id = id;
+	stream->next = *bucket;
+	*bucket = stream;
+	return stream;
+}
+
+static void remove_stream(nljson_pool_t *pool, struct pool_stream *stream)
+{
+	struct pool_stream **iter;
+
+	iter = &pool->streams[stream->id % POOL_NUM_BUCKETS];
+	while (*iter) {
+		if (*iter == stream) {
+			*iter = stream->next;
+			break;
+		}
+		iter = &(*iter)->next;
+	}
+
+	nljson_free(stream);
+}
+
+static void free_job(struct pool_job *job)
+{
+	if (job->output)
+		nljson_free(job->output);
+	nljson_free(job);
+}
+
+static int submit(nljson_pool_t *pool, struct pool_job *job,
+		  uint64_t stream_id, struct nljson_error *error)
+{
+	pthread_mutex_lock(&pool->lock);
+
+	job->stream = get_stream(pool, stream_id);
+	if (!job->stream) {
+		pthread_mutex_unlock(&pool->lock);
+		SET_ERR(error, ENOMEM, "Unable to allocate stream");
+		nljson_free(job);
+		return -1;
+	}
+	job->seq = job->stream->next_seq++;
+
+	if (pool->queue_tail)
+		pool->queue_tail->next = job;
+	else
+		pool->queue_head = job;
+	pool->queue_tail = job;
+
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+static struct pool_job *alloc_job(nljson_completion_cb_t cb, void *user_data,
+				  uint64_t stream_id,
+				  struct nljson_error *error)
+{
+	struct pool_job *job;
+
+	if (!cb) {
+		SET_ERR(error, EINVAL, "cb == NULL");
+		return NULL;
+	}
+
+	job = nljson_calloc(sizeof(*job), 1);
+	if (!job) {
+		SET_ERR(error, ENOMEM, "Unable to allocate job");
+		return NULL;
+	}
+
+	job->cb = cb;
+	job->completion.stream_id = stream_id;
+	job->completion.user_data = user_data;
+	return job;
+}
+
+int nljson_pool_init(nljson_pool_t **pool,
+		     unsigned int num_threads,
+		     size_t scratch_size,
+		     struct nljson_error *error)
+{
+	unsigned int i;
+
+	memset(error, 0, sizeof(*error));
+
+	if (num_threads == 0) {
+		SET_ERR(error, EINVAL, "num_threads == 0");
+		return -1;
+	}
+
+	*pool = nljson_calloc(sizeof(nljson_pool_t), 1);
+	if (!*pool) {
+		SET_ERR(error, ENOMEM, "Unable to allocate pool");
+		return -1;
+	}
+
+	(*pool)->scratch_size = scratch_size;
+	(*pool)->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((*pool)->efd < 0) {
+		SET_ERR(error, errno, "Unable to create eventfd");
+		goto err_efd;
+	}
+
+	(*pool)->threads = nljson_calloc(sizeof(pthread_t), num_threads);
+	if (!(*pool)->threads) {
+		SET_ERR(error, ENOMEM, "Unable to allocate threads");
+		goto err_threads;
+	}
+
+	if (pthread_mutex_init(&(*pool)->lock, NULL)) {
+		SET_ERR(error, ENOMEM, "Unable to create mutex");
+		goto err_mutex;
+	}
+
+	if (pthread_cond_init(&(*pool)->cond, NULL)) {
+		SET_ERR(error, ENOMEM, "Unable to create condition variable");
+		goto err_cond;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&(*pool)->threads[i], NULL, worker, *pool)) {
+			SET_ERR(error, EAGAIN, "Unable to create worker thread");
+			break;
+		}
+		(*pool)->num_threads++;
+	}
+
+	if ((*pool)->num_threads < num_threads) {
+		nljson_pool_deinit(pool);
+		return -1;
+	}
+
+	return 0;
+
+err_cond:
+	pthread_mutex_destroy(&(*pool)->lock);
+err_mutex:
+	nljson_free((*pool)->threads);
+err_threads:
+	close((*pool)->efd);
+err_efd:
+	nljson_free(*pool);
+	*pool = NULL;
+	return -1;
+}
+
+void nljson_pool_deinit(nljson_pool_t **pool)
+{
+	unsigned int i;
+
+	if (!pool || !*pool)
+		return;
+
+	/* Let the workers finish all queued jobs */
+	pthread_mutex_lock(&(*pool)->lock);
+	(*pool)->stop = true;
+	pthread_cond_broadcast(&(*pool)->cond);
+	pthread_mutex_unlock(&(*pool)->lock);
+
+	for (i = 0; i < (*pool)->num_threads; i++)
+		pthread_join((*pool)->threads[i], NULL);
+
+	/* Drop all undelivered completions */
+	for (i = 0; i < POOL_NUM_BUCKETS; i++) {
+		struct pool_stream *stream = (*pool)->streams[i];
+
+		while (stream) {
+			struct pool_stream *tmp = stream;
+
+			while (stream->done) {
+				struct pool_job *job = stream->done;
+
+				stream->done = job->next;
+				free_job(job);
+			}
+			stream = stream->next;
+			nljson_free(tmp);
+		}
+	}
+
+	pthread_cond_destroy(&(*pool)->cond);
+	pthread_mutex_destroy(&(*pool)->lock);
+	close((*pool)->efd);
+	nljson_free((*pool)->threads);
+	nljson_free(*pool);
+	*pool = NULL;
+}
+
+int nljson_pool_fd(nljson_pool_t *pool)
+{
+	return pool->efd;
+}
+
+int nljson_submit_encode(nljson_pool_t *pool,
+			 nljson_t *hdl,
+			 uint64_t stream_id,
+			 const void *nla_stream,
+			 size_t nla_stream_len,
+			 uint32_t json_format_flags,
+			 nljson_completion_cb_t cb,
+			 void *user_data,
+			 struct nljson_error *error)
+{
+	struct pool_job *job;
+
+	memset(error, 0, sizeof(*error));
+
+	job = alloc_job(cb, user_data, stream_id, error);
+	if (!job)
+		return -1;
+
+	job->type = POOL_JOB_ENCODE;
+	job->hdl = hdl;
+	job->input = nla_stream;
+	job->input_len = nla_stream_len;
+	job->flags = json_format_flags;
+
+	return submit(pool, job, stream_id, error);
+}
+
+int nljson_submit_decode(nljson_pool_t *pool,
+			 uint64_t stream_id,
+			 const char *input,
+			 uint32_t json_decode_flags,
+			 nljson_completion_cb_t cb,
+			 void *user_data,
+			 struct nljson_error *error)
+{
+	struct pool_job *job;
+
+	memset(error, 0, sizeof(*error));
+
+	job = alloc_job(cb, user_data, stream_id, error);
+	if (!job)
+		return -1;
+
+	job->type = POOL_JOB_DECODE;
+	job->input = input;
+	job->flags = json_decode_flags;
+
+	return submit(pool, job, stream_id, error);
+}
+
+int nljson_pool_process_completions(nljson_pool_t *pool)
+{
+	struct pool_stream *stream;
+	uint64_t val;
+	ssize_t rc;
+	int num = 0;
+
+	/* Clear the eventfd before looking at the ready list so that no
+	 * notification is lost.
+	 */
+	rc = read(pool->efd, &val, sizeof(val));
+	(void) rc;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while ((stream = pool->ready_head)) {
+		pool->ready_head = stream->ready_next;
+		if (!pool->ready_head)
+			pool->ready_tail = NULL;
+		stream->ready = false;
+
+		while (stream->done &&
+		       (stream->done->seq == stream->next_deliver)) {
+			struct pool_job *job = stream->done;
+
+			stream->done = job->next;
+			stream->next_deliver++;
+
+			/* The callback may submit new jobs */
+			pthread_mutex_unlock(&pool->lock);
+			job->cb(&job->completion);
+			free_job(job);
+			num++;
+			pthread_mutex_lock(&pool->lock);
+		}
+
+		/* Remove streams without any outstanding jobs, unless the
+		 * stream has been added to the ready list again while the
+		 * lock was released.
+		 */
+		if (!stream->ready && (stream->next_deliver == stream->next_seq))
+			remove_stream(pool, stream);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return num;
+}
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+/* Number of slots in the per level table of unknown attribute types above
+ * the max attribute type of the level. Must be a power of two.
+ */
+#define UNKNOWN_SLOTS (64)
+#define EMPTY_SLOT (UINT32_MAX)
+/* Max length of a level path (longer paths are truncated) */
+#define PATH_LEN (512)
+
+struct unknown_slot {
+	uint32_t type;
+	uint64_t hits;
+};
+
+struct nljson_profile_level {
+	/* Hits of the types 0..max_attr_type of the level */
+	uint64_t *hits;
+	size_t num_types;
+	/* Hits of the types above max_attr_type. A slot is claimed (with
+	 * a compare and swap of type) the first time a type is seen.
+	 */
+	struct unknown_slot unknown[UNKNOWN_SLOTS];
+	/* Hits of the unknown types that did not get a slot */
+	uint64_t other;
+};
+
+void nljson_profile_hit(struct nljson_profile_level *level, int type)
+{
+	uint32_t empty, slot;
+	unsigned int i;
+
+	if ((size_t) type < level->num_types) {
+		__atomic_fetch_add(&level->hits[type], 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	slot = ((uint32_t) type * 2654435761U) & (UNKNOWN_SLOTS - 1);
+	for (i = 0; i < UNKNOWN_SLOTS; i++) {
+		struct unknown_slot *u = &level->unknown[slot];
+		uint32_t cur = __atomic_load_n(&u->type, __ATOMIC_ACQUIRE);
+
+		if (cur == EMPTY_SLOT) {
+			empty = EMPTY_SLOT;
+			if (__atomic_compare_exchange_n(&u->type, &empty,
+							(uint32_t) type, false,
+							__ATOMIC_ACQ_REL,
+							__ATOMIC_ACQUIRE))
+				cur = (uint32_t) type;
+			else
+				cur = empty;
+		}
+
+		if (cur == (uint32_t) type) {
+			__atomic_fetch_add(&u->hits, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		slot = (slot + 1) & (UNKNOWN_SLOTS - 1);
+	}
+
+	__atomic_fetch_add(&level->other, 1, __ATOMIC_RELAXED);
+}
+
+void nljson_profile_level_free(struct nljson_profile_level *level)
+{
+	nljson_free(level->hits);
+	nljson_free(level);
+}
+
+static struct nljson_profile_level *level_create(size_t num_types)
+{
+	struct nljson_profile_level *level;
+	unsigned int i;
+
+	level = nljson_calloc(1, sizeof(*level));
+	if (!level)
+		return NULL;
+
+	level->hits = nljson_calloc(num_types, sizeof(*level->hits));
+	if (!level->hits) {
+		nljson_free(level);
+		return NULL;
+	}
+
+	level->num_types = num_types;
+	for (i = 0; i < UNKNOWN_SLOTS; i++)
+		level->unknown[i].type = EMPTY_SLOT;
+
+	return level;
+}
+
+static void disable_profile(struct nljson_nla_policy *policy)
+{
+	nljson_int_t i;
+
+	if (policy->profile) {
+		nljson_profile_level_free(policy->profile);
+		policy->profile = NULL;
+	}
+
+	for (i = 0; policy->nested && (i <= policy->max_nested_attr_type); i++) {
+		if (policy->nested[i])
+			disable_profile(policy->nested[i]);
+	}
+}
+
+static int enable_profile(struct nljson_nla_policy *policy)
+{
+	nljson_int_t i;
+
+	policy->profile = level_create(policy->max_attr_type + 1);
+	if (!policy->profile)
+		return -1;
+
+	for (i = 0; policy->nested && (i <= policy->max_nested_attr_type); i++) {
+		if (policy->nested[i] && enable_profile(policy->nested[i]))
+			return -1;
+	}
+
+	return 0;
+}
+
+int nljson_enable_profile(nljson_t *hdl,
+			  int enable,
+			  struct nljson_error *error)
+{
+	memset(error, 0, sizeof(*error));
+
+	if (!hdl) {
+		SET_ERR(error, EINVAL, "hdl == NULL");
+		return -1;
+	}
+
+	if (!hdl->policy) {
+		SET_ERR(error, EINVAL, "The handle has no policy");
+		return -1;
+	}
+
+	disable_profile(hdl->policy);
+	if (!enable)
+		return 0;
+
+	if (enable_profile(hdl->policy)) {
+		disable_profile(hdl->policy);
+		SET_ERR(error, ENOMEM, "Unable to allocate profile counters");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int report(struct nljson_profile_entry *entry, uint32_t type,
+		  const char *name, int data_type, uint64_t hits,
+		  int (*profile_cb)(const struct nljson_profile_entry *entry,
+				    void *data),
+		  void *cb_data)
+{
+	entry->nla_type = type;
+	entry->name = name;
+	entry->data_type = data_type_strings[data_type];
+	entry->hits = hits;
+	return profile_cb(entry, cb_data);
+}
+
+/* Reports the entries of policy and its nested policies. path holds the
+ * path of the level (path_len bytes).
+ */
+static int report_level(struct nljson_nla_policy *policy, char *path,
+			size_t path_len,
+			int (*profile_cb)(const struct nljson_profile_entry *entry,
+					  void *data),
+			void *cb_data)
+{
+	struct nljson_profile_level *level = policy->profile;
+	struct nljson_profile_entry entry;
+	nljson_int_t i;
+	uint64_t hits;
+
+	entry.level = path_len ? path : "/";
+
+	for (i = 0; i <= policy->max_attr_type; i++) {
+		const char *name = policy->id_to_str_map ?
+				   policy->id_to_str_map[i] : NULL;
+
+		hits = __atomic_load_n(&level->hits[i], __ATOMIC_RELAXED);
+		if (!name && !hits)
+			continue;
+
+		if (report(&entry, i, name,
+			   name ? policy->policy[i].type : NLA_UNSPEC, hits,
+			   profile_cb, cb_data))
+			return -1;
+	}
+
+	for (i = 0; i < UNKNOWN_SLOTS; i++) {
+		uint32_t type = __atomic_load_n(&level->unknown[i].type,
+						__ATOMIC_ACQUIRE);
+
+		hits = __atomic_load_n(&level->unknown[i].hits,
+				       __ATOMIC_RELAXED);
+		if ((type == EMPTY_SLOT) || !hits)
+			continue;
+
+		if (report(&entry, type, NULL, NLA_UNSPEC, hits, profile_cb,
+			   cb_data))
+			return -1;
+	}
+
+	hits = __atomic_load_n(&level->other, __ATOMIC_RELAXED);
+	if (hits && report(&entry, NLJSON_PROFILE_OTHER_TYPE, NULL,
+			   NLA_UNSPEC, hits, profile_cb, cb_data))
+		return -1;
+
+	for (i = 0; policy->nested && (i <= policy->max_nested_attr_type); i++) {
+		const char *name = NULL;
+		int len;
+
+		if (!policy->nested[i])
+			continue;
+
+		if (policy->id_to_str_map && (i <= policy->max_attr_type))
+			name = policy->id_to_str_map[i];
+
+		if (name)
+			len = snprintf(path + path_len, PATH_LEN - path_len,
+				       "/%s", name);
+		else
+			len = snprintf(path + path_len, PATH_LEN - path_len,
+				       "/%d", (int) i);
+		if (len < 0)
+			len = 0;
+		if ((size_t) len >= PATH_LEN - path_len)
+			len = PATH_LEN - path_len - 1;
+
+		if (report_level(policy->nested[i], path, path_len + len,
+				 profile_cb, cb_data))
+			return -1;
+		path[path_len] = '\0';
+	}
+
+	return 0;
+}
+
+int nljson_get_profile(nljson_t *hdl,
+		       int (*profile_cb)(const struct nljson_profile_entry *entry,
+					 void *data),
+		       void *cb_data)
+{
+	char path[PATH_LEN];
+
+	if (!hdl || !hdl->policy || !hdl->policy->profile)
+		return -1;
+
+	path[0] = '\0';
+	return report_level(hdl->policy, path, 0, profile_cb, cb_data);
+}
+
+static void reset_level(struct nljson_nla_policy *policy)
+{
+	struct nljson_profile_level *level = policy->profile;
+	nljson_int_t i;
+	size_t j;
+
+	for (j = 0; j < level->num_types; j++)
+		__atomic_store_n(&level->hits[j], 0, __ATOMIC_RELAXED);
+	for (j = 0; j < UNKNOWN_SLOTS; j++)
+		__atomic_store_n(&level->unknown[j].hits, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&level->other, 0, __ATOMIC_RELAXED);
+
+	for (i = 0; policy->nested && (i <= policy->max_nested_attr_type); i++) {
+		if (policy->nested[i])
+			reset_level(policy->nested[i]);
+	}
+}
+
+void nljson_reset_profile(nljson_t *hdl)
+{
+	if (!hdl || !hdl->policy || !hdl->policy->profile)
+		return;
+
+	reset_level(hdl->policy);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <time.h>
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#define RECORD_PAD(len) \
+	(((len) + NLJSON_RECORD_ALIGN - 1) & ~((size_t) NLJSON_RECORD_ALIGN - 1))
+
+size_t nljson_record_len(size_t nla_stream_len)
+{
+	return sizeof(struct nljson_record_hdr) + RECORD_PAD(nla_stream_len);
+}
+
+int nljson_record_hdr_init(struct nljson_record_hdr *hdr,
+			   size_t nla_stream_len,
+			   uint16_t family,
+			   uint8_t cmd,
+			   struct nljson_error *error)
+{
+	struct timespec ts;
+
+	memset(error, 0, sizeof(*error));
+
+	if (nla_stream_len > UINT32_MAX) {
+		SET_ERR(error, EINVAL, "nla stream too long (%zu bytes)",
+			nla_stream_len);
+		return -1;
+	}
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = NLJSON_RECORD_MAGIC;
+	hdr->len = nla_stream_len;
+	if (family || cmd) {
+		hdr->family = family;
+		hdr->cmd = cmd;
+		hdr->flags |= NLJSON_RECORD_FLAG_GENL;
+	}
+
+	if (!clock_gettime(CLOCK_REALTIME, &ts))
+		hdr->timestamp = (uint64_t) ts.tv_sec * 1000000000ULL +
+				 ts.tv_nsec;
+
+	return 0;
+}
+
+int nljson_record_next(const void *buf,
+		       size_t buf_len,
+		       struct nljson_record_hdr *hdr,
+		       const void **nla_stream,
+		       size_t *bytes_consumed,
+		       struct nljson_error *error)
+{
+	size_t record_len;
+
+	memset(error, 0, sizeof(*error));
+	*bytes_consumed = 0;
+
+	if (buf_len < sizeof(*hdr))
+		return 0;
+
+	memcpy(hdr, buf, sizeof(*hdr));
+	if (hdr->magic != NLJSON_RECORD_MAGIC) {
+		SET_ERR(error, EINVAL, "Bad record magic 0x%08x", hdr->magic);
+		return -1;
+	}
+
+	record_len = nljson_record_len(hdr->len);
+	if (record_len > buf_len)
+		return 0;
+
+	*nla_stream = (const uint8_t *) buf + sizeof(*hdr);
+	*bytes_consumed = record_len;
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "nljson.h"
+#include "nljson_internal.h"
+#include <time.h>
+
+#define CACHE_LINE (64)
+/* Number of counter shards per handle. Threads are assigned to the shards
+ * round robin, so with more threads than shards, some shards are shared
+ * (the counters are atomic, so this is only slower).
+ */
+#define STATS_SHARDS (16)
+
+#define NUM_COUNTERS (sizeof(struct nljson_stats) / sizeof(uint64_t))
+
+struct stats_shard {
+	uint64_t counters[NUM_COUNTERS];
+} __attribute__((aligned(CACHE_LINE)));
+
+struct nljson_stats_shards {
+	/* The allocated memory. shards is aligned to a cache line */
+	void *mem;
+	struct stats_shard *shards;
+};
+
+/* The shard index of the calling thread (0 means not yet assigned) */
+static __thread unsigned int thread_shard;
+static unsigned int next_shard;
+
+static unsigned int get_shard(void)
+{
+	if (!thread_shard)
+		thread_shard = (__atomic_fetch_add(&next_shard, 1,
+						   __ATOMIC_RELAXED) %
+				STATS_SHARDS) + 1;
+
+	return thread_shard - 1;
+}
+
+uint64_t nljson_stats_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct nljson_stats_shards *nljson_stats_create(void)
+{
+	struct nljson_stats_shards *stats;
+	size_t size = STATS_SHARDS * sizeof(struct stats_shard);
+
+	stats = nljson_calloc(1, sizeof(*stats));
+	if (!stats)
+		return NULL;
+
+	stats->mem = nljson_calloc(1, size + CACHE_LINE);
+	if (!stats->mem) {
+		nljson_free(stats);
+		return NULL;
+	}
+
+	stats->shards = (struct stats_shard *)
+		(((uintptr_t) stats->mem + CACHE_LINE - 1) &
+		 ~((uintptr_t) CACHE_LINE - 1));
+	return stats;
+}
+
+void nljson_stats_destroy(struct nljson_stats_shards *stats)
+{
+	nljson_free(stats->mem);
+	nljson_free(stats);
+}
+
+void nljson_stats_add(struct nljson_stats_shards *stats,
+		      const struct nljson_stats *delta)
+{
+	struct stats_shard *shard = &stats->shards[get_shard()];
+	const uint64_t *src = (const uint64_t *) delta;
+	size_t i;
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (src[i])
+			__atomic_fetch_add(&shard->counters[i], src[i],
+					   __ATOMIC_RELAXED);
+	}
+}
+
+int nljson_enable_stats(nljson_t *hdl,
+			int enable,
+			struct nljson_error *error)
+{
+	memset(error, 0, sizeof(*error));
+
+	if (!hdl) {
+		SET_ERR(error, EINVAL, "hdl == NULL");
+		return -1;
+	}
+
+	if (hdl->stats) {
+		nljson_stats_destroy(hdl->stats);
+		hdl->stats = NULL;
+	}
+
+	if (!enable)
+		return 0;
+
+	hdl->stats = nljson_stats_create();
+	if (!hdl->stats) {
+		SET_ERR(error, ENOMEM, "Unable to allocate statistics");
+		return -1;
+	}
+
+	/* The JSON objects must be allocated with the nljson allocation
+	 * functions in order to be counted.
+	 */
+	nljson_install_json_hooks();
+	return 0;
+}
+
+int nljson_get_stats(nljson_t *hdl, struct nljson_stats *stats)
+{
+	uint64_t *dst = (uint64_t *) stats;
+	unsigned int shard;
+	size_t i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!hdl || !hdl->stats)
+		return -1;
+
+	for (shard = 0; shard < STATS_SHARDS; shard++) {
+		const uint64_t *src = hdl->stats->shards[shard].counters;
+
+		for (i = 0; i < NUM_COUNTERS; i++)
+			dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+void nljson_reset_stats(nljson_t *hdl)
+{
+	unsigned int shard;
+	size_t i;
+
+	if (!hdl || !hdl->stats)
+		return;
+
+	for (shard = 0; shard < STATS_SHARDS; shard++) {
+		uint64_t *counters = hdl->stats->shards[shard].counters;
+
+		for (i = 0; i < NUM_COUNTERS; i++)
+			__atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+/* A location in the nla stream where a slot value is stored */
+struct template_store {
+	size_t offset;
+	size_t len;
+	size_t slot;
+};
+
+struct _nljson_template {
+	uint8_t *nla_stream;
+	size_t nla_stream_len;
+	char **slot_names;
+	size_t num_slots;
+	struct template_store *stores;
+	size_t num_stores;
+};
+
+static const char *get_slot_name(json_t *attr_json)
+{
+	json_t *slot_json;
+
+	slot_json = json_object_get(attr_json, SLOT_STR);
+	if (!slot_json || !json_is_string(slot_json))
+		return NULL;
+
+	return json_string_value(slot_json);
+}
+
+/* First pass: counts all slot attributes and adds a default value to the
+ * slots that don't have any, so that the JSON object can be decoded by
+ * the decoder.
+ */
+static int prepare_slots(json_t *attrs_json, size_t *num_stores,
+			 struct nljson_error *error)
+{
+	const char *key;
+	json_t *value;
+
+	json_object_foreach(attrs_json, key, value) {
+		json_t *data_type_json, *nested_json;
+		const char *data_type_str;
+
+		if (!json_is_object(value))
+			continue;
+
+		data_type_json = json_object_get(value, DATA_TYPE_STR);
+		if (!data_type_json || !json_is_string(data_type_json))
+			continue;
+		data_type_str = json_string_value(data_type_json);
+
+		if (!strcmp(data_type_str, data_type_strings[NLA_NESTED])) {
+			nested_json = json_object_get(value, VALUE_STR);
+			if (nested_json && json_is_object(nested_json) &&
+			    prepare_slots(nested_json, num_stores, error))
+				return -1;
+			continue;
+		}
+
+		if (!get_slot_name(value))
+			continue;
+
+		/* Only fixed size integers can be used as slots since
+		 * the layout of the stream must not change when filling
+		 * the template.
+		 */
+		if (strcmp(data_type_str, data_type_strings[NLA_U8]) &&
+		    strcmp(data_type_str, data_type_strings[NLA_U16]) &&
+		    strcmp(data_type_str, data_type_strings[NLA_U32]) &&
+		    strcmp(data_type_str, data_type_strings[NLA_U64])) {
+			SET_ERR(error, EINVAL,
+				"Slot attribute %s is not an integer", key);
+			return -1;
+		}
+
+		if (!json_object_get(value, VALUE_STR))
+			json_object_set_new(value, VALUE_STR, json_integer(0));
+
+		(*num_stores)++;
+	}
+
+	return 0;
+}
+
+static int find_or_add_slot(nljson_template_t *tmpl, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < tmpl->num_slots; i++) {
+		if (!strcmp(tmpl->slot_names[i], name))
+			return i;
+	}
+
+	tmpl->slot_names[i] = nljson_strdup(name);
+	if (!tmpl->slot_names[i])
+		return -1;
+
+	tmpl->num_slots++;
+	return i;
+}
+
+/* Second pass: walks the JSON object and the decoded nla stream in
+ * parallel and records the location of each slot.
+ * The attributes in the stream have the same order as in the JSON object
+ * (see create_attr_list in nljson_decode.c).
+ */
+static int locate_slots(nljson_template_t *tmpl, json_t *attrs_json,
+			size_t offset, size_t len)
+{
+	const char *key;
+	json_t *value;
+	size_t cur = offset;
+
+	json_object_foreach(attrs_json, key, value) {
+		struct nlattr *attr;
+		json_t *nested_json;
+		const char *slot_name;
+
+		if (cur + NLA_HDR_LEN > offset + len)
+			return -1;
+
+		attr = (struct nlattr *) (tmpl->nla_stream + cur);
+
+		slot_name = get_slot_name(value);
+		nested_json = json_object_get(value, VALUE_STR);
+
+		if (nested_json && json_is_object(nested_json)) {
+			if (locate_slots(tmpl, nested_json, cur + NLA_HDR_LEN,
+					 attr->nla_len - NLA_HDR_LEN))
+				return -1;
+		} else if (slot_name) {
+			struct template_store *store;
+			int slot;
+
+			slot = find_or_add_slot(tmpl, slot_name);
+			if (slot < 0)
+				return -1;
+
+			store = &tmpl->stores[tmpl->num_stores++];
+			store->offset = cur + NLA_HDR_LEN;
+			store->len = attr->nla_len - NLA_HDR_LEN;
+			store->slot = slot;
+		}
+
+		cur += NLA_ALIGN(attr->nla_len);
+	}
+
+	return 0;
+}
+
+void nljson_template_free(nljson_template_t **tmpl)
+{
+	size_t i;
+
+	if (!tmpl || !*tmpl)
+		return;
+
+	if ((*tmpl)->slot_names) {
+		for (i = 0; i < (*tmpl)->num_slots; i++)
+			nljson_free((*tmpl)->slot_names[i]);
+		nljson_free((*tmpl)->slot_names);
+	}
+
+	if ((*tmpl)->stores)
+		nljson_free((*tmpl)->stores);
+
+	if ((*tmpl)->nla_stream)
+		nljson_free((*tmpl)->nla_stream);
+
+	nljson_free(*tmpl);
+	*tmpl = NULL;
+}
+
+int nljson_prepare(nljson_template_t **tmpl,
+		   const char *input,
+		   size_t *bytes_consumed,
+		   uint32_t json_decode_flags,
+		   struct nljson_error *error)
+{
+	int rc;
+	json_t *obj = NULL;
+	json_error_t json_error;
+	size_t num_stores = 0;
+	void *nla_stream;
+
+	memset(error, 0, sizeof(*error));
+
+	*tmpl = nljson_calloc(sizeof(nljson_template_t), 1);
+	if (!*tmpl) {
+		SET_ERR(error, ENOMEM, "Unable to allocate template");
+		return -1;
+	}
+
+	/*We must have JSON_DISABLE_EOF_CHECK set in order to handle
+	 *the case where not all bytes in input are consumed
+	 */
+	json_decode_flags |= JSON_DISABLE_EOF_CHECK;
+	obj = json_loads(input, json_decode_flags, &json_error);
+	if (!obj) {
+		SET_ERR(error, EINVAL,
+			"JSON error line %d, column %d, offset %u: %s",
+			json_error.line, json_error.column,
+			json_error.position, json_error.text);
+		goto err;
+	}
+
+	if (prepare_slots(obj, &num_stores, error))
+		goto err;
+
+	rc = nljson_parse_json_attrs_alloc(obj, &nla_stream,
+					   &(*tmpl)->nla_stream_len);
+	if (rc) {
+		SET_ERR(error, EINVAL, "Parse error");
+		goto err;
+	}
+	(*tmpl)->nla_stream = nla_stream;
+
+	if (num_stores > 0) {
+		(*tmpl)->stores = nljson_calloc(sizeof(struct template_store),
+					 num_stores);
+		(*tmpl)->slot_names = nljson_calloc(sizeof(char *), num_stores);
+		if (!(*tmpl)->stores || !(*tmpl)->slot_names) {
+			SET_ERR(error, ENOMEM, "Unable to allocate slots");
+			goto err;
+		}
+	}
+
+	if (locate_slots(*tmpl, obj, 0, (*tmpl)->nla_stream_len)) {
+		SET_ERR(error, EINVAL, "Unable to locate slots");
+		goto err;
+	}
+
+	json_decref(obj);
+	*bytes_consumed = json_error.position;
+	return 0;
+err:
+	if (obj)
+		json_decref(obj);
+	nljson_template_free(tmpl);
+	*bytes_consumed = 0;
+	return -1;
+}
+
+size_t nljson_template_num_slots(const nljson_template_t *tmpl)
+{
+	return tmpl->num_slots;
+}
+
+int nljson_template_slot_index(const nljson_template_t *tmpl,
+			       const char *slot_name)
+{
+	size_t i;
+
+	for (i = 0; i < tmpl->num_slots; i++) {
+		if (!strcmp(tmpl->slot_names[i], slot_name))
+			return i;
+	}
+
+	return -1;
+}
+
+size_t nljson_template_len(const nljson_template_t *tmpl)
+{
+	return tmpl->nla_stream_len;
+}
+
+int nljson_template_fill(const nljson_template_t *tmpl,
+			 const int64_t *values,
+			 size_t num_values,
+			 void *nla_stream,
+			 size_t nla_stream_buf_len,
+			 size_t *bytes_produced,
+			 struct nljson_error *error)
+{
+	size_t i;
+	uint8_t *out = nla_stream;
+
+	memset(error, 0, sizeof(*error));
+
+	if (num_values < tmpl->num_slots) {
+		SET_ERR(error, EINVAL, "Too few values (%zu < %zu)",
+			num_values, tmpl->num_slots);
+		return -1;
+	}
+
+	if (tmpl->nla_stream_len > nla_stream_buf_len) {
+		SET_ERR(error, ENOSPC, "nla stream buffer too small");
+		return -1;
+	}
+
+	memcpy(out, tmpl->nla_stream, tmpl->nla_stream_len);
+
+	/* The values are stored in the same way as the decoder stores
+	 * integers, i.e. the first len bytes of the value in host byte
+	 * order.
+	 */
+	for (i = 0; i < tmpl->num_stores; i++) {
+		const struct template_store *store = &tmpl->stores[i];
+
+		memcpy(out + store->offset, &values[store->slot], store->len);
+	}
+
+	*bytes_produced = tmpl->nla_stream_len;
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _NLJSON_TRACE_H_
+#define _NLJSON_TRACE_H_
+
+/*
+ * USDT (user level statically defined tracing) probes.
+ *
+ * If the library is built with NLJSON_USE_USDT, the probes are added with
+ * the macros of sys/sdt.h. A probe is a single nop instruction (plus a
+ * note in the ELF file describing the location and the arguments), so the
+ * cost is negligible when nobody is tracing. Tools like bpftrace and perf
+ * attach to the probes at runtime, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libnljson.so:nljson:encode__return
+ *                { @bytes = hist(arg3); }'
+ *
+ * All probes are in the nljson provider:
+ *
+ *   init__entry(nljson_flags)
+ *   init__return(rc, hdl)
+ *   encode__entry(hdl, nla_stream_len)
+ *   encode__return(hdl, rc, bytes_consumed, bytes_produced)
+ *   encode__attr(nla_type, data_type, nla_len, depth)
+ *   decode__entry(input, input_len)
+ *   decode__return(rc, bytes_consumed, bytes_produced)
+ *   decode__attr(nla_type, data_type, nla_len, depth)
+ *
+ * depth is 1 for top level attributes. input_len is 0 if the input is a
+ * NUL terminated string.
+ *
+ * Without sys/sdt.h the macros expand to nothing.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define NLJSON_TRACE1(name, a) \
+	DTRACE_PROBE1(nljson, name, a)
+#define NLJSON_TRACE2(name, a, b) \
+	DTRACE_PROBE2(nljson, name, a, b)
+#define NLJSON_TRACE3(name, a, b, c) \
+	DTRACE_PROBE3(nljson, name, a, b, c)
+#define NLJSON_TRACE4(name, a, b, c, d) \
+	DTRACE_PROBE4(nljson, name, a, b, c, d)
+#else
+#define NLJSON_TRACE1(name, a) do { } while (0)
+#define NLJSON_TRACE2(name, a, b) do { } while (0)
+#define NLJSON_TRACE3(name, a, b, c) do { } while (0)
+#define NLJSON_TRACE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /*_NLJSON_TRACE_H_*/
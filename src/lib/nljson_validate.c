@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "nljson.h"
+#include "nljson_internal.h"
+
+#define VALIDATE_MAX_DEPTH (32)
+#define VALIDATE_PATH_LEN  (128)
+
+/* An element of the attribute path. The names are only looked up when
+ * a violation is reported.
+ */
+struct path_elem {
+	struct nljson_nla_policy *policy;
+	int type;
+};
+
+struct validate_ctx {
+	const uint8_t *buf;
+	size_t depth;
+	/* Path of the current attribute, e.g. "ATTR_1/ATTR_2" */
+	struct path_elem path[VALIDATE_MAX_DEPTH];
+	size_t path_depth;
+	struct nljson_error *error;
+	size_t *error_offset;
+};
+
+/* Minimum payload lengths of the data types (same as libnl) */
+static const uint16_t data_type_minlen[NLA_TYPE_MAX + 1] = {
+	[NLA_U8]     = sizeof(uint8_t),
+	[NLA_U16]    = sizeof(uint16_t),
+	[NLA_U32]    = sizeof(uint32_t),
+	[NLA_U64]    = sizeof(uint64_t),
+	[NLA_STRING] = 1,
+	[NLA_MSECS]  = sizeof(uint64_t),
+};
+
+/* Writes the attribute names of the current path into buf */
+static void format_path(struct validate_ctx *ctx, char *buf, size_t size)
+{
+	size_t i, len = 0;
+	int rc;
+
+	buf[0] = '\0';
+	for (i = 0; (i < ctx->path_depth) && (len < size - 1); i++) {
+		struct nljson_nla_policy *policy = ctx->path[i].policy;
+		int type = ctx->path[i].type;
+
+		if (policy && (type <= policy->max_attr_type) &&
+		    policy->id_to_str_map[type])
+			rc = snprintf(buf + len, size - len, "%s%s",
+				      i ? "/" : "",
+				      policy->id_to_str_map[type]);
+		else
+			rc = snprintf(buf + len, size - len,
+				      "%sUNKNOWN_ATTR_%d", i ? "/" : "", type);
+		if (rc < 0)
+			break;
+
+		len += rc;
+	}
+}
+
+static int violation(struct validate_ctx *ctx, const uint8_t *pos,
+		     const char *what)
+{
+	size_t offset = pos - ctx->buf;
+	char path[VALIDATE_PATH_LEN];
+
+	format_path(ctx, path, sizeof(path));
+	SET_ERR(ctx->error, EINVAL, "%s: %s (offset %zu)",
+		ctx->path_depth ? path : "<top>", what, offset);
+	if (ctx->error_offset)
+		*ctx->error_offset = offset;
+	return -1;
+}
+
+static int validate_attrs(struct validate_ctx *ctx, const uint8_t *buf,
+			  size_t len, struct nljson_nla_policy *policy);
+
+static int validate_attr(struct validate_ctx *ctx, const struct nlattr *attr,
+			 struct nljson_nla_policy *policy)
+{
+	const uint8_t *data = (const uint8_t *) attr + NLA_HDR_LEN;
+	size_t len = attr->nla_len - NLA_HDR_LEN;
+	int type = attr->nla_type & NLA_TYPE_MASK;
+	const struct nla_policy *pt;
+	size_t minlen;
+	char msg[64];
+
+	if (!policy || (type > policy->max_attr_type))
+		return 0;
+
+	pt = &policy->policy[type];
+	if (pt->type > NLA_TYPE_MAX)
+		return 0;
+
+	minlen = pt->minlen ? pt->minlen : data_type_minlen[pt->type];
+	if (len < minlen) {
+		snprintf(msg, sizeof(msg), "length %zu < minimum length %zu",
+			 len, minlen);
+		return violation(ctx, (const uint8_t *) attr, msg);
+	}
+
+	if (pt->maxlen && (len > pt->maxlen)) {
+		snprintf(msg, sizeof(msg), "length %zu > maxlen %u",
+			 len, pt->maxlen);
+		return violation(ctx, (const uint8_t *) attr, msg);
+	}
+
+	if ((pt->type == NLA_STRING) && (data[len - 1] != '\0'))
+		return violation(ctx, (const uint8_t *) attr,
+				 "string is not NUL terminated");
+
+	if (pt->type == NLA_NESTED) {
+		struct nljson_nla_policy *nested = NULL;
+
+		if (ctx->depth >= VALIDATE_MAX_DEPTH)
+			return violation(ctx, (const uint8_t *) attr,
+					 "too deeply nested");
+
+		if (policy->nested && (type <= policy->max_nested_attr_type))
+			nested = policy->nested[type];
+
+		return validate_attrs(ctx, data, len, nested);
+	}
+
+	return 0;
+}
+
+/* Validates all attributes in buf. The attribute headers are always
+ * checked, the payloads only if there is a policy for the attribute.
+ */
+static int validate_attrs(struct validate_ctx *ctx, const uint8_t *buf,
+			  size_t len, struct nljson_nla_policy *policy)
+{
+	size_t offset = 0;
+
+	ctx->depth++;
+
+	while (len - offset >= NLA_HDR_LEN) {
+		const struct nlattr *attr =
+			(const struct nlattr *) (buf + offset);
+		int rc;
+
+		ctx->path[ctx->depth - 1].policy = policy;
+		ctx->path[ctx->depth - 1].type = attr->nla_type & NLA_TYPE_MASK;
+		ctx->path_depth = ctx->depth;
+
+		if ((attr->nla_len < NLA_HDR_LEN) ||
+		    (attr->nla_len > len - offset))
+			return violation(ctx, buf + offset,
+					 "invalid attribute length");
+
+		rc = validate_attr(ctx, attr, policy);
+		if (rc)
+			return rc;
+
+		offset += NLA_ALIGN(attr->nla_len);
+		if (offset > len)
+			offset = len;
+	}
+
+	if (offset != len) {
+		ctx->path_depth = ctx->depth - 1;
+		return violation(ctx, buf + offset, "trailing bytes");
+	}
+
+	ctx->depth--;
+	return 0;
+}
+
+int nljson_validate_nla(nljson_t *hdl,
+			const void *nla_stream,
+			size_t nla_stream_len,
+			size_t *error_offset,
+			struct nljson_error *error)
+{
+	struct validate_ctx ctx;
+
+	memset(error, 0, sizeof(*error));
+
+	ctx.buf = nla_stream;
+	ctx.depth = 0;
+	ctx.path_depth = 0;
+	ctx.error = error;
+	ctx.error_offset = error_offset;
+
+	return validate_attrs(&ctx, nla_stream, nla_stream_len,
+			      hdl ? hdl->policy : NULL);
+}
@@ -0,0 +1,557 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <nljson.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <nljson_tools_config.h>
+
+#include "nljson_io.h"
+
+#define FILE_NAME_LEN (256)
+#define NSEC_PER_SEC (1000000000ULL)
+/* Max length of the start of the JSON object of a record */
+#define PREFIX_LEN (128)
+#define SUFFIX "}\n"
+#define SUFFIX_LEN (sizeof(SUFFIX) - 1)
+
+enum archive_mode {
+	MODE_QUERY,
+	MODE_CREATE,
+	MODE_LIST,
+};
+
+static char *archive_file, *policy_file, *input_file, *output_file;
+static enum archive_mode mode = MODE_QUERY;
+static uint32_t json_format_flags;
+static uint32_t nljson_flags;
+static size_t block_size;
+static bool no_compress, framed;
+static struct nljson_archive_query query = {
+	.start = 0,
+	.end = UINT64_MAX,
+};
+
+/* State of a query (passed to the record callback) */
+struct query_output {
+	nljson_t *hdl;
+	nljson_ctx_t *ctx;
+	struct io_output *out;
+	uint64_t records;
+	uint64_t errors;
+	bool write_error;
+};
+
+static void print_usage(const char *argv0)
+{
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "%s -A ARCHIVE OPTIONS\n", argv0);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "nljson-archive creates and queries archives of framed records (see\n");
+	fprintf(stderr, "nljson_archive_create). The records are stored in compressed blocks\n");
+	fprintf(stderr, "with an index of the time range and the (family, cmd) pairs of each\n");
+	fprintf(stderr, "block, so a query only decodes the blocks it needs.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "By default, the records matching the query options are encoded into\n");
+	fprintf(stderr, "JSON objects (one per line) and written to stdout or a file.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -A, --archive FILE The archive file.\n");
+	fprintf(stderr, "  --create           Create the archive from a stream of framed records\n");
+	fprintf(stderr, "                     (e.g. nljson-decoder --framed output) read from\n");
+	fprintf(stderr, "                     stdin or the input file.\n");
+	fprintf(stderr, "  --list             Write a summary of the archive and the index entry\n");
+	fprintf(stderr, "                     of each block as JSON (one object per line).\n");
+	fprintf(stderr, "  -i, --input        Framed record input file (--create).\n");
+	fprintf(stderr, "  -o, --output       Output file. If omitted, the output is written\n");
+	fprintf(stderr, "                     to stdout.\n");
+	fprintf(stderr, "  --block-size N     Size of the uncompressed blocks (--create, default\n");
+	fprintf(stderr, "                     %d).\n", NLJSON_ARCHIVE_DEFAULT_BLOCK_SIZE);
+	fprintf(stderr, "  --no-compress      Don't compress the blocks (--create).\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Query options:\n");
+	fprintf(stderr, "  --start TIME       Only records at or after TIME (seconds since the\n");
+	fprintf(stderr, "                     epoch, e.g. 1700000000.5).\n");
+	fprintf(stderr, "  --end TIME         Only records before TIME.\n");
+	fprintf(stderr, "  --family ID        Only generic netlink records of family ID.\n");
+	fprintf(stderr, "  --cmd N            Only generic netlink records with command N.\n");
+	fprintf(stderr, "  -p, --policy       netlink attribute policy file in JSON format.\n");
+	fprintf(stderr, "  -f, --flags        format flags for the JSON encoded output.\n");
+	fprintf(stderr, "                     See jansson library documentation for more details.\n");
+	fprintf(stderr, "  -s, --skip-unknown Skip all unknown attributes (attributes not present in\n");
+	fprintf(stderr, "                     the policy file).\n");
+	fprintf(stderr, "  --framed           Write the matching records as framed records instead\n");
+	fprintf(stderr, "                     of JSON (e.g. for nljson-encoder --framed).\n");
+	fprintf(stderr, "  --version          Print version info and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+static void print_version(void)
+{
+#if GIT_SHA_AVAILABLE
+	fprintf(stderr, "\n%s-%s\n\n", VERSION, GIT_SHA);
+#else
+	fprintf(stderr, "\n%s-\n\n", VERSION);
+#endif
+}
+
+/* Parses SECONDS[.FRACTION] into nanoseconds since the epoch */
+static int parse_time(const char *str, uint64_t *ns)
+{
+	unsigned long long sec;
+	uint64_t frac = 0, scale = NSEC_PER_SEC;
+	char *tmp;
+
+	if ((*str < '0') || (*str > '9'))
+		return -1;
+
+	errno = 0;
+	sec = strtoull(str, &tmp, 10);
+	if (errno || (sec > UINT64_MAX / NSEC_PER_SEC - 1))
+		return -1;
+
+	if (*tmp == '.') {
+		for (tmp++; (*tmp >= '0') && (*tmp <= '9'); tmp++) {
+			/* Digits below a nanosecond are ignored */
+			if (scale < 10)
+				continue;
+			scale /= 10;
+			frac += (*tmp - '0') * scale;
+		}
+	}
+
+	if (*tmp != '\0')
+		return -1;
+
+	*ns = sec * NSEC_PER_SEC + frac;
+	return 0;
+}
+
+static int write_ts(FILE *f, const char *name, uint64_t ns)
+{
+	return fprintf(f, "\"%s\": %llu.%09llu", name,
+		       (unsigned long long) (ns / NSEC_PER_SEC),
+		       (unsigned long long) (ns % NSEC_PER_SEC));
+}
+
+static void do_create(void)
+{
+	nljson_archive_t *archive = NULL;
+	struct nljson_error error;
+	struct io_input in;
+	bool in_open = false;
+	uint64_t records = 0;
+
+	if (io_input_open(&in, input_file, IO_DEFAULT_BUF_SIZE)) {
+		fprintf(stderr, "Unable to open input: %s\n", strerror(errno));
+		goto out;
+	}
+	in_open = true;
+
+	if (nljson_archive_create(&archive, archive_file, block_size,
+				  no_compress ? 0 : NLJSON_ARCHIVE_FLAG_COMPRESS,
+				  &error)) {
+		fprintf(stderr, "Archive error: %s\n", error.err_msg);
+		goto out;
+	}
+
+	for (;;) {
+		struct nljson_record_hdr hdr;
+		const void *nla_stream;
+		size_t consumed;
+
+		if (nljson_record_next(io_input_data(&in), io_input_len(&in),
+				       &hdr, &nla_stream, &consumed,
+				       &error)) {
+			fprintf(stderr, "Record error: %s\n", error.err_msg);
+			break;
+		}
+
+		if (!consumed) {
+			if (in.eof) {
+				if (io_input_len(&in))
+					fprintf(stderr, "Truncated record at end of input\n");
+				break;
+			}
+			if (io_input_fill(&in) < 0) {
+				fprintf(stderr, "Error: Unable to read input\n");
+				break;
+			}
+			continue;
+		}
+
+		if (nljson_archive_append(archive, &hdr, nla_stream,
+					  &error)) {
+			fprintf(stderr, "Archive error: %s\n", error.err_msg);
+			break;
+		}
+		io_input_consume(&in, consumed);
+		records++;
+	}
+
+	fprintf(stderr, "{\"records\": %llu}\n", (unsigned long long) records);
+out:
+	if (archive && nljson_archive_close(&archive, &error))
+		fprintf(stderr, "Archive error: %s\n", error.err_msg);
+	if (in_open)
+		io_input_close(&in);
+}
+
+static void do_list(void)
+{
+	nljson_archive_t *archive = NULL;
+	struct nljson_archive_info info;
+	struct nljson_error error;
+	FILE *f = stdout;
+	uint32_t i, k;
+
+	if (nljson_archive_open(&archive, archive_file, &error)) {
+		fprintf(stderr, "Archive error: %s\n", error.err_msg);
+		return;
+	}
+
+	if (output_file) {
+		f = fopen(output_file, "w");
+		if (!f) {
+			fprintf(stderr, "Unable to open output: %s\n",
+				strerror(errno));
+			goto out;
+		}
+	}
+
+	nljson_archive_get_info(archive, &info);
+	fprintf(f, "{\"records\": %llu, \"blocks\": %u, ",
+		(unsigned long long) info.num_records, info.num_blocks);
+	write_ts(f, "min_ts", info.min_timestamp);
+	fprintf(f, ", ");
+	write_ts(f, "max_ts", info.max_timestamp);
+	fprintf(f, ", \"raw_bytes\": %llu, \"stored_bytes\": %llu, \"recovered\": %s}\n",
+		(unsigned long long) info.raw_bytes,
+		(unsigned long long) info.stored_bytes,
+		(info.flags & NLJSON_ARCHIVE_INFO_RECOVERED) ?
+		"true" : "false");
+
+	for (i = 0; i < info.num_blocks; i++) {
+		struct nljson_archive_block block;
+
+		if (nljson_archive_get_block(archive, i, &block))
+			break;
+
+		fprintf(f, "{\"offset\": %llu, \"records\": %u, ",
+			(unsigned long long) block.offset, block.num_records);
+		write_ts(f, "min_ts", block.min_timestamp);
+		fprintf(f, ", ");
+		write_ts(f, "max_ts", block.max_timestamp);
+		fprintf(f, ", \"raw_len\": %u, \"stored_len\": %u, \"keys\": [",
+			block.raw_len, block.stored_len);
+		for (k = 0; k < block.num_keys; k++) {
+			const struct nljson_archive_key *key = &block.keys[k];
+
+			fprintf(f, "%s{", k ? ", " : "");
+			if (key->flags & NLJSON_RECORD_FLAG_GENL)
+				fprintf(f, "\"nlmsg_type\": %u, \"genl_cmd\": %u, ",
+					key->family, key->cmd);
+			fprintf(f, "\"count\": %u}", key->count);
+		}
+		fprintf(f, "]}\n");
+	}
+
+	if ((f != stdout) ? fclose(f) : fflush(f))
+		fprintf(stderr, "Error: Unable to write output\n");
+out:
+	nljson_archive_close(&archive, &error);
+}
+
+static int write_record(struct io_output *out,
+			const struct nljson_record_hdr *hdr,
+			const void *nla_stream)
+{
+	static const uint8_t pad[NLJSON_RECORD_ALIGN];
+	size_t record_len = nljson_record_len(hdr->len);
+
+	if (io_output_write(out, hdr, sizeof(*hdr)) ||
+	    io_output_write(out, nla_stream, hdr->len) ||
+	    io_output_write(out, pad, record_len - sizeof(*hdr) - hdr->len))
+		return -1;
+
+	return 0;
+}
+
+static int query_record(const struct nljson_record_hdr *hdr,
+			const void *nla_stream, void *data)
+{
+	struct query_output *qo = (struct query_output *) data;
+	struct nljson_error error;
+	char prefix[PREFIX_LEN];
+	const char *out_buf;
+	size_t consumed, produced;
+	int prefix_len;
+
+	if (framed) {
+		if (write_record(qo->out, hdr, nla_stream)) {
+			qo->write_error = true;
+			return 1;
+		}
+		qo->records++;
+		return 0;
+	}
+
+	if (hdr->flags & NLJSON_RECORD_FLAG_GENL)
+		prefix_len = snprintf(prefix, sizeof(prefix),
+				      "{\"ts\": %llu.%09llu, \"nlmsg_type\": %u, \"genl_cmd\": %u, \"attrs\": ",
+				      (unsigned long long) (hdr->timestamp / NSEC_PER_SEC),
+				      (unsigned long long) (hdr->timestamp % NSEC_PER_SEC),
+				      hdr->family, hdr->cmd);
+	else
+		prefix_len = snprintf(prefix, sizeof(prefix),
+				      "{\"ts\": %llu.%09llu, \"attrs\": ",
+				      (unsigned long long) (hdr->timestamp / NSEC_PER_SEC),
+				      (unsigned long long) (hdr->timestamp % NSEC_PER_SEC));
+
+	if (nljson_encode_nla_ctx(qo->hdl, qo->ctx, nla_stream, hdr->len,
+				  &out_buf, &consumed, &produced,
+				  json_format_flags, &error)) {
+		fprintf(stderr, "Encoding error: %s\n", error.err_msg);
+		qo->errors++;
+		return 0;
+	}
+
+	if (io_output_write(qo->out, prefix, prefix_len) ||
+	    io_output_write(qo->out, out_buf, produced) ||
+	    io_output_write(qo->out, SUFFIX, SUFFIX_LEN)) {
+		qo->write_error = true;
+		return 1;
+	}
+
+	qo->records++;
+	return 0;
+}
+
+static void do_query(void)
+{
+	nljson_archive_t *archive = NULL;
+	struct nljson_archive_info info;
+	struct query_output qo;
+	struct nljson_error error;
+	struct io_output out;
+	bool out_open = false;
+	int rc = 0;
+
+	memset(&qo, 0, sizeof(qo));
+
+	if (policy_file || nljson_flags)
+		rc = nljson_init_file(&qo.hdl, 0, nljson_flags,
+				      policy_file, &error);
+
+	if (rc || nljson_ctx_init(&qo.ctx, 0, &error)) {
+		fprintf(stderr, "Init error: %s\n", error.err_msg);
+		goto out;
+	}
+
+	if (nljson_archive_open(&archive, archive_file, &error)) {
+		fprintf(stderr, "Archive error: %s\n", error.err_msg);
+		goto out;
+	}
+
+	if (io_output_open(&out, output_file, IO_DEFAULT_BUF_SIZE)) {
+		fprintf(stderr, "Unable to open output: %s\n", strerror(errno));
+		goto out;
+	}
+	out_open = true;
+	qo.out = &out;
+
+	if (nljson_archive_query(archive, &query, query_record, &qo, &error))
+		fprintf(stderr, "Archive error: %s\n", error.err_msg);
+	if (qo.write_error)
+		fprintf(stderr, "Error: Unable to write output\n");
+
+	nljson_archive_get_info(archive, &info);
+	fprintf(stderr, "{\"records\": %llu, \"errors\": %llu, \"blocks\": %u, \"blocks_read\": %llu}\n",
+		(unsigned long long) qo.records,
+		(unsigned long long) qo.errors, info.num_blocks,
+		(unsigned long long) info.blocks_read);
+out:
+	if (out_open && io_output_close(&out))
+		fprintf(stderr, "Error: Unable to write output\n");
+	if (archive)
+		nljson_archive_close(&archive, &error);
+	if (qo.ctx)
+		nljson_ctx_deinit(&qo.ctx);
+	if (qo.hdl)
+		nljson_deinit(&qo.hdl);
+}
+
+static char *alloc_file_name(const char *name)
+{
+	char *tmp = calloc(FILE_NAME_LEN, 1);
+
+	if (!tmp) {
+		fprintf(stderr, "calloc returned NULL!\n");
+		return NULL;
+	}
+	strncpy(tmp, name, FILE_NAME_LEN - 1);
+	return tmp;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, optind = 0;
+	unsigned long val;
+	char *tmp;
+	struct option long_opts[] = {
+		{"help", no_argument, 0, 'h'},
+		{"archive", required_argument, 0, 'A'},
+		{"policy", required_argument, 0, 'p'},
+		{"flags", required_argument, 0, 'f'},
+		{"input", required_argument, 0, 'i'},
+		{"output", required_argument, 0, 'o'},
+		{"skip-unknown", no_argument, 0, 's'},
+		{"version", no_argument, 0, 1000},
+		{"create", no_argument, 0, 1001},
+		{"list", no_argument, 0, 1002},
+		{"block-size", required_argument, 0, 1003},
+		{"no-compress", no_argument, 0, 1004},
+		{"start", required_argument, 0, 1005},
+		{"end", required_argument, 0, 1006},
+		{"family", required_argument, 0, 1007},
+		{"cmd", required_argument, 0, 1008},
+		{"framed", no_argument, 0, 1009},
+		{NULL, 0, 0, 0},
+	};
+
+	while ((opt = getopt_long(argc, argv, "hA:p:f:i:o:s", long_opts, &optind)) != -1) {
+		switch (opt) {
+		case 'A':
+			archive_file = alloc_file_name(optarg);
+			if (!archive_file)
+				return -1;
+			break;
+		case 'p':
+			policy_file = alloc_file_name(optarg);
+			if (!policy_file)
+				return -1;
+			break;
+		case 'f':
+			json_format_flags = strtoul(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad JSON format flags: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 'i':
+			input_file = alloc_file_name(optarg);
+			if (!input_file)
+				return -1;
+			break;
+		case 'o':
+			output_file = alloc_file_name(optarg);
+			if (!output_file)
+				return -1;
+			break;
+		case 's':
+			nljson_flags |= NLJSON_FLAG_SKIP_UNKNOWN_ATTRS;
+			break;
+		case 1000:
+			print_version();
+			return 0;
+		case 1001:
+			mode = MODE_CREATE;
+			break;
+		case 1002:
+			mode = MODE_LIST;
+			break;
+		case 1003:
+			block_size = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (block_size == 0)) {
+				fprintf(stderr, "Bad block size: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 1004:
+			no_compress = true;
+			break;
+		case 1005:
+			if (parse_time(optarg, &query.start)) {
+				fprintf(stderr, "Bad start time: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 1006:
+			if (parse_time(optarg, &query.end)) {
+				fprintf(stderr, "Bad end time: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 1007:
+			val = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (val > UINT16_MAX)) {
+				fprintf(stderr, "Bad family id: %s\n", optarg);
+				return -1;
+			}
+			query.family = val;
+			query.match |= NLJSON_ARCHIVE_MATCH_FAMILY;
+			break;
+		case 1008:
+			val = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (val > UINT8_MAX)) {
+				fprintf(stderr, "Bad command: %s\n", optarg);
+				return -1;
+			}
+			query.cmd = val;
+			query.match |= NLJSON_ARCHIVE_MATCH_CMD;
+			break;
+		case 1009:
+			framed = true;
+			break;
+		case 'h':
+		default:
+			print_usage(argv[0]);
+			return 0;
+		}
+	}
+
+	if (!archive_file) {
+		fprintf(stderr, "No archive file given (-A)\n");
+		return -1;
+	}
+
+	switch (mode) {
+	case MODE_CREATE:
+		do_create();
+		break;
+	case MODE_LIST:
+		do_list();
+		break;
+	default:
+		do_query();
+		break;
+	}
+
+	free(archive_file);
+	free(policy_file);
+	free(input_file);
+	free(output_file);
+	return 0;
+}
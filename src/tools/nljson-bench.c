@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <nljson.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <nljson_tools_config.h>
+
+#define NLA_HDR_LEN (4)
+#define NLA_ALIGN_LEN(len) (((len) + 3) & ~3)
+/* Max number of nljson flag combinations given with --nljson-flags */
+#define MAX_FLAG_SETS (8)
+/* Default size of the scratch arena of the contexts used by the *_ctx
+ * benchmarks
+ */
+#define DEFAULT_SCRATCH_SIZE (256 * 1024)
+
+static unsigned int num_attrs = 16;
+static unsigned int depth;
+static unsigned int payload_len = 16;
+static unsigned int unspec_pct;
+static unsigned long num_messages = 10000;
+static unsigned int scratch_size = DEFAULT_SCRATCH_SIZE;
+static uint32_t json_format_flags;
+static uint32_t flag_sets[MAX_FLAG_SETS];
+static unsigned int num_flag_sets = 1;
+static bool use_policy = true, no_policy = true;
+static bool json_output;
+
+/* Number of allocations made by the library (and jansson) */
+static unsigned long num_allocs;
+
+/* Data types of the generated leaf attributes (in order) */
+static const char *leaf_types[] = {
+	"NLA_U8", "NLA_U16", "NLA_U32", "NLA_U64", "NLA_STRING",
+};
+
+#define NUM_LEAF_TYPES (sizeof(leaf_types) / sizeof(leaf_types[0]))
+
+/* One benchmark configuration (workload, policy and flags) */
+struct bench_state {
+	nljson_t *hdl;
+	nljson_ctx_t *ctx;
+	uint8_t *nla_stream;
+	size_t nla_stream_len;
+	/* JSON encoded nla stream (NUL terminated), the decode input */
+	char *json;
+	size_t json_len;
+	/* Total number of attributes (including nested ones) per message */
+	size_t msg_attrs;
+	bool policy;
+	uint32_t nljson_flags;
+};
+
+struct bench_op {
+	const char *name;
+	/* Returns the length of the input of one message (0 if the
+	 * benchmark can't be run with the current configuration)
+	 */
+	size_t (*input_len)(const struct bench_state *st);
+	int (*run)(struct bench_state *st, struct nljson_error *error);
+};
+
+static void print_usage(const char *argv0)
+{
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "%s OPTIONS\n", argv0);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "nljson-bench measures the encode and decode throughput of the nljson\n");
+	fprintf(stderr, "library using synthetic messages.\n");
+	fprintf(stderr, "Each level of a message has --attrs attributes. On all levels but the\n");
+	fprintf(stderr, "last one, the last attribute is a nested attribute holding the next\n");
+	fprintf(stderr, "level. The other attributes cycle through NLA_U8, NLA_U16, NLA_U32,\n");
+	fprintf(stderr, "NLA_U64 and NLA_STRING, with --unspec percent of them being NLA_UNSPEC.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -a, --attrs N        Number of attributes per level (default 16).\n");
+	fprintf(stderr, "  -d, --depth N        Nesting depth (default 0, i.e. no nesting).\n");
+	fprintf(stderr, "  -s, --payload N      Payload length of NLA_STRING and NLA_UNSPEC\n");
+	fprintf(stderr, "                       attributes (default 16).\n");
+	fprintf(stderr, "  -u, --unspec N       Percentage of NLA_UNSPEC attributes (default 0).\n");
+	fprintf(stderr, "  -m, --messages N     Number of messages per run (default 10000).\n");
+	fprintf(stderr, "  -p, --policy MODE    Run with a policy (yes), without (no) or\n");
+	fprintf(stderr, "                       both (default).\n");
+	fprintf(stderr, "  -n, --nljson-flags L Comma separated list of nljson flag\n");
+	fprintf(stderr, "                       combinations to run (default 0).\n");
+	fprintf(stderr, "  -c, --scratch N      Scratch arena size of the contexts used by the\n");
+	fprintf(stderr, "                       *_ctx benchmarks (default %d, 0 means no arena).\n", DEFAULT_SCRATCH_SIZE);
+	fprintf(stderr, "  -f, --flags          format flags for the JSON output.\n");
+	fprintf(stderr, "                       See jansson library documentation for more details.\n");
+	fprintf(stderr, "  -j, --json           Write the results in JSON format.\n");
+	fprintf(stderr, "  --version            Print version info and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+static void print_version(void)
+{
+#if GIT_SHA_AVAILABLE
+	fprintf(stderr, "\n%s-%s\n\n", VERSION, GIT_SHA);
+#else
+	fprintf(stderr, "\n%s-\n\n", VERSION);
+#endif
+}
+
+static void *count_malloc(size_t size)
+{
+	num_allocs++;
+	return malloc(size);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return -1;
+
+	return usage.ru_maxrss;
+}
+
+/* Returns the data type of attribute i of a level (NULL for the nested
+ * attribute). The NLA_UNSPEC attributes are spread evenly.
+ */
+static const char *attr_type(unsigned int level, unsigned int i)
+{
+	if ((level < depth) && (i == num_attrs - 1))
+		return NULL;
+
+	if (((i + 1) * unspec_pct / 100) > (i * unspec_pct / 100))
+		return "NLA_UNSPEC";
+
+	return leaf_types[i % NUM_LEAF_TYPES];
+}
+
+static size_t attr_payload_len(const char *type)
+{
+	if (!strcmp(type, "NLA_U8"))
+		return 1;
+	if (!strcmp(type, "NLA_U16"))
+		return 2;
+	if (!strcmp(type, "NLA_U32"))
+		return 4;
+	if (!strcmp(type, "NLA_U64"))
+		return 8;
+	if (!strcmp(type, "NLA_STRING"))
+		return payload_len + 1;
+	return payload_len;
+}
+
+/* Returns the length of the nla stream of a level */
+static size_t level_len(unsigned int level)
+{
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_attrs; i++) {
+		const char *type = attr_type(level, i);
+
+		if (type)
+			len += NLA_HDR_LEN + NLA_ALIGN_LEN(attr_payload_len(type));
+		else
+			len += NLA_HDR_LEN + level_len(level + 1);
+	}
+
+	return len;
+}
+
+static void put_attr_hdr(uint8_t *buf, size_t nla_len, unsigned int nla_type)
+{
+	uint16_t hdr[2] = { nla_len, nla_type };
+
+	memcpy(buf, hdr, sizeof(hdr));
+}
+
+/* Writes the nla stream of a level into buf. Returns the length */
+static size_t gen_level(uint8_t *buf, unsigned int level)
+{
+	size_t off = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_attrs; i++) {
+		const char *type = attr_type(level, i);
+		uint8_t *data = buf + off + NLA_HDR_LEN;
+		size_t len, j;
+
+		if (!type) {
+			len = gen_level(data, level + 1);
+			put_attr_hdr(buf + off, NLA_HDR_LEN + len, i + 1);
+			off += NLA_HDR_LEN + len;
+			continue;
+		}
+
+		len = attr_payload_len(type);
+		for (j = 0; j < len; j++)
+			data[j] = 'a' + (i + j) % 26;
+		if (!strcmp(type, "NLA_STRING"))
+			data[len - 1] = '\0';
+		memset(data + len, 0, NLA_ALIGN_LEN(len) - len);
+
+		put_attr_hdr(buf + off, NLA_HDR_LEN + len, i + 1);
+		off += NLA_HDR_LEN + NLA_ALIGN_LEN(len);
+	}
+
+	return off;
+}
+
+static void gen_policy(FILE *f, unsigned int level)
+{
+	unsigned int i;
+
+	fprintf(f, "{");
+	for (i = 0; i < num_attrs; i++) {
+		const char *type = attr_type(level, i);
+
+		fprintf(f, "%s\"ATTR_%u_%u\": {\"nla_type\": %u, ",
+			i ? ", " : "", level, i, i + 1);
+		if (type) {
+			fprintf(f, "\"data_type\": \"%s\"}", type);
+		} else {
+			fprintf(f, "\"data_type\": \"NLA_NESTED\", \"nested\": ");
+			gen_policy(f, level + 1);
+			fprintf(f, "}");
+		}
+	}
+	fprintf(f, "}");
+}
+
+static size_t encode_input_len(const struct bench_state *st)
+{
+	return st->nla_stream_len;
+}
+
+static size_t decode_input_len(const struct bench_state *st)
+{
+	return st->json_len;
+}
+
+static int run_encode(struct bench_state *st, struct nljson_error *error)
+{
+	size_t consumed, produced;
+	char *output;
+
+	output = nljson_encode_nla_alloc(st->hdl, st->nla_stream,
+					 st->nla_stream_len, &consumed,
+					 &produced, json_format_flags, error);
+	if (!output)
+		return -1;
+
+	free(output);
+	return 0;
+}
+
+static int run_encode_ctx(struct bench_state *st, struct nljson_error *error)
+{
+	size_t consumed, produced;
+	const char *output;
+
+	return nljson_encode_nla_ctx(st->hdl, st->ctx, st->nla_stream,
+				     st->nla_stream_len, &output, &consumed,
+				     &produced, json_format_flags, error);
+}
+
+static int run_decode(struct bench_state *st, struct nljson_error *error)
+{
+	size_t consumed, produced;
+	void *nla_stream;
+
+	nla_stream = nljson_decode_nla_alloc(st->json, &consumed, &produced,
+					     0, error);
+	if (!nla_stream)
+		return -1;
+
+	free(nla_stream);
+	return 0;
+}
+
+static int run_decode_ctx(struct bench_state *st, struct nljson_error *error)
+{
+	size_t consumed, produced;
+	const void *nla_stream;
+
+	return nljson_decode_nla_ctx(st->ctx, st->json, st->json_len,
+				     &nla_stream, &consumed, &produced, 0,
+				     error);
+}
+
+static const struct bench_op bench_ops[] = {
+	{ "encode", encode_input_len, run_encode },
+	{ "encode_ctx", encode_input_len, run_encode_ctx },
+	{ "decode", decode_input_len, run_decode },
+	{ "decode_ctx", decode_input_len, run_decode_ctx },
+};
+
+static int bench_init(struct bench_state *st, bool policy,
+		      uint32_t nljson_flags, struct nljson_error *error)
+{
+	char *policy_json = NULL;
+	nljson_t *json_hdl = NULL;
+	size_t policy_len, consumed, produced;
+	unsigned int level;
+	int rc = -1;
+
+	memset(st, 0, sizeof(*st));
+	st->policy = policy;
+	st->nljson_flags = nljson_flags;
+
+	for (level = 0; level <= depth; level++)
+		st->msg_attrs += num_attrs;
+
+	st->nla_stream_len = level_len(0);
+	st->nla_stream = malloc(st->nla_stream_len);
+	if (!st->nla_stream) {
+		snprintf(error->err_msg, sizeof(error->err_msg),
+			 "Unable to allocate nla stream");
+		goto out;
+	}
+	gen_level(st->nla_stream, 0);
+
+	if (policy) {
+		FILE *f = open_memstream(&policy_json, &policy_len);
+
+		if (!f) {
+			snprintf(error->err_msg, sizeof(error->err_msg),
+				 "Unable to allocate policy");
+			goto out;
+		}
+		gen_policy(f, 0);
+		fclose(f);
+	}
+
+	if (nljson_init(&st->hdl, 0, nljson_flags, policy_json, error))
+		goto out;
+
+	if (nljson_ctx_init(&st->ctx, scratch_size, error))
+		goto out;
+
+	/* The decode input is the encoded message. Time stamps can't be
+	 * decoded, so they are left out.
+	 */
+	if (nljson_init(&json_hdl, 0,
+			nljson_flags & ~NLJSON_FLAG_ADD_TIMESTAMP,
+			policy_json, error))
+		goto out;
+
+	st->json = nljson_encode_nla_alloc(json_hdl, st->nla_stream,
+					   st->nla_stream_len, &consumed,
+					   &produced, json_format_flags, error);
+	if (!st->json)
+		goto out;
+
+	/* The encoded message can't always be decoded (e.g. an empty
+	 * object if all attributes are skipped). The decode benchmarks are
+	 * skipped in that case.
+	 */
+	if (run_decode(st, error))
+		fprintf(stderr, "Skipping decode (policy %s, flags %u): %s\n",
+			policy ? "yes" : "no", nljson_flags, error->err_msg);
+	else
+		st->json_len = produced;
+
+	rc = 0;
+out:
+	if (json_hdl)
+		nljson_deinit(&json_hdl);
+	free(policy_json);
+	return rc;
+}
+
+static void bench_deinit(struct bench_state *st)
+{
+	if (st->ctx)
+		nljson_ctx_deinit(&st->ctx);
+	if (st->hdl)
+		nljson_deinit(&st->hdl);
+	free(st->json);
+	free(st->nla_stream);
+}
+
+static void print_result(const struct bench_op *op,
+			 const struct bench_state *st, double elapsed,
+			 unsigned long allocs, bool first)
+{
+	double msgs_per_sec = num_messages / elapsed;
+	double mb_per_sec = msgs_per_sec * op->input_len(st) / 1e6;
+	double ns_per_attr = elapsed * 1e9 / (num_messages * st->msg_attrs);
+	double allocs_per_msg = (double) allocs / num_messages;
+
+	if (json_output) {
+		printf("%s    {\"op\": \"%s\", \"policy\": %s, "
+		       "\"nljson_flags\": %u, \"msg_len\": %zu, "
+		       "\"msg_attrs\": %zu, \"msgs_per_sec\": %.1f, "
+		       "\"mb_per_sec\": %.2f, \"ns_per_attr\": %.2f, "
+		       "\"allocs_per_msg\": %.2f, \"peak_rss_kb\": %ld}",
+		       first ? "" : ",\n", op->name,
+		       st->policy ? "true" : "false", st->nljson_flags,
+		       op->input_len(st), st->msg_attrs, msgs_per_sec,
+		       mb_per_sec, ns_per_attr, allocs_per_msg, peak_rss_kb());
+		return;
+	}
+
+	printf("%-10s %-6s %5u %8zu %12.0f %9.2f %9.2f %9.2f %9ld\n",
+	       op->name, st->policy ? "yes" : "no", st->nljson_flags,
+	       op->input_len(st), msgs_per_sec, mb_per_sec, ns_per_attr,
+	       allocs_per_msg, peak_rss_kb());
+}
+
+static int run_benchmarks(void)
+{
+	struct bench_state st;
+	struct nljson_error error;
+	unsigned int p, f, i;
+	unsigned long n;
+	bool first = true;
+
+	if (json_output) {
+		printf("{\n  \"version\": \"%s\",\n", VERSION);
+		printf("  \"attrs\": %u, \"depth\": %u, \"payload\": %u, "
+		       "\"unspec_pct\": %u, \"messages\": %lu, "
+		       "\"scratch\": %u, \"json_flags\": %u,\n",
+		       num_attrs, depth, payload_len, unspec_pct,
+		       num_messages, scratch_size, json_format_flags);
+		printf("  \"results\": [\n");
+	} else {
+		printf("%-10s %-6s %5s %8s %12s %9s %9s %9s %9s\n",
+		       "op", "policy", "flags", "msg_len", "msgs/s", "MB/s",
+		       "ns/attr", "allocs", "rss_kb");
+	}
+
+	for (p = 0; p < 2; p++) {
+		bool policy = (p == 0);
+
+		if ((policy && !use_policy) || (!policy && !no_policy))
+			continue;
+
+		for (f = 0; f < num_flag_sets; f++) {
+			if (bench_init(&st, policy, flag_sets[f], &error)) {
+				fprintf(stderr, "Init error: %s\n",
+					error.err_msg);
+				bench_deinit(&st);
+				return -1;
+			}
+
+			for (i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++) {
+				const struct bench_op *op = &bench_ops[i];
+				unsigned long allocs;
+				double start;
+
+				if (op->input_len(&st) == 0)
+					continue;
+
+				/* Warm up (caches, arenas and output
+				 * buffers)
+				 */
+				for (n = 0; n < num_messages / 10 + 1; n++) {
+					if (op->run(&st, &error))
+						break;
+				}
+
+				allocs = num_allocs;
+				start = now();
+				for (n = 0; n < num_messages; n++) {
+					if (op->run(&st, &error))
+						break;
+				}
+
+				if (n < num_messages) {
+					fprintf(stderr, "%s error: %s\n",
+						op->name, error.err_msg);
+					bench_deinit(&st);
+					return -1;
+				}
+
+				print_result(op, &st, now() - start,
+					     num_allocs - allocs, first);
+				first = false;
+			}
+
+			bench_deinit(&st);
+		}
+	}
+
+	if (json_output)
+		printf("\n  ]\n}\n");
+
+	return 0;
+}
+
+static int parse_flag_sets(const char *arg)
+{
+	char *end;
+
+	num_flag_sets = 0;
+	for (;;) {
+		if (num_flag_sets == MAX_FLAG_SETS)
+			return -1;
+
+		flag_sets[num_flag_sets++] = strtoul(arg, &end, 0);
+		if (end == arg)
+			return -1;
+		if (*end == '\0')
+			return 0;
+		if (*end != ',')
+			return -1;
+		arg = end + 1;
+	}
+}
+
+static int parse_uint(const char *arg, const char *name, unsigned int *val)
+{
+	char *tmp;
+
+	*val = strtoul(arg, &tmp, 0);
+	if ((*tmp != '\0') || (tmp == arg)) {
+		fprintf(stderr, "Bad %s: %s\n", name, arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, optind = 0;
+	unsigned int val;
+	struct option long_opts[] = {
+		{"help", no_argument, 0, 'h'},
+		{"attrs", required_argument, 0, 'a'},
+		{"depth", required_argument, 0, 'd'},
+		{"payload", required_argument, 0, 's'},
+		{"unspec", required_argument, 0, 'u'},
+		{"messages", required_argument, 0, 'm'},
+		{"policy", required_argument, 0, 'p'},
+		{"nljson-flags", required_argument, 0, 'n'},
+		{"scratch", required_argument, 0, 'c'},
+		{"flags", required_argument, 0, 'f'},
+		{"json", no_argument, 0, 'j'},
+		{"version", no_argument, 0, 1000},
+		{NULL, 0, 0, 0},
+	};
+
+	/* Must be set before any other library function is called */
+	nljson_set_alloc_funcs(count_malloc, free);
+
+	while ((opt = getopt_long(argc, argv, "ha:d:s:u:m:p:n:c:f:j", long_opts, &optind)) != -1) {
+		switch (opt) {
+		case 'a':
+			if (parse_uint(optarg, "number of attributes",
+				       &num_attrs))
+				return -1;
+			if ((num_attrs == 0) || (num_attrs > UINT16_MAX)) {
+				fprintf(stderr, "Bad number of attributes: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 'd':
+			if (parse_uint(optarg, "depth", &depth))
+				return -1;
+			break;
+		case 's':
+			if (parse_uint(optarg, "payload length", &payload_len))
+				return -1;
+			break;
+		case 'u':
+			if (parse_uint(optarg, "NLA_UNSPEC percentage",
+				       &unspec_pct))
+				return -1;
+			if (unspec_pct > 100) {
+				fprintf(stderr, "Bad NLA_UNSPEC percentage: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 'm':
+			if (parse_uint(optarg, "number of messages", &val))
+				return -1;
+			num_messages = val ? val : 1;
+			break;
+		case 'p':
+			if (!strcmp(optarg, "yes")) {
+				no_policy = false;
+			} else if (!strcmp(optarg, "no")) {
+				use_policy = false;
+			} else if (strcmp(optarg, "both")) {
+				fprintf(stderr, "Bad policy mode: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'n':
+			if (parse_flag_sets(optarg)) {
+				fprintf(stderr, "Bad nljson flags: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'c':
+			if (parse_uint(optarg, "scratch size", &scratch_size))
+				return -1;
+			break;
+		case 'f':
+			if (parse_uint(optarg, "JSON format flags", &val))
+				return -1;
+			json_format_flags = val;
+			break;
+		case 'j':
+			json_output = true;
+			break;
+		case 1000:
+			print_version();
+			return 0;
+		case 'h':
+		default:
+			print_usage(argv[0]);
+			return 0;
+		}
+	}
+
+	/* All attributes (including the nested ones) must fit in the 16 bit
+	 * nla_len
+	 */
+	if ((payload_len + 1 > UINT16_MAX - NLA_HDR_LEN) ||
+	    ((depth > 0) && (level_len(1) > UINT16_MAX - NLA_HDR_LEN))) {
+		fprintf(stderr, "Attributes are too large\n");
+		return -1;
+	}
+
+	return run_benchmarks() ? -1 : 0;
+}
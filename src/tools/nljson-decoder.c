@@ -30,18 +30,68 @@
 #include <errno.h>
 #include <nljson_tools_config.h>
 
-#define IN_BUF_LEN (1024)
+#include "nljson_pipeline.h"
+#include "nljson_io.h"
+#include "nljson_hex.h"
+#include "nljson_hist.h"
+
+/* Initial size of the per record output buffers in --threads mode */
 #define OUT_BUF_LEN (1024)
-#define ASCII_BUF_LEN (3 * OUT_BUF_LEN + 1)
+/* Size of the blocks of lines handed over to the workers in --threads
+ * mode and of the per thread scratch arenas.
+ */
+#define BLOCK_LEN (1024 * 1024)
+#define ARENA_SIZE (256 * 1024)
+/* Number of bytes formatted at a time in ASCII mode */
+#define ASCII_CHUNK_LEN (1024)
 
 static char input_file[256];
 static char output_file[256];
-
-static char in_buf[IN_BUF_LEN], ascii_buf[ASCII_BUF_LEN];
-static uint8_t out_buf[OUT_BUF_LEN];
+static char stats_file[256];
 
 static uint32_t json_format_flags;
-static bool input_file_set, output_file_set, ascii_output;
+static bool input_file_set, output_file_set, ascii_output, framed;
+static bool stats_enabled, stats_file_set;
+/* --format cbor|msgpack */
+static bool bin_input;
+static enum nljson_bin_format bin_format;
+static double stats_interval;
+static unsigned int num_threads;
+static size_t buffer_size = IO_DEFAULT_BUF_SIZE;
+/* Run statistics (NULL unless --stats is used) */
+static struct run_stats *stats;
+
+/* A line that could not be decoded in --threads mode */
+struct decode_error {
+	size_t line;
+	struct nljson_error error;
+};
+
+/* A block of complete lines (JSON documents) decoded by one worker */
+struct decode_record {
+	struct pipeline_record rec;
+	size_t out_size;
+	/* Line number of the first line in the block */
+	size_t first_line;
+	/* The lines of the block that failed (in line order) */
+	struct decode_error *errors;
+	size_t num_errors;
+	size_t errors_size;
+	/* Line at which the block was given up (if there was no memory
+	 * for its errors)
+	 */
+	size_t stop_line;
+	/* rec.in is a copy of the input (i.e. not in the mapped file) */
+	bool in_copied;
+};
+
+struct decode_pipeline {
+	nljson_ctx_t **ctxs;
+	struct io_input *in;
+	struct io_output *out;
+	size_t num_lines;
+	bool read_error;
+};
 
 static void print_usage(const char *argv0)
 {
@@ -61,6 +111,23 @@ static void print_usage(const char *argv0)
 	fprintf(stderr, "  -o, --output     netlink attribute output stream.\n");
 	fprintf(stderr, "                   If omitted, the nla byte stream will be written to stdout.\n");
 	fprintf(stderr, "  -a, --ascii      ASCII output. Print output in ASCII format.\n");
+	fprintf(stderr, "  -b, --buffer-size Initial size of the input and output buffers\n");
+	fprintf(stderr, "                   (default %d). Regular input files are memory\n", IO_DEFAULT_BUF_SIZE);
+	fprintf(stderr, "                   mapped. The input buffer grows if needed.\n");
+	fprintf(stderr, "  --framed         Write each decoded nla stream as a framed record\n");
+	fprintf(stderr, "                   (header, nla stream and padding). See\n");
+	fprintf(stderr, "                   nljson_record_next.\n");
+	fprintf(stderr, "  --format FORMAT  Input format: json (default), cbor or msgpack.\n");
+	fprintf(stderr, "                   The input is a sequence of documents written by\n");
+	fprintf(stderr, "                   nljson-encoder --format FORMAT.\n");
+	fprintf(stderr, "  --threads N      Decode newline delimited JSON (one document per\n");
+	fprintf(stderr, "                   line) using N worker threads. The output is written\n");
+	fprintf(stderr, "                   in input order.\n");
+	fprintf(stderr, "  --stats[=SECONDS] Report throughput, errors, the time spent reading,\n");
+	fprintf(stderr, "                   decoding and writing and a histogram of the decode\n");
+	fprintf(stderr, "                   latency as JSON. The report is written every SECONDS\n");
+	fprintf(stderr, "                   (if given) and when the input has been decoded.\n");
+	fprintf(stderr, "  --stats-file FILE Write the --stats reports to FILE instead of stderr.\n");
 	fprintf(stderr, "  --version        Print version info and exit.\n");
 	fprintf(stderr, "\n");
 
@@ -75,132 +142,550 @@ static void print_version(void)
 #endif
 }
 
-static int write_ascii(int fd, const uint8_t *buf, size_t len)
+static int write_ascii(struct io_output *out, const uint8_t *buf, size_t len)
 {
-	size_t i;
-	int n = 0, write_ret;
+	char hex[HEX_BYTE_LEN * ASCII_CHUNK_LEN];
 
-	for (i = 0; i < len; i++)
-		n += snprintf(ascii_buf + n, sizeof(ascii_buf) - n, "%02X ",
-			      buf[i]);
-	n += snprintf(ascii_buf + n, sizeof(ascii_buf) - n, "\n");
+	while (len > 0) {
+		size_t chunk_len = len < ASCII_CHUNK_LEN ? len : ASCII_CHUNK_LEN;
 
-	write_ret = write(fd, ascii_buf, n);
-	if (write_ret != n)
-		return 0;
-	else
-		return len;
+		hex_format(hex, buf, chunk_len);
+		if (io_output_write(out, hex, HEX_BYTE_LEN * chunk_len))
+			return -1;
+
+		buf += chunk_len;
+		len -= chunk_len;
+	}
+
+	return 0;
 }
 
-static void do_decode(void)
+static int write_data(struct io_output *out, const void *buf, size_t len)
 {
-	int rc = 0, in_fd, out_fd;
-	size_t in_buf_len = 0;
+	if (ascii_output)
+		return write_ascii(out, buf, len);
+
+	return io_output_write(out, buf, len);
+}
+
+/* Writes a decoded nla stream (as a framed record in --framed mode).
+ * In ASCII mode, each nla stream (or record) is written on a line of its
+ * own.
+ */
+static int write_nla_stream(struct io_output *out, const void *nla_stream,
+			    size_t len)
+{
+	static const uint8_t pad[NLJSON_RECORD_ALIGN];
+	struct nljson_record_hdr hdr;
 	struct nljson_error error;
-	bool decode_error = false;
 
-	if (input_file_set)
-		in_fd = open(input_file, O_RDONLY);
-	else
-		in_fd = 0;
+	if (framed) {
+		if (nljson_record_hdr_init(&hdr, len, 0, 0, &error) ||
+		    write_data(out, &hdr, sizeof(hdr)) ||
+		    write_data(out, nla_stream, len) ||
+		    write_data(out, pad, nljson_record_len(len) -
+					 sizeof(hdr) - len))
+			return -1;
+	} else if (write_data(out, nla_stream, len)) {
+		return -1;
+	}
 
-	if (in_fd < 0)
-		goto out;
+	return ascii_output ? io_output_write(out, "\n", 1) : 0;
+}
 
-	if (output_file_set)
-		out_fd = open(output_file, O_WRONLY);
-	else
-		out_fd = 1;
+/* Returns the length of data up to and including the last newline in
+ * the first len bytes (or 0 if there is no newline).
+ */
+static size_t last_line_end(const uint8_t *data, size_t len)
+{
+	while ((len > 0) && (data[len - 1] != '\n'))
+		len--;
 
-	if (out_fd < 0)
-		goto out;
+	return len;
+}
 
-	/**
-	 * Main processing loop:
-	 * Reads the input stream and decodes the data.
-	 * Trailing input data (data not processed by the decoding function)
-	 * is saved for the next iteration.
+static struct pipeline_record *decode_read(void *data)
+{
+	struct decode_pipeline *pl = (struct decode_pipeline *) data;
+	struct io_input *in = pl->in;
+	struct decode_record *dr;
+	const uint8_t *block;
+	size_t len, avail, i;
+	uint64_t start = run_stats_now(stats);
+
+	/* Blocks are split at the last newline within BLOCK_LEN bytes
+	 * (or at the first newline if the first line is longer).
 	 */
 	for (;;) {
-		ssize_t read_len, write_len;
-		size_t consumed, produced;
-		bool eof_reached = false;
-
-		read_len = read(in_fd, in_buf + in_buf_len,
-				sizeof(in_buf) - in_buf_len);
-		if (read_len <= 0) {
-			read_len = 0;
-			eof_reached = true;
+		avail = io_input_len(in);
+		len = last_line_end(io_input_data(in),
+				    avail < BLOCK_LEN ? avail : BLOCK_LEN);
+		if (len == 0)
+			len = last_line_end(io_input_data(in), avail);
+
+		if ((len > 0) && (avail >= BLOCK_LEN))
+			break;
+
+		/* The last line does not need to be newline terminated */
+		if (in->eof) {
+			len = avail;
+			break;
 		}
 
-		in_buf_len += read_len;
+		if (io_input_fill(in) < 0) {
+			pl->read_error = true;
+			return NULL;
+		}
+	}
+
+	if (len == 0)
+		return NULL;
 
-		while (in_buf_len > 0) {
-			size_t i;
+	dr = calloc(1, sizeof(*dr));
+	if (!dr) {
+		pl->read_error = true;
+		return NULL;
+	}
 
-			rc = nljson_decode_nla(in_buf, out_buf,
-					       sizeof(out_buf),
-					       &consumed, &produced,
-					       json_format_flags,
-					       &error);
+	/* Blocks in a mapped file are used directly. Blocks in the input
+	 * buffer must be copied since the buffer is reused.
+	 */
+	block = io_input_data(in);
+	if (in->mapped) {
+		dr->rec.in = (void *) block;
+	} else {
+		dr->rec.in = malloc(len);
+		if (!dr->rec.in) {
+			free(dr);
+			pl->read_error = true;
+			return NULL;
+		}
+		memcpy(dr->rec.in, block, len);
+		dr->in_copied = true;
+	}
+	dr->rec.in_len = len;
 
-			if (rc) {
-				/* We don't print the error here since the
-				 * error could be caused by an incomplete
-				 * JSON string and we could get more data
-				 * in the next iteration.
-				 */
-				decode_error = true;
+	dr->first_line = pl->num_lines + 1;
+	for (i = 0; i < len; i++) {
+		if (block[i] == '\n')
+			pl->num_lines++;
+	}
+
+	io_input_consume(in, len);
+	run_stats_read(stats, start);
+	return &dr->rec;
+}
+
+/* Makes sure there is room for len more bytes in the output of dr */
+static int decode_reserve(struct decode_record *dr, size_t len)
+{
+	if (dr->rec.out_len + len > dr->out_size) {
+		size_t new_size = dr->out_size ? dr->out_size : OUT_BUF_LEN;
+		uint8_t *tmp;
+
+		while (new_size < dr->rec.out_len + len)
+			new_size *= 2;
+
+		tmp = realloc(dr->rec.out, new_size);
+		if (!tmp)
+			return -1;
+		dr->rec.out = tmp;
+		dr->out_size = new_size;
+	}
+
+	return 0;
+}
+
+static int decode_append(struct decode_record *dr, const void *data,
+			 size_t len)
+{
+	if (decode_reserve(dr, len))
+		return -1;
+
+	memcpy((uint8_t *) dr->rec.out + dr->rec.out_len, data, len);
+	dr->rec.out_len += len;
+	return 0;
+}
+
+static int decode_append_ascii(struct decode_record *dr, const uint8_t *buf,
+			       size_t len)
+{
+	if (decode_reserve(dr, HEX_BYTE_LEN * len))
+		return -1;
+
+	hex_format((char *) dr->rec.out + dr->rec.out_len, buf, len);
+	dr->rec.out_len += HEX_BYTE_LEN * len;
+	return 0;
+}
+
+static int decode_append_data(struct decode_record *dr, const void *buf,
+			      size_t len)
+{
+	if (ascii_output)
+		return decode_append_ascii(dr, buf, len);
+
+	return decode_append(dr, buf, len);
+}
+
+/* Same as write_nla_stream, but appends to the output of dr */
+static int decode_append_nla_stream(struct decode_record *dr,
+				    const void *nla_stream, size_t len)
+{
+	static const uint8_t pad[NLJSON_RECORD_ALIGN];
+	struct nljson_record_hdr hdr;
+	struct nljson_error error;
+
+	if (framed) {
+		if (nljson_record_hdr_init(&hdr, len, 0, 0, &error) ||
+		    decode_append_data(dr, &hdr, sizeof(hdr)) ||
+		    decode_append_data(dr, nla_stream, len) ||
+		    decode_append_data(dr, pad, nljson_record_len(len) -
+						sizeof(hdr) - len))
+			return -1;
+	} else if (decode_append_data(dr, nla_stream, len)) {
+		return -1;
+	}
+
+	return ascii_output ? decode_append(dr, "\n", 1) : 0;
+}
+
+/* Adds a failing line to the errors of dr. Returns a pointer to the
+ * error (or NULL if there is no memory for it).
+ */
+static struct decode_error *decode_add_error(struct decode_record *dr,
+					     size_t line_no)
+{
+	struct decode_error *err;
+
+	if (dr->num_errors == dr->errors_size) {
+		size_t new_size = dr->errors_size ? 2 * dr->errors_size : 4;
+		struct decode_error *tmp;
+
+		tmp = realloc(dr->errors, new_size * sizeof(*tmp));
+		if (!tmp)
+			return NULL;
+		dr->errors = tmp;
+		dr->errors_size = new_size;
+	}
+
+	err = &dr->errors[dr->num_errors++];
+	err->line = line_no;
+	return err;
+}
+
+/* Decodes the lines of a block. A line that fails is recorded and
+ * decoding continues with the next line, so the output (and the
+ * reported errors) don't depend on how the input is split into blocks.
+ */
+static void decode_process(unsigned int worker, struct pipeline_record *rec,
+			   void *data)
+{
+	struct decode_pipeline *pl = (struct decode_pipeline *) data;
+	struct decode_record *dr = (struct decode_record *) rec;
+	const char *line = rec->in, *end = line + rec->in_len;
+	size_t line_no = dr->first_line;
+
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		size_t line_len = (eol ? eol : end) - line;
+		size_t consumed, produced, i;
+		struct nljson_error error;
+		struct decode_error *err;
+		const void *nla_stream;
+		uint64_t start;
+		int rc;
+
+		/* Skip empty lines */
+		for (i = 0; i < line_len; i++) {
+			if (line[i] != ' ' && line[i] != '\t' &&
+			    line[i] != '\r')
 				break;
+		}
+
+		if (i < line_len) {
+			start = run_stats_now(stats);
+			rc = nljson_decode_nla_ctx(pl->ctxs[worker], line,
+						   line_len, &nla_stream,
+						   &consumed, &produced,
+						   json_format_flags,
+						   &error);
+			if (rc) {
+				run_stats_message(stats, worker, start, 0, 0,
+						  true);
+			} else {
+				rc = decode_append_nla_stream(dr, nla_stream,
+							      produced);
+				run_stats_message(stats, worker, start,
+						  line_len, produced, rc != 0);
+				if (rc)
+					snprintf(error.err_msg,
+						 sizeof(error.err_msg),
+						 "Unable to allocate output buffer");
 			}
 
-			decode_error = false;
+			if (rc) {
+				err = decode_add_error(dr, line_no);
+				if (!err) {
+					dr->stop_line = line_no;
+					rec->status = -1;
+					return;
+				}
+				err->error = error;
+			}
+		}
 
-			if ((produced == 0) || (consumed == 0))
+		line += line_len + 1;
+		line_no++;
+	}
+
+	rec->status = 0;
+}
+
+static int decode_write(struct pipeline_record **recs, size_t num_recs,
+			void *data)
+{
+	struct decode_pipeline *pl = (struct decode_pipeline *) data;
+	struct iovec iov[PIPELINE_MAX_BATCH];
+	uint64_t start = run_stats_now(stats);
+	size_t i;
+	int iovcnt = 0, rc;
+
+	for (i = 0; i < num_recs; i++) {
+		struct decode_record *dr = (struct decode_record *) recs[i];
+		size_t e;
+
+		/* The output of the other lines of the block is written
+		 * anyway.
+		 */
+		for (e = 0; e < dr->num_errors; e++) {
+			fprintf(stderr, "Decoding error (line %zu): %s\n",
+				dr->errors[e].line,
+				dr->errors[e].error.err_msg);
+		}
+		if (recs[i]->status) {
+			fprintf(stderr, "Decoding error (line %zu): Out of memory, rest of the block skipped\n",
+				dr->stop_line);
+		}
+
+		if (recs[i]->out_len == 0)
+			continue;
+
+		iov[iovcnt].iov_base = recs[i]->out;
+		iov[iovcnt].iov_len = recs[i]->out_len;
+		iovcnt++;
+	}
+
+	rc = io_output_writev(pl->out, iov, iovcnt);
+	run_stats_write(stats, start);
+	run_stats_poll(stats);
+	return rc;
+}
+
+static void decode_release(struct pipeline_record *rec, void *data)
+{
+	struct decode_record *dr = (struct decode_record *) rec;
+
+	(void) data;
+
+	if (dr->in_copied)
+		free(rec->in);
+	free(rec->out);
+	free(dr->errors);
+	free(dr);
+}
+
+static void do_decode_threads(struct io_input *in, struct io_output *out)
+{
+	struct pipeline_ops ops = {
+		.read = decode_read,
+		.process = decode_process,
+		.write = decode_write,
+		.release = decode_release,
+	};
+	struct decode_pipeline pl;
+	struct nljson_error error;
+	unsigned int i;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.in = in;
+	pl.out = out;
+	pl.ctxs = calloc(num_threads, sizeof(*pl.ctxs));
+	if (!pl.ctxs) {
+		fprintf(stderr, "calloc returned NULL!\n");
+		return;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		if (nljson_ctx_init(&pl.ctxs[i], ARENA_SIZE, &error)) {
+			fprintf(stderr, "Init error: %s\n", error.err_msg);
+			goto out;
+		}
+	}
+
+	if (pipeline_run(num_threads, &ops, &pl))
+		fprintf(stderr, "Error: Unable to write output\n");
+	else if (pl.read_error)
+		fprintf(stderr, "Error: Unable to read input\n");
+out:
+	for (i = 0; i < num_threads; i++)
+		nljson_ctx_deinit(&pl.ctxs[i]);
+	free(pl.ctxs);
+}
+
+/* io_input_fill (counted as read time in the run statistics) */
+static ssize_t fill_input(struct io_input *in)
+{
+	uint64_t start = run_stats_now(stats);
+	ssize_t rc;
+
+	rc = io_input_fill(in);
+	run_stats_read(stats, start);
+	return rc;
+}
+
+static void do_decode(void)
+{
+	int rc;
+	nljson_ctx_t *ctx = NULL;
+	struct io_input in;
+	struct io_output out;
+	struct nljson_error error;
+	bool in_open = false, out_open = false;
+	/* Amount of buffered data needed before a failed decoding is
+	 * retried
+	 */
+	size_t retry_len = 0;
+
+	if (io_input_open(&in, input_file_set ? input_file : NULL,
+			  buffer_size)) {
+		fprintf(stderr, "Unable to open input: %s\n", strerror(errno));
+		goto out;
+	}
+	in_open = true;
+
+	if (io_output_open(&out, output_file_set ? output_file : NULL,
+			   buffer_size)) {
+		fprintf(stderr, "Unable to open output: %s\n", strerror(errno));
+		goto out;
+	}
+	out_open = true;
+
+	if (stats_enabled) {
+		stats = run_stats_create("nljson-decoder",
+					 stats_file_set ? stats_file : NULL,
+					 stats_interval,
+					 num_threads ? num_threads : 1);
+		if (!stats) {
+			fprintf(stderr, "Unable to open stats output: %s\n",
+				strerror(errno));
+			goto out;
+		}
+	}
+
+	if (num_threads > 0) {
+		do_decode_threads(&in, &out);
+		goto out;
+	}
+
+	if (nljson_ctx_init(&ctx, 0, &error)) {
+		fprintf(stderr, "Init error: %s\n", error.err_msg);
+		goto out;
+	}
+
+	/**
+	 * Main processing loop:
+	 * Decodes one JSON object (or binary document) at a time. If the
+	 * decoding fails, more data is read (the object could be incomplete)
+	 * and the decoding is retried. The input buffer grows as needed, so
+	 * objects of any size can be decoded. The decoding is not retried
+	 * until the amount of buffered data has doubled (or the end of the
+	 * input is reached), otherwise a large object read from a pipe would
+	 * be parsed from the start once per read.
+	 */
+	for (;;) {
+		const uint8_t *data = io_input_data(&in);
+		size_t len = io_input_len(&in), consumed, produced, i = 0;
+		const void *nla_stream;
+		void *bin_buf = NULL;
+		uint64_t start;
+
+		/* Make sure the data begins with a '{', otherwise
+		 * nljson_decode_nla_ctx will fail.
+		 */
+		for (; !bin_input && (i < len); i++) {
+			if (data[i] == '{')
 				break;
+		}
+		io_input_consume(&in, i);
 
-			if (ascii_output)
-				write_len = write_ascii(out_fd, out_buf,
-							produced);
-			else
-				write_len = write(out_fd, out_buf, produced);
-			if ((size_t) write_len != produced)
+		if ((i == len) || ((len < retry_len) && !in.eof)) {
+			if ((i == len) && in.eof)
 				break;
-			if (consumed > (size_t) in_buf_len) {
-				fprintf(stderr, "Error: Consumed %u bytes "
-					"out of %u", consumed, produced);
+			if (fill_input(&in) < 0) {
+				fprintf(stderr, "Error: Unable to read input\n");
 				break;
 			}
+			continue;
+		}
 
-			in_buf_len -= consumed;
-			memmove(in_buf, in_buf + consumed, in_buf_len);
-
-			/* Make sure in_buf begins with a '{', otherwise
-			 * nljson_decode_nla will fail.
+		start = run_stats_now(stats);
+		if (bin_input) {
+			bin_buf = nljson_decode_nla_bin_alloc(data, len,
+							      bin_format,
+							      &consumed,
+							      &produced,
+							      &error);
+			nla_stream = bin_buf;
+			rc = bin_buf ? 0 : -1;
+		} else {
+			rc = nljson_decode_nla_ctx(ctx, (const char *) data + i,
+						   len - i, &nla_stream,
+						   &consumed, &produced,
+						   json_format_flags, &error);
+		}
+		if (rc) {
+			/* The error could be caused by an incomplete JSON
+			 * object, so we only report it when there is no
+			 * more data.
 			 */
-			for (i = 0; i < in_buf_len; i++) {
-				if (in_buf[i] == '{')
-					break;
+			if (!in.eof) {
+				retry_len = 2 * len;
+				continue;
 			}
 
-			if (i > 0) {
-				in_buf_len -= i;
-				memmove(in_buf, in_buf + i, in_buf_len);
-			}
+			run_stats_message(stats, 0, start, 0, 0, true);
+			fprintf(stderr, "Decoding error: %s\n", error.err_msg);
+			break;
 		}
-
-		if (eof_reached)
+		run_stats_message(stats, 0, start, consumed, produced, false);
+		retry_len = 0;
+
+		start = run_stats_now(stats);
+		rc = write_nla_stream(&out, nla_stream, produced);
+		free(bin_buf);
+		if (rc) {
+			fprintf(stderr, "Error: Unable to write output\n");
 			break;
-	}
+		}
+		run_stats_write(stats, start);
+		run_stats_poll(stats);
 
-	if (decode_error)
-		/* The last iteration was an error */
-		fprintf(stderr, "Decoding error: %s\n", error.err_msg);
+		io_input_consume(&in, consumed ? consumed : 1);
+	}
 out:
-	if (in_fd > 0)
-		close(in_fd);
-	if (out_fd > 1)
-		close(out_fd);
+	if (ctx)
+		nljson_ctx_deinit(&ctx);
+	if (in_open)
+		io_input_close(&in);
+	if (out_open) {
+		uint64_t start = run_stats_now(stats);
+
+		if (io_output_close(&out))
+			fprintf(stderr, "Error: Unable to write output\n");
+		run_stats_write(stats, start);
+	}
+	/* Writes the final report */
+	run_stats_destroy(stats);
 }
 
 int main(int argc, char *argv[])
@@ -214,10 +699,16 @@ int main(int argc, char *argv[])
 		{"output", required_argument, 0, 'o'},
 		{"ascii", no_argument, 0, 'a'},
 		{"version", no_argument, 0, 1000},
+		{"buffer-size", required_argument, 0, 'b'},
+		{"threads", required_argument, 0, 1001},
+		{"framed", no_argument, 0, 1002},
+		{"stats", optional_argument, 0, 1003},
+		{"stats-file", required_argument, 0, 1004},
+		{"format", required_argument, 0, 1005},
 		{NULL, 0, 0, 0},
 	};
 
-	while ((opt = getopt_long(argc, argv, "hf:i:o:a", long_opts, &optind)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hf:i:o:ab:", long_opts, &optind)) != -1) {
 		switch (opt) {
 		case 'f':
 			json_format_flags = strtoul(optarg, &tmp, 0);
@@ -238,9 +729,57 @@ int main(int argc, char *argv[])
 		case 'a':
 			ascii_output = true;
 			break;
+		case 'b':
+			buffer_size = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (buffer_size == 0)) {
+				fprintf(stderr, "Bad buffer size: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
 		case 1000:
 			print_version();
 			return 0;
+		case 1001:
+			num_threads = strtoul(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad number of threads: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1002:
+			framed = true;
+			break;
+		case 1003:
+			stats_enabled = true;
+			if (!optarg)
+				break;
+			stats_interval = strtod(optarg, &tmp);
+			if ((*tmp != '\0') || (stats_interval < 0)) {
+				fprintf(stderr, "Bad stats interval: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1004:
+			strncpy(stats_file, optarg, sizeof(stats_file));
+			stats_file_set = true;
+			stats_enabled = true;
+			break;
+		case 1005:
+			if (!strcmp(optarg, "cbor")) {
+				bin_input = true;
+				bin_format = NLJSON_BIN_CBOR;
+			} else if (!strcmp(optarg, "msgpack")) {
+				bin_input = true;
+				bin_format = NLJSON_BIN_MSGPACK;
+			} else if (strcmp(optarg, "json")) {
+				fprintf(stderr, "Bad input format: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
 		case 'h':
 		default:
 			print_usage(argv[0]);
@@ -248,6 +787,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (bin_input && num_threads) {
+		fprintf(stderr, "--threads can't be used with binary formats\n");
+		return -1;
+	}
+
 	do_decode();
 	return 0;
 }
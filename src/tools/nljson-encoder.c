@@ -31,13 +31,71 @@
 #include <errno.h>
 #include <nljson_tools_config.h>
 
+#include "nljson_pipeline.h"
+#include "nljson_io.h"
+#include "nljson_hist.h"
+#include "nljson_pcap.h"
+
+/* Max size of the blocks of attributes encoded into one JSON object */
 #define IN_BUF_LEN (1024)
 #define FILE_NAME_LEN (256)
+/* Size of the per thread scratch arenas used in --threads mode */
+#define ARENA_SIZE (256 * 1024)
+#define NLA_HDR_LEN (4)
+#define NLA_ALIGN_LEN(len) (((len) + 3) & ~3)
+/* Max length of the start of the JSON object written for each captured
+ * message in --pcap mode (see format_pcap_prefix)
+ */
+#define PCAP_PREFIX_LEN (128)
+#define PCAP_SUFFIX "}\n"
+#define PCAP_SUFFIX_LEN (sizeof(PCAP_SUFFIX) - 1)
 
-static char *policy_file, *input_file, *output_file;
-static uint8_t in_buf[IN_BUF_LEN];
+static char *policy_file, *input_file, *output_file, *stats_file;
+static char *profile_file;
 static uint32_t json_format_flags;
 static uint32_t nljson_flags;
+static unsigned int num_threads;
+static size_t buffer_size = IO_DEFAULT_BUF_SIZE;
+static bool framed, hex_input, stats_enabled, pcap_input;
+/* --format cbor|msgpack */
+static bool bin_output;
+static enum nljson_bin_format bin_format;
+static double stats_interval;
+/* Run statistics (NULL unless --stats is used) */
+static struct run_stats *stats;
+static struct pcap_reader pcap;
+
+/* The next block of input to encode into one JSON object */
+struct block {
+	const uint8_t *nla_stream;
+	size_t nla_stream_len;
+	/* Number of input bytes used by the block (including the record
+	 * header and padding in --framed mode). 0 in --pcap mode (the pcap
+	 * reader consumes the input).
+	 */
+	size_t len;
+	/* The captured message (--pcap mode) */
+	struct pcap_msg msg;
+};
+
+/* A block of complete top level attributes encoded by one worker */
+struct encode_record {
+	struct pipeline_record rec;
+	struct nljson_error error;
+	/* rec.in is a copy of the input (i.e. not in the mapped file) */
+	bool in_copied;
+	/* Start of the JSON object of the captured message (--pcap mode) */
+	char prefix[PCAP_PREFIX_LEN];
+	size_t prefix_len;
+};
+
+struct encode_pipeline {
+	nljson_t *hdl;
+	nljson_arena_t **arenas;
+	struct io_input *in;
+	struct io_output *out;
+	bool read_error;
+};
 
 static void print_usage(const char *argv0)
 {
@@ -63,6 +121,36 @@ static void print_usage(const char *argv0)
 	fprintf(stderr, "  -s, --skip-unknown Skip all unknown attributes (attributes not present in\n");
 	fprintf(stderr, "                     the policy file).\n");
 	fprintf(stderr, "  -t, --timestamps   Add timestamps to JSON output.\n");
+	fprintf(stderr, "  -b, --buffer-size  Initial size of the input and output buffers\n");
+	fprintf(stderr, "                     (default %d). Regular input files are memory\n", IO_DEFAULT_BUF_SIZE);
+	fprintf(stderr, "                     mapped. The input buffer grows if needed.\n");
+	fprintf(stderr, "  --framed           The input is a stream of framed records (see\n");
+	fprintf(stderr, "                     nljson_record_next). Each record is encoded into\n");
+	fprintf(stderr, "                     one JSON object on a line of its own.\n");
+	fprintf(stderr, "  --hex-input        The input is hex text (pairs of hex digits separated\n");
+	fprintf(stderr, "                     by whitespace or ':'), e.g. nljson-decoder -a output.\n");
+	fprintf(stderr, "  --pcap FILE        Read netlink messages from a pcap or pcapng capture\n");
+	fprintf(stderr, "                     of an nlmon interface. The attributes of each\n");
+	fprintf(stderr, "                     generic netlink message are encoded into a JSON\n");
+	fprintf(stderr, "                     object on a line of its own together with the\n");
+	fprintf(stderr, "                     capture time stamp, the message type and command.\n");
+	fprintf(stderr, "  --format FORMAT    Output format: json (default), cbor or msgpack.\n");
+	fprintf(stderr, "                     The binary formats have the same structure as the\n");
+	fprintf(stderr, "                     JSON output, but NLA_UNSPEC payloads are written as\n");
+	fprintf(stderr, "                     byte strings. In --framed mode, the binary documents\n");
+	fprintf(stderr, "                     are written back to back (without newlines).\n");
+	fprintf(stderr, "  --threads N        Encode using N worker threads. The input is split\n");
+	fprintf(stderr, "                     into blocks of complete attributes that are encoded\n");
+	fprintf(stderr, "                     in parallel. The output is written in input order.\n");
+	fprintf(stderr, "  --stats[=SECONDS]  Report throughput, errors, the time spent reading,\n");
+	fprintf(stderr, "                     encoding and writing and a histogram of the encode\n");
+	fprintf(stderr, "                     latency as JSON. The report is written every SECONDS\n");
+	fprintf(stderr, "                     (if given) and when the input has been encoded.\n");
+	fprintf(stderr, "  --stats-file FILE  Write the --stats reports to FILE instead of stderr.\n");
+	fprintf(stderr, "  --profile FILE     Count the encoded attributes per policy level and\n");
+	fprintf(stderr, "                     attribute type (including unknown attributes) and\n");
+	fprintf(stderr, "                     write the counts to FILE (one JSON object per line)\n");
+	fprintf(stderr, "                     when the input has been encoded. Requires a policy.\n");
 	fprintf(stderr, "  --version          Print version info and exit.\n");
 	fprintf(stderr, "\n");
 }
@@ -76,13 +164,388 @@ static void print_version(void)
 #endif
 }
 
+/* Returns the length of the first block of complete top level attributes
+ * in data, or 0 if more data is needed (or if the data is invalid, in
+ * which case *invalid is set).
+ * A block is at most IN_BUF_LEN bytes unless it consists of a single
+ * large attribute. Blocks only depend on the input data (and not on how
+ * it was split up by read), so the output is always the same.
+ */
+static size_t frame_block(const uint8_t *data, size_t data_len, bool eof,
+			  bool *invalid)
+{
+	size_t off = 0;
+
+	*invalid = false;
+	while (off + NLA_HDR_LEN <= data_len) {
+		uint16_t nla_len;
+		size_t len;
+
+		memcpy(&nla_len, data + off, sizeof(nla_len));
+		if (nla_len < NLA_HDR_LEN) {
+			*invalid = true;
+			return 0;
+		}
+
+		/* The padding of the last attribute may be missing */
+		len = NLA_ALIGN_LEN(nla_len);
+		if (eof && (off + len > data_len))
+			len = nla_len;
+
+		if ((off > 0) && (off + len > IN_BUF_LEN))
+			return off;
+		if (off + len > data_len)
+			break;
+
+		off += len;
+		if (off >= IN_BUF_LEN)
+			return off;
+	}
+
+	return eof ? off : 0;
+}
+
+/* Returns the length of the first record in data (--framed mode), or 0
+ * if more data is needed (or if the record header is invalid, in which
+ * case *invalid is set).
+ */
+static size_t frame_record(const uint8_t *data, size_t data_len,
+			   struct block *block, bool *invalid)
+{
+	struct nljson_record_hdr hdr;
+	struct nljson_error error;
+	const void *nla_stream;
+	size_t len;
+
+	*invalid = nljson_record_next(data, data_len, &hdr, &nla_stream,
+				      &len, &error) != 0;
+	if (len > 0) {
+		block->nla_stream = nla_stream;
+		block->nla_stream_len = hdr.len;
+	}
+
+	return len;
+}
+
+/* Formats the start of the JSON object of a captured message. The
+ * encoded attributes and PCAP_SUFFIX are written after it.
+ */
+static size_t format_pcap_prefix(char *buf, const struct pcap_msg *msg)
+{
+	int len;
+
+	len = snprintf(buf, PCAP_PREFIX_LEN,
+		       "{\"ts\": %llu.%09u, \"nlmsg_type\": %u, "
+		       "\"genl_cmd\": %u, \"attrs\": ",
+		       (unsigned long long) msg->ts_sec, msg->ts_nsec,
+		       msg->nlmsg_type, msg->genl_cmd);
+	return len > 0 ? len : 0;
+}
+
+/* Gets the next message of the capture (--pcap mode) */
+static bool next_pcap_block(struct io_input *in, struct block *block,
+			    bool *read_error)
+{
+	int rc;
+
+	rc = pcap_next_msg(&pcap, in, &block->msg);
+	if (rc < 0) {
+		fprintf(stderr, "Encoding error: %s\n", pcap.error);
+		*read_error = true;
+	}
+	if (rc <= 0)
+		return false;
+
+	block->nla_stream = block->msg.nla_stream;
+	block->nla_stream_len = block->msg.nla_stream_len;
+	block->len = 0;
+	return true;
+}
+
+/* Gets the next block in the input (reading more data if necessary).
+ * Returns false if there are no more blocks.
+ */
+static bool next_block(struct io_input *in, struct block *block,
+		       bool *read_error)
+{
+	bool invalid;
+
+	if (pcap_input)
+		return next_pcap_block(in, block, read_error);
+
+	for (;;) {
+		if (framed) {
+			block->len = frame_record(io_input_data(in),
+						  io_input_len(in), block,
+						  &invalid);
+		} else {
+			block->len = frame_block(io_input_data(in),
+						 io_input_len(in), in->eof,
+						 &invalid);
+			block->nla_stream = io_input_data(in);
+			block->nla_stream_len = block->len;
+		}
+		if (block->len > 0)
+			return true;
+
+		if (invalid || in->eof)
+			break;
+
+		if (io_input_fill(in) < 0)
+			break;
+	}
+
+	if (in->invalid) {
+		fprintf(stderr, "Encoding error: Invalid hex input\n");
+		*read_error = true;
+	} else if (invalid || (io_input_len(in) > 0)) {
+		fprintf(stderr, "Encoding error: Invalid or truncated input "
+			"(%zu trailing bytes)\n", io_input_len(in));
+		*read_error = true;
+	} else if (!in->eof) {
+		fprintf(stderr, "Error: Unable to read input\n");
+		*read_error = true;
+	}
+
+	return false;
+}
+
+static struct pipeline_record *encode_read(void *data)
+{
+	struct encode_pipeline *pl = (struct encode_pipeline *) data;
+	struct encode_record *er;
+	struct block block;
+	uint64_t start = run_stats_now(stats);
+
+	if (!next_block(pl->in, &block, &pl->read_error))
+		return NULL;
+
+	er = calloc(1, sizeof(*er));
+	if (!er) {
+		pl->read_error = true;
+		return NULL;
+	}
+
+	/* Blocks in a mapped file are used directly. Blocks in the input
+	 * buffer must be copied since the buffer is reused.
+	 */
+	if (pl->in->mapped) {
+		er->rec.in = (void *) block.nla_stream;
+	} else {
+		er->rec.in = malloc(block.nla_stream_len ?
+				    block.nla_stream_len : 1);
+		if (!er->rec.in) {
+			free(er);
+			pl->read_error = true;
+			return NULL;
+		}
+		memcpy(er->rec.in, block.nla_stream, block.nla_stream_len);
+		er->in_copied = true;
+	}
+	er->rec.in_len = block.nla_stream_len;
+	if (pcap_input)
+		er->prefix_len = format_pcap_prefix(er->prefix, &block.msg);
+	io_input_consume(pl->in, block.len);
+	run_stats_read(stats, start);
+
+	return &er->rec;
+}
+
+static void encode_process(unsigned int worker, struct pipeline_record *rec,
+			   void *data)
+{
+	struct encode_pipeline *pl = (struct encode_pipeline *) data;
+	struct encode_record *er = (struct encode_record *) rec;
+	size_t consumed, produced;
+	uint64_t start = run_stats_now(stats);
+
+	nljson_arena_use(pl->arenas[worker]);
+	if (bin_output)
+		rec->out = nljson_encode_nla_bin_alloc(pl->hdl, rec->in,
+						       rec->in_len, bin_format,
+						       &consumed, &produced,
+						       &er->error);
+	else
+		rec->out = nljson_encode_nla_alloc(pl->hdl, rec->in,
+						   rec->in_len, &consumed,
+						   &produced,
+						   json_format_flags,
+						   &er->error);
+	nljson_arena_use(NULL);
+	run_stats_message(stats, worker, start, rec->in_len,
+			  produced + ((framed && !bin_output) ? 1 : 0) +
+			  (pcap_input ? er->prefix_len + PCAP_SUFFIX_LEN : 0),
+			  !rec->out);
+
+	rec->out_len = produced;
+	rec->status = rec->out ? 0 : -1;
+}
+
+static int encode_write(struct pipeline_record **recs, size_t num_recs,
+			void *data)
+{
+	struct encode_pipeline *pl = (struct encode_pipeline *) data;
+	struct iovec iov[3 * PIPELINE_MAX_BATCH];
+	uint64_t start = run_stats_now(stats);
+	size_t i;
+	int iovcnt = 0, rc;
+
+	for (i = 0; i < num_recs; i++) {
+		struct encode_record *er = (struct encode_record *) recs[i];
+
+		if (recs[i]->status) {
+			fprintf(stderr, "Encoding error: %s\n",
+				er->error.err_msg);
+			continue;
+		}
+
+		if (pcap_input) {
+			iov[iovcnt].iov_base = er->prefix;
+			iov[iovcnt].iov_len = er->prefix_len;
+			iovcnt++;
+		}
+		iov[iovcnt].iov_base = recs[i]->out;
+		iov[iovcnt].iov_len = recs[i]->out_len;
+		iovcnt++;
+		if (framed && !bin_output) {
+			iov[iovcnt].iov_base = "\n";
+			iov[iovcnt].iov_len = 1;
+			iovcnt++;
+		} else if (pcap_input) {
+			iov[iovcnt].iov_base = PCAP_SUFFIX;
+			iov[iovcnt].iov_len = PCAP_SUFFIX_LEN;
+			iovcnt++;
+		}
+	}
+
+	rc = io_output_writev(pl->out, iov, iovcnt);
+	run_stats_write(stats, start);
+	run_stats_poll(stats);
+	return rc;
+}
+
+static void encode_release(struct pipeline_record *rec, void *data)
+{
+	struct encode_record *er = (struct encode_record *) rec;
+
+	(void) data;
+
+	if (er->in_copied)
+		free(rec->in);
+	free(rec->out);
+	free(er);
+}
+
+static void do_encode_threads(nljson_t *hdl, struct io_input *in,
+			      struct io_output *out)
+{
+	struct pipeline_ops ops = {
+		.read = encode_read,
+		.process = encode_process,
+		.write = encode_write,
+		.release = encode_release,
+	};
+	struct encode_pipeline pl;
+	struct nljson_error error;
+	unsigned int i;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.hdl = hdl;
+	pl.in = in;
+	pl.out = out;
+	pl.arenas = calloc(num_threads, sizeof(*pl.arenas));
+	if (!pl.arenas) {
+		fprintf(stderr, "calloc returned NULL!\n");
+		return;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		if (nljson_arena_init(&pl.arenas[i], ARENA_SIZE, &error)) {
+			fprintf(stderr, "Init error: %s\n", error.err_msg);
+			goto out;
+		}
+	}
+
+	if (pipeline_run(num_threads, &ops, &pl))
+		fprintf(stderr, "Error: Unable to write output\n");
+out:
+	for (i = 0; i < num_threads; i++)
+		nljson_arena_deinit(&pl.arenas[i]);
+	free(pl.arenas);
+}
+
+static void print_json_string(FILE *f, const char *str)
+{
+	if (!str) {
+		fputs("null", f);
+		return;
+	}
+
+	fputc('"', f);
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if ((c == '"') || (c == '\\'))
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static int print_profile_entry(const struct nljson_profile_entry *entry,
+			       void *data)
+{
+	FILE *f = (FILE *) data;
+
+	fputs("{\"level\": ", f);
+	print_json_string(f, entry->level);
+	if (entry->nla_type == NLJSON_PROFILE_OTHER_TYPE)
+		fputs(", \"nla_type\": null", f);
+	else
+		fprintf(f, ", \"nla_type\": %u", entry->nla_type);
+	fputs(", \"name\": ", f);
+	print_json_string(f, entry->name);
+	fputs(", \"data_type\": ", f);
+	print_json_string(f, entry->data_type);
+	fprintf(f, ", \"hits\": %llu}\n", (unsigned long long) entry->hits);
+	return ferror(f) ? -1 : 0;
+}
+
+/* Writes the --profile output */
+static void write_profile(nljson_t *hdl)
+{
+	FILE *f;
+	int rc;
+
+	f = fopen(profile_file, "w");
+	if (!f) {
+		fprintf(stderr, "Unable to open profile output: %s\n",
+			strerror(errno));
+		return;
+	}
+
+	rc = nljson_get_profile(hdl, print_profile_entry, f);
+	if (fclose(f))
+		rc = -1;
+	if (rc)
+		fprintf(stderr, "Error: Unable to write profile output\n");
+}
+
 static void do_encode(void)
 {
-	int rc = 0, in_fd, out_fd;
+	int rc = 0;
 	nljson_t *hdl = NULL;
-	size_t in_buf_len = 0;
+	nljson_ctx_t *ctx = NULL;
+	struct io_input in;
+	struct io_output out;
 	struct nljson_error error;
-	bool encode_error = false;
+	bool in_open = false, out_open = false, read_error = false;
+	bool profile = false;
+
+	pcap_reader_init(&pcap);
 
 	if (policy_file || nljson_flags)
 		rc = nljson_init_file(&hdl, 0, nljson_flags,
@@ -93,94 +556,147 @@ static void do_encode(void)
 		goto out;
 	}
 
-	if (input_file)
-		in_fd = open(input_file, O_RDONLY);
+	if (profile_file) {
+		if (!hdl) {
+			fprintf(stderr, "--profile requires a policy\n");
+			goto out;
+		}
+		if (nljson_enable_profile(hdl, 1, &error)) {
+			fprintf(stderr, "Profile error: %s\n", error.err_msg);
+			goto out;
+		}
+		profile = true;
+	}
+
+	if (hex_input)
+		rc = io_input_open_hex(&in, input_file, buffer_size);
 	else
-		in_fd = 0;
+		rc = io_input_open(&in, input_file, buffer_size);
+	if (rc) {
+		fprintf(stderr, "Unable to open input: %s\n", strerror(errno));
+		goto out;
+	}
+	in_open = true;
 
-	if (in_fd < 0)
+	if (io_output_open(&out, output_file, buffer_size)) {
+		fprintf(stderr, "Unable to open output: %s\n", strerror(errno));
 		goto out;
+	}
+	out_open = true;
 
-	if (output_file)
-		out_fd = open(output_file, O_WRONLY);
-	else
-		out_fd = 1;
+	if (stats_enabled) {
+		stats = run_stats_create("nljson-encoder", stats_file,
+					 stats_interval,
+					 num_threads ? num_threads : 1);
+		if (!stats) {
+			fprintf(stderr, "Unable to open stats output: %s\n",
+				strerror(errno));
+			goto out;
+		}
+	}
+
+	if (num_threads > 0) {
+		do_encode_threads(hdl, &in, &out);
+		goto out;
+	}
 
-	if (out_fd < 0)
+	if (nljson_ctx_init(&ctx, 0, &error)) {
+		fprintf(stderr, "Init error: %s\n", error.err_msg);
 		goto out;
+	}
 
 	/**
 	 * Main processing loop:
-	 * Reads the input stream and encodes the data.
-	 * Trailing input data (data not processed by the encoding functions)
-	 * is saved for the next iteration.
+	 * Splits the input into blocks of complete attributes (or records in
+	 * --framed mode or captured messages in --pcap mode) and encodes
+	 * each block into a JSON object. The output is written from the
+	 * output buffer of the context, so nothing is allocated per block
+	 * (except for the binary formats).
 	 */
 	for (;;) {
-		ssize_t read_len, write_len;
-		size_t consumed, produced;
-		bool eof_reached = false;
-
-		read_len = read(in_fd, in_buf + in_buf_len,
-				sizeof(in_buf) - in_buf_len);
-		if (read_len <= 0) {
-			read_len = 0;
-			eof_reached = true;
-		}
-
-		in_buf_len += read_len;
-
-		while (in_buf_len > 0) {
-			char *out_buf;
+		size_t consumed, produced, prefix_len = 0;
+		bool newline = framed && !bin_output;
+		size_t extra = newline ? 1 : 0;
+		char prefix[PCAP_PREFIX_LEN];
+		const char *out_buf;
+		void *bin_buf = NULL;
+		struct block block;
+		uint64_t start;
 
-			out_buf = nljson_encode_nla_alloc(hdl, in_buf,
-							  sizeof(in_buf),
-							  &consumed, &produced,
-							  json_format_flags,
-							  &error);
-
-			if (!out_buf) {
-				/* We don't print the error here since the
-				 * error could be caused by an incomplete
-				 * input buffer and we could get more data
-				 * in the next iteration.
-				 */
-				encode_error = true;
-				break;
-			}
-
-			encode_error = false;
-
-			if ((produced == 0) || (consumed == 0))
-				break;
+		start = run_stats_now(stats);
+		if (!next_block(&in, &block, &read_error))
+			break;
+		run_stats_read(stats, start);
 
-			write_len = write(out_fd, out_buf, produced);
-			free(out_buf);
-			if ((size_t) write_len != produced)
-				break;
-			if (consumed > (size_t) in_buf_len) {
-				fprintf(stderr, "Error: Consumed %u bytes "
-					"out of %u", consumed, produced);
-				break;
-			}
+		if (pcap_input) {
+			prefix_len = format_pcap_prefix(prefix, &block.msg);
+			extra = prefix_len + PCAP_SUFFIX_LEN;
+		}
 
-			in_buf_len -= consumed;
-			memmove(in_buf, in_buf + consumed, in_buf_len);
+		start = run_stats_now(stats);
+		if (bin_output) {
+			bin_buf = nljson_encode_nla_bin_alloc(hdl,
+							      block.nla_stream,
+							      block.nla_stream_len,
+							      bin_format,
+							      &consumed,
+							      &produced,
+							      &error);
+			out_buf = bin_buf;
+			rc = bin_buf ? 0 : -1;
+		} else {
+			rc = nljson_encode_nla_ctx(hdl, ctx, block.nla_stream,
+						   block.nla_stream_len,
+						   &out_buf, &consumed,
+						   &produced,
+						   json_format_flags, &error);
+		}
+		run_stats_message(stats, 0, start, block.nla_stream_len,
+				  produced + extra, rc != 0);
+		io_input_consume(&in, block.len);
+		if (rc) {
+			fprintf(stderr, "Encoding error: %s\n",
+				error.err_msg);
+			continue;
 		}
 
-		if (eof_reached)
+		start = run_stats_now(stats);
+		rc = (prefix_len && io_output_write(&out, prefix, prefix_len)) ||
+		     io_output_write(&out, out_buf, produced) ||
+		     (newline && io_output_write(&out, "\n", 1)) ||
+		     (pcap_input && io_output_write(&out, PCAP_SUFFIX,
+						    PCAP_SUFFIX_LEN));
+		free(bin_buf);
+		if (rc) {
+			fprintf(stderr, "Error: Unable to write output\n");
 			break;
+		}
+		run_stats_write(stats, start);
+		run_stats_poll(stats);
 	}
-
-	if (encode_error)
-		/* The last iteration was an error */
-		fprintf(stderr, "Encoding error: %s\n", error.err_msg);
 out:
+	if (ctx)
+		nljson_ctx_deinit(&ctx);
+	if (profile)
+		write_profile(hdl);
 	if (hdl)
 		nljson_deinit(&hdl);
-	if (in_fd > 0)
-		close(in_fd);
-	if (out_fd > 1)
-		close(out_fd);
+	if (in_open)
+		io_input_close(&in);
+	pcap_reader_deinit(&pcap);
+	if (out_open) {
+		uint64_t start = run_stats_now(stats);
+
+		if (io_output_close(&out))
+			fprintf(stderr, "Error: Unable to write output\n");
+		run_stats_write(stats, start);
+	}
+	/* Writes the final report */
+	run_stats_destroy(stats);
+	if (stats_file)
+		free(stats_file);
+	if (profile_file)
+		free(profile_file);
 	if (policy_file)
 		free(policy_file);
 	if (input_file)
@@ -202,10 +718,19 @@ int main(int argc, char *argv[])
 		{"skip-unknown", no_argument, 0, 's'},
 		{"timestamps", no_argument, 0, 't'},
 		{"version", no_argument, 0, 1000},
+		{"buffer-size", required_argument, 0, 'b'},
+		{"threads", required_argument, 0, 1001},
+		{"framed", no_argument, 0, 1002},
+		{"hex-input", no_argument, 0, 1003},
+		{"stats", optional_argument, 0, 1004},
+		{"stats-file", required_argument, 0, 1005},
+		{"profile", required_argument, 0, 1006},
+		{"pcap", required_argument, 0, 1007},
+		{"format", required_argument, 0, 1008},
 		{NULL, 0, 0, 0},
 	};
 
-	while ((opt = getopt_long(argc, argv, "hp:f:i:o:st", long_opts, &optind)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hp:f:i:o:stb:", long_opts, &optind)) != -1) {
 		switch (opt) {
 		case 'p':
 			policy_file = calloc(FILE_NAME_LEN, 1);
@@ -245,9 +770,82 @@ int main(int argc, char *argv[])
 		case 't':
 			nljson_flags |= NLJSON_FLAG_ADD_TIMESTAMP;
 			break;
+		case 'b':
+			buffer_size = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (buffer_size == 0)) {
+				fprintf(stderr, "Bad buffer size: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
 		case 1000:
 			print_version();
 			return 0;
+		case 1001:
+			num_threads = strtoul(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad number of threads: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1002:
+			framed = true;
+			break;
+		case 1003:
+			hex_input = true;
+			break;
+		case 1004:
+			stats_enabled = true;
+			if (!optarg)
+				break;
+			stats_interval = strtod(optarg, &tmp);
+			if ((*tmp != '\0') || (stats_interval < 0)) {
+				fprintf(stderr, "Bad stats interval: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1005:
+			stats_file = calloc(FILE_NAME_LEN, 1);
+			if (!stats_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(stats_file, optarg, FILE_NAME_LEN);
+			stats_enabled = true;
+			break;
+		case 1006:
+			profile_file = calloc(FILE_NAME_LEN, 1);
+			if (!profile_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(profile_file, optarg, FILE_NAME_LEN);
+			break;
+		case 1007:
+			if (!input_file)
+				input_file = calloc(FILE_NAME_LEN, 1);
+			if (!input_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(input_file, optarg, FILE_NAME_LEN);
+			pcap_input = true;
+			break;
+		case 1008:
+			if (!strcmp(optarg, "cbor")) {
+				bin_output = true;
+				bin_format = NLJSON_BIN_CBOR;
+			} else if (!strcmp(optarg, "msgpack")) {
+				bin_output = true;
+				bin_format = NLJSON_BIN_MSGPACK;
+			} else if (strcmp(optarg, "json")) {
+				fprintf(stderr, "Bad output format: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
 		case 'h':
 		default:
 			print_usage(argv[0]);
@@ -255,6 +853,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (pcap_input && framed) {
+		fprintf(stderr, "--pcap can't be used with --framed\n");
+		return -1;
+	}
+
+	if (pcap_input && bin_output) {
+		fprintf(stderr, "--pcap can't be used with binary formats\n");
+		return -1;
+	}
+
 	do_encode();
 	return 0;
 }
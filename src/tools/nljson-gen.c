@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <nljson.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <nljson_tools_config.h>
+
+#include "nljson_io.h"
+
+#define FILE_NAME_LEN (256)
+/* Default max length of a generated message */
+#define DEFAULT_MAX_LEN (64 * 1024)
+/* Length of the headers in front of the nla stream in --genl mode */
+#define GENL_HDR_LEN (NLMSG_HDRLEN + GENL_HDRLEN)
+#define NSEC_PER_SEC (1000000000ULL)
+/* Default time between the time stamps of two records (1 ms) */
+#define DEFAULT_TIME_STEP (1000000)
+
+static char *policy_file, *output_file;
+static unsigned long long num_messages = 1;
+static uint64_t seed = 1;
+static uint32_t gen_flags;
+static size_t buffer_size = IO_DEFAULT_BUF_SIZE;
+static size_t max_len = DEFAULT_MAX_LEN;
+static bool genl, framed;
+static uint16_t genl_family;
+static uint8_t genl_cmd;
+/* Time stamp of the first record and time between records (ns) */
+static uint64_t start_time;
+static uint64_t time_step = DEFAULT_TIME_STEP;
+
+static void print_usage(const char *argv0)
+{
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "%s OPTIONS\n", argv0);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "nljson-gen generates random (but valid) netlink attribute streams from\n");
+	fprintf(stderr, "a policy file and writes them to stdout or a file.\n");
+	fprintf(stderr, "The output only depends on the policy and the seed.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -p, --policy       netlink attribute policy file in JSON format.\n");
+	fprintf(stderr, "  -o, --output       Output file.\n");
+	fprintf(stderr, "                     If omitted, the output will be written to stdout.\n");
+	fprintf(stderr, "  -n, --count N      Number of messages to generate (default 1).\n");
+	fprintf(stderr, "  -s, --seed N       Seed of the random number generator (default 1).\n");
+	fprintf(stderr, "  -a, --all-attrs    Include all attributes of the policy in each message.\n");
+	fprintf(stderr, "                     Otherwise each attribute is included with a\n");
+	fprintf(stderr, "                     probability of 50%%.\n");
+	fprintf(stderr, "  -m, --max-len N    Max length of a message (default %d).\n", DEFAULT_MAX_LEN);
+	fprintf(stderr, "  -b, --buffer-size  Size of the output buffer (default %d).\n", IO_DEFAULT_BUF_SIZE);
+	fprintf(stderr, "  --genl FAMILY:CMD  Wrap each message in a netlink message header\n");
+	fprintf(stderr, "                     (nlmsg_type FAMILY) and a generic netlink header\n");
+	fprintf(stderr, "                     (command CMD).\n");
+	fprintf(stderr, "  --framed           Write each message as a framed record (see\n");
+	fprintf(stderr, "                     nljson_record_next). If --genl is given, the family\n");
+	fprintf(stderr, "                     and command are stored in the record header instead.\n");
+	fprintf(stderr, "  --start-time SEC   Time stamp of the first record in seconds since the\n");
+	fprintf(stderr, "                     epoch (--framed, default 0).\n");
+	fprintf(stderr, "  --time-step NS     Time between the time stamps of two records in\n");
+	fprintf(stderr, "                     nanoseconds (--framed, default %d).\n", DEFAULT_TIME_STEP);
+	fprintf(stderr, "  --version          Print version info and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+static void print_version(void)
+{
+#if GIT_SHA_AVAILABLE
+	fprintf(stderr, "\n%s-%s\n\n", VERSION, GIT_SHA);
+#else
+	fprintf(stderr, "\n%s-\n\n", VERSION);
+#endif
+}
+
+/* Writes one message (with the headers selected by the options). The nla
+ * stream is at buf + GENL_HDR_LEN, so the netlink headers can be added in
+ * front of it without copying.
+ */
+static int write_message(struct io_output *out, uint8_t *buf, size_t len,
+			 unsigned long long index)
+{
+	static const uint8_t pad[NLJSON_RECORD_ALIGN];
+	struct nljson_record_hdr record_hdr;
+	struct nlmsghdr nlh;
+	struct genlmsghdr genlh;
+	struct nljson_error error;
+
+	if (framed) {
+		if (nljson_record_hdr_init(&record_hdr, len, genl_family,
+					   genl_cmd, &error))
+			return -1;
+
+		/* The current time would make the output differ between
+		 * runs with the same seed.
+		 */
+		record_hdr.timestamp = start_time + index * time_step;
+
+		return io_output_write(out, &record_hdr, sizeof(record_hdr)) ||
+		       io_output_write(out, buf + GENL_HDR_LEN, len) ||
+		       io_output_write(out, pad, nljson_record_len(len) -
+						 sizeof(record_hdr) - len);
+	}
+
+	if (!genl)
+		return io_output_write(out, buf + GENL_HDR_LEN, len);
+
+	memset(&nlh, 0, sizeof(nlh));
+	nlh.nlmsg_len = GENL_HDR_LEN + len;
+	nlh.nlmsg_type = genl_family;
+	nlh.nlmsg_seq = index + 1;
+
+	memset(&genlh, 0, sizeof(genlh));
+	genlh.cmd = genl_cmd;
+	genlh.version = 1;
+
+	memcpy(buf, &nlh, sizeof(nlh));
+	memcpy(buf + NLMSG_HDRLEN, &genlh, sizeof(genlh));
+
+	return io_output_write(out, buf, GENL_HDR_LEN + len);
+}
+
+static void do_gen(void)
+{
+	nljson_t *hdl = NULL;
+	struct io_output out;
+	struct nljson_error error;
+	unsigned long long i;
+	uint8_t *buf = NULL;
+	bool out_open = false;
+
+	if (!policy_file) {
+		fprintf(stderr, "A policy file is needed (--policy)\n");
+		goto out;
+	}
+
+	if (nljson_init_file(&hdl, 0, 0, policy_file, &error)) {
+		fprintf(stderr, "Init error: %s\n", error.err_msg);
+		goto out;
+	}
+
+	buf = malloc(GENL_HDR_LEN + max_len);
+	if (!buf) {
+		fprintf(stderr, "malloc returned NULL!\n");
+		goto out;
+	}
+
+	if (io_output_open(&out, output_file, buffer_size)) {
+		fprintf(stderr, "Unable to open output: %s\n", strerror(errno));
+		goto out;
+	}
+	out_open = true;
+
+	for (i = 0; i < num_messages; i++) {
+		size_t len;
+
+		if (nljson_generate_nla(hdl, &seed, buf + GENL_HDR_LEN,
+					max_len, &len, gen_flags, &error)) {
+			fprintf(stderr, "Generate error: %s\n", error.err_msg);
+			break;
+		}
+
+		if (write_message(&out, buf, len, i)) {
+			fprintf(stderr, "Error: Unable to write output\n");
+			break;
+		}
+	}
+out:
+	if (out_open && io_output_close(&out))
+		fprintf(stderr, "Error: Unable to write output\n");
+	free(buf);
+	if (hdl)
+		nljson_deinit(&hdl);
+	if (policy_file)
+		free(policy_file);
+	if (output_file)
+		free(output_file);
+}
+
+static int parse_genl(const char *arg)
+{
+	unsigned long family, cmd;
+	char *tmp;
+
+	family = strtoul(arg, &tmp, 0);
+	if ((tmp == arg) || (*tmp != ':') || (family > UINT16_MAX))
+		return -1;
+
+	arg = tmp + 1;
+	cmd = strtoul(arg, &tmp, 0);
+	if ((tmp == arg) || (*tmp != '\0') || (cmd > UINT8_MAX))
+		return -1;
+
+	genl_family = family;
+	genl_cmd = cmd;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, optind = 0;
+	char *tmp;
+	struct option long_opts[] = {
+		{"help", no_argument, 0, 'h'},
+		{"policy", required_argument, 0, 'p'},
+		{"output", required_argument, 0, 'o'},
+		{"count", required_argument, 0, 'n'},
+		{"seed", required_argument, 0, 's'},
+		{"all-attrs", no_argument, 0, 'a'},
+		{"max-len", required_argument, 0, 'm'},
+		{"buffer-size", required_argument, 0, 'b'},
+		{"version", no_argument, 0, 1000},
+		{"genl", required_argument, 0, 1001},
+		{"framed", no_argument, 0, 1002},
+		{"start-time", required_argument, 0, 1003},
+		{"time-step", required_argument, 0, 1004},
+		{NULL, 0, 0, 0},
+	};
+
+	while ((opt = getopt_long(argc, argv, "hp:o:n:s:am:b:", long_opts, &optind)) != -1) {
+		switch (opt) {
+		case 'p':
+			policy_file = calloc(FILE_NAME_LEN, 1);
+			if (!policy_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(policy_file, optarg, FILE_NAME_LEN);
+			break;
+		case 'o':
+			output_file = calloc(FILE_NAME_LEN, 1);
+			if (!output_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(output_file, optarg, FILE_NAME_LEN);
+			break;
+		case 'n':
+			num_messages = strtoull(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad number of messages: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 's':
+			seed = strtoull(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad seed: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'a':
+			gen_flags |= NLJSON_GEN_FLAG_ALL_ATTRS;
+			break;
+		case 'm':
+			max_len = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (max_len == 0)) {
+				fprintf(stderr, "Bad max length: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'b':
+			buffer_size = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (buffer_size == 0)) {
+				fprintf(stderr, "Bad buffer size: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1000:
+			print_version();
+			return 0;
+		case 1001:
+			if (parse_genl(optarg)) {
+				fprintf(stderr, "Bad generic netlink family/command: %s\n",
+					optarg);
+				return -1;
+			}
+			genl = true;
+			break;
+		case 1002:
+			framed = true;
+			break;
+		case 1003:
+			start_time = strtoull(optarg, &tmp, 0);
+			if ((*tmp != '\0') ||
+			    (start_time > UINT64_MAX / NSEC_PER_SEC)) {
+				fprintf(stderr, "Bad start time: %s\n", optarg);
+				return -1;
+			}
+			start_time *= NSEC_PER_SEC;
+			break;
+		case 1004:
+			time_step = strtoull(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad time step: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'h':
+		default:
+			print_usage(argv[0]);
+			return 0;
+		}
+	}
+
+	do_gen();
+	return 0;
+}
@@ -0,0 +1,804 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/* recvmmsg */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <nljson.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <linux/neighbour.h>
+#include <nljson_tools_config.h>
+
+#include "nljson_io.h"
+
+#define FILE_NAME_LEN (256)
+#define MAX_GROUPS (32)
+#define GROUP_NAME_LEN (GENL_NAMSIZ)
+/* Default number of messages received with one recvmmsg call */
+#define DEFAULT_BATCH (64)
+/* Default size of the receive buffer of each message */
+#define DEFAULT_MSG_BUF_SIZE (64 * 1024)
+/* Default socket receive buffer size (SO_RCVBUF) */
+#define DEFAULT_RCVBUF (4 * 1024 * 1024)
+/* Max length of the start of the JSON object of an event */
+#define PREFIX_LEN (128)
+#define SUFFIX "}\n"
+#define SUFFIX_LEN (sizeof(SUFFIX) - 1)
+
+static char *policy_file, *output_file, *archive_file;
+static char family_name[GENL_NAMSIZ];
+static char group_names[MAX_GROUPS][GROUP_NAME_LEN];
+static unsigned int num_group_names;
+static uint32_t rtnl_groups[MAX_GROUPS];
+static unsigned int num_rtnl_groups;
+static uint32_t json_format_flags;
+static uint32_t nljson_flags;
+static unsigned int batch = DEFAULT_BATCH;
+static size_t msg_buf_size = DEFAULT_MSG_BUF_SIZE;
+static int rcvbuf = DEFAULT_RCVBUF;
+static unsigned long long max_events;
+static volatile sig_atomic_t stop;
+
+/* Event counters (written to stderr on exit) */
+struct monitor_counters {
+	uint64_t events;
+	uint64_t bytes;
+	/* Number of times the socket receive buffer overflowed (ENOBUFS).
+	 * Events have been lost each time.
+	 */
+	uint64_t overruns;
+	/* Messages larger than the message buffer */
+	uint64_t truncated;
+	uint64_t skipped;
+	uint64_t errors;
+};
+
+struct rtnl_group {
+	const char *name;
+	uint32_t group;
+};
+
+static const struct rtnl_group rtnl_group_names[] = {
+	{"link", RTNLGRP_LINK},
+	{"neigh", RTNLGRP_NEIGH},
+	{"ipv4-ifaddr", RTNLGRP_IPV4_IFADDR},
+	{"ipv4-route", RTNLGRP_IPV4_ROUTE},
+	{"ipv6-ifaddr", RTNLGRP_IPV6_IFADDR},
+	{"ipv6-route", RTNLGRP_IPV6_ROUTE},
+};
+
+static void print_usage(const char *argv0)
+{
+	unsigned int i;
+
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "%s OPTIONS\n", argv0);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "nljson-monitor receives netlink events from a generic netlink family\n");
+	fprintf(stderr, "(or rtnetlink) and encodes the attributes of each event into a JSON\n");
+	fprintf(stderr, "object on a line of its own. The output is written to stdout or a file.\n");
+	fprintf(stderr, "Generic netlink events can also be written to an archive (see\n");
+	fprintf(stderr, "nljson-archive) instead.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -p, --policy       netlink attribute policy file in JSON format.\n");
+	fprintf(stderr, "  -f, --flags        format flags for the JSON encoded output.\n");
+	fprintf(stderr, "                     See jansson library documentation for more details.\n");
+	fprintf(stderr, "  -o, --output       JSON encoded output stream.\n");
+	fprintf(stderr, "                     If omitted, the JSON output will be written to stdout.\n");
+	fprintf(stderr, "  -s, --skip-unknown Skip all unknown attributes (attributes not present in\n");
+	fprintf(stderr, "                     the policy file).\n");
+	fprintf(stderr, "  -F, --family NAME  Generic netlink family (e.g. nl80211 or nlctrl).\n");
+	fprintf(stderr, "                     The family and its multicast groups are resolved\n");
+	fprintf(stderr, "                     with nlctrl.\n");
+	fprintf(stderr, "  -g, --group NAME   Multicast group of the family to listen to (may be\n");
+	fprintf(stderr, "                     given several times). If omitted, all groups of the\n");
+	fprintf(stderr, "                     family are joined.\n");
+	fprintf(stderr, "  --rtnl GROUP       Listen to an rtnetlink group instead of a generic\n");
+	fprintf(stderr, "                     netlink family (may be given several times).\n");
+	fprintf(stderr, "                     Groups:");
+	for (i = 0; i < sizeof(rtnl_group_names) / sizeof(rtnl_group_names[0]); i++)
+		fprintf(stderr, " %s", rtnl_group_names[i].name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -n, --count N      Exit after N events (default: run until interrupted).\n");
+	fprintf(stderr, "  --batch N          Max number of messages received with one recvmmsg\n");
+	fprintf(stderr, "                     call (default %d).\n", DEFAULT_BATCH);
+	fprintf(stderr, "  --msg-size N       Size of the receive buffer of each message\n");
+	fprintf(stderr, "                     (default %d). Larger messages are truncated.\n", DEFAULT_MSG_BUF_SIZE);
+	fprintf(stderr, "  --rcvbuf N         Socket receive buffer size (default %d). If the\n", DEFAULT_RCVBUF);
+	fprintf(stderr, "                     buffer overflows, events are lost and counted as\n");
+	fprintf(stderr, "                     overruns.\n");
+	fprintf(stderr, "  --archive FILE     Write the events (unencoded) to an archive instead of\n");
+	fprintf(stderr, "                     JSON output (not with --rtnl).\n");
+	fprintf(stderr, "  --version          Print version info and exit.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "The event counters are written to stderr (as JSON) on exit.\n");
+	fprintf(stderr, "\n");
+}
+
+static void print_version(void)
+{
+#if GIT_SHA_AVAILABLE
+	fprintf(stderr, "\n%s-%s\n\n", VERSION, GIT_SHA);
+#else
+	fprintf(stderr, "\n%s-\n\n", VERSION);
+#endif
+}
+
+static void handle_signal(int sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+static int parse_rtnl_group(const char *name)
+{
+	unsigned int i;
+
+	if (num_rtnl_groups == MAX_GROUPS)
+		return -1;
+
+	for (i = 0; i < sizeof(rtnl_group_names) / sizeof(rtnl_group_names[0]); i++) {
+		if (!strcmp(rtnl_group_names[i].name, name)) {
+			rtnl_groups[num_rtnl_groups++] = rtnl_group_names[i].group;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Length of the family header of an rtnetlink message (0 if the message
+ * type is not supported)
+ */
+static size_t rtnl_hdr_len(uint16_t type)
+{
+	switch (type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		return NLMSG_ALIGN(sizeof(struct ifinfomsg));
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		return NLMSG_ALIGN(sizeof(struct ifaddrmsg));
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		return NLMSG_ALIGN(sizeof(struct rtmsg));
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		return NLMSG_ALIGN(sizeof(struct ndmsg));
+	default:
+		return 0;
+	}
+}
+
+static int join_group(int fd, uint32_t group)
+{
+	if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group,
+		       sizeof(group))) {
+		fprintf(stderr, "Unable to join multicast group %u: %s\n",
+			group, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Joins the multicast groups in the CTRL_ATTR_MCAST_GROUPS attribute
+ * that were selected with --group (or all groups).
+ */
+static int join_mcast_groups(int fd, const struct nlattr *groups)
+{
+	const struct nlattr *grp;
+	unsigned int joined = 0, i;
+	int rem, rem_grp;
+
+	rem = groups->nla_len - NLA_HDRLEN;
+	for (grp = (const struct nlattr *) ((const uint8_t *) groups + NLA_HDRLEN);
+	     (rem >= NLA_HDRLEN) && (grp->nla_len >= NLA_HDRLEN) &&
+	     (grp->nla_len <= rem);
+	     rem -= NLA_ALIGN(grp->nla_len),
+	     grp = (const struct nlattr *) ((const uint8_t *) grp + NLA_ALIGN(grp->nla_len))) {
+		const struct nlattr *attr;
+		const char *name = NULL;
+		uint32_t id = 0;
+		bool selected = (num_group_names == 0);
+
+		rem_grp = grp->nla_len - NLA_HDRLEN;
+		for (attr = (const struct nlattr *) ((const uint8_t *) grp + NLA_HDRLEN);
+		     (rem_grp >= NLA_HDRLEN) && (attr->nla_len >= NLA_HDRLEN) &&
+		     (attr->nla_len <= rem_grp);
+		     rem_grp -= NLA_ALIGN(attr->nla_len),
+		     attr = (const struct nlattr *) ((const uint8_t *) attr + NLA_ALIGN(attr->nla_len))) {
+			const void *data = (const uint8_t *) attr + NLA_HDRLEN;
+			size_t len = attr->nla_len - NLA_HDRLEN;
+
+			if (((attr->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GRP_NAME) &&
+			    memchr(data, '\0', len))
+				name = data;
+			else if (((attr->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GRP_ID) &&
+				 (len >= sizeof(id)))
+				memcpy(&id, data, sizeof(id));
+		}
+
+		if (!name || !id)
+			continue;
+
+		for (i = 0; i < num_group_names; i++) {
+			if (!strcmp(group_names[i], name))
+				selected = true;
+		}
+
+		if (!selected)
+			continue;
+		if (join_group(fd, id))
+			return -1;
+		joined++;
+	}
+
+	if ((num_group_names && (joined != num_group_names)) || !joined) {
+		fprintf(stderr, "Unknown multicast group of family %s\n",
+			family_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Resolves the family (and its multicast groups) with nlctrl and joins
+ * the groups.
+ */
+static int resolve_family(int fd, uint16_t *family_id)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct genlmsghdr genlh;
+		uint8_t attrs[NLA_HDRLEN + NLA_ALIGN(GENL_NAMSIZ)];
+	} req;
+	struct nlattr *attr = (struct nlattr *) req.attrs;
+	size_t name_len = strlen(family_name) + 1;
+	uint8_t *buf;
+	const struct nlattr *groups = NULL;
+	int rc = -1;
+
+	memset(&req, 0, sizeof(req));
+	attr->nla_type = CTRL_ATTR_FAMILY_NAME;
+	attr->nla_len = NLA_HDRLEN + name_len;
+	memcpy(req.attrs + NLA_HDRLEN, family_name, name_len);
+	req.nlh.nlmsg_len = NLMSG_HDRLEN + GENL_HDRLEN +
+			    NLA_ALIGN(attr->nla_len);
+	req.nlh.nlmsg_type = GENL_ID_CTRL;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.nlh.nlmsg_seq = 1;
+	req.genlh.cmd = CTRL_CMD_GETFAMILY;
+	req.genlh.version = 1;
+
+	buf = malloc(msg_buf_size);
+	if (!buf) {
+		fprintf(stderr, "malloc returned NULL!\n");
+		return -1;
+	}
+
+	if (send(fd, &req, req.nlh.nlmsg_len, 0) < 0) {
+		fprintf(stderr, "Unable to query nlctrl: %s\n",
+			strerror(errno));
+		goto out;
+	}
+
+	for (;;) {
+		const struct nlmsghdr *nlh = (const struct nlmsghdr *) buf;
+		const struct nlattr *cur;
+		ssize_t len;
+		int rem;
+
+		len = recv(fd, buf, msg_buf_size, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Unable to query nlctrl: %s\n",
+				strerror(errno));
+			goto out;
+		}
+
+		if (!NLMSG_OK(nlh, len) || (nlh->nlmsg_seq != 1))
+			continue;
+
+		if (nlh->nlmsg_type == NLMSG_ERROR) {
+			const struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+			fprintf(stderr, "Unknown generic netlink family %s: %s\n",
+				family_name, strerror(-err->error));
+			goto out;
+		}
+
+		rem = nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN;
+		for (cur = (const struct nlattr *) ((const uint8_t *) NLMSG_DATA(nlh) + GENL_HDRLEN);
+		     (rem >= NLA_HDRLEN) && (cur->nla_len >= NLA_HDRLEN) &&
+		     (cur->nla_len <= rem);
+		     rem -= NLA_ALIGN(cur->nla_len),
+		     cur = (const struct nlattr *) ((const uint8_t *) cur + NLA_ALIGN(cur->nla_len))) {
+			if (((cur->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID) &&
+			    (cur->nla_len >= NLA_HDRLEN + sizeof(*family_id)))
+				memcpy(family_id, (const uint8_t *) cur + NLA_HDRLEN,
+				       sizeof(*family_id));
+			else if ((cur->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GROUPS)
+				groups = cur;
+		}
+		break;
+	}
+
+	if (!groups) {
+		fprintf(stderr, "Family %s has no multicast groups\n",
+			family_name);
+		goto out;
+	}
+
+	rc = join_mcast_groups(fd, groups);
+out:
+	free(buf);
+	return rc;
+}
+
+static int open_socket(uint16_t *family_id)
+{
+	struct sockaddr_nl addr;
+	unsigned int i;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+		    num_rtnl_groups ? NETLINK_ROUTE : NETLINK_GENERIC);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open netlink socket: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	/* SO_RCVBUFFORCE can exceed rmem_max, but requires CAP_NET_ADMIN */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+		       sizeof(rcvbuf)) &&
+	    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+		fprintf(stderr, "Unable to set the receive buffer size: %s\n",
+			strerror(errno));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		fprintf(stderr, "Unable to bind netlink socket: %s\n",
+			strerror(errno));
+		goto err;
+	}
+
+	if (num_rtnl_groups) {
+		for (i = 0; i < num_rtnl_groups; i++) {
+			if (join_group(fd, rtnl_groups[i]))
+				goto err;
+		}
+		return fd;
+	}
+
+	if (resolve_family(fd, family_id))
+		goto err;
+
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
+
+/* Appends the event to the archive */
+static int archive_event(nljson_archive_t *archive,
+			 const struct nlmsghdr *nlh, size_t hdr_len,
+			 const struct timespec *ts, struct monitor_counters *cnt)
+{
+	const struct genlmsghdr *genlh = NLMSG_DATA(nlh);
+	struct nljson_record_hdr hdr;
+	struct nljson_error error;
+
+	if (nljson_record_hdr_init(&hdr,
+				   nlh->nlmsg_len - NLMSG_HDRLEN - hdr_len,
+				   nlh->nlmsg_type, genlh->cmd, &error))
+		goto err;
+
+	/* Receive time of the batch (like the JSON output) */
+	hdr.timestamp = (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+
+	if (nljson_archive_append(archive, &hdr,
+				  (const uint8_t *) genlh + hdr_len, &error))
+		goto err;
+
+	cnt->events++;
+	cnt->bytes += nlh->nlmsg_len;
+	return 0;
+err:
+	fprintf(stderr, "Archive error: %s\n", error.err_msg);
+	return -1;
+}
+
+/* Encodes the events in one received datagram (or appends them to the
+ * archive)
+ */
+static int encode_datagram(nljson_t *hdl, nljson_ctx_t *ctx,
+			   struct io_output *out, nljson_archive_t *archive,
+			   uint16_t family_id, const struct timespec *ts,
+			   const uint8_t *buf, size_t len,
+			   struct monitor_counters *cnt)
+{
+	const struct nlmsghdr *nlh = (const struct nlmsghdr *) buf;
+	int rem = len;
+
+	for (; NLMSG_OK(nlh, rem); nlh = NLMSG_NEXT(nlh, rem)) {
+		struct nljson_error error;
+		char prefix[PREFIX_LEN];
+		const char *out_buf;
+		size_t hdr_len, consumed, produced;
+		int prefix_len;
+
+		if (num_rtnl_groups) {
+			hdr_len = rtnl_hdr_len(nlh->nlmsg_type);
+			prefix_len = snprintf(prefix, sizeof(prefix),
+					      "{\"ts\": %llu.%09ld, \"nlmsg_type\": %u, \"attrs\": ",
+					      (unsigned long long) ts->tv_sec,
+					      ts->tv_nsec, nlh->nlmsg_type);
+		} else {
+			hdr_len = nlh->nlmsg_type == family_id ?
+				  GENL_HDRLEN : 0;
+			prefix_len = snprintf(prefix, sizeof(prefix),
+					      "{\"ts\": %llu.%09ld, \"nlmsg_type\": %u, \"genl_cmd\": %u, \"attrs\": ",
+					      (unsigned long long) ts->tv_sec,
+					      ts->tv_nsec, nlh->nlmsg_type,
+					      ((const struct genlmsghdr *) NLMSG_DATA(nlh))->cmd);
+		}
+
+		/* Control messages and messages of other families */
+		if (!hdr_len || (nlh->nlmsg_len < NLMSG_HDRLEN + hdr_len) ||
+		    (prefix_len <= 0)) {
+			cnt->skipped++;
+			continue;
+		}
+
+		if (archive) {
+			if (archive_event(archive, nlh, hdr_len, ts, cnt))
+				return -1;
+			if (max_events && (cnt->events >= max_events))
+				return 1;
+			continue;
+		}
+
+		if (nljson_encode_nla_ctx(hdl, ctx,
+					  (const uint8_t *) NLMSG_DATA(nlh) + hdr_len,
+					  nlh->nlmsg_len - NLMSG_HDRLEN - hdr_len,
+					  &out_buf, &consumed, &produced,
+					  json_format_flags, &error)) {
+			fprintf(stderr, "Encoding error: %s\n", error.err_msg);
+			cnt->errors++;
+			continue;
+		}
+
+		if (io_output_write(out, prefix, prefix_len) ||
+		    io_output_write(out, out_buf, produced) ||
+		    io_output_write(out, SUFFIX, SUFFIX_LEN)) {
+			fprintf(stderr, "Error: Unable to write output\n");
+			return -1;
+		}
+
+		cnt->events++;
+		cnt->bytes += nlh->nlmsg_len;
+		if (max_events && (cnt->events >= max_events))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void do_monitor(void)
+{
+	struct monitor_counters cnt;
+	struct mmsghdr *msgs = NULL;
+	struct iovec *iov = NULL;
+	uint8_t *bufs = NULL;
+	nljson_t *hdl = NULL;
+	nljson_ctx_t *ctx = NULL;
+	nljson_archive_t *archive = NULL;
+	struct nljson_error error;
+	struct io_output out;
+	struct sigaction sa;
+	bool out_open = false;
+	uint16_t family_id = 0;
+	unsigned int i;
+	int fd = -1, rc = 0;
+
+	memset(&cnt, 0, sizeof(cnt));
+
+	if (policy_file || nljson_flags)
+		rc = nljson_init_file(&hdl, 0, nljson_flags,
+				      policy_file, &error);
+
+	if (rc || nljson_ctx_init(&ctx, 0, &error)) {
+		fprintf(stderr, "Init error: %s\n", error.err_msg);
+		goto out;
+	}
+
+	/* Preallocated receive buffers, one per message in a batch */
+	msgs = calloc(batch, sizeof(*msgs));
+	iov = calloc(batch, sizeof(*iov));
+	bufs = malloc(batch * msg_buf_size);
+	if (!msgs || !iov || !bufs) {
+		fprintf(stderr, "Unable to allocate receive buffers\n");
+		goto out;
+	}
+
+	for (i = 0; i < batch; i++) {
+		iov[i].iov_base = bufs + i * msg_buf_size;
+		iov[i].iov_len = msg_buf_size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	fd = open_socket(&family_id);
+	if (fd < 0)
+		goto out;
+
+	if (archive_file) {
+		if (nljson_archive_create(&archive, archive_file, 0,
+					  NLJSON_ARCHIVE_FLAG_COMPRESS,
+					  &error)) {
+			fprintf(stderr, "Archive error: %s\n", error.err_msg);
+			goto out;
+		}
+	} else {
+		if (io_output_open(&out, output_file, IO_DEFAULT_BUF_SIZE)) {
+			fprintf(stderr, "Unable to open output: %s\n",
+				strerror(errno));
+			goto out;
+		}
+		out_open = true;
+	}
+
+	/* No SA_RESTART, so that recvmmsg is interrupted */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!stop) {
+		struct timespec ts;
+		int n;
+
+		/* Blocks until at least one message is available and then
+		 * takes all available messages (up to batch).
+		 */
+		n = recvmmsg(fd, msgs, batch, MSG_WAITFORONE, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				cnt.overruns++;
+				continue;
+			}
+			fprintf(stderr, "Error: Unable to receive: %s\n",
+				strerror(errno));
+			break;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		for (i = 0; i < (unsigned int) n; i++) {
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+				cnt.truncated++;
+
+			rc = encode_datagram(hdl, ctx, &out, archive, family_id,
+					     &ts, iov[i].iov_base,
+					     msgs[i].msg_len, &cnt);
+			if (rc)
+				break;
+		}
+
+		/* Events are written as soon as a batch has been encoded.
+		 * Archived events are written when their block is full.
+		 */
+		if (out_open && io_output_flush(&out)) {
+			fprintf(stderr, "Error: Unable to write output\n");
+			break;
+		}
+		if (rc)
+			break;
+	}
+
+	fprintf(stderr, "{\"events\": %llu, \"bytes\": %llu, \"overruns\": %llu, "
+		"\"truncated\": %llu, \"skipped\": %llu, \"errors\": %llu}\n",
+		(unsigned long long) cnt.events,
+		(unsigned long long) cnt.bytes,
+		(unsigned long long) cnt.overruns,
+		(unsigned long long) cnt.truncated,
+		(unsigned long long) cnt.skipped,
+		(unsigned long long) cnt.errors);
+out:
+	if (fd >= 0)
+		close(fd);
+	if (out_open && io_output_close(&out))
+		fprintf(stderr, "Error: Unable to write output\n");
+	if (archive && nljson_archive_close(&archive, &error))
+		fprintf(stderr, "Archive error: %s\n", error.err_msg);
+	if (ctx)
+		nljson_ctx_deinit(&ctx);
+	if (hdl)
+		nljson_deinit(&hdl);
+	free(bufs);
+	free(iov);
+	free(msgs);
+	if (policy_file)
+		free(policy_file);
+	if (output_file)
+		free(output_file);
+	if (archive_file)
+		free(archive_file);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, optind = 0;
+	unsigned long val;
+	char *tmp;
+	struct option long_opts[] = {
+		{"help", no_argument, 0, 'h'},
+		{"policy", required_argument, 0, 'p'},
+		{"flags", required_argument, 0, 'f'},
+		{"output", required_argument, 0, 'o'},
+		{"skip-unknown", no_argument, 0, 's'},
+		{"family", required_argument, 0, 'F'},
+		{"group", required_argument, 0, 'g'},
+		{"count", required_argument, 0, 'n'},
+		{"version", no_argument, 0, 1000},
+		{"rtnl", required_argument, 0, 1001},
+		{"batch", required_argument, 0, 1002},
+		{"msg-size", required_argument, 0, 1003},
+		{"rcvbuf", required_argument, 0, 1004},
+		{"archive", required_argument, 0, 1005},
+		{NULL, 0, 0, 0},
+	};
+
+	while ((opt = getopt_long(argc, argv, "hp:f:o:sF:g:n:", long_opts, &optind)) != -1) {
+		switch (opt) {
+		case 'p':
+			policy_file = calloc(FILE_NAME_LEN, 1);
+			if (!policy_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(policy_file, optarg, FILE_NAME_LEN);
+			break;
+		case 'f':
+			json_format_flags = strtoul(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad JSON format flags: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 'o':
+			output_file = calloc(FILE_NAME_LEN, 1);
+			if (!output_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(output_file, optarg, FILE_NAME_LEN);
+			break;
+		case 's':
+			nljson_flags |= NLJSON_FLAG_SKIP_UNKNOWN_ATTRS;
+			break;
+		case 'F':
+			if (strlen(optarg) >= sizeof(family_name)) {
+				fprintf(stderr, "Bad family name: %s\n", optarg);
+				return -1;
+			}
+			strcpy(family_name, optarg);
+			break;
+		case 'g':
+			if ((num_group_names == MAX_GROUPS) ||
+			    (strlen(optarg) >= GROUP_NAME_LEN)) {
+				fprintf(stderr, "Bad multicast group: %s\n",
+					optarg);
+				return -1;
+			}
+			strcpy(group_names[num_group_names++], optarg);
+			break;
+		case 'n':
+			max_events = strtoull(optarg, &tmp, 0);
+			if (*tmp != '\0') {
+				fprintf(stderr, "Bad number of events: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1000:
+			print_version();
+			return 0;
+		case 1001:
+			if (parse_rtnl_group(optarg)) {
+				fprintf(stderr, "Bad rtnetlink group: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1002:
+			val = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (val == 0) || (val > 1024)) {
+				fprintf(stderr, "Bad batch size: %s\n", optarg);
+				return -1;
+			}
+			batch = val;
+			break;
+		case 1003:
+			msg_buf_size = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (msg_buf_size < NLMSG_HDRLEN)) {
+				fprintf(stderr, "Bad message size: %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 1004:
+			val = strtoul(optarg, &tmp, 0);
+			if ((*tmp != '\0') || (val == 0) || (val > INT32_MAX)) {
+				fprintf(stderr, "Bad receive buffer size: %s\n",
+					optarg);
+				return -1;
+			}
+			rcvbuf = val;
+			break;
+		case 1005:
+			archive_file = calloc(FILE_NAME_LEN, 1);
+			if (!archive_file) {
+				fprintf(stderr, "calloc returned NULL!\n");
+				return -1;
+			}
+			strncpy(archive_file, optarg, FILE_NAME_LEN);
+			break;
+		case 'h':
+		default:
+			print_usage(argv[0]);
+			return 0;
+		}
+	}
+
+	if (!num_rtnl_groups == !family_name[0]) {
+		fprintf(stderr, "Either --family or --rtnl must be given\n");
+		return -1;
+	}
+
+	if (archive_file && num_rtnl_groups) {
+		fprintf(stderr, "--archive can't be used with --rtnl\n");
+		return -1;
+	}
+
+	do_monitor();
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "nljson_hex.h"
+
+#define HEX_ROW(h) \
+	h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" \
+	h "8" h "9" h "A" h "B" h "C" h "D" h "E" h "F"
+
+/* Two hex digits for each byte value */
+static const char hex_digits[] =
+	HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+	HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+	HEX_ROW("8") HEX_ROW("9") HEX_ROW("A") HEX_ROW("B")
+	HEX_ROW("C") HEX_ROW("D") HEX_ROW("E") HEX_ROW("F");
+
+/* Character classes used by hex_parse. Hex digits have HEX_DIGIT set and
+ * their value in the low nibble. All other characters are invalid (0).
+ */
+#define HEX_DIGIT (0x10)
+#define HEX_SEP   (0x20)
+
+static const uint8_t hex_class[256] = {
+	['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13,
+	['4'] = 0x14, ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17,
+	['8'] = 0x18, ['9'] = 0x19,
+	['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d,
+	['E'] = 0x1e, ['F'] = 0x1f,
+	['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d,
+	['e'] = 0x1e, ['f'] = 0x1f,
+	[' '] = HEX_SEP, ['\t'] = HEX_SEP, ['\n'] = HEX_SEP,
+	['\r'] = HEX_SEP, ['\v'] = HEX_SEP, ['\f'] = HEX_SEP,
+	[':'] = HEX_SEP,
+};
+
+void hex_format(char *dst, const uint8_t *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		memcpy(dst, &hex_digits[2 * src[i]], 2);
+		dst[2] = ' ';
+		dst += HEX_BYTE_LEN;
+	}
+}
+
+size_t hex_parse(uint8_t *dst, size_t dst_len, const char *src,
+		 size_t src_len, bool eof, size_t *consumed, bool *invalid)
+{
+	const uint8_t *text = (const uint8_t *) src;
+	size_t i = 0, n = 0;
+
+	*invalid = false;
+
+	while (n < dst_len) {
+		uint8_t hi, lo;
+
+		/* Fast path for "XX " (and "XX"). Each iteration uses at most
+		 * three characters, so no bounds checks are needed for
+		 * num iterations.
+		 */
+		for (;;) {
+			size_t num = (src_len - i) / HEX_BYTE_LEN;
+
+			if (num > dst_len - n)
+				num = dst_len - n;
+			if (num == 0)
+				break;
+
+			while (num > 0) {
+				hi = hex_class[text[i]];
+				lo = hex_class[text[i + 1]];
+				if (!(hi & lo & HEX_DIGIT))
+					break;
+				dst[n++] = ((hi & 0xf) << 4) | (lo & 0xf);
+				i += 2 + (hex_class[text[i + 2]] == HEX_SEP);
+				num--;
+			}
+
+			if (num > 0)
+				break;
+		}
+
+		if ((i >= src_len) || (n >= dst_len))
+			break;
+
+		hi = hex_class[text[i]];
+		if (hi == HEX_SEP) {
+			i++;
+			continue;
+		}
+
+		if (!(hi & HEX_DIGIT)) {
+			*invalid = true;
+			break;
+		}
+
+		if (i + 1 == src_len) {
+			/* Incomplete pair */
+			*invalid = eof;
+			break;
+		}
+
+		lo = hex_class[text[i + 1]];
+		if (!(lo & HEX_DIGIT)) {
+			*invalid = true;
+			break;
+		}
+
+		dst[n++] = ((hi & 0xf) << 4) | (lo & 0xf);
+		i += 2;
+	}
+
+	*consumed = i;
+	return n;
+}
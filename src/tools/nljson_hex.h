@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NLJSON_HEX_H_
+#define _NLJSON_HEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Length of the hex text of one byte ("XX ") */
+#define HEX_BYTE_LEN (3)
+
+/**
+ * Formats len bytes of src as hex text ("XX " per byte) into dst.
+ * dst must have room for HEX_BYTE_LEN * len characters (no NUL
+ * terminator is written).
+ */
+void hex_format(char *dst, const uint8_t *src, size_t len);
+
+/**
+ * Parses hex text into bytes.
+ *
+ * The text consists of pairs of hex digits (upper or lower case). Pairs
+ * may be separated by whitespace or ':'. Parsing stops when dst is full,
+ * at the end of the text or at an incomplete pair at the end of the text
+ * (unless eof is set, in which case the pair is invalid).
+ *
+ * @param[out] consumed Number of characters of src that were parsed.
+ *
+ * @param[out] invalid  Set if the text contains invalid characters (at
+ *                      src + *consumed).
+ *
+ * @return The number of bytes written to dst.
+ */
+size_t hex_parse(uint8_t *dst, size_t dst_len, const char *src,
+		 size_t src_len, bool eof, size_t *consumed, bool *invalid);
+
+#endif /*_NLJSON_HEX_H_*/
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <nljson_tools_config.h>
+
+#include "nljson_hist.h"
+
+#define NS_PER_SEC (1000000000ULL)
+
+/* Counters have a single writer, so a relaxed load and store is enough */
+static inline void counter_add(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t counter_get(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static unsigned int hist_index(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < HIST_SUB_BUCKETS)
+		return value;
+
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB_BUCKETS +
+	       (value >> shift) - HIST_SUB_BUCKETS;
+}
+
+/* Highest value recorded in a bucket */
+static uint64_t hist_value(unsigned int index)
+{
+	unsigned int shift;
+	uint64_t top;
+
+	if (index < HIST_SUB_BUCKETS)
+		return index;
+
+	shift = index / HIST_SUB_BUCKETS - 1;
+	top = index % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS;
+	return ((top + 1) << shift) - 1;
+}
+
+static void hist_record(struct hist *h, uint64_t value)
+{
+	counter_add(&h->counts[hist_index(value)], 1);
+	if (!h->count || (value < h->min))
+		__atomic_store_n(&h->min, value, __ATOMIC_RELAXED);
+	if (value > h->max)
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+	counter_add(&h->sum, value);
+	counter_add(&h->count, 1);
+}
+
+static void hist_merge(struct hist *dst, const struct hist *src)
+{
+	uint64_t count = counter_get(&src->count), value;
+	unsigned int i;
+
+	if (!count)
+		return;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->counts[i] += counter_get(&src->counts[i]);
+
+	value = counter_get(&src->min);
+	if (!dst->count || (value < dst->min))
+		dst->min = value;
+	value = counter_get(&src->max);
+	if (value > dst->max)
+		dst->max = value;
+	dst->sum += counter_get(&src->sum);
+	dst->count += count;
+}
+
+/* Returns the value at or below which a fraction p of the values are */
+static uint64_t hist_percentile(const struct hist *h, double p)
+{
+	uint64_t rank, total = 0;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	rank = (uint64_t) (p * h->count + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		total += h->counts[i];
+		if (total >= rank)
+			break;
+	}
+
+	if (i == HIST_BUCKETS)
+		return h->max;
+
+	return hist_value(i) < h->max ? hist_value(i) : h->max;
+}
+
+static uint64_t clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static double rate(uint64_t value, double elapsed)
+{
+	return elapsed > 0 ? value / elapsed : 0;
+}
+
+/* Writes one report (a JSON object on a line of its own) */
+static void run_stats_report(struct run_stats *st, bool final)
+{
+	uint64_t messages = 0, errors = 0, bytes_in = 0, bytes_out = 0;
+	uint64_t codec_ns = 0;
+	struct hist *h = &st->merged;
+	double elapsed;
+	unsigned int i;
+
+	memset(h, 0, sizeof(*h));
+	for (i = 0; i < st->num_threads; i++) {
+		struct run_stats_thread *t = &st->threads[i];
+
+		messages += counter_get(&t->messages);
+		errors += counter_get(&t->errors);
+		bytes_in += counter_get(&t->bytes_in);
+		bytes_out += counter_get(&t->bytes_out);
+		codec_ns += counter_get(&t->codec_ns);
+		hist_merge(h, &t->latency);
+	}
+
+	elapsed = (double) (clock_ns() - st->start) / NS_PER_SEC;
+
+	fprintf(st->out, "{\"tool\": \"%s\", \"final\": %s, "
+		"\"elapsed_s\": %.3f, \"messages\": %llu, \"errors\": %llu, "
+		"\"bytes_in\": %llu, \"bytes_out\": %llu, "
+		"\"msgs_per_s\": %.1f, \"mb_in_per_s\": %.2f, "
+		"\"mb_out_per_s\": %.2f, ",
+		st->tool, final ? "true" : "false", elapsed,
+		(unsigned long long) messages, (unsigned long long) errors,
+		(unsigned long long) bytes_in, (unsigned long long) bytes_out,
+		rate(messages, elapsed), rate(bytes_in, elapsed) / 1e6,
+		rate(bytes_out, elapsed) / 1e6);
+	fprintf(st->out, "\"time_ns\": {\"read\": %llu, \"codec\": %llu, "
+		"\"write\": %llu}, ",
+		(unsigned long long) counter_get(&st->read_ns),
+		(unsigned long long) codec_ns,
+		(unsigned long long) counter_get(&st->write_ns));
+	fprintf(st->out, "\"latency_ns\": {\"count\": %llu, \"min\": %llu, "
+		"\"mean\": %.0f, \"p50\": %llu, \"p90\": %llu, "
+		"\"p99\": %llu, \"p99.9\": %llu, \"max\": %llu}}\n",
+		(unsigned long long) h->count, (unsigned long long) h->min,
+		h->count ? (double) h->sum / h->count : 0.0,
+		(unsigned long long) hist_percentile(h, 0.5),
+		(unsigned long long) hist_percentile(h, 0.9),
+		(unsigned long long) hist_percentile(h, 0.99),
+		(unsigned long long) hist_percentile(h, 0.999),
+		(unsigned long long) h->max);
+	fflush(st->out);
+}
+
+struct run_stats *run_stats_create(const char *tool, const char *path,
+				   double interval, unsigned int num_threads)
+{
+	struct run_stats *st;
+
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return NULL;
+
+	if (posix_memalign((void **) &st->threads, HIST_CACHE_LINE,
+			   num_threads * sizeof(*st->threads))) {
+		free(st);
+		return NULL;
+	}
+	memset(st->threads, 0, num_threads * sizeof(*st->threads));
+	st->num_threads = num_threads;
+
+	st->out = path ? fopen(path, "w") : stderr;
+	if (!st->out) {
+		free(st->threads);
+		free(st);
+		return NULL;
+	}
+
+	st->tool = tool;
+	st->interval_ns = (uint64_t) (interval * NS_PER_SEC);
+	st->start = clock_ns();
+	st->next_report = st->start + st->interval_ns;
+	return st;
+}
+
+void run_stats_destroy(struct run_stats *st)
+{
+	if (!st)
+		return;
+
+	run_stats_report(st, true);
+	if (st->out != stderr)
+		fclose(st->out);
+	free(st->threads);
+	free(st);
+}
+
+uint64_t run_stats_now(const struct run_stats *st)
+{
+	return st ? clock_ns() : 0;
+}
+
+void run_stats_message(struct run_stats *st, unsigned int thread,
+		       uint64_t start, size_t bytes_in, size_t bytes_out,
+		       bool error)
+{
+	struct run_stats_thread *t;
+	uint64_t ns;
+
+	if (!st)
+		return;
+
+	t = &st->threads[thread];
+	ns = clock_ns() - start;
+	counter_add(&t->codec_ns, ns);
+	if (error) {
+		counter_add(&t->errors, 1);
+		return;
+	}
+
+	hist_record(&t->latency, ns);
+	counter_add(&t->bytes_in, bytes_in);
+	counter_add(&t->bytes_out, bytes_out);
+	counter_add(&t->messages, 1);
+}
+
+void run_stats_read(struct run_stats *st, uint64_t start)
+{
+	if (st)
+		counter_add(&st->read_ns, clock_ns() - start);
+}
+
+void run_stats_write(struct run_stats *st, uint64_t start)
+{
+	if (st)
+		counter_add(&st->write_ns, clock_ns() - start);
+}
+
+void run_stats_poll(struct run_stats *st)
+{
+	uint64_t now;
+
+	if (!st || !st->interval_ns)
+		return;
+
+	now = clock_ns();
+	if (now < st->next_report)
+		return;
+
+	run_stats_report(st, false);
+	while (st->next_report <= now)
+		st->next_report += st->interval_ns;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _NLJSON_HIST_H_
+#define _NLJSON_HIST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define HIST_CACHE_LINE (64)
+/* Each power of two range is split into 2^HIST_SUB_BITS buckets, i.e.
+ * the values are recorded with a relative precision of about 3%.
+ */
+#define HIST_SUB_BITS (5)
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+/*
+ * Log-linear (HDR style) histogram of 64 bit values (e.g. latencies in
+ * ns). Values below HIST_SUB_BUCKETS * 2 are recorded exactly.
+ */
+struct hist {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+/*
+ * Run statistics of the tools (--stats).
+ *
+ * Each thread processing messages (the main thread or the pipeline
+ * workers) has a thread section of its own. All counters have a single
+ * writer and are updated with relaxed atomic stores, so the report can be
+ * made by another thread while the counters are updated.
+ */
+struct run_stats_thread {
+	struct hist latency;
+	uint64_t messages;
+	uint64_t errors;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t codec_ns;
+} __attribute__((aligned(HIST_CACHE_LINE)));
+
+struct run_stats {
+	const char *tool;
+	FILE *out;
+	/* Report interval (0 if only the final report is written) */
+	uint64_t interval_ns;
+	uint64_t start;
+	uint64_t next_report;
+	struct run_stats_thread *threads;
+	unsigned int num_threads;
+	/* Time spent reading and writing. Written by the reader and the
+	 * writer stage respectively.
+	 */
+	uint64_t read_ns;
+	uint64_t write_ns;
+	/* Scratch histogram used when the threads are merged */
+	struct hist merged;
+};
+
+/**
+ * Creates the run statistics of a tool.
+ *
+ * @param[in] path        Report file (stderr if NULL).
+ * @param[in] interval    Report interval in seconds (0: only a final report).
+ * @param[in] num_threads Number of thread sections.
+ *
+ * @return The statistics or NULL on error.
+ */
+struct run_stats *run_stats_create(const char *tool, const char *path,
+				   double interval, unsigned int num_threads);
+
+/**
+ * Writes the final report and frees the statistics.
+ */
+void run_stats_destroy(struct run_stats *st);
+
+/**
+ * Returns the current time in ns, or 0 if st is NULL (i.e. if --stats is
+ * not used), so that the tools can call the run_stats functions
+ * unconditionally.
+ */
+uint64_t run_stats_now(const struct run_stats *st);
+
+/**
+ * Records one message processed by thread (started at start).
+ * error is set if the message could not be processed.
+ */
+void run_stats_message(struct run_stats *st, unsigned int thread,
+		       uint64_t start, size_t bytes_in, size_t bytes_out,
+		       bool error);
+
+/**
+ * Adds the time since start to the time spent reading (or writing).
+ */
+void run_stats_read(struct run_stats *st, uint64_t start);
+void run_stats_write(struct run_stats *st, uint64_t start);
+
+/**
+ * Writes a report if the report interval has elapsed.
+ */
+void run_stats_poll(struct run_stats *st);
+
+#endif /*_NLJSON_HIST_H_*/
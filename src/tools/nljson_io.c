@@ -0,0 +1,750 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <nljson_tools_config.h>
+
+#include "nljson_io.h"
+#include "nljson_hex.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+
+/* Max number of writes in flight for regular output files */
+#define URING_DEPTH (4)
+#define URING_BUF_ALIGN (4096)
+
+/* Read ahead for inputs that can't be memory mapped. One read into a
+ * registered buffer is kept in flight while the previously read data is
+ * processed. Only one read is in flight since the input is not seekable,
+ * i.e. several reads at the current position could complete out of order.
+ */
+struct uring_input {
+	struct io_uring ring;
+	uint8_t *buf;
+	size_t size;
+	bool pending;
+};
+
+/* Asynchronous output. Full buffers are written while the next buffer is
+ * filled. Regular files are written at explicit offsets with several
+ * writes in flight. Other outputs have one write in flight in order to
+ * keep the order of the data.
+ */
+struct uring_output {
+	struct io_uring ring;
+	uint8_t *bufs[URING_DEPTH];
+	size_t lens[URING_DEPTH];
+	off_t offsets[URING_DEPTH];
+	bool busy[URING_DEPTH];
+	unsigned int num_bufs;
+	unsigned int cur;
+	off_t offset;
+	bool seekable;
+	bool written;
+	bool error;
+};
+#endif
+
+static int write_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t write_len;
+
+		write_len = write(fd, data, len);
+		if (write_len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data += write_len;
+		len -= write_len;
+	}
+
+	return 0;
+}
+
+/* Writes all of iov to fd (handling partial writes) */
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t len;
+
+		len = writev(fd, iov, iovcnt);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while ((iovcnt > 0) && ((size_t) len >= iov->iov_len)) {
+			len -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *) iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_LIBURING
+static int pwrite_all(int fd, const uint8_t *data, size_t len, off_t offset)
+{
+	while (len > 0) {
+		ssize_t write_len;
+
+		write_len = pwrite(fd, data, len, offset);
+		if (write_len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data += write_len;
+		len -= write_len;
+		offset += write_len;
+	}
+
+	return 0;
+}
+#endif
+
+/* Makes sure there is room for at least len more bytes after the end of
+ * the data (moving the unconsumed data or growing the buffer).
+ */
+static int input_reserve(struct io_input *in, size_t len)
+{
+	if ((in->size - in->end < len) && (in->start > 0)) {
+		memmove(in->buf, in->buf + in->start, in->end - in->start);
+		in->end -= in->start;
+		in->start = 0;
+	}
+
+	while (in->size - in->end < len) {
+		uint8_t *tmp;
+
+		tmp = realloc(in->buf, 2 * in->size);
+		if (!tmp)
+			return -1;
+		in->buf = tmp;
+		in->size *= 2;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_LIBURING
+static void uring_input_destroy(struct io_input *in)
+{
+	struct uring_input *u = in->uring;
+
+	io_uring_unregister_buffers(&u->ring);
+	io_uring_queue_exit(&u->ring);
+	free(u->buf);
+	free(u);
+	in->uring = NULL;
+}
+
+static int uring_input_submit(struct io_input *in)
+{
+	struct uring_input *u = in->uring;
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&u->ring);
+	if (!sqe)
+		return -1;
+
+	/* Offset -1 reads from the current file position */
+	io_uring_prep_read_fixed(sqe, in->fd, u->buf, u->size, -1, 0);
+	if (io_uring_submit(&u->ring) != 1)
+		return -1;
+
+	u->pending = true;
+	return 0;
+}
+
+/* Sets up read ahead. The plain read path is used if io_uring is not
+ * available.
+ */
+static void uring_input_init(struct io_input *in)
+{
+	struct uring_input *u;
+	struct iovec iov;
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return;
+
+	if (io_uring_queue_init(2, &u->ring, 0)) {
+		free(u);
+		return;
+	}
+
+	u->size = in->size;
+	if (posix_memalign((void **) &u->buf, URING_BUF_ALIGN, u->size))
+		u->buf = NULL;
+
+	iov.iov_base = u->buf;
+	iov.iov_len = u->size;
+	in->uring = u;
+	if (!u->buf || io_uring_register_buffers(&u->ring, &iov, 1) ||
+	    uring_input_submit(in))
+		uring_input_destroy(in);
+}
+
+static ssize_t uring_input_fill(struct io_input *in)
+{
+	struct uring_input *u = in->uring;
+	struct io_uring_cqe *cqe;
+	ssize_t res;
+
+	if (!u->pending) {
+		in->eof = true;
+		return -1;
+	}
+
+	if (io_uring_wait_cqe(&u->ring, &cqe)) {
+		in->eof = true;
+		return -1;
+	}
+
+	res = cqe->res;
+	io_uring_cqe_seen(&u->ring, cqe);
+	u->pending = false;
+
+	if (res == -EINTR || res == -EAGAIN)
+		return uring_input_submit(in) ? -1 : 0;
+
+	if (res <= 0) {
+		in->eof = true;
+		return res ? -1 : 0;
+	}
+
+	if (input_reserve(in, res)) {
+		in->eof = true;
+		return -1;
+	}
+
+	memcpy(in->buf + in->end, u->buf, res);
+	in->end += res;
+
+	/* Start reading the next block while this one is processed.
+	 * Fall back to plain reads if the read can't be submitted.
+	 */
+	if (uring_input_submit(in))
+		uring_input_destroy(in);
+
+	return res;
+}
+#endif
+
+/* Maps the whole input file. Returns -1 if the input is not a (non
+ * empty) regular file or if it can't be mapped.
+ */
+static int map_input(struct io_input *in)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(in->fd, &st) || !S_ISREG(st.st_mode) || (st.st_size == 0))
+		return -1;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	in->buf = map;
+	in->size = st.st_size;
+	in->end = st.st_size;
+	in->mapped = true;
+	in->eof = true;
+	return 0;
+}
+
+int io_input_open(struct io_input *in, const char *path, size_t buf_size)
+{
+	memset(in, 0, sizeof(*in));
+
+	if (path) {
+		in->fd = open(path, O_RDONLY);
+		if (in->fd < 0)
+			return -1;
+	}
+
+	if (!map_input(in))
+		return 0;
+
+	in->size = buf_size ? buf_size : IO_DEFAULT_BUF_SIZE;
+	in->buf = malloc(in->size);
+	if (!in->buf) {
+		io_input_close(in);
+		return -1;
+	}
+
+#ifdef HAVE_LIBURING
+	uring_input_init(in);
+#endif
+	return 0;
+}
+
+int io_input_open_hex(struct io_input *in, const char *path, size_t buf_size)
+{
+	memset(in, 0, sizeof(*in));
+
+	in->fd = -1;
+	in->size = buf_size ? buf_size : IO_DEFAULT_BUF_SIZE;
+	in->buf = malloc(in->size);
+	in->text = calloc(1, sizeof(*in->text));
+	if (!in->buf || !in->text)
+		goto err;
+
+	if (io_input_open(in->text, path, buf_size)) {
+		free(in->text);
+		in->text = NULL;
+		goto err;
+	}
+
+	return 0;
+err:
+	io_input_close(in);
+	return -1;
+}
+
+/* Parses the next part of the hex text into the buffer (reading more
+ * text if necessary).
+ */
+static ssize_t hex_input_fill(struct io_input *in)
+{
+	struct io_input *text = in->text;
+	size_t len, consumed;
+	bool invalid;
+
+	for (;;) {
+		if (input_reserve(in, in->size / 2))
+			return -1;
+
+		len = hex_parse(in->buf + in->end, in->size - in->end,
+				(const char *) io_input_data(text),
+				io_input_len(text), text->eof, &consumed,
+				&invalid);
+		io_input_consume(text, consumed);
+		in->end += len;
+
+		if (invalid) {
+			in->invalid = true;
+			return -1;
+		}
+		if (len > 0)
+			return len;
+
+		if (text->eof) {
+			in->eof = true;
+			return 0;
+		}
+
+		if (io_input_fill(text) < 0)
+			return -1;
+	}
+}
+
+ssize_t io_input_fill(struct io_input *in)
+{
+	ssize_t read_len;
+
+	if (in->eof)
+		return 0;
+
+	if (in->text)
+		return hex_input_fill(in);
+
+#ifdef HAVE_LIBURING
+	if (in->uring)
+		return uring_input_fill(in);
+#endif
+
+	if (input_reserve(in, 1))
+		return -1;
+
+	do {
+		read_len = read(in->fd, in->buf + in->end, in->size - in->end);
+	} while ((read_len < 0) && (errno == EINTR));
+
+	if (read_len <= 0) {
+		in->eof = true;
+		return read_len;
+	}
+
+	in->end += read_len;
+	return read_len;
+}
+
+void io_input_consume(struct io_input *in, size_t len)
+{
+	in->start += len;
+
+	/* Restart from the beginning of the buffer when it is empty */
+	if (!in->mapped && (in->start == in->end)) {
+		in->start = 0;
+		in->end = 0;
+	}
+}
+
+void io_input_close(struct io_input *in)
+{
+#ifdef HAVE_LIBURING
+	if (in->uring) {
+		/* Wait for the pending read before the buffer is freed */
+		if (in->uring->pending) {
+			struct io_uring_cqe *cqe;
+
+			if (!io_uring_wait_cqe(&in->uring->ring, &cqe))
+				io_uring_cqe_seen(&in->uring->ring, cqe);
+		}
+		uring_input_destroy(in);
+	}
+#endif
+
+	if (in->text) {
+		io_input_close(in->text);
+		free(in->text);
+	}
+
+	if (in->mapped)
+		munmap(in->buf, in->size);
+	else
+		free(in->buf);
+
+	if (in->fd > 0)
+		close(in->fd);
+
+	memset(in, 0, sizeof(*in));
+}
+
+#ifdef HAVE_LIBURING
+/* Waits for one write to complete. Short writes are completed
+ * synchronously.
+ */
+static void uring_output_reap(struct io_output *out)
+{
+	struct uring_output *u = out->uring;
+	struct io_uring_cqe *cqe;
+	unsigned int i;
+	int res;
+
+	if (io_uring_wait_cqe(&u->ring, &cqe)) {
+		/* Give up on all writes in flight */
+		u->error = true;
+		memset(u->busy, 0, sizeof(u->busy));
+		return;
+	}
+
+	i = (unsigned int) (uintptr_t) io_uring_cqe_get_data(cqe);
+	res = cqe->res;
+	io_uring_cqe_seen(&u->ring, cqe);
+
+	if (res < 0) {
+		u->error = true;
+	} else if ((size_t) res < u->lens[i]) {
+		if (u->seekable) {
+			if (pwrite_all(out->fd, u->bufs[i] + res,
+				       u->lens[i] - res, u->offsets[i] + res))
+				u->error = true;
+		} else if (write_all(out->fd, u->bufs[i] + res,
+				     u->lens[i] - res)) {
+			u->error = true;
+		}
+	}
+
+	u->busy[i] = false;
+}
+
+static void uring_output_wait_all(struct io_output *out)
+{
+	struct uring_output *u = out->uring;
+	unsigned int i;
+
+	for (i = 0; i < u->num_bufs; i++) {
+		while (u->busy[i])
+			uring_output_reap(out);
+	}
+}
+
+static void uring_output_destroy(struct io_output *out)
+{
+	struct uring_output *u = out->uring;
+	unsigned int i;
+
+	io_uring_unregister_buffers(&u->ring);
+	io_uring_queue_exit(&u->ring);
+	for (i = 0; i < u->num_bufs; i++)
+		free(u->bufs[i]);
+	free(u);
+	out->uring = NULL;
+	out->buf = NULL;
+}
+
+/* Sets up asynchronous writes. The plain write path is used if io_uring
+ * is not available.
+ */
+static void uring_output_init(struct io_output *out)
+{
+	struct iovec iov[URING_DEPTH];
+	struct uring_output *u;
+	struct stat st;
+	unsigned int i;
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return;
+
+	if (!fstat(out->fd, &st) && S_ISREG(st.st_mode)) {
+		u->offset = lseek(out->fd, 0, SEEK_CUR);
+		u->seekable = (u->offset >= 0);
+	}
+	u->num_bufs = u->seekable ? URING_DEPTH : 2;
+
+	if (io_uring_queue_init(URING_DEPTH, &u->ring, 0)) {
+		free(u);
+		return;
+	}
+
+	for (i = 0; i < u->num_bufs; i++) {
+		if (posix_memalign((void **) &u->bufs[i], URING_BUF_ALIGN,
+				   out->size))
+			break;
+		iov[i].iov_base = u->bufs[i];
+		iov[i].iov_len = out->size;
+	}
+
+	if ((i < u->num_bufs) ||
+	    io_uring_register_buffers(&u->ring, iov, u->num_bufs)) {
+		io_uring_queue_exit(&u->ring);
+		while (i > 0)
+			free(u->bufs[--i]);
+		free(u);
+		return;
+	}
+
+	free(out->buf);
+	out->buf = u->bufs[0];
+	out->uring = u;
+}
+
+static int uring_output_flush(struct io_output *out)
+{
+	struct uring_output *u = out->uring;
+	struct io_uring_sqe *sqe;
+
+	if (out->len == 0)
+		return u->error ? -1 : 0;
+
+	/* Writes at the current position must not be reordered */
+	if (!u->seekable)
+		uring_output_wait_all(out);
+
+	sqe = io_uring_get_sqe(&u->ring);
+	if (!sqe) {
+		uring_output_reap(out);
+		sqe = io_uring_get_sqe(&u->ring);
+	}
+	if (!sqe)
+		return -1;
+
+	io_uring_prep_write_fixed(sqe, out->fd, u->bufs[u->cur], out->len,
+				  u->seekable ? u->offset : -1, u->cur);
+	io_uring_sqe_set_data(sqe, (void *) (uintptr_t) u->cur);
+	if (io_uring_submit(&u->ring) != 1)
+		return -1;
+
+	u->lens[u->cur] = out->len;
+	u->offsets[u->cur] = u->offset;
+	u->busy[u->cur] = true;
+	u->offset += out->len;
+	u->written = true;
+
+	/* Continue with the next buffer once its write is done */
+	u->cur = (u->cur + 1) % u->num_bufs;
+	while (u->busy[u->cur])
+		uring_output_reap(out);
+
+	out->buf = u->bufs[u->cur];
+	out->len = 0;
+	return u->error ? -1 : 0;
+}
+
+static int uring_output_write(struct io_output *out, const void *data,
+			      size_t len)
+{
+	const uint8_t *ptr = data;
+
+	/* Everything goes through the buffers since writes in flight use
+	 * explicit offsets (i.e. the file position is not updated).
+	 */
+	while (len > 0) {
+		size_t chunk = out->size - out->len;
+
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(out->buf + out->len, ptr, chunk);
+		out->len += chunk;
+		ptr += chunk;
+		len -= chunk;
+
+		if ((out->len == out->size) && uring_output_flush(out))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int uring_output_close(struct io_output *out)
+{
+	struct uring_output *u = out->uring;
+	int rc;
+
+	rc = uring_output_flush(out);
+	uring_output_wait_all(out);
+	if (u->error)
+		rc = -1;
+
+	/* Leave the file position after the written data */
+	if (u->seekable && u->written)
+		lseek(out->fd, u->offset, SEEK_SET);
+
+	uring_output_destroy(out);
+	return rc;
+}
+#endif
+
+int io_output_open(struct io_output *out, const char *path, size_t buf_size)
+{
+	memset(out, 0, sizeof(*out));
+	out->fd = 1;
+
+	if (path) {
+		out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out->fd < 0)
+			return -1;
+	}
+
+	out->size = buf_size ? buf_size : IO_DEFAULT_BUF_SIZE;
+	out->buf = malloc(out->size);
+	if (!out->buf) {
+		if (out->fd > 1)
+			close(out->fd);
+		return -1;
+	}
+
+#ifdef HAVE_LIBURING
+	uring_output_init(out);
+#endif
+	return 0;
+}
+
+int io_output_write(struct io_output *out, const void *data, size_t len)
+{
+#ifdef HAVE_LIBURING
+	if (out->uring)
+		return uring_output_write(out, data, len);
+#endif
+
+	if (out->len + len > out->size) {
+		if (io_output_flush(out))
+			return -1;
+
+		/* Large writes are not copied to the buffer */
+		if (len >= out->size)
+			return write_all(out->fd, data, len);
+	}
+
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+	return 0;
+}
+
+int io_output_writev(struct io_output *out, struct iovec *iov, int iovcnt)
+{
+#ifdef HAVE_LIBURING
+	/* Writes in flight use the registered buffers, so the data is
+	 * copied there
+	 */
+	if (out->uring) {
+		int i;
+
+		for (i = 0; i < iovcnt; i++) {
+			if (uring_output_write(out, iov[i].iov_base,
+					       iov[i].iov_len))
+				return -1;
+		}
+		return 0;
+	}
+#endif
+
+	if (io_output_flush(out))
+		return -1;
+
+	return writev_all(out->fd, iov, iovcnt);
+}
+
+int io_output_flush(struct io_output *out)
+{
+	int rc;
+
+#ifdef HAVE_LIBURING
+	if (out->uring)
+		return uring_output_flush(out);
+#endif
+
+	rc = write_all(out->fd, out->buf, out->len);
+	out->len = 0;
+	return rc;
+}
+
+int io_output_close(struct io_output *out)
+{
+	int rc;
+
+#ifdef HAVE_LIBURING
+	if (out->uring)
+		rc = uring_output_close(out);
+	else
+#endif
+	rc = io_output_flush(out);
+
+	free(out->buf);
+	if (out->fd > 1)
+		close(out->fd);
+
+	memset(out, 0, sizeof(*out));
+	return rc;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NLJSON_IO_H_
+#define _NLJSON_IO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Default size of the input and output buffers used by the tools */
+#define IO_DEFAULT_BUF_SIZE (64 * 1024)
+
+/* io_uring state (only used if the tools are built with liburing) */
+struct uring_input;
+struct uring_output;
+
+/*
+ * Input used by the nljson tools.
+ *
+ * Regular files are memory mapped, i.e. the whole file is available
+ * directly after io_input_open and no data is copied.
+ * Other inputs (pipes, stdin etc.) are read into a buffer that grows if
+ * it is too small to hold the unconsumed data. If the tools are built
+ * with io_uring support, the next read is kept in flight while the
+ * previously read data is processed.
+ *
+ * In hex mode (io_input_open_hex), the input is hex text that is parsed
+ * into the buffer by io_input_fill.
+ *
+ * The unconsumed data is available at io_input_data (io_input_len bytes).
+ * Pointers into the data are valid until the next call to io_input_fill.
+ */
+struct io_input {
+	int fd;
+	uint8_t *buf;
+	/* Size of buf (or the size of the file if it is mapped) */
+	size_t size;
+	/* Offsets of the first unconsumed byte and the end of the data */
+	size_t start;
+	size_t end;
+	bool mapped;
+	bool eof;
+	struct uring_input *uring;
+	/* The hex text (hex mode only) */
+	struct io_input *text;
+	/* The hex text contains invalid characters */
+	bool invalid;
+};
+
+/*
+ * Buffered output. Data is written in blocks of (at least) the buffer
+ * size. Large writes bypass the buffer.
+ * If the tools are built with io_uring support, full buffers are written
+ * asynchronously (several writes in flight for regular files) while the
+ * next buffer is filled.
+ */
+struct io_output {
+	int fd;
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	struct uring_output *uring;
+};
+
+/**
+ * Opens path (or stdin if path is NULL) for reading.
+ *
+ * @param[in] buf_size Initial buffer size used if the input can't be
+ *                     memory mapped.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int io_input_open(struct io_input *in, const char *path, size_t buf_size);
+
+/**
+ * Opens path (or stdin if path is NULL) for reading hex text (see
+ * hex_parse). The data of in is the parsed bytes.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int io_input_open_hex(struct io_input *in, const char *path, size_t buf_size);
+
+/**
+ * Reads more data into the input buffer. The buffer is grown if it is
+ * full.
+ *
+ * @return The number of bytes read, 0 if the end of the input has been
+ *         reached (in->eof is set) or -1 on error (in->invalid is set if
+ *         the hex text is invalid).
+ */
+ssize_t io_input_fill(struct io_input *in);
+
+/**
+ * Marks len bytes (from the beginning of the unconsumed data) as consumed.
+ */
+void io_input_consume(struct io_input *in, size_t len);
+
+void io_input_close(struct io_input *in);
+
+static inline const uint8_t *io_input_data(const struct io_input *in)
+{
+	return in->buf + in->start;
+}
+
+static inline size_t io_input_len(const struct io_input *in)
+{
+	return in->end - in->start;
+}
+
+/**
+ * Opens path (or stdout if path is NULL) for writing.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int io_output_open(struct io_output *out, const char *path, size_t buf_size);
+
+/**
+ * Writes len bytes of data to the output.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int io_output_write(struct io_output *out, const void *data, size_t len);
+
+/**
+ * Writes the iovcnt buffers of iov to the output (in order). Without
+ * io_uring, the buffered data is written first and iov is written
+ * directly with writev (i.e. without copying). iov may be modified.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int io_output_writev(struct io_output *out, struct iovec *iov, int iovcnt);
+
+/**
+ * Writes all buffered data.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int io_output_flush(struct io_output *out);
+
+/**
+ * Flushes and closes the output.
+ *
+ * @return 0 on success or -1 if the buffered data could not be written.
+ */
+int io_output_close(struct io_output *out);
+
+#endif /*_NLJSON_IO_H_*/
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "nljson_pcap.h"
+
+#define PCAP_MAGIC (0xa1b2c3d4)
+#define PCAP_MAGIC_NSEC (0xa1b23c4d)
+#define PCAP_HDR_LEN (24)
+#define PCAP_REC_HDR_LEN (16)
+
+#define PCAPNG_SHB (0x0a0d0d0a)
+#define PCAPNG_IDB (1)
+#define PCAPNG_OPB (2)
+#define PCAPNG_SPB (3)
+#define PCAPNG_EPB (6)
+#define PCAPNG_BYTE_ORDER_MAGIC (0x1a2b3c4d)
+#define PCAPNG_OPT_END (0)
+#define PCAPNG_OPT_TSRESOL (9)
+/* Block type and total length (and the trailing total length) */
+#define PCAPNG_BLOCK_HDR_LEN (8)
+#define PCAPNG_MIN_BLOCK_LEN (12)
+
+#define LINKTYPE_LINUX_SLL (113)
+#define LINKTYPE_NETLINK (253)
+/* Cooked header (pkttype, hatype, address length, address, protocol)
+ * added by nlmon
+ */
+#define COOKED_HDR_LEN (16)
+#define COOKED_HATYPE_OFF (2)
+#define COOKED_PROTOCOL_OFF (14)
+#define ARPHRD_NETLINK (824)
+
+/* Larger packets (or blocks) are assumed to be garbage */
+#define MAX_BLOCK_LEN (64 * 1024 * 1024)
+
+struct pcap_interface {
+	uint32_t linktype;
+	/* if_tsresol: 10^-tsresol seconds (or 2^-tsresol if bit 7 is set) */
+	uint8_t tsresol;
+};
+
+static uint32_t get32(const struct pcap_reader *r, const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return r->swapped ? __builtin_bswap32(val) : val;
+}
+
+static uint16_t get16(const struct pcap_reader *r, const uint8_t *p)
+{
+	uint16_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return r->swapped ? __builtin_bswap16(val) : val;
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/* Makes sure that len bytes are available in the input.
+ * Returns 1 if they are, 0 at the end of the input or -1 on read error.
+ */
+static int ensure(struct io_input *in, size_t len)
+{
+	while (io_input_len(in) < len) {
+		if (in->eof)
+			return 0;
+		if (io_input_fill(in) < 0)
+			return -1;
+	}
+
+	return 1;
+}
+
+void pcap_reader_init(struct pcap_reader *r)
+{
+	memset(r, 0, sizeof(*r));
+}
+
+void pcap_reader_deinit(struct pcap_reader *r)
+{
+	free(r->ifaces);
+	r->ifaces = NULL;
+}
+
+/* Sets the current packet. The packet data (including the cooked header)
+ * is caplen bytes at offset off in the current block. Packets that do not
+ * contain generic netlink messages get no data (pkt_len 0).
+ */
+static void set_packet(struct pcap_reader *r, const uint8_t *block,
+		       uint32_t linktype, size_t off, size_t caplen)
+{
+	const uint8_t *pkt = block + off;
+
+	r->pkt_len = 0;
+	r->msg_off = 0;
+
+	if ((linktype != LINKTYPE_NETLINK) && (linktype != LINKTYPE_LINUX_SLL))
+		return;
+	if (caplen < COOKED_HDR_LEN)
+		return;
+	if ((linktype == LINKTYPE_LINUX_SLL) &&
+	    (get_be16(pkt + COOKED_HATYPE_OFF) != ARPHRD_NETLINK))
+		return;
+	if (get_be16(pkt + COOKED_PROTOCOL_OFF) != NETLINK_GENERIC)
+		return;
+
+	r->pkt_off = off + COOKED_HDR_LEN;
+	r->pkt_len = caplen - COOKED_HDR_LEN;
+}
+
+/* Gets the next generic netlink message in the current packet.
+ * Messages truncated by the capture snap length are skipped.
+ */
+static bool next_in_packet(struct pcap_reader *r, const uint8_t *block,
+			   struct pcap_msg *msg)
+{
+	const uint8_t *pkt = block + r->pkt_off;
+
+	while (r->msg_off + NLMSG_HDRLEN <= r->pkt_len) {
+		struct nlmsghdr nlh;
+		size_t off = r->msg_off;
+
+		memcpy(&nlh, pkt + off, sizeof(nlh));
+		if ((nlh.nlmsg_len < NLMSG_HDRLEN) ||
+		    (nlh.nlmsg_len > r->pkt_len - off))
+			break;
+
+		r->msg_off += NLMSG_ALIGN(nlh.nlmsg_len);
+		if ((nlh.nlmsg_type < NLMSG_MIN_TYPE) ||
+		    (nlh.nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN))
+			continue;
+
+		msg->nla_stream = pkt + off + NLMSG_HDRLEN + GENL_HDRLEN;
+		msg->nla_stream_len = nlh.nlmsg_len -
+				      (NLMSG_HDRLEN + GENL_HDRLEN);
+		msg->ts_sec = r->ts_sec;
+		msg->ts_nsec = r->ts_nsec;
+		msg->nlmsg_type = nlh.nlmsg_type;
+		msg->genl_cmd = pkt[off + NLMSG_HDRLEN];
+		return true;
+	}
+
+	r->pkt_len = 0;
+	return false;
+}
+
+/* Reads the pcap file header (or detects a pcapng file) */
+static int read_file_header(struct pcap_reader *r, struct io_input *in)
+{
+	const uint8_t *p;
+	uint32_t magic;
+	int rc;
+
+	rc = ensure(in, sizeof(magic));
+	if (rc < 0)
+		return -1;
+	if (rc == 0) {
+		/* An empty input has no messages */
+		if (io_input_len(in) == 0)
+			return 0;
+		r->error = "Truncated capture file";
+		return -1;
+	}
+
+	p = io_input_data(in);
+	memcpy(&magic, p, sizeof(magic));
+	if (magic == PCAPNG_SHB) {
+		r->pcapng = true;
+		r->started = true;
+		return 1;
+	}
+
+	if ((magic == PCAP_MAGIC) || (magic == PCAP_MAGIC_NSEC)) {
+		r->swapped = false;
+	} else if ((__builtin_bswap32(magic) == PCAP_MAGIC) ||
+		   (__builtin_bswap32(magic) == PCAP_MAGIC_NSEC)) {
+		r->swapped = true;
+	} else {
+		r->error = "Not a pcap or pcapng file";
+		return -1;
+	}
+
+	rc = ensure(in, PCAP_HDR_LEN);
+	if (rc <= 0) {
+		if (rc == 0)
+			r->error = "Truncated capture file";
+		return -1;
+	}
+
+	p = io_input_data(in);
+	r->nsec = get32(r, p) == PCAP_MAGIC_NSEC;
+	/* The upper bits may hold FCS information */
+	r->linktype = get32(r, p + 20) & 0x0fffffff;
+	if ((r->linktype != LINKTYPE_NETLINK) &&
+	    (r->linktype != LINKTYPE_LINUX_SLL)) {
+		r->error = "Unsupported link type (not a netlink capture)";
+		return -1;
+	}
+
+	io_input_consume(in, PCAP_HDR_LEN);
+	r->started = true;
+	return 1;
+}
+
+static int read_pcap_record(struct pcap_reader *r, struct io_input *in)
+{
+	const uint8_t *p;
+	uint32_t caplen, frac;
+	int rc;
+
+	rc = ensure(in, PCAP_REC_HDR_LEN);
+	if (rc <= 0)
+		goto end;
+
+	p = io_input_data(in);
+	caplen = get32(r, p + 8);
+	if (caplen > MAX_BLOCK_LEN) {
+		r->error = "Invalid packet length";
+		return -1;
+	}
+
+	rc = ensure(in, PCAP_REC_HDR_LEN + caplen);
+	if (rc <= 0)
+		goto end;
+
+	p = io_input_data(in);
+	frac = get32(r, p + 4);
+	r->ts_sec = get32(r, p);
+	r->ts_nsec = r->nsec ? frac : frac * 1000;
+	r->block_len = PCAP_REC_HDR_LEN + caplen;
+	set_packet(r, p, r->linktype, PCAP_REC_HDR_LEN, caplen);
+	return 1;
+end:
+	if ((rc == 0) && (io_input_len(in) > 0)) {
+		r->error = "Truncated capture file";
+		return -1;
+	}
+	return rc;
+}
+
+/* Converts a pcapng time stamp to seconds and nanoseconds */
+static void set_pcapng_ts(struct pcap_reader *r,
+			  const struct pcap_interface *iface, uint64_t ts)
+{
+	unsigned int exp = iface->tsresol & 0x7f, i;
+	uint64_t div = 1, frac;
+
+	if (iface->tsresol & 0x80) {
+		if (exp >= 64) {
+			r->ts_sec = 0;
+			r->ts_nsec = 0;
+			return;
+		}
+		r->ts_sec = exp ? ts >> exp : ts;
+		frac = exp ? ts & ((1ULL << exp) - 1) : 0;
+		if (exp <= 32)
+			r->ts_nsec = (frac * 1000000000ULL) >> exp;
+		else
+			r->ts_nsec = ((frac >> (exp - 32)) * 1000000000ULL) >> 32;
+		return;
+	}
+
+	if (exp > 19)
+		exp = 19;
+	for (i = 0; i < exp; i++)
+		div *= 10;
+
+	r->ts_sec = ts / div;
+	frac = ts % div;
+	for (i = exp; i < 9; i++)
+		frac *= 10;
+	for (i = 9; i < exp; i++)
+		frac /= 10;
+	r->ts_nsec = frac;
+}
+
+static int add_interface(struct pcap_reader *r, const uint8_t *block,
+			 uint32_t block_len)
+{
+	struct pcap_interface *iface;
+	uint32_t off = 16;
+
+	if (r->num_ifaces == r->ifaces_size) {
+		size_t new_size = r->ifaces_size ? 2 * r->ifaces_size : 4;
+		struct pcap_interface *tmp;
+
+		tmp = realloc(r->ifaces, new_size * sizeof(*tmp));
+		if (!tmp) {
+			r->error = "Out of memory";
+			return -1;
+		}
+		r->ifaces = tmp;
+		r->ifaces_size = new_size;
+	}
+
+	iface = &r->ifaces[r->num_ifaces++];
+	iface->linktype = get16(r, block + 8);
+	iface->tsresol = 6;
+
+	/* Options (up to the trailing block length) */
+	while (off + 4 <= block_len - 4) {
+		uint16_t code = get16(r, block + off);
+		uint16_t len = get16(r, block + off + 2);
+
+		if ((code == PCAPNG_OPT_END) || (off + 4 + len > block_len - 4))
+			break;
+		if ((code == PCAPNG_OPT_TSRESOL) && (len >= 1))
+			iface->tsresol = block[off + 4];
+		off += 4 + ((len + 3) & ~3);
+	}
+
+	return 0;
+}
+
+/* Sets the current packet from an enhanced (or obsolete) packet block */
+static void set_pcapng_packet(struct pcap_reader *r, const uint8_t *block,
+			      uint32_t block_len, uint32_t if_id)
+{
+	const struct pcap_interface *iface;
+	uint32_t caplen = get32(r, block + 20);
+	uint64_t ts;
+
+	if ((if_id >= r->num_ifaces) || (caplen > block_len - 32))
+		return;
+
+	iface = &r->ifaces[if_id];
+	ts = ((uint64_t) get32(r, block + 12) << 32) | get32(r, block + 16);
+	set_pcapng_ts(r, iface, ts);
+	set_packet(r, block, iface->linktype, 28, caplen);
+}
+
+static int read_pcapng_block(struct pcap_reader *r, struct io_input *in)
+{
+	const uint8_t *p;
+	uint32_t type, block_len, caplen;
+	int rc;
+
+	rc = ensure(in, PCAPNG_MIN_BLOCK_LEN);
+	if (rc <= 0)
+		goto end;
+
+	p = io_input_data(in);
+	memcpy(&type, p, sizeof(type));
+	if (type == PCAPNG_SHB) {
+		uint32_t magic;
+
+		/* A new section, possibly with another byte order */
+		memcpy(&magic, p + PCAPNG_BLOCK_HDR_LEN, sizeof(magic));
+		if (magic == PCAPNG_BYTE_ORDER_MAGIC) {
+			r->swapped = false;
+		} else if (__builtin_bswap32(magic) == PCAPNG_BYTE_ORDER_MAGIC) {
+			r->swapped = true;
+		} else {
+			r->error = "Invalid pcapng section header";
+			return -1;
+		}
+		r->num_ifaces = 0;
+	}
+
+	type = get32(r, p);
+	block_len = get32(r, p + 4);
+	if ((block_len < PCAPNG_MIN_BLOCK_LEN) || (block_len % 4) ||
+	    (block_len > MAX_BLOCK_LEN)) {
+		r->error = "Invalid pcapng block length";
+		return -1;
+	}
+
+	rc = ensure(in, block_len);
+	if (rc <= 0)
+		goto end;
+
+	p = io_input_data(in);
+	r->block_len = block_len;
+	r->pkt_len = 0;
+
+	switch (type) {
+	case PCAPNG_IDB:
+		if (block_len < 20) {
+			r->error = "Invalid pcapng interface block";
+			return -1;
+		}
+		return add_interface(r, p, block_len) ? -1 : 1;
+	case PCAPNG_EPB:
+		if (block_len >= 32)
+			set_pcapng_packet(r, p, block_len, get32(r, p + 8));
+		break;
+	case PCAPNG_OPB:
+		if (block_len >= 32)
+			set_pcapng_packet(r, p, block_len, get16(r, p + 8));
+		break;
+	case PCAPNG_SPB:
+		if ((block_len < 16) || (r->num_ifaces == 0))
+			break;
+		/* No time stamp and the length is the original length */
+		caplen = get32(r, p + 8);
+		if (caplen > block_len - 16)
+			caplen = block_len - 16;
+		r->ts_sec = 0;
+		r->ts_nsec = 0;
+		set_packet(r, p, r->ifaces[0].linktype, 12, caplen);
+		break;
+	default:
+		break;
+	}
+
+	return 1;
+end:
+	if ((rc == 0) && (io_input_len(in) > 0)) {
+		r->error = "Truncated capture file";
+		return -1;
+	}
+	return rc;
+}
+
+int pcap_next_msg(struct pcap_reader *r, struct io_input *in,
+		  struct pcap_msg *msg)
+{
+	int rc;
+
+	rc = r->started ? 1 : read_file_header(r, in);
+
+	while (rc > 0) {
+		if (r->block_len) {
+			if (r->pkt_len &&
+			    next_in_packet(r, io_input_data(in), msg))
+				return 1;
+
+			io_input_consume(in, r->block_len);
+			r->block_len = 0;
+		}
+
+		if (r->pcapng)
+			rc = read_pcapng_block(r, in);
+		else
+			rc = read_pcap_record(r, in);
+	}
+
+	if ((rc < 0) && !r->error)
+		r->error = in->invalid ? "Invalid hex input" :
+			   "Unable to read input";
+	return rc;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _NLJSON_PCAP_H_
+#define _NLJSON_PCAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "nljson_io.h"
+
+/*
+ * Reader of netlink messages in pcap and pcapng captures (e.g. captured
+ * with tcpdump on an nlmon interface).
+ *
+ * Packets with link type LINKTYPE_NETLINK (and LINKTYPE_LINUX_SLL packets
+ * with ARPHRD_NETLINK) are split into netlink messages. The cooked
+ * header, the nlmsghdr and the genlmsghdr are stripped, i.e. each message
+ * is the nla stream of one generic netlink message. Control messages
+ * (NLMSG_ERROR, NLMSG_DONE etc.) and messages of other netlink protocols
+ * are skipped. The netlink headers are assumed to be in host byte order
+ * (i.e. the capture was made on a host with the same byte order).
+ *
+ * The messages point into the input, so nothing is copied if the input
+ * is memory mapped.
+ */
+
+struct pcap_interface;
+
+struct pcap_reader {
+	/* The input is a pcapng file (otherwise pcap) */
+	bool pcapng;
+	/* The file header has been read */
+	bool started;
+	/* The headers of the file (or section) are in the other byte order */
+	bool swapped;
+	/* Link type and time stamp resolution (pcap) */
+	uint32_t linktype;
+	bool nsec;
+	/* Interfaces of the current section (pcapng) */
+	struct pcap_interface *ifaces;
+	size_t num_ifaces;
+	size_t ifaces_size;
+	/* The current packet. pkt_off and pkt_len are the offset and length
+	 * of the netlink data in the input and msg_off the offset of the
+	 * next message in the packet. The block (block_len bytes) is
+	 * consumed when all messages in it have been returned.
+	 */
+	size_t block_len;
+	size_t pkt_off;
+	size_t pkt_len;
+	size_t msg_off;
+	uint64_t ts_sec;
+	uint32_t ts_nsec;
+	/* Description of the error if pcap_next_msg failed */
+	const char *error;
+};
+
+/* A generic netlink message */
+struct pcap_msg {
+	const uint8_t *nla_stream;
+	size_t nla_stream_len;
+	/* Capture time stamp */
+	uint64_t ts_sec;
+	uint32_t ts_nsec;
+	uint16_t nlmsg_type;
+	uint8_t genl_cmd;
+};
+
+void pcap_reader_init(struct pcap_reader *r);
+
+void pcap_reader_deinit(struct pcap_reader *r);
+
+/**
+ * Gets the next message from in (reading more data if necessary).
+ * The message is valid until the next call (the input data of the
+ * message is consumed on the next call).
+ *
+ * @return 1 if a message was found, 0 at the end of the input or -1 on
+ *         error (r->error is set).
+ */
+int pcap_next_msg(struct pcap_reader *r, struct io_input *in,
+		  struct pcap_msg *msg);
+
+#endif /*_NLJSON_PCAP_H_*/
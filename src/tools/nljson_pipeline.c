@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "nljson_pipeline.h"
+
+/* Number of slots in each worker ring. Must be a power of two */
+#define RING_SIZE (64)
+#define CACHE_LINE (64)
+/* Number of sched_yield calls before an idle stage starts sleeping */
+#define SPIN_COUNT (100)
+#define IDLE_SLEEP_NS (100000)
+
+/* Single producer (the reader), single consumer (a worker) ring.
+ * head and tail are only written by the consumer and the producer
+ * respectively and are kept on separate cache lines.
+ */
+struct spsc_ring {
+	size_t head __attribute__((aligned(CACHE_LINE)));
+	size_t tail __attribute__((aligned(CACHE_LINE)));
+	struct pipeline_record *slots[RING_SIZE]
+		__attribute__((aligned(CACHE_LINE)));
+};
+
+struct pipeline;
+
+struct pipeline_worker {
+	struct pipeline *pl;
+	struct spsc_ring ring;
+	pthread_t thread;
+	unsigned int index;
+};
+
+struct pipeline {
+	const struct pipeline_ops *ops;
+	void *data;
+	struct pipeline_worker *workers;
+	unsigned int num_workers;
+	/* Processed records. A lock-free stack (multi producer, single
+	 * consumer). The writer takes the whole stack at once.
+	 */
+	struct pipeline_record *done;
+	/* Reorder buffer. Indexed by seq modulo window */
+	struct pipeline_record **reorder;
+	size_t window;
+	/* Number of records read and written */
+	uint64_t num_read;
+	uint64_t num_written;
+	bool eof;
+	bool stop;
+};
+
+static void backoff(unsigned int *spins)
+{
+	struct timespec ts = {
+		.tv_sec = 0,
+		.tv_nsec = IDLE_SLEEP_NS,
+	};
+
+	if ((*spins)++ < SPIN_COUNT)
+		sched_yield();
+	else
+		nanosleep(&ts, NULL);
+}
+
+static bool ring_push(struct spsc_ring *ring, struct pipeline_record *rec)
+{
+	size_t tail = ring->tail;
+
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+		return false;
+
+	ring->slots[tail & (RING_SIZE - 1)] = rec;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static struct pipeline_record *ring_pop(struct spsc_ring *ring)
+{
+	size_t head = ring->head;
+	struct pipeline_record *rec;
+
+	if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	rec = ring->slots[head & (RING_SIZE - 1)];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return rec;
+}
+
+static void done_push(struct pipeline *pl, struct pipeline_record *rec)
+{
+	struct pipeline_record *head;
+
+	head = __atomic_load_n(&pl->done, __ATOMIC_RELAXED);
+	do {
+		rec->next = head;
+	} while (!__atomic_compare_exchange_n(&pl->done, &head, rec, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+}
+
+static void *worker_thread(void *data)
+{
+	struct pipeline_worker *worker = (struct pipeline_worker *) data;
+	struct pipeline *pl = worker->pl;
+	unsigned int spins = 0;
+
+	for (;;) {
+		struct pipeline_record *rec;
+		bool eof;
+
+		/* eof must be read before the ring is checked. Otherwise
+		 * the last records could be missed.
+		 */
+		eof = __atomic_load_n(&pl->eof, __ATOMIC_ACQUIRE);
+		rec = ring_pop(&worker->ring);
+		if (!rec) {
+			if (eof)
+				break;
+			backoff(&spins);
+			continue;
+		}
+
+		spins = 0;
+		if (__atomic_load_n(&pl->stop, __ATOMIC_RELAXED))
+			rec->status = -1;
+		else
+			pl->ops->process(worker->index, rec, pl->data);
+
+		done_push(pl, rec);
+	}
+
+	return NULL;
+}
+
+/* Writes (and releases) all records in the reorder buffer that are next
+ * in order.
+ */
+static void write_ready(struct pipeline *pl)
+{
+	struct pipeline_record *batch[PIPELINE_MAX_BATCH];
+	size_t i, num;
+
+	for (;;) {
+		for (num = 0; num < PIPELINE_MAX_BATCH; num++) {
+			size_t slot = (pl->num_written + num) &
+				      (pl->window - 1);
+
+			if (!pl->reorder[slot])
+				break;
+			batch[num] = pl->reorder[slot];
+			pl->reorder[slot] = NULL;
+		}
+
+		if (num == 0)
+			return;
+
+		if (!__atomic_load_n(&pl->stop, __ATOMIC_RELAXED) &&
+		    pl->ops->write(batch, num, pl->data))
+			__atomic_store_n(&pl->stop, true, __ATOMIC_RELAXED);
+
+		for (i = 0; i < num; i++)
+			pl->ops->release(batch[i], pl->data);
+
+		__atomic_store_n(&pl->num_written, pl->num_written + num,
+				 __ATOMIC_RELEASE);
+	}
+}
+
+static void *writer_thread(void *data)
+{
+	struct pipeline *pl = (struct pipeline *) data;
+	unsigned int spins = 0;
+
+	for (;;) {
+		struct pipeline_record *list;
+
+		if (__atomic_load_n(&pl->eof, __ATOMIC_ACQUIRE) &&
+		    (pl->num_written ==
+		     __atomic_load_n(&pl->num_read, __ATOMIC_RELAXED)))
+			break;
+
+		list = __atomic_exchange_n(&pl->done, NULL, __ATOMIC_ACQUIRE);
+		if (!list) {
+			backoff(&spins);
+			continue;
+		}
+
+		spins = 0;
+		while (list) {
+			struct pipeline_record *rec = list;
+
+			list = rec->next;
+			pl->reorder[rec->seq & (pl->window - 1)] = rec;
+		}
+
+		write_ready(pl);
+	}
+
+	return NULL;
+}
+
+/* Hands over rec to one of the workers. Workers with full rings are
+ * skipped, so a slow record does not hold back the other workers.
+ */
+static void dispatch(struct pipeline *pl, struct pipeline_record *rec,
+		     unsigned int *next_worker)
+{
+	unsigned int i, spins = 0;
+
+	for (;;) {
+		for (i = 0; i < pl->num_workers; i++) {
+			unsigned int w = (*next_worker + i) % pl->num_workers;
+
+			if (ring_push(&pl->workers[w].ring, rec)) {
+				*next_worker = (w + 1) % pl->num_workers;
+				return;
+			}
+		}
+		backoff(&spins);
+	}
+}
+
+int pipeline_run(unsigned int num_workers, const struct pipeline_ops *ops,
+		 void *data)
+{
+	struct pipeline pl;
+	pthread_t writer;
+	unsigned int i, num_started = 0, next_worker = 0;
+	uint64_t seq = 0;
+	int rc = -1;
+
+	if (num_workers == 0)
+		return -1;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.ops = ops;
+	pl.data = data;
+	pl.num_workers = num_workers;
+
+	/* The reorder buffer must be able to hold all records in flight */
+	pl.window = RING_SIZE;
+	while (pl.window < (size_t) num_workers * RING_SIZE)
+		pl.window *= 2;
+
+	pl.reorder = calloc(pl.window, sizeof(*pl.reorder));
+	if (posix_memalign((void **) &pl.workers, CACHE_LINE,
+			   num_workers * sizeof(*pl.workers)))
+		pl.workers = NULL;
+	if (!pl.reorder || !pl.workers)
+		goto out;
+
+	memset(pl.workers, 0, num_workers * sizeof(*pl.workers));
+	if (pthread_create(&writer, NULL, writer_thread, &pl))
+		goto out;
+
+	for (i = 0; i < num_workers; i++) {
+		pl.workers[i].pl = &pl;
+		pl.workers[i].index = i;
+		if (pthread_create(&pl.workers[i].thread, NULL, worker_thread,
+				   &pl.workers[i])) {
+			__atomic_store_n(&pl.stop, true, __ATOMIC_RELAXED);
+			break;
+		}
+		num_started++;
+	}
+
+	/* Reader stage */
+	while (!__atomic_load_n(&pl.stop, __ATOMIC_RELAXED)) {
+		struct pipeline_record *rec;
+		unsigned int spins = 0;
+
+		/* Limit the number of records in flight to the size of
+		 * the reorder buffer.
+		 */
+		while ((seq - __atomic_load_n(&pl.num_written,
+					      __ATOMIC_ACQUIRE) >= pl.window) &&
+		       !__atomic_load_n(&pl.stop, __ATOMIC_RELAXED))
+			backoff(&spins);
+
+		if (__atomic_load_n(&pl.stop, __ATOMIC_RELAXED))
+			break;
+
+		rec = ops->read(data);
+		if (!rec)
+			break;
+
+		rec->seq = seq++;
+		rec->next = NULL;
+		dispatch(&pl, rec, &next_worker);
+	}
+
+	__atomic_store_n(&pl.num_read, seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&pl.eof, true, __ATOMIC_RELEASE);
+
+	for (i = 0; i < num_started; i++)
+		pthread_join(pl.workers[i].thread, NULL);
+	pthread_join(writer, NULL);
+
+	if (!pl.stop)
+		rc = 0;
+out:
+	free(pl.workers);
+	free(pl.reorder);
+	return rc;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NLJSON_PIPELINE_H_
+#define _NLJSON_PIPELINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Max number of records passed to the write function at once */
+#define PIPELINE_MAX_BATCH (64)
+
+/*
+ * Ordered multi-threaded pipeline used by the nljson tools.
+ *
+ * The pipeline has three stages:
+ *
+ * - A reader stage (the thread calling pipeline_run) that splits the input
+ *   into records.
+ * - N worker threads processing the records.
+ * - A writer thread writing the processed records in input order.
+ *
+ * The reader hands over records to the workers through one single
+ * producer/single consumer ring per worker. The workers pass processed
+ * records to the writer through a multi producer/single consumer queue.
+ * The writer puts the records into a reorder buffer and writes them as
+ * soon as all preceding records have been written.
+ * All queues are lock-free.
+ */
+
+/**
+ * A unit of work in the pipeline.
+ * Tools typically embed this struct as the first member of a larger
+ * struct holding tool specific data.
+ */
+struct pipeline_record {
+	/* Used internally by the pipeline */
+	struct pipeline_record *next;
+	uint64_t seq;
+	/* Input data (set by the reader) */
+	void *in;
+	size_t in_len;
+	/* Output data (set by the worker) */
+	void *out;
+	size_t out_len;
+	/* 0 if the record was processed successfully */
+	int status;
+};
+
+struct pipeline_ops {
+	/**
+	 * Reader stage. Returns the next record or NULL when there is no
+	 * more input (or on error).
+	 */
+	struct pipeline_record *(*read)(void *data);
+	/**
+	 * Worker stage. Processes rec and sets rec->out, rec->out_len and
+	 * rec->status. worker is the index of the calling worker thread,
+	 * 0 <= worker < num_workers.
+	 */
+	void (*process)(unsigned int worker, struct pipeline_record *rec,
+			void *data);
+	/**
+	 * Writer stage. Called with num_recs consecutive records in input
+	 * order. Returns 0 on success or -1 if the pipeline shall be
+	 * stopped.
+	 */
+	int (*write)(struct pipeline_record **recs, size_t num_recs,
+		     void *data);
+	/**
+	 * Frees a record. Called for all records after they have been
+	 * written (or discarded if the pipeline was stopped).
+	 */
+	void (*release)(struct pipeline_record *rec, void *data);
+};
+
+/**
+ * Runs the pipeline until the reader returns NULL and all records have
+ * been written.
+ *
+ * @return 0 on success or -1 if the pipeline could not be started or
+ *         was stopped by the writer.
+ */
+int pipeline_run(unsigned int num_workers, const struct pipeline_ops *ops,
+		 void *data);
+
+#endif /*_NLJSON_PIPELINE_H_*/
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fixture.h"
+
+const char *fixture_dir = ".";
+
+void fixture_init(int argc, char *argv[])
+{
+	if (argc > 1)
+		fixture_dir = argv[1];
+}
+
+void fixture_path(const char *name, char *path, size_t size)
+{
+	snprintf(path, size, "%s/%s", fixture_dir, name);
+}
+
+int fixture_read_file(const char *path, uint8_t *data, size_t size,
+		      size_t *len)
+{
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		return -1;
+	}
+
+	*len = fread(data, 1, size, f);
+	if (ferror(f) || (fgetc(f) != EOF)) {
+		fprintf(stderr, "Unable to read %s (larger than %zu bytes?)\n",
+			path, size);
+		ret = -1;
+	}
+
+	fclose(f);
+	return ret;
+}
+
+int fixture_load(const char *name, uint8_t *data, size_t size, size_t *len)
+{
+	char path[1024];
+
+	fixture_path(name, path, sizeof(path));
+	return fixture_read_file(path, data, size, len);
+}
+
+int fixture_for_each_prefix(const uint8_t *data, size_t len,
+			    int (*cb)(const uint8_t *prefix, size_t len,
+				      void *arg),
+			    void *arg)
+{
+	uint8_t *prefix;
+	size_t i;
+	int rc;
+
+	for (i = 0; i < len; i++) {
+		/* malloc(0) may return NULL */
+		prefix = malloc(i ? i : 1);
+		if (!prefix)
+			return -1;
+
+		memcpy(prefix, data, i);
+		rc = cb(prefix, i, arg);
+		free(prefix);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
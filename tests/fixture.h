@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _NLJSON_TEST_FIXTURE_H_
+#define _NLJSON_TEST_FIXTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Helpers for the tests reading fixtures from tests/data.
+ *
+ * The directory of the fixtures is passed to the tests as their first
+ * argument (see tests/CMakeLists.txt).
+ */
+
+/* Directory of the fixtures ("." unless set by fixture_init) */
+extern const char *fixture_dir;
+
+/* Takes the fixture directory from the command line of the test */
+void fixture_init(int argc, char *argv[]);
+
+/* Writes the path of the fixture name to path */
+void fixture_path(const char *name, char *path, size_t size);
+
+/* Reads the file at path into data. Files larger than size bytes are
+ * rejected. Returns 0 on success or -1 on error.
+ */
+int fixture_read_file(const char *path, uint8_t *data, size_t size,
+		      size_t *len);
+
+/* Reads the fixture name into data (see fixture_read_file) */
+int fixture_load(const char *name, uint8_t *data, size_t size, size_t *len);
+
+/*
+ * Calls cb with each truncated copy (0 to len - 1 bytes) of data. The
+ * copies are allocated with their exact length, so that reads beyond the
+ * end are caught by the address sanitizer. Stops at the first non-zero
+ * return value of cb, which is returned (-1 if a copy can't be
+ * allocated).
+ */
+int fixture_for_each_prefix(const uint8_t *data, size_t len,
+			    int (*cb)(const uint8_t *prefix, size_t len,
+				      void *arg),
+			    void *arg);
+
+#endif /*_NLJSON_TEST_FIXTURE_H_*/
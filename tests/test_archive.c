@@ -0,0 +1,591 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Tests of the archive writer and reader (nljson_archive_*).
+ *
+ * tests/data/records.nlja is an uncompressed archive (block size 256) of
+ * the records created by make_record. Archives are written with and
+ * without compression and queried. Truncated copies must be recovered
+ * (up to the last complete block) and copies with corrupted or oversized
+ * lengths must be rejected (or recovered) without reading outside the
+ * blocks or allocating the corrupted lengths.
+ *
+ * The archives are in host byte order, so the fixture is only used on
+ * little endian hosts.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <nljson.h>
+
+#include "fixture.h"
+
+#define NUM_RECORDS     (60)
+#define BLOCK_SIZE      (256)
+#define BASE_TIMESTAMP  (1700000000000000000ULL)
+#define TIMESTAMP_STEP  (1000000ULL)
+#define MAX_NLA_LEN     (64)
+#define MAX_ARCHIVE_LEN (64 * 1024)
+
+/* File layout (see nljson_archive.c) */
+#define FILE_HDR_LEN    (16)
+#define BLOCK_HDR_LEN   (40)
+#define INDEX_ENTRY_LEN (48)
+#define FOOTER_LEN      (32)
+
+struct record {
+	struct nljson_record_hdr hdr;
+	uint8_t nla[MAX_NLA_LEN];
+};
+
+struct archive_file {
+	uint8_t data[MAX_ARCHIVE_LEN];
+	size_t len;
+	/* Offset and number of records of the blocks (from the index) */
+	uint64_t block_offset[NUM_RECORDS];
+	uint32_t block_len[NUM_RECORDS];
+	uint32_t block_records[NUM_RECORDS];
+	uint32_t num_blocks;
+	uint64_t index_offset;
+};
+
+struct query_result {
+	const struct nljson_archive_query *query;
+	unsigned int num_records;
+	unsigned int next;
+	bool mismatch;
+};
+
+static char tmp_dir[] = "/tmp/nljson-test-XXXXXX";
+static char tmp_path[sizeof(tmp_dir) + 32];
+
+/* Record i: an NLA_U32 attribute (i) and an NLA_UNSPEC attribute of
+ * i % 13 bytes. Every 10th record is not a generic netlink record.
+ */
+static void make_record(unsigned int i, struct record *rec)
+{
+	size_t len = 8, unspec_len = i % 13;
+	struct nljson_error error;
+	uint32_t val = i;
+
+	memset(rec, 0, sizeof(*rec));
+	memcpy(rec->nla, "\x08\x00\x01\x00", 4);
+	memcpy(rec->nla + 4, &val, sizeof(val));
+	if (unspec_len) {
+		uint16_t nla_len = 4 + unspec_len, nla_type = 2;
+
+		memcpy(rec->nla + len, &nla_len, sizeof(nla_len));
+		memcpy(rec->nla + len + 2, &nla_type, sizeof(nla_type));
+		memset(rec->nla + len + 4, i, unspec_len);
+		len += (nla_len + 3) & ~3;
+	}
+
+	if (i % 10)
+		nljson_record_hdr_init(&rec->hdr, len, 0x20 + i % 3, 1 + i % 4,
+				       &error);
+	else
+		nljson_record_hdr_init(&rec->hdr, len, 0, 0, &error);
+	rec->hdr.timestamp = BASE_TIMESTAMP + i * TIMESTAMP_STEP;
+}
+
+static bool record_matches(const struct nljson_archive_query *query,
+			   const struct nljson_record_hdr *hdr)
+{
+	if ((hdr->timestamp < query->start) || (hdr->timestamp >= query->end))
+		return false;
+	if (!query->match)
+		return true;
+	if (!(hdr->flags & NLJSON_RECORD_FLAG_GENL))
+		return false;
+	if ((query->match & NLJSON_ARCHIVE_MATCH_FAMILY) &&
+	    (hdr->family != query->family))
+		return false;
+	if ((query->match & NLJSON_ARCHIVE_MATCH_CMD) &&
+	    (hdr->cmd != query->cmd))
+		return false;
+	return true;
+}
+
+/* Compares each record with the next expected record matching the
+ * query.
+ */
+static int query_cb(const struct nljson_record_hdr *hdr,
+		    const void *nla_stream, void *data)
+{
+	struct query_result *result = data;
+	struct record rec;
+
+	do {
+		if (result->next >= NUM_RECORDS) {
+			result->mismatch = true;
+			return 1;
+		}
+		make_record(result->next++, &rec);
+	} while (!record_matches(result->query, &rec.hdr));
+
+	if (memcmp(hdr, &rec.hdr, sizeof(*hdr)) ||
+	    memcmp(nla_stream, rec.nla, hdr->len)) {
+		result->mismatch = true;
+		return 1;
+	}
+
+	result->num_records++;
+	return 0;
+}
+
+static unsigned int count_matching(const struct nljson_archive_query *query,
+				   unsigned int num_records)
+{
+	struct record rec;
+	unsigned int i, count = 0;
+
+	for (i = 0; i < num_records; i++) {
+		make_record(i, &rec);
+		if (record_matches(query, &rec.hdr))
+			count++;
+	}
+
+	return count;
+}
+
+/* Runs a query and checks that the first expected_records matching
+ * records (and nothing else) are returned. If expected_error is set, the
+ * query must fail with that error after the records.
+ */
+static int run_query(nljson_archive_t *ar, const char *what,
+		     const struct nljson_archive_query *query,
+		     unsigned int expected_records,
+		     const char *expected_error)
+{
+	struct nljson_archive_query all = { .start = 0, .end = UINT64_MAX };
+	struct query_result result;
+	struct nljson_error error;
+	int rc;
+
+	memset(&result, 0, sizeof(result));
+	result.query = query ? query : &all;
+
+	rc = nljson_archive_query(ar, query, query_cb, &result, &error);
+	if (result.mismatch ||
+	    (result.num_records != expected_records) ||
+	    (expected_error ? ((rc != -1) ||
+			       !strstr(error.err_msg, expected_error)) :
+			      (rc != 0))) {
+		fprintf(stderr, "%s: rc %d, %u records (expected %u)%s%s%s\n",
+			what, rc, result.num_records, expected_records,
+			result.mismatch ? ", mismatch" : "",
+			rc ? ": " : "", rc ? error.err_msg : "");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_archive(const char *path, uint32_t flags)
+{
+	struct nljson_error error;
+	nljson_archive_t *ar;
+	struct record rec;
+	unsigned int i;
+
+	if (nljson_archive_create(&ar, path, BLOCK_SIZE, flags, &error)) {
+		fprintf(stderr, "nljson_archive_create: %s\n", error.err_msg);
+		return -1;
+	}
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		make_record(i, &rec);
+		if (nljson_archive_append(ar, &rec.hdr, rec.nla, &error)) {
+			fprintf(stderr, "nljson_archive_append: %s\n",
+				error.err_msg);
+			nljson_archive_close(&ar, &error);
+			return -1;
+		}
+	}
+
+	if (nljson_archive_close(&ar, &error)) {
+		fprintf(stderr, "nljson_archive_close: %s\n", error.err_msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_file(const char *path, const uint8_t *data, size_t len)
+{
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f || (fwrite(data, 1, len, f) != len)) {
+		fprintf(stderr, "Unable to write %s\n", path);
+		if (f)
+			fclose(f);
+		return -1;
+	}
+
+	return fclose(f) ? -1 : 0;
+}
+
+/* Opens an archive and checks the number of records and the recovered
+ * flag.
+ */
+static int open_archive(nljson_archive_t **ar, const char *path,
+			const char *what, uint64_t expected_records,
+			bool expected_recovered)
+{
+	struct nljson_archive_info info;
+	struct nljson_error error;
+
+	if (nljson_archive_open(ar, path, &error)) {
+		fprintf(stderr, "%s: %s\n", what, error.err_msg);
+		return -1;
+	}
+
+	nljson_archive_get_info(*ar, &info);
+	if ((info.num_records != expected_records) ||
+	    (!!(info.flags & NLJSON_ARCHIVE_INFO_RECOVERED) !=
+	     expected_recovered)) {
+		fprintf(stderr, "%s: %llu records, flags 0x%x\n", what,
+			(unsigned long long) info.num_records, info.flags);
+		nljson_archive_close(ar, &error);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Reads the archive file at path and the block offsets from its index */
+static int load_archive(const char *path, struct archive_file *file)
+{
+	struct nljson_archive_block block;
+	struct nljson_error error;
+	nljson_archive_t *ar;
+	uint32_t i;
+
+	if (fixture_read_file(path, file->data, sizeof(file->data),
+			      &file->len) ||
+	    open_archive(&ar, path, path, NUM_RECORDS, false))
+		return -1;
+
+	for (i = 0; !nljson_archive_get_block(ar, i, &block); i++) {
+		file->block_offset[i] = block.offset;
+		file->block_len[i] = BLOCK_HDR_LEN + block.stored_len;
+		file->block_records[i] = block.num_records;
+	}
+	file->num_blocks = i;
+	memcpy(&file->index_offset,
+	       file->data + file->len - FOOTER_LEN + 16,
+	       sizeof(file->index_offset));
+
+	nljson_archive_close(&ar, &error);
+
+	if (file->num_blocks < 3) {
+		fprintf(stderr, "%s: only %u blocks\n", path,
+			file->num_blocks);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_queries(const char *path)
+{
+	struct nljson_archive_query query;
+	struct nljson_archive_info info;
+	struct nljson_error error;
+	nljson_archive_t *ar;
+	uint64_t blocks_read;
+	int ret = -1;
+
+	if (open_archive(&ar, path, path, NUM_RECORDS, false))
+		return -1;
+
+	if (run_query(ar, "all records", NULL, NUM_RECORDS, NULL))
+		goto out;
+
+	/* Only the blocks in the time range are read */
+	memset(&query, 0, sizeof(query));
+	query.start = BASE_TIMESTAMP + 50 * TIMESTAMP_STEP;
+	query.end = UINT64_MAX;
+	nljson_archive_get_info(ar, &info);
+	blocks_read = info.blocks_read;
+	if (run_query(ar, "time range", &query,
+		      count_matching(&query, NUM_RECORDS), NULL))
+		goto out;
+	nljson_archive_get_info(ar, &info);
+	if (info.blocks_read - blocks_read >= info.num_blocks) {
+		fprintf(stderr, "time range: all blocks read\n");
+		goto out;
+	}
+
+	query.start = BASE_TIMESTAMP + 10 * TIMESTAMP_STEP;
+	query.end = BASE_TIMESTAMP + 30 * TIMESTAMP_STEP;
+	query.family = 0x21;
+	query.match = NLJSON_ARCHIVE_MATCH_FAMILY;
+	if (run_query(ar, "family", &query,
+		      count_matching(&query, NUM_RECORDS), NULL))
+		goto out;
+
+	query.start = 0;
+	query.end = UINT64_MAX;
+	query.family = 0x22;
+	query.cmd = 3;
+	query.match = NLJSON_ARCHIVE_MATCH_FAMILY | NLJSON_ARCHIVE_MATCH_CMD;
+	if (run_query(ar, "family and cmd", &query,
+		      count_matching(&query, NUM_RECORDS), NULL))
+		goto out;
+
+	ret = 0;
+out:
+	nljson_archive_close(&ar, &error);
+	return ret;
+}
+
+/* A truncated copy of an archive must be opened with the records of its
+ * complete blocks (the index is rebuilt).
+ */
+static int check_truncated(const uint8_t *data, size_t len, void *arg)
+{
+	const struct archive_file *file = (const struct archive_file *) arg;
+	struct nljson_error error;
+	unsigned int num_records = 0;
+	nljson_archive_t *ar;
+	char what[64];
+	uint32_t i;
+	int ret;
+
+	snprintf(what, sizeof(what), "truncated to %zu bytes", len);
+	if (write_file(tmp_path, data, len))
+		return -1;
+
+	if (len < FILE_HDR_LEN) {
+		if (!nljson_archive_open(&ar, tmp_path, &error)) {
+			fprintf(stderr, "%s: accepted\n", what);
+			nljson_archive_close(&ar, &error);
+			return -1;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < file->num_blocks; i++) {
+		if (file->block_offset[i] + file->block_len[i] > len)
+			break;
+		num_records += file->block_records[i];
+	}
+
+	if (open_archive(&ar, tmp_path, what, num_records, true))
+		return -1;
+
+	ret = run_query(ar, what, NULL, num_records, NULL);
+	nljson_archive_close(&ar, &error);
+	return ret;
+}
+
+static int test_truncated(const struct archive_file *file)
+{
+	return fixture_for_each_prefix(file->data, file->len, check_truncated,
+				       (void *) file);
+}
+
+/* Writes a copy of the archive (truncated to len bytes) with val written
+ * at off, opens it and queries all records.
+ */
+static int test_corrupted(const struct archive_file *file, const char *what,
+			  size_t len, size_t off, const void *val,
+			  size_t val_len, uint64_t expected_records,
+			  bool expected_recovered,
+			  unsigned int expected_query_records,
+			  const char *expected_error)
+{
+	uint8_t data[MAX_ARCHIVE_LEN];
+	struct nljson_error error;
+	nljson_archive_t *ar;
+	int ret;
+
+	memcpy(data, file->data, len);
+	memcpy(data + off, val, val_len);
+	if (write_file(tmp_path, data, len) ||
+	    open_archive(&ar, tmp_path, what, expected_records,
+			 expected_recovered))
+		return -1;
+
+	ret = run_query(ar, what, NULL, expected_query_records,
+			expected_error);
+	nljson_archive_close(&ar, &error);
+	return ret;
+}
+
+static int test_corrupted_lengths(const struct archive_file *file)
+{
+	uint64_t block1 = file->block_offset[1];
+	uint64_t index = file->index_offset;
+	uint32_t records0 = file->block_records[0];
+	uint32_t big32 = 0xffffffff, max_block = 0x7fffffff;
+	uint64_t big64 = UINT64_MAX - 8;
+
+	/* Block headers (raw_len at offset 8, stored_len at 12) with the
+	 * index. The block is checked against the index before it is read.
+	 */
+	if (test_corrupted(file, "raw_len", file->len, block1 + 8, &big32,
+			   4, NUM_RECORDS, false, records0, "Bad block") ||
+	    test_corrupted(file, "large raw_len", file->len, block1 + 8,
+			   &max_block, 4, NUM_RECORDS, false, records0,
+			   "Bad block") ||
+	    test_corrupted(file, "stored_len", file->len, block1 + 12, &big32,
+			   4, NUM_RECORDS, false, records0, "Bad block"))
+		return -1;
+
+	/* Block headers without the index. The recovery stops at the
+	 * corrupted block.
+	 */
+	if (test_corrupted(file, "raw_len (no index)", index, block1 + 8,
+			   &big32, 4, records0, true, records0, NULL) ||
+	    test_corrupted(file, "large raw_len (no index)", index,
+			   block1 + 8, &max_block, 4, records0, true,
+			   records0, NULL) ||
+	    test_corrupted(file, "stored_len (no index)", index, block1 + 12,
+			   &big32, 4, records0, true, records0, NULL) ||
+	    test_corrupted(file, "large stored_len (no index)", index,
+			   block1 + 12, &max_block, 4, records0, true,
+			   records0, NULL))
+		return -1;
+
+	/* Index entries (offset at 0, stored_len at 32, first_key at 36)
+	 * and the footer (num_blocks at 4, num_keys at 8, index_offset at
+	 * 16). An invalid index is rebuilt from the blocks.
+	 */
+	if (test_corrupted(file, "index offset", file->len, index, &big64, 8,
+			   NUM_RECORDS, true, NUM_RECORDS, NULL) ||
+	    test_corrupted(file, "index stored_len", file->len, index + 32,
+			   &big32, 4, NUM_RECORDS, true, NUM_RECORDS, NULL) ||
+	    test_corrupted(file, "index first_key", file->len, index + 36,
+			   &big32, 4, NUM_RECORDS, true, NUM_RECORDS, NULL) ||
+	    test_corrupted(file, "footer num_blocks", file->len,
+			   file->len - FOOTER_LEN + 4, &big32, 4,
+			   NUM_RECORDS, true, NUM_RECORDS, NULL) ||
+	    test_corrupted(file, "footer num_keys", file->len,
+			   file->len - FOOTER_LEN + 8, &big32, 4,
+			   NUM_RECORDS, true, NUM_RECORDS, NULL) ||
+	    test_corrupted(file, "footer index_offset", file->len,
+			   file->len - FOOTER_LEN + 16, &big64, 8,
+			   NUM_RECORDS, true, NUM_RECORDS, NULL))
+		return -1;
+
+	/* A block length in the index that does not match the block (but
+	 * is within the file)
+	 */
+	return test_corrupted(file, "index stored_len mismatch", file->len,
+			      index + INDEX_ENTRY_LEN + 32,
+			      &file->block_len[1], 4, NUM_RECORDS, false,
+			      records0, "Bad block");
+}
+
+static int test_archive(uint32_t flags, const struct archive_file *fixture)
+{
+	struct archive_file *file;
+	int ret = -1;
+
+	file = malloc(sizeof(*file));
+	if (!file)
+		return -1;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s/archive.nlja", tmp_dir);
+	if (write_archive(tmp_path, flags) ||
+	    test_queries(tmp_path) ||
+	    load_archive(tmp_path, file))
+		goto out;
+
+	/* The uncompressed archive must be identical to the fixture */
+	if (fixture && ((file->len != fixture->len) ||
+			memcmp(file->data, fixture->data, file->len))) {
+		fprintf(stderr, "Archive differs from the fixture\n");
+		goto out;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s/copy.nlja", tmp_dir);
+	if (test_truncated(file) || test_corrupted_lengths(file))
+		goto out;
+
+	ret = 0;
+out:
+	free(file);
+	return ret;
+}
+
+static int test_fixture(void)
+{
+	struct archive_file *fixture;
+	char path[1024];
+	int ret = -1;
+
+	fixture = malloc(sizeof(*fixture));
+	if (!fixture)
+		return -1;
+
+	fixture_path("records.nlja", path, sizeof(path));
+	if (test_queries(path) ||
+	    load_archive(path, fixture) ||
+	    test_archive(0, fixture))
+		goto out;
+
+	ret = 0;
+out:
+	free(fixture);
+	return ret;
+}
+
+static int is_little_endian(void)
+{
+	uint16_t val = 1;
+
+	return *((uint8_t *) &val);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 1;
+
+	fixture_init(argc, argv);
+
+	if (!mkdtemp(tmp_dir)) {
+		fprintf(stderr, "Unable to create %s\n", tmp_dir);
+		return 1;
+	}
+
+	if (is_little_endian() ? test_fixture() : test_archive(0, NULL))
+		goto out;
+
+	/* Ignored (stored uncompressed) if built without zlib */
+	if (test_archive(NLJSON_ARCHIVE_FLAG_COMPRESS, NULL))
+		goto out;
+
+	ret = 0;
+out:
+	snprintf(tmp_path, sizeof(tmp_path), "%s/archive.nlja", tmp_dir);
+	unlink(tmp_path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s/copy.nlja", tmp_dir);
+	unlink(tmp_path);
+	rmdir(tmp_dir);
+	return ret;
+}
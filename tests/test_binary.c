@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Tests of the CBOR and MessagePack encoding and decoding
+ * (nljson_encode_nla_bin_alloc and nljson_decode_nla_bin_alloc).
+ *
+ * tests/data/attrs.cbor and tests/data/attrs.msgpack are the encoded
+ * attrs_nla stream below. The encoder must produce exactly the fixtures
+ * and the decoder must give back the nla stream. Truncated fixtures and
+ * documents with oversized lengths or too deep nesting must be rejected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <nljson.h>
+
+#include "fixture.h"
+
+#define MAX_FIXTURE_LEN (4096)
+#define MAX_NLA_LEN     (4096)
+#define NUM_GENERATED   (200)
+#define MAX_DEPTH_DOC   (2000)
+
+static const char *policy =
+	"{\"A\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1},"
+	" \"C\": {\"data_type\": \"NLA_U32\", \"nla_type\": 3},"
+	" \"D\": {\"data_type\": \"NLA_U64\", \"nla_type\": 4},"
+	" \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 5},"
+	" \"U\": {\"data_type\": \"NLA_UNSPEC\", \"nla_type\": 6},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 9, \"nested\":"
+	"        {\"X\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1}}}}";
+
+/* A = 7, C = 0xdeadbeef, D = 0x0123456789abcdef, S = "wlan0",
+ * U = {1, 2, 3} and N = {X = 42}
+ */
+static const uint8_t attrs_nla[] =
+	"\x05\x00\x01\x00\x07\x00\x00\x00"
+	"\x08\x00\x03\x00\xef\xbe\xad\xde"
+	"\x0c\x00\x04\x00\xef\xcd\xab\x89"
+	"\x67\x45\x23\x01\x0a\x00\x05\x00"
+	"\x77\x6c\x61\x6e\x30\x00\x00\x00"
+	"\x07\x00\x06\x00\x01\x02\x03\x00"
+	"\x0c\x00\x09\x00\x08\x00\x01\x00"
+	"\x2a\x00\x00\x00";
+
+#define ATTRS_NLA_LEN (sizeof(attrs_nla) - 1)
+
+struct fixture {
+	const char *name;
+	enum nljson_bin_format format;
+	uint8_t data[MAX_FIXTURE_LEN];
+	size_t len;
+};
+
+static struct fixture fixtures[] = {
+	{ .name = "attrs.cbor", .format = NLJSON_BIN_CBOR },
+	{ .name = "attrs.msgpack", .format = NLJSON_BIN_MSGPACK },
+};
+
+#define NUM_FIXTURES (sizeof(fixtures) / sizeof(fixtures[0]))
+
+/* Documents with lengths far beyond the end of the input */
+struct bad_doc {
+	const char *what;
+	enum nljson_bin_format format;
+	const char *data;
+	size_t len;
+	const char *error;
+};
+
+#define BAD_DOC(what, format, data, error) \
+	{ what, format, data, sizeof(data) - 1, error }
+
+static const struct bad_doc bad_docs[] = {
+	BAD_DOC("map", NLJSON_BIN_CBOR,
+		"\xbb\x7f\xff\xff\xff\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("array", NLJSON_BIN_CBOR,
+		"\xa1\x61U\x9b\xff\xff\xff\xff\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("byte string", NLJSON_BIN_CBOR,
+		"\xa1\x61U\xa1\x65value\x5b\xff\xff\xff\xff\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("text string", NLJSON_BIN_CBOR,
+		"\xa1\x7a\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("argument", NLJSON_BIN_CBOR,
+		"\xa1\x61U\x1b\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("map", NLJSON_BIN_MSGPACK,
+		"\xdf\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("array", NLJSON_BIN_MSGPACK,
+		"\x81\xa1U\xdd\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("bin", NLJSON_BIN_MSGPACK,
+		"\x81\xa1U\x81\xa5value\xc6\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("str", NLJSON_BIN_MSGPACK,
+		"\x81\xdb\xff\xff\xff\xff",
+		"Unexpected end of input"),
+	BAD_DOC("length", NLJSON_BIN_MSGPACK,
+		"\x81\xa1U\xcf\xff",
+		"Unexpected end of input"),
+};
+
+#define NUM_BAD_DOCS (sizeof(bad_docs) / sizeof(bad_docs[0]))
+
+static nljson_t *hdl;
+
+static const char *format_name(enum nljson_bin_format format)
+{
+	return format == NLJSON_BIN_CBOR ? "CBOR" : "MessagePack";
+}
+
+static int test_fixture(const struct fixture *fixture)
+{
+	uint8_t data[2 * MAX_FIXTURE_LEN];
+	struct nljson_error error;
+	size_t consumed, produced;
+	void *output;
+	int ret = -1;
+
+	output = nljson_encode_nla_bin_alloc(hdl, attrs_nla, ATTRS_NLA_LEN,
+					     fixture->format, &consumed,
+					     &produced, &error);
+	if (!output) {
+		fprintf(stderr, "%s: %s\n", fixture->name, error.err_msg);
+		return -1;
+	}
+
+	if ((consumed != ATTRS_NLA_LEN) || (produced != fixture->len) ||
+	    memcmp(output, fixture->data, fixture->len)) {
+		fprintf(stderr, "%s: encoded document differs\n",
+			fixture->name);
+		goto out;
+	}
+	free(output);
+
+	/* The decoder stops after the first document */
+	memcpy(data, fixture->data, fixture->len);
+	memcpy(data + fixture->len, fixture->data, fixture->len);
+
+	output = nljson_decode_nla_bin_alloc(data, 2 * fixture->len,
+					     fixture->format, &consumed,
+					     &produced, &error);
+	if (!output) {
+		fprintf(stderr, "%s: %s\n", fixture->name, error.err_msg);
+		return -1;
+	}
+
+	if ((consumed != fixture->len) || (produced != ATTRS_NLA_LEN) ||
+	    memcmp(output, attrs_nla, ATTRS_NLA_LEN)) {
+		fprintf(stderr, "%s: decoded nla stream differs\n",
+			fixture->name);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(output);
+	return ret;
+}
+
+/* A truncated copy of a fixture must be rejected */
+static int check_truncated(const uint8_t *data, size_t len, void *arg)
+{
+	const struct fixture *fixture = (const struct fixture *) arg;
+	struct nljson_error error;
+	size_t consumed, produced;
+	void *output;
+
+	output = nljson_decode_nla_bin_alloc(data, len, fixture->format,
+					     &consumed, &produced, &error);
+	if (output) {
+		fprintf(stderr, "%s truncated to %zu bytes: accepted\n",
+			fixture->name, len);
+		free(output);
+		return -1;
+	}
+
+	if (!strstr(error.err_msg, "Unexpected end of input")) {
+		fprintf(stderr, "%s truncated to %zu bytes: %s\n",
+			fixture->name, len, error.err_msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_truncated(const struct fixture *fixture)
+{
+	return fixture_for_each_prefix(fixture->data, fixture->len,
+				       check_truncated, (void *) fixture);
+}
+
+static int decode_bad_doc(const char *what, enum nljson_bin_format format,
+			  const char *doc, size_t len,
+			  const char *expected_error)
+{
+	struct nljson_error error;
+	size_t consumed, produced;
+	uint8_t *data;
+	void *output;
+
+	data = malloc(len);
+	if (!data)
+		return -1;
+	memcpy(data, doc, len);
+
+	output = nljson_decode_nla_bin_alloc(data, len, format, &consumed,
+					     &produced, &error);
+	free(data);
+	if (output) {
+		fprintf(stderr, "%s %s: accepted\n", format_name(format), what);
+		free(output);
+		return -1;
+	}
+
+	if (!strstr(error.err_msg, expected_error)) {
+		fprintf(stderr, "%s %s: %s\n", format_name(format), what,
+			error.err_msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_bad_docs(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_BAD_DOCS; i++) {
+		const struct bad_doc *doc = &bad_docs[i];
+
+		if (decode_bad_doc(doc->what, doc->format, doc->data,
+				   doc->len, doc->error))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Deeply nested arrays must not exhaust the stack */
+static int test_depth(enum nljson_bin_format format)
+{
+	char doc[MAX_DEPTH_DOC + 3];
+
+	/* A map with key "A" and nested single element arrays */
+	if (format == NLJSON_BIN_CBOR) {
+		memcpy(doc, "\xa1\x61\x41", 3);
+		memset(doc + 3, 0x81, MAX_DEPTH_DOC);
+	} else {
+		memcpy(doc, "\x81\xa1\x41", 3);
+		memset(doc + 3, 0x91, MAX_DEPTH_DOC);
+	}
+
+	return decode_bad_doc("nesting", format, doc, sizeof(doc),
+			      "Max nesting depth exceeded");
+}
+
+/* Generated nla streams must survive the round trip */
+static int test_generated(enum nljson_bin_format format)
+{
+	uint8_t nla[MAX_NLA_LEN];
+	struct nljson_error error;
+	size_t nla_len, consumed, produced, len;
+	void *doc, *decoded;
+	uint64_t seed = 1;
+	int i;
+
+	for (i = 0; i < NUM_GENERATED; i++) {
+		if (nljson_generate_nla(hdl, &seed, nla, sizeof(nla),
+					&nla_len, 0, &error)) {
+			fprintf(stderr, "nljson_generate_nla: %s\n",
+				error.err_msg);
+			return -1;
+		}
+
+		doc = nljson_encode_nla_bin_alloc(hdl, nla, nla_len, format,
+						  &consumed, &len, &error);
+		if (!doc) {
+			fprintf(stderr, "%s: %s\n", format_name(format),
+				error.err_msg);
+			return -1;
+		}
+
+		decoded = nljson_decode_nla_bin_alloc(doc, len, format,
+						      &consumed, &produced,
+						      &error);
+		free(doc);
+		if (!decoded) {
+			fprintf(stderr, "%s: %s\n", format_name(format),
+				error.err_msg);
+			return -1;
+		}
+
+		if ((produced != nla_len) || memcmp(decoded, nla, nla_len)) {
+			fprintf(stderr, "%s: generated stream %d differs\n",
+				format_name(format), i);
+			free(decoded);
+			return -1;
+		}
+		free(decoded);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct nljson_error error;
+	unsigned int i;
+	int ret = 1;
+
+	fixture_init(argc, argv);
+
+	if (nljson_init(&hdl, 0, 0, policy, &error)) {
+		fprintf(stderr, "nljson_init: %s\n", error.err_msg);
+		return 1;
+	}
+
+	for (i = 0; i < NUM_FIXTURES; i++) {
+		struct fixture *fixture = &fixtures[i];
+
+		if (fixture_load(fixture->name, fixture->data,
+				 sizeof(fixture->data), &fixture->len) ||
+		    test_fixture(fixture) ||
+		    test_truncated(fixture) ||
+		    test_depth(fixture->format) ||
+		    test_generated(fixture->format))
+			goto out;
+	}
+
+	if (test_bad_docs())
+		goto out;
+
+	ret = 0;
+out:
+	nljson_deinit(&hdl);
+	return ret;
+}
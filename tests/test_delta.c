@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Delta encodes a sequence of messages (with changed, added, removed,
+ * reordered and duplicate attributes) and checks that the delta decoder
+ * recreates each message.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <nljson.h>
+
+#define BUF_SIZE  (256)
+#define MAX_ATTRS (8)
+#define KEYFRAME_INTERVAL (4)
+#define ALIGN(len) (((len) + 3) & ~3)
+
+#define ATTR_A (1)
+#define ATTR_B (2)
+#define ATTR_C (3)
+#define ATTR_D (4)
+#define ATTR_S (5)
+#define ATTR_N (6)
+
+static const char *policy =
+	"{\"A\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1},"
+	" \"B\": {\"data_type\": \"NLA_U16\", \"nla_type\": 2},"
+	" \"C\": {\"data_type\": \"NLA_U32\", \"nla_type\": 3},"
+	" \"D\": {\"data_type\": \"NLA_U64\", \"nla_type\": 4},"
+	" \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 5},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 6, \"nested\":"
+	"        {\"X\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1}}}}";
+
+static const char *strings[] = {"first", "second string"};
+
+struct attr {
+	uint16_t type;
+	uint32_t value;
+};
+
+struct message {
+	uint64_t stream_key;
+	/* Attributes of the message, terminated by type 0 */
+	struct attr attrs[MAX_ATTRS];
+	bool keyframe;
+	/* The message has duplicate attribute types, so the expected output
+	 * is the one of a regular encode and decode.
+	 */
+	bool duplicates;
+};
+
+static const struct message messages[] = {
+	{1, {{ATTR_A, 1}, {ATTR_B, 2}, {ATTR_C, 3}}, true, false},
+	/* Changed */
+	{1, {{ATTR_A, 1}, {ATTR_B, 5}, {ATTR_C, 3}}, false, false},
+	/* Removed */
+	{1, {{ATTR_A, 1}, {ATTR_C, 3}}, false, false},
+	/* Another stream key has its own state */
+	{2, {{ATTR_A, 9}}, true, false},
+	/* Added */
+	{1, {{ATTR_A, 1}, {ATTR_C, 3}, {ATTR_D, 7}, {ATTR_N, 8}}, false, false},
+	/* Keyframe interval */
+	{1, {{ATTR_A, 1}, {ATTR_C, 3}, {ATTR_D, 7}, {ATTR_N, 9}}, true, false},
+	{2, {{ATTR_A, 10}}, false, false},
+	/* Reordered */
+	{1, {{ATTR_C, 3}, {ATTR_A, 1}, {ATTR_D, 7}, {ATTR_N, 9}}, true, false},
+	/* Duplicates in the current and in the previous message */
+	{1, {{ATTR_C, 3}, {ATTR_A, 1}, {ATTR_A, 2}, {ATTR_D, 7}}, true, true},
+	{1, {{ATTR_C, 3}, {ATTR_A, 1}, {ATTR_D, 7}}, true, false},
+	{1, {{ATTR_C, 3}, {ATTR_A, 2}, {ATTR_D, 7}, {ATTR_S, 0}}, false, false},
+	{1, {{ATTR_C, 3}, {ATTR_A, 2}, {ATTR_D, 7}, {ATTR_S, 1}}, false, false},
+	/* Everything removed (an empty stream is followed by a keyframe) */
+	{1, {{0}}, false, false},
+	{1, {{ATTR_B, 4}}, true, false},
+};
+
+static size_t put_attr(uint8_t *buf, uint16_t type, const void *data,
+		       size_t len)
+{
+	uint16_t hdr[2] = {(uint16_t) (4 + len), type};
+
+	memcpy(buf, hdr, sizeof(hdr));
+	memcpy(buf + 4, data, len);
+	memset(buf + 4 + len, 0, ALIGN(len) - len);
+	return 4 + ALIGN(len);
+}
+
+static size_t build(uint8_t *buf, const struct attr *attrs)
+{
+	size_t len = 0, nested_len;
+	uint8_t u8;
+	uint16_t u16;
+	uint64_t u64;
+	const char *str;
+
+	for (; attrs->type; attrs++) {
+		switch (attrs->type) {
+		case ATTR_A:
+			u8 = (uint8_t) attrs->value;
+			len += put_attr(buf + len, ATTR_A, &u8, sizeof(u8));
+			break;
+		case ATTR_B:
+			u16 = (uint16_t) attrs->value;
+			len += put_attr(buf + len, ATTR_B, &u16, sizeof(u16));
+			break;
+		case ATTR_C:
+			len += put_attr(buf + len, ATTR_C, &attrs->value,
+					sizeof(attrs->value));
+			break;
+		case ATTR_D:
+			u64 = attrs->value;
+			len += put_attr(buf + len, ATTR_D, &u64, sizeof(u64));
+			break;
+		case ATTR_S:
+			str = strings[attrs->value];
+			len += put_attr(buf + len, ATTR_S, str,
+					strlen(str) + 1);
+			break;
+		case ATTR_N:
+			nested_len = put_attr(buf + len + 4, 1, &attrs->value,
+					      sizeof(attrs->value));
+			len += put_attr(buf + len, ATTR_N, buf + len + 4,
+					nested_len);
+			break;
+		}
+	}
+
+	return len;
+}
+
+/* Encodes and decodes nla_stream without delta encoding */
+static void *round_trip(nljson_t *hdl, const uint8_t *nla_stream,
+			size_t nla_stream_len, size_t *len)
+{
+	struct nljson_error error;
+	size_t consumed, produced;
+	char *json;
+	void *nla;
+
+	json = nljson_encode_nla_alloc(hdl, nla_stream, nla_stream_len,
+				       &consumed, &produced, 0, &error);
+	if (!json)
+		return NULL;
+
+	nla = nljson_decode_nla_alloc(json, &consumed, len, 0, &error);
+	free(json);
+	return nla;
+}
+
+static int run_test(nljson_t *hdl, nljson_delta_t *encoder,
+		    nljson_delta_t *decoder, unsigned int index)
+{
+	const struct message *msg = &messages[index];
+	uint8_t nla_stream[BUF_SIZE];
+	struct nljson_error error;
+	size_t len, consumed, produced, decoded_len, expected_len;
+	void *decoded = NULL, *expected = NULL;
+	char *json;
+	bool keyframe;
+	int ret = -1;
+
+	len = build(nla_stream, msg->attrs);
+
+	json = nljson_encode_nla_delta_alloc(hdl, encoder, msg->stream_key,
+					     nla_stream, len, &consumed,
+					     &produced, 0, &error);
+	if (!json) {
+		fprintf(stderr, "message %u: encode failed: %s\n", index,
+			error.err_msg);
+		return -1;
+	}
+
+	if (consumed != len) {
+		fprintf(stderr, "message %u: consumed %zu bytes (expected "
+			"%zu)\n", index, consumed, len);
+		goto out;
+	}
+
+	keyframe = strstr(json, "\"keyframe\": true") != NULL;
+	if (keyframe != msg->keyframe) {
+		fprintf(stderr, "message %u: unexpected keyframe %d: %s\n",
+			index, keyframe, json);
+		goto out;
+	}
+
+	decoded = nljson_decode_nla_delta_alloc(decoder, json, &consumed,
+						&decoded_len, 0, &error);
+	if (!decoded) {
+		fprintf(stderr, "message %u: decode failed: %s\n", index,
+			error.err_msg);
+		goto out;
+	}
+
+	if (consumed != produced) {
+		fprintf(stderr, "message %u: decoder consumed %zu bytes "
+			"(expected %zu)\n", index, consumed, produced);
+		goto out;
+	}
+
+	if (msg->duplicates) {
+		expected = round_trip(hdl, nla_stream, len, &expected_len);
+		if (!expected) {
+			fprintf(stderr, "message %u: round trip failed\n",
+				index);
+			goto out;
+		}
+	} else {
+		expected = nla_stream;
+		expected_len = len;
+	}
+
+	if ((decoded_len != expected_len) ||
+	    memcmp(decoded, expected, expected_len)) {
+		fprintf(stderr, "message %u: decoded stream differs: %s\n",
+			index, json);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	if (msg->duplicates && expected)
+		free(expected);
+	free(decoded);
+	free(json);
+	return ret;
+}
+
+int main(void)
+{
+	nljson_delta_t *encoder = NULL, *decoder = NULL;
+	struct nljson_error error;
+	unsigned int i, failed = 0;
+	nljson_t *hdl;
+
+	if (nljson_init(&hdl, 0, 0, policy, &error)) {
+		fprintf(stderr, "nljson_init failed: %s\n", error.err_msg);
+		return 1;
+	}
+
+	if (nljson_delta_init(&encoder, KEYFRAME_INTERVAL, &error) ||
+	    nljson_delta_init(&decoder, 0, &error)) {
+		fprintf(stderr, "nljson_delta_init failed: %s\n",
+			error.err_msg);
+		failed++;
+		goto out;
+	}
+
+	for (i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+		if (run_test(hdl, encoder, decoder, i))
+			failed++;
+	}
+
+out:
+	nljson_delta_deinit(&decoder);
+	nljson_delta_deinit(&encoder);
+	nljson_deinit(&hdl);
+
+	if (failed) {
+		fprintf(stderr, "%u tests failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Generates nla streams for a number of seeds and checks that the same
+ * seed always gives the same stream and that the streams pass
+ * nljson_validate_nla and survive an encode/decode round trip.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <nljson.h>
+
+#define NUM_SEEDS    (200)
+#define NUM_MESSAGES (4)
+#define BUF_SIZE     (8192)
+
+/* NLA_FLAG is left out, since the decoder expects NLA_FLAG values to be
+ * integers and the encoder writes them as (empty) arrays.
+ */
+static const char *policy =
+	"{\"A\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1},"
+	" \"B\": {\"data_type\": \"NLA_U16\", \"nla_type\": 2},"
+	" \"C\": {\"data_type\": \"NLA_U32\", \"nla_type\": 3},"
+	" \"D\": {\"data_type\": \"NLA_U64\", \"nla_type\": 4},"
+	" \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 5,"
+	"        \"maxlen\": 13},"
+	" \"U\": {\"data_type\": \"NLA_UNSPEC\", \"nla_type\": 6,"
+	"        \"minlen\": 3, \"maxlen\": 9},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 8, \"nested\":"
+	"        {\"X\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	"         \"T\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 2},"
+	"         \"Y\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 3,"
+	"                \"nested\": {\"Z\": {\"data_type\": \"NLA_U16\","
+	"                                    \"nla_type\": 1}}}}}}";
+
+static int generate(nljson_t *hdl, uint64_t *seed, uint8_t *buf, size_t *len,
+		    uint32_t flags)
+{
+	struct nljson_error error;
+
+	if (nljson_generate_nla(hdl, seed, buf, BUF_SIZE, len, flags,
+				&error)) {
+		fprintf(stderr, "nljson_generate_nla failed: %s\n",
+			error.err_msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Checks that nla_stream is valid and that encoding and decoding it gives
+ * back the same stream.
+ */
+static int check_stream(nljson_t *hdl, const uint8_t *nla_stream, size_t len)
+{
+	struct nljson_error error;
+	size_t offset, consumed, produced, decoded_len;
+	void *decoded = NULL;
+	char *json;
+	int ret = -1;
+
+	if (nljson_validate_nla(hdl, nla_stream, len, &offset, &error)) {
+		fprintf(stderr, "invalid stream: %s\n", error.err_msg);
+		return -1;
+	}
+
+	json = nljson_encode_nla_alloc(hdl, nla_stream, len, &consumed,
+				       &produced, 0, &error);
+	if (!json) {
+		fprintf(stderr, "encode failed: %s\n", error.err_msg);
+		return -1;
+	}
+
+	if (consumed != len) {
+		fprintf(stderr, "encoder consumed %zu bytes (expected %zu)\n",
+			consumed, len);
+		goto out;
+	}
+
+	decoded = nljson_decode_nla_alloc(json, &consumed, &decoded_len, 0,
+					  &error);
+	if (!decoded) {
+		fprintf(stderr, "decode failed: %s\n", error.err_msg);
+		goto out;
+	}
+
+	if ((decoded_len != len) || memcmp(decoded, nla_stream, len)) {
+		fprintf(stderr, "round trip differs: %s\n", json);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(decoded);
+	free(json);
+	return ret;
+}
+
+static int check_seed(nljson_t *hdl, uint64_t seed, uint32_t flags)
+{
+	uint8_t first[BUF_SIZE], second[BUF_SIZE];
+	uint64_t seed1 = seed, seed2 = seed;
+	size_t len1, len2;
+	unsigned int i;
+
+	for (i = 0; i < NUM_MESSAGES; i++) {
+		if (generate(hdl, &seed1, first, &len1, flags) ||
+		    generate(hdl, &seed2, second, &len2, flags))
+			return -1;
+
+		if ((seed1 != seed2) || (len1 != len2) ||
+		    memcmp(first, second, len1)) {
+			fprintf(stderr, "seed %llu, message %u: output differs "
+				"between runs\n", (unsigned long long) seed, i);
+			return -1;
+		}
+
+		if (check_stream(hdl, first, len1)) {
+			fprintf(stderr, "seed %llu, message %u, flags %u\n",
+				(unsigned long long) seed, i,
+				(unsigned int) flags);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_errors(nljson_t *hdl)
+{
+	struct nljson_error error;
+	uint8_t buf[BUF_SIZE];
+	uint64_t seed = 1;
+	size_t len;
+
+	if (!nljson_generate_nla(hdl, &seed, buf, 16, &len,
+				 NLJSON_GEN_FLAG_ALL_ATTRS, &error) ||
+	    (error.err_code != ENOSPC) || (seed != 1) || len) {
+		fprintf(stderr, "too small buffer not rejected\n");
+		return -1;
+	}
+
+	if (!nljson_generate_nla(NULL, &seed, buf, sizeof(buf), &len, 0,
+				 &error) || (error.err_code != EINVAL)) {
+		fprintf(stderr, "missing handle not rejected\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	uint8_t first[BUF_SIZE], second[BUF_SIZE];
+	struct nljson_error error;
+	unsigned int failed = 0;
+	uint64_t seed, seed1 = 1, seed2 = 2;
+	size_t len1, len2;
+	nljson_t *hdl;
+
+	if (nljson_init(&hdl, 0, 0, policy, &error)) {
+		fprintf(stderr, "nljson_init failed: %s\n", error.err_msg);
+		return 1;
+	}
+
+	/* Seed 0 is valid too (the generator replaces it internally) */
+	for (seed = 0; seed < NUM_SEEDS; seed++) {
+		if (check_seed(hdl, seed, 0) ||
+		    check_seed(hdl, seed, NLJSON_GEN_FLAG_ALL_ATTRS))
+			failed++;
+	}
+
+	/* Different seeds give different streams */
+	if (generate(hdl, &seed1, first, &len1, NLJSON_GEN_FLAG_ALL_ATTRS) ||
+	    generate(hdl, &seed2, second, &len2, NLJSON_GEN_FLAG_ALL_ATTRS) ||
+	    ((len1 == len2) && !memcmp(first, second, len1))) {
+		fprintf(stderr, "seeds 1 and 2 give the same stream\n");
+		failed++;
+	}
+
+	if (check_errors(hdl))
+		failed++;
+
+	nljson_deinit(&hdl);
+
+	if (failed) {
+		fprintf(stderr, "%u tests failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Applies patches to an nla stream and compares the result with a stream
+ * built directly with the expected values, including the nla_len of the
+ * enclosing nested attributes when an attribute changes size.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <nljson.h>
+
+#define BUF_SIZE  (1024)
+#define MAX_DEPTH (4)
+#define ALIGN(len) (((len) + 3) & ~3)
+
+static const char *policy =
+	"{\"A\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1},"
+	" \"B\": {\"data_type\": \"NLA_U16\", \"nla_type\": 2},"
+	" \"C\": {\"data_type\": \"NLA_U32\", \"nla_type\": 3},"
+	" \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 5},"
+	" \"U\": {\"data_type\": \"NLA_UNSPEC\", \"nla_type\": 6},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 9, \"nested\":"
+	"        {\"X\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	"         \"Y\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 2,"
+	"                \"nested\": {\"Z\": {\"data_type\": \"NLA_STRING\","
+	"                                    \"nla_type\": 1}}}}}}";
+
+struct stream {
+	uint8_t buf[BUF_SIZE];
+	size_t len;
+	size_t nest[MAX_DEPTH];
+	unsigned int depth;
+};
+
+/* The attribute values of the test stream. The strings are written
+ * without NUL terminator, in the same way as the patch function does it.
+ */
+struct values {
+	uint8_t a;
+	bool has_b;
+	uint16_t b;
+	uint32_t c;
+	bool has_x;
+	uint32_t x;
+	const char *z;
+	const char *s;
+	uint8_t u[8];
+	size_t u_len;
+	uint32_t unknown;
+};
+
+static const struct values initial = {
+	.a = 1,
+	.has_b = true,
+	.b = 2,
+	.c = 3,
+	.has_x = true,
+	.x = 4,
+	.z = "zz",
+	.s = "string",
+	.u = {0xde, 0xad},
+	.u_len = 2,
+	.unknown = 7,
+};
+
+struct patch_test {
+	const char *patch;
+	/* Expected values (initial values with the patched values) */
+	struct values expected;
+	/* Expected error code, 0 if the patch should succeed */
+	int err_code;
+};
+
+static void put_attr(struct stream *s, uint16_t type, const void *data,
+		     size_t len)
+{
+	uint16_t hdr[2] = {(uint16_t) (4 + len), type};
+
+	memcpy(s->buf + s->len, hdr, sizeof(hdr));
+	if (len)
+		memcpy(s->buf + s->len + 4, data, len);
+	memset(s->buf + s->len + 4 + len, 0, ALIGN(len) - len);
+	s->len += 4 + ALIGN(len);
+}
+
+static void nest_start(struct stream *s, uint16_t type)
+{
+	s->nest[s->depth++] = s->len;
+	put_attr(s, type, NULL, 0);
+}
+
+static void nest_end(struct stream *s)
+{
+	size_t start = s->nest[--s->depth];
+	uint16_t len = (uint16_t) (s->len - start);
+
+	memcpy(s->buf + start, &len, sizeof(len));
+}
+
+static void build(struct stream *s, const struct values *v)
+{
+	memset(s, 0, sizeof(*s));
+	put_attr(s, 1, &v->a, sizeof(v->a));
+	if (v->has_b)
+		put_attr(s, 2, &v->b, sizeof(v->b));
+	put_attr(s, 3, &v->c, sizeof(v->c));
+	nest_start(s, 9);
+	if (v->has_x)
+		put_attr(s, 1, &v->x, sizeof(v->x));
+	nest_start(s, 2);
+	put_attr(s, 1, v->z, strlen(v->z));
+	nest_end(s);
+	nest_end(s);
+	put_attr(s, 5, v->s, strlen(v->s));
+	put_attr(s, 6, v->u, v->u_len);
+	put_attr(s, 7, &v->unknown, sizeof(v->unknown));
+}
+
+static int run_test(nljson_t *hdl, const struct patch_test *test,
+		    size_t extra_space)
+{
+	struct nljson_error error;
+	struct stream stream, expected;
+	size_t produced;
+	int rc;
+
+	build(&stream, &initial);
+	build(&expected, test->err_code ? &initial : &test->expected);
+
+	rc = nljson_patch_nla(hdl, stream.buf, stream.len,
+			      stream.len + extra_space, test->patch,
+			      &produced, 0, &error);
+	if (test->err_code) {
+		if (!rc || (error.err_code != test->err_code)) {
+			fprintf(stderr, "%s: rc %d, error %d (expected %d)\n",
+				test->patch, rc, error.err_code,
+				test->err_code);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (rc) {
+		fprintf(stderr, "%s: %s\n", test->patch, error.err_msg);
+		return -1;
+	}
+
+	if ((produced != expected.len) ||
+	    memcmp(stream.buf, expected.buf, produced)) {
+		fprintf(stderr, "%s: unexpected output (%zu bytes, expected "
+			"%zu)\n", test->patch, produced, expected.len);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	struct nljson_error error;
+	struct patch_test tests[] = {
+		{.patch = "{\"C\": 305419896}"},
+		{.patch = "{\"A\": 255, \"B\": 65535}"},
+		{.patch = "{\"A\": -1}"},
+		{.patch = "{\"N/Y/Z\": \"a longer nested string\"}"},
+		{.patch = "{\"N\": {\"Y\": {\"Z\": \"z\"}}, \"S\": \"str\"}"},
+		{.patch = "{\"B\": null, \"N/X\": null}"},
+		{.patch = "{\"U\": [1, 2, 3, 4, 5]}"},
+		{.patch = "{\"UNKNOWN_ATTR_7\": 8}"},
+		{.patch = "{\"A\": 256}", .err_code = ERANGE},
+		{.patch = "{\"B\": -32769}", .err_code = ERANGE},
+		{.patch = "{\"N/W\": 1}", .err_code = ENOENT},
+		{.patch = "{\"UNKNOWN_ATTR_8\": 1}", .err_code = ENOENT},
+		{.patch = "{\"N\": 1}", .err_code = EINVAL},
+		{.patch = "[1]", .err_code = EINVAL},
+	};
+	struct patch_test grow = {
+		.patch = "{\"S\": \"a string longer than the buffer\"}",
+		.err_code = ENOSPC,
+	};
+	struct patch_test unknown = {
+		.patch = "{\"UNKNOWN_ATTR_3\": 9, \"UNKNOWN_ATTR_9/UNKNOWN_ATTR_1\": 10}",
+	};
+	unsigned int i, failed = 0;
+	nljson_t *hdl;
+
+	if (nljson_init(&hdl, 0, 0, policy, &error)) {
+		fprintf(stderr, "nljson_init failed: %s\n", error.err_msg);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		tests[i].expected = initial;
+
+	tests[0].expected.c = 305419896;
+	tests[1].expected.a = 255;
+	tests[1].expected.b = 65535;
+	tests[2].expected.a = 0xff;
+	tests[3].expected.z = "a longer nested string";
+	tests[4].expected.z = "z";
+	tests[4].expected.s = "str";
+	tests[5].expected.has_b = false;
+	tests[5].expected.has_x = false;
+	tests[6].expected.u_len = 5;
+	memcpy(tests[6].expected.u, "\x01\x02\x03\x04\x05", 5);
+	tests[7].expected.unknown = 8;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		if (run_test(hdl, &tests[i], 64))
+			failed++;
+	}
+
+	/* The stream grows beyond the buffer */
+	if (run_test(hdl, &grow, 8))
+		failed++;
+
+	/* Without a handle, only UNKNOWN_ATTR_<type> names resolve */
+	unknown.expected = initial;
+	unknown.expected.c = 9;
+	unknown.expected.x = 10;
+	if (run_test(NULL, &unknown, 64))
+		failed++;
+
+	nljson_deinit(&hdl);
+
+	if (failed) {
+		fprintf(stderr, "%u tests failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Tests of the pcap/pcapng reader of the tools (nljson_pcap.c).
+ *
+ * The fixtures in tests/data contain the same capture of an nlmon
+ * interface as pcap (nlmon.pcap), little endian pcapng (nlmon.pcapng) and
+ * big endian pcapng (nlmon-be.pcapng):
+ *
+ * 1. A generic netlink message (expected[0])
+ * 2. Two generic netlink messages in one packet (expected[1] and [2])
+ * 3. An NLMSG_ERROR control message (skipped)
+ * 4. A NETLINK_ROUTE message (skipped)
+ * 5. A generic netlink message (expected[3])
+ *
+ * The pcapng files also have an ethernet interface with a packet (skipped).
+ *
+ * The fixtures are read as files (memory mapped) and through a pipe.
+ * Truncated and corrupted copies are created from the fixtures and must
+ * be rejected without reading outside the input.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "nljson_pcap.h"
+#include "fixture.h"
+
+#define MAX_FIXTURE_LEN (4096)
+#define PCAP_HDR_LEN (24)
+#define PCAP_REC_HDR_LEN (16)
+/* Offset of the second pcapng interface description block */
+#define PCAPNG_IDB2_OFF (28 + 20)
+/* Offset of the first enhanced packet block */
+#define PCAPNG_EPB_OFF (PCAPNG_IDB2_OFF + 32)
+
+struct expected_msg {
+	const char *nla_stream;
+	size_t nla_stream_len;
+	uint64_t ts_sec;
+	uint32_t ts_nsec;
+	uint8_t genl_cmd;
+};
+
+static const struct expected_msg expected[] = {
+	{ "\x08\x00\x01\x00\x44\x33\x22\x11", 8,
+	  1700000000, 0, 1 },
+	{ "\x0a\x00\x02\x00" "wlan0\x00\x00\x00", 12,
+	  1700000001, 10000, 2 },
+	{ "\x05\x00\x03\x00\x07\x00\x00\x00\x06\x00\x04\x00\x34\x12\x00\x00",
+	  16, 1700000001, 10000, 3 },
+	{ "\x0c\x00\x05\x80\x08\x00\x01\x00\x01\x00\x00\x00", 12,
+	  1700000004, 40000, 4 },
+};
+
+#define NUM_EXPECTED (sizeof(expected) / sizeof(expected[0]))
+
+struct fixture {
+	const char *name;
+	bool pcapng;
+	bool big_endian;
+	uint8_t data[MAX_FIXTURE_LEN];
+	size_t len;
+};
+
+static struct fixture fixtures[] = {
+	{ .name = "nlmon.pcap" },
+	{ .name = "nlmon.pcapng", .pcapng = true },
+	{ .name = "nlmon-be.pcapng", .pcapng = true, .big_endian = true },
+};
+
+#define NUM_FIXTURES (sizeof(fixtures) / sizeof(fixtures[0]))
+
+static uint32_t get32(const struct fixture *fixture, size_t off)
+{
+	const uint8_t *p = fixture->data + off;
+
+	if (fixture->big_endian)
+		return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) |
+		       p[3];
+	return ((uint32_t) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static void put32(const struct fixture *fixture, uint8_t *data, size_t off,
+		  uint32_t val)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		int shift = fixture->big_endian ? 8 * (3 - i) : 8 * i;
+
+		data[off + i] = val >> shift;
+	}
+}
+
+/* Returns true if len is the end of a pcap record or pcapng block (or 0),
+ * i.e. if the fixture truncated to len bytes is a valid (shorter) file.
+ */
+static bool is_boundary(const struct fixture *fixture, size_t len)
+{
+	size_t off = 0;
+
+	if (len == 0)
+		return true;
+
+	if (!fixture->pcapng)
+		off = PCAP_HDR_LEN;
+
+	while (off < len) {
+		if (fixture->pcapng)
+			off += get32(fixture, off + 4);
+		else
+			off += PCAP_REC_HDR_LEN + get32(fixture, off + 8);
+	}
+
+	return off == len;
+}
+
+/*
+ * Reads all messages from data (through a pipe, or from the fixture file
+ * if data is NULL) and compares them with the expected messages starting
+ * at expected[first]. The number of messages is returned in num_msgs and
+ * the error of the reader (or NULL) in error.
+ */
+static int read_msgs(const struct fixture *fixture, const uint8_t *data,
+		     size_t len, size_t first, size_t *num_msgs,
+		     const char **error)
+{
+	struct pcap_reader r;
+	struct pcap_msg msg;
+	struct io_input in;
+	int fds[2] = { -1, -1 }, rc;
+	char path[1024];
+
+	*num_msgs = 0;
+	*error = NULL;
+
+	if (data) {
+		/* The fixtures are much smaller than the pipe buffer */
+		if (pipe(fds) ||
+		    (write(fds[1], data, len) != (ssize_t) len)) {
+			fprintf(stderr, "Unable to write to pipe\n");
+			return -2;
+		}
+		close(fds[1]);
+		snprintf(path, sizeof(path), "/dev/fd/%d", fds[0]);
+	} else {
+		fixture_path(fixture->name, path, sizeof(path));
+	}
+
+	/* A small buffer, so that it has to grow for the larger blocks */
+	if (io_input_open(&in, path, 16)) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		if (fds[0] >= 0)
+			close(fds[0]);
+		return -2;
+	}
+
+	pcap_reader_init(&r);
+
+	while ((rc = pcap_next_msg(&r, &in, &msg)) > 0) {
+		const struct expected_msg *exp;
+
+		if (first + *num_msgs >= NUM_EXPECTED) {
+			fprintf(stderr, "%s: too many messages\n",
+				fixture->name);
+			rc = -2;
+			break;
+		}
+
+		exp = &expected[first + *num_msgs];
+		if ((msg.nla_stream_len != exp->nla_stream_len) ||
+		    memcmp(msg.nla_stream, exp->nla_stream,
+			   exp->nla_stream_len) ||
+		    (msg.ts_sec != exp->ts_sec) ||
+		    (msg.ts_nsec != exp->ts_nsec) ||
+		    (msg.nlmsg_type != 0x1c) ||
+		    (msg.genl_cmd != exp->genl_cmd)) {
+			fprintf(stderr, "%s: unexpected message %zu\n",
+				fixture->name, first + *num_msgs);
+			rc = -2;
+			break;
+		}
+		(*num_msgs)++;
+	}
+
+	if (rc == -1)
+		*error = r.error;
+
+	pcap_reader_deinit(&r);
+	io_input_close(&in);
+	if (fds[0] >= 0)
+		close(fds[0]);
+	return rc;
+}
+
+static int test_fixture(const struct fixture *fixture)
+{
+	const char *error;
+	size_t num_msgs;
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		const uint8_t *data = pass ? fixture->data : NULL;
+
+		if (read_msgs(fixture, data, fixture->len, 0, &num_msgs,
+			      &error) || (num_msgs != NUM_EXPECTED)) {
+			fprintf(stderr, "%s (%s): %zu messages (%s)\n",
+				fixture->name, pass ? "pipe" : "file",
+				num_msgs, error ? error : "no error");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* A truncated copy of a fixture must either be a valid shorter file (if
+ * it ends at a record boundary) or be rejected as truncated. The messages
+ * read before the error must be correct.
+ */
+static int check_truncated(const uint8_t *data, size_t len, void *arg)
+{
+	const struct fixture *fixture = (const struct fixture *) arg;
+	const char *error;
+	size_t num_msgs;
+	int rc;
+
+	rc = read_msgs(fixture, data, len, 0, &num_msgs, &error);
+	if (rc == -2)
+		return -1;
+
+	if (is_boundary(fixture, len) ? (rc != 0) :
+	    ((rc != -1) || !error || strcmp(error, "Truncated capture file"))) {
+		fprintf(stderr, "%s truncated to %zu bytes: rc %d (%s)\n",
+			fixture->name, len, rc, error ? error : "no error");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_truncated(const struct fixture *fixture)
+{
+	return fixture_for_each_prefix(fixture->data, fixture->len,
+				       check_truncated, (void *) fixture);
+}
+
+/* Reads a corrupted copy of a fixture (val written at off) */
+static int test_corrupted(const struct fixture *fixture, const char *what,
+			  size_t off, uint32_t val, size_t first,
+			  size_t expected_msgs, const char *expected_error)
+{
+	uint8_t data[MAX_FIXTURE_LEN];
+	const char *error;
+	size_t num_msgs;
+	int rc;
+
+	memcpy(data, fixture->data, fixture->len);
+	put32(fixture, data, off, val);
+
+	rc = read_msgs(fixture, data, fixture->len, first, &num_msgs, &error);
+	if ((num_msgs != expected_msgs) ||
+	    (expected_error ? ((rc != -1) || !error ||
+			       strcmp(error, expected_error)) : (rc != 0))) {
+		fprintf(stderr, "%s (%s): rc %d, %zu messages (%s)\n",
+			fixture->name, what, rc, num_msgs,
+			error ? error : "no error");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_pcap_corrupted(const struct fixture *fixture)
+{
+	size_t rec2 = PCAP_HDR_LEN + PCAP_REC_HDR_LEN +
+		      get32(fixture, PCAP_HDR_LEN + 8);
+
+	return test_corrupted(fixture, "bad magic", 0, 0x12345678, 0, 0,
+			      "Not a pcap or pcapng file") ||
+	       test_corrupted(fixture, "oversized caplen", rec2 + 8,
+			      0xffffffff, 0, 1, "Invalid packet length") ||
+	       test_corrupted(fixture, "caplen beyond the end", rec2 + 8,
+			      0x10000, 0, 1, "Truncated capture file");
+}
+
+static int test_pcapng_corrupted(const struct fixture *fixture)
+{
+	return test_corrupted(fixture, "oversized block", PCAPNG_IDB2_OFF + 4,
+			      0xfffffff0, 0, 0,
+			      "Invalid pcapng block length") ||
+	       test_corrupted(fixture, "unaligned block", PCAPNG_IDB2_OFF + 4,
+			      33, 0, 0, "Invalid pcapng block length") ||
+	       test_corrupted(fixture, "short block", PCAPNG_IDB2_OFF + 4,
+			      8, 0, 0, "Invalid pcapng block length") ||
+	       test_corrupted(fixture, "block beyond the end",
+			      PCAPNG_IDB2_OFF + 4, 0x10000, 0, 0,
+			      "Truncated capture file") ||
+	       test_corrupted(fixture, "bad byte order magic", 8,
+			      0x12345678, 0, 0,
+			      "Invalid pcapng section header") ||
+	       /* A packet longer than its block is skipped */
+	       test_corrupted(fixture, "oversized caplen",
+			      PCAPNG_EPB_OFF + 20, 0xffffffff, 1,
+			      NUM_EXPECTED - 1, NULL) ||
+	       /* A packet of an unknown interface is skipped */
+	       test_corrupted(fixture, "unknown interface",
+			      PCAPNG_EPB_OFF + 8, 7, 1, NUM_EXPECTED - 1,
+			      NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	fixture_init(argc, argv);
+
+	for (i = 0; i < NUM_FIXTURES; i++) {
+		struct fixture *fixture = &fixtures[i];
+
+		if (fixture_load(fixture->name, fixture->data,
+				 sizeof(fixture->data), &fixture->len) ||
+		    test_fixture(fixture) ||
+		    test_truncated(fixture) ||
+		    (fixture->pcapng ? test_pcapng_corrupted(fixture) :
+				       test_pcap_corrupted(fixture)))
+			return 1;
+	}
+
+	return 0;
+}
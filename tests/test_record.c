@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Writes nla streams of different lengths as framed records into one
+ * buffer and checks that nljson_record_next returns them unchanged, that
+ * truncated records are reported as incomplete and that bad headers are
+ * rejected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <nljson.h>
+
+#define NUM_RECORDS (6)
+#define BUF_SIZE    (1024)
+
+struct record_test {
+	size_t len;
+	uint16_t family;
+	uint8_t cmd;
+};
+
+static const struct record_test records[NUM_RECORDS] = {
+	{8, 0, 0},
+	{0, 0, 0},
+	{5, 0x1234, 7},
+	{1, 0, 0},
+	{7, 0, 1},
+	{64, 0, 0},
+};
+
+/* Fills the nla stream of record index with a pattern of its own */
+static void fill(uint8_t *data, size_t len, unsigned int index)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		data[i] = (uint8_t) (index * 16 + i + 1);
+}
+
+static size_t build(uint8_t *buf)
+{
+	struct nljson_record_hdr hdr;
+	struct nljson_error error;
+	size_t len = 0;
+	unsigned int i;
+
+	memset(buf, 0xff, BUF_SIZE);
+	for (i = 0; i < NUM_RECORDS; i++) {
+		const struct record_test *r = &records[i];
+
+		if (nljson_record_hdr_init(&hdr, r->len, r->family, r->cmd,
+					   &error)) {
+			fprintf(stderr, "nljson_record_hdr_init failed: %s\n",
+				error.err_msg);
+			return 0;
+		}
+
+		memcpy(buf + len, &hdr, sizeof(hdr));
+		fill(buf + len + sizeof(hdr), r->len, i);
+		memset(buf + len + sizeof(hdr) + r->len, 0,
+		       nljson_record_len(r->len) - sizeof(hdr) - r->len);
+		len += nljson_record_len(r->len);
+	}
+
+	return len;
+}
+
+static int check_record(const uint8_t *buf, size_t buf_len, unsigned int index,
+			size_t *consumed)
+{
+	const struct record_test *r = &records[index];
+	uint8_t expected[BUF_SIZE];
+	struct nljson_record_hdr hdr;
+	struct nljson_error error;
+	const void *nla_stream;
+
+	if (nljson_record_next(buf, buf_len, &hdr, &nla_stream, consumed,
+			       &error)) {
+		fprintf(stderr, "record %u: %s\n", index, error.err_msg);
+		return -1;
+	}
+
+	if (*consumed != nljson_record_len(r->len)) {
+		fprintf(stderr, "record %u: consumed %zu bytes (expected "
+			"%zu)\n", index, *consumed, nljson_record_len(r->len));
+		return -1;
+	}
+
+	if ((*consumed % NLJSON_RECORD_ALIGN) ||
+	    (hdr.magic != NLJSON_RECORD_MAGIC) || (hdr.len != r->len) ||
+	    (hdr.family != r->family) || (hdr.cmd != r->cmd) ||
+	    (!!(hdr.flags & NLJSON_RECORD_FLAG_GENL) !=
+	     !!(r->family || r->cmd)) || (hdr.timestamp == 0)) {
+		fprintf(stderr, "record %u: unexpected header\n", index);
+		return -1;
+	}
+
+	fill(expected, r->len, index);
+	if ((nla_stream != buf + sizeof(hdr)) ||
+	    memcmp(nla_stream, expected, r->len)) {
+		fprintf(stderr, "record %u: unexpected nla stream\n", index);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Every prefix of a record is incomplete and consumes nothing */
+static int check_truncated(const uint8_t *buf, unsigned int index)
+{
+	struct nljson_record_hdr hdr;
+	struct nljson_error error;
+	const void *nla_stream;
+	size_t len, consumed;
+
+	for (len = 0; len < nljson_record_len(records[index].len); len++) {
+		consumed = 1;
+		if (nljson_record_next(buf, len, &hdr, &nla_stream, &consumed,
+				       &error) || consumed) {
+			fprintf(stderr, "record %u: truncated to %zu bytes "
+				"not incomplete\n", index, len);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_errors(const uint8_t *buf, size_t buf_len)
+{
+	uint8_t bad[BUF_SIZE];
+	struct nljson_record_hdr hdr;
+	struct nljson_error error;
+	const void *nla_stream;
+	size_t consumed;
+
+	memcpy(bad, buf, buf_len);
+	bad[0] ^= 0xff;
+	if (!nljson_record_next(bad, buf_len, &hdr, &nla_stream, &consumed,
+				&error) || (error.err_code != EINVAL) ||
+	    consumed) {
+		fprintf(stderr, "bad magic not rejected\n");
+		return -1;
+	}
+
+	if ((sizeof(size_t) > sizeof(uint32_t)) &&
+	    (!nljson_record_hdr_init(&hdr, (size_t) UINT32_MAX + 1, 0, 0,
+				     &error) || (error.err_code != EINVAL))) {
+		fprintf(stderr, "too long nla stream not rejected\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	uint8_t buf[BUF_SIZE];
+	size_t len, offset = 0, consumed;
+	unsigned int i, failed = 0;
+
+	len = build(buf);
+	if (!len)
+		return 1;
+
+	for (i = 0; i < NUM_RECORDS; i++) {
+		if (check_truncated(buf + offset, i))
+			failed++;
+
+		if (check_record(buf + offset, len - offset, i, &consumed)) {
+			failed++;
+			break;
+		}
+		offset += consumed;
+	}
+
+	if (!failed && (offset != len)) {
+		fprintf(stderr, "consumed %zu bytes (expected %zu)\n", offset,
+			len);
+		failed++;
+	}
+
+	if (check_errors(buf, len))
+		failed++;
+
+	if (failed) {
+		fprintf(stderr, "%u tests failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
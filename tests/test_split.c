@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Encodes large messages with nested entries (including invalid ones)
+ * with encode threads enabled and checks that the output is identical to
+ * the output of the serial encoder for different format flags.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <jansson.h>
+#include <nljson.h>
+
+#define NUM_ENTRIES  (64)
+#define NUM_MESSAGES (8)
+#define BUF_SIZE     (64 * 1024)
+#define POLICY_LEN   (32 * 1024)
+#define MAX_NEST     (4)
+#define ALIGN(len) (((len) + 3) & ~3)
+
+/* Policy of one entry of the lists L and M */
+static const char *entry_fmt =
+	"%s\"E%u\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": %u,"
+	" \"nested\": {\"I\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	"              \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 2},"
+	"              \"Q\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 3,"
+	"                     \"nested\": {\"V\": {\"data_type\": \"NLA_U16\","
+	"                                        \"nla_type\": 1}}}}}";
+
+static const char *policy_fmt =
+	"{\"A\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	" \"L\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 2,"
+	"        \"nested\": {%s}},"
+	" \"M\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 3,"
+	"        \"nested\": {%s}}}";
+
+struct stream {
+	uint8_t buf[BUF_SIZE];
+	size_t len;
+	size_t nest[MAX_NEST];
+	unsigned int depth;
+};
+
+static uint32_t next_rand(uint64_t *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (uint32_t) (*seed >> 32);
+}
+
+static void put_attr(struct stream *s, uint16_t type, const void *data,
+		     size_t len)
+{
+	uint16_t hdr[2] = {(uint16_t) (4 + len), type};
+
+	memcpy(s->buf + s->len, hdr, sizeof(hdr));
+	if (len)
+		memcpy(s->buf + s->len + 4, data, len);
+	memset(s->buf + s->len + 4 + len, 0, ALIGN(len) - len);
+	s->len += 4 + ALIGN(len);
+}
+
+static void nest_start(struct stream *s, uint16_t type)
+{
+	s->nest[s->depth++] = s->len;
+	put_attr(s, type, NULL, 0);
+}
+
+static void nest_end(struct stream *s)
+{
+	size_t start = s->nest[--s->depth];
+	uint16_t len = (uint16_t) (s->len - start);
+
+	memcpy(s->buf + start, &len, sizeof(len));
+}
+
+static void put_entry(struct stream *s, uint16_t type, uint64_t *seed)
+{
+	char str[64];
+	uint32_t u32 = next_rand(seed);
+	uint16_t u16 = next_rand(seed);
+	size_t start;
+
+	snprintf(str, sizeof(str), "entry %u", next_rand(seed));
+
+	nest_start(s, type);
+	start = s->len;
+	put_attr(s, 1, &u32, sizeof(u32));
+	put_attr(s, 2, str, strlen(str) + 1);
+	nest_start(s, 3);
+	put_attr(s, 1, &u16, sizeof(u16));
+	nest_end(s);
+
+	/* Some entries have trailing bytes and are dropped by the encoder */
+	if (next_rand(seed) % 8 == 0) {
+		memset(s->buf + s->len, 0xff, 2);
+		s->len += 2;
+		nest_end(s);
+		memset(s->buf + s->len, 0, 2);
+		s->len += 2;
+		return;
+	}
+
+	/* Some entries are empty */
+	if (next_rand(seed) % 8 == 0)
+		s->len = start;
+
+	nest_end(s);
+}
+
+static void generate(struct stream *s, uint64_t *seed)
+{
+	uint32_t u32 = next_rand(seed);
+	unsigned int i, num;
+
+	memset(s, 0, sizeof(*s));
+	put_attr(s, 1, &u32, sizeof(u32));
+
+	num = 1 + next_rand(seed) % NUM_ENTRIES;
+	nest_start(s, 2);
+	for (i = 0; i < num; i++)
+		put_entry(s, 1 + i, seed);
+	nest_end(s);
+
+	num = next_rand(seed) % NUM_ENTRIES;
+	nest_start(s, 3);
+	for (i = 0; i < num; i++)
+		put_entry(s, 1 + i, seed);
+	nest_end(s);
+}
+
+static int create_handle(nljson_t **hdl, unsigned int num_threads)
+{
+	static char entries[POLICY_LEN], policy[2 * POLICY_LEN];
+	struct nljson_error error;
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 1; i <= NUM_ENTRIES; i++)
+		len += snprintf(entries + len, sizeof(entries) - len,
+				entry_fmt, (i > 1) ? ", " : "", i, i);
+	snprintf(policy, sizeof(policy), policy_fmt, entries, entries);
+
+	if (nljson_init(hdl, 0, 0, policy, &error)) {
+		fprintf(stderr, "nljson_init failed: %s\n", error.err_msg);
+		return -1;
+	}
+
+	if (num_threads &&
+	    nljson_set_encode_threads(*hdl, num_threads, 0, &error)) {
+		fprintf(stderr, "nljson_set_encode_threads failed: %s\n",
+			error.err_msg);
+		nljson_deinit(hdl);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int check_message(nljson_t *serial, nljson_t *split,
+			 const struct stream *s, uint32_t flags)
+{
+	size_t serial_consumed, serial_len, split_consumed, split_len;
+	struct nljson_error error;
+	char *expected, *output;
+	int ret = -1;
+
+	expected = nljson_encode_nla_alloc(serial, s->buf, s->len,
+					   &serial_consumed, &serial_len,
+					   flags, &error);
+	if (!expected) {
+		fprintf(stderr, "serial encode failed: %s\n", error.err_msg);
+		return -1;
+	}
+
+	output = nljson_encode_nla_alloc(split, s->buf, s->len,
+					 &split_consumed, &split_len, flags,
+					 &error);
+	if (!output) {
+		fprintf(stderr, "split encode failed: %s\n", error.err_msg);
+		goto out;
+	}
+
+	if ((split_consumed != serial_consumed) ||
+	    (split_len != serial_len) || memcmp(output, expected, split_len)) {
+		fprintf(stderr, "split output differs (flags 0x%x)\n",
+			(unsigned int) flags);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(output);
+	free(expected);
+	return ret;
+}
+
+int main(void)
+{
+	static const uint32_t flags[] = {
+		0, JSON_INDENT(4), JSON_COMPACT, JSON_SORT_KEYS,
+	};
+	static const unsigned int num_threads[] = {1, 3};
+	nljson_t *serial, *split;
+	struct stream *s;
+	unsigned int i, j, k, failed = 0;
+	uint64_t seed;
+
+	s = malloc(sizeof(*s));
+	if (!s || create_handle(&serial, 0)) {
+		free(s);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(num_threads) / sizeof(num_threads[0]); i++) {
+		if (create_handle(&split, num_threads[i])) {
+			failed++;
+			break;
+		}
+
+		seed = 1;
+		for (j = 0; j < NUM_MESSAGES; j++) {
+			generate(s, &seed);
+			for (k = 0; k < sizeof(flags) / sizeof(flags[0]); k++) {
+				if (check_message(serial, split, s, flags[k]))
+					failed++;
+			}
+		}
+
+		nljson_deinit(&split);
+	}
+
+	nljson_deinit(&serial);
+	free(s);
+
+	if (failed) {
+		fprintf(stderr, "%u tests failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Encodes a message with each encode function and checks the runtime
+ * statistics of the handle, with and without the encode cache (messages
+ * taken from the cache must be counted like encoded ones), and the
+ * policy coverage profile (the cache is bypassed while profiling).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <nljson.h>
+
+#define BUF_SIZE    (256)
+#define OUT_SIZE    (4096)
+#define MAX_DEPTH   (4)
+#define CACHE_SIZE  (64 * 1024)
+#define ALIGN(len) (((len) + 3) & ~3)
+
+/* Attributes of the test message (see build) */
+#define MSG_ATTRS   (6)
+#define MSG_UNKNOWN (1)
+/* Two levels of nested attributes */
+#define MSG_DEPTH_BUCKET (2)
+
+static const char *policy =
+	"{\"A\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 2, \"nested\":"
+	"        {\"X\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	"         \"Y\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 2,"
+	"                \"nested\": {\"Z\": {\"data_type\": \"NLA_U16\","
+	"                                    \"nla_type\": 1}}}}}}";
+
+struct stream {
+	uint8_t buf[BUF_SIZE];
+	size_t len;
+	size_t nest[MAX_DEPTH];
+	unsigned int depth;
+};
+
+struct cb_data {
+	char buf[OUT_SIZE];
+	size_t len;
+};
+
+struct profile_test {
+	const char *level;
+	uint32_t nla_type;
+	/* Hits per encoded message */
+	uint64_t hits;
+	bool seen;
+};
+
+/* Expected profile entries of the test message */
+static struct profile_test profile_tests[] = {
+	{"/", 1, 1, false},
+	{"/", 2, 1, false},
+	{"/", 20, 1, false},
+	{"/N", 1, 1, false},
+	{"/N", 2, 1, false},
+	{"/N/Y", 1, 1, false},
+};
+
+static void put_attr(struct stream *s, uint16_t type, const void *data,
+		     size_t len)
+{
+	uint16_t hdr[2] = {(uint16_t) (4 + len), type};
+
+	memcpy(s->buf + s->len, hdr, sizeof(hdr));
+	if (len)
+		memcpy(s->buf + s->len + 4, data, len);
+	memset(s->buf + s->len + 4 + len, 0, ALIGN(len) - len);
+	s->len += 4 + ALIGN(len);
+}
+
+static void nest_start(struct stream *s, uint16_t type)
+{
+	s->nest[s->depth++] = s->len;
+	put_attr(s, type, NULL, 0);
+}
+
+static void nest_end(struct stream *s)
+{
+	size_t start = s->nest[--s->depth];
+	uint16_t len = (uint16_t) (s->len - start);
+
+	memcpy(s->buf + start, &len, sizeof(len));
+}
+
+static void build(struct stream *s)
+{
+	uint32_t u32 = 1;
+	uint16_t u16 = 2;
+
+	memset(s, 0, sizeof(*s));
+	put_attr(s, 1, &u32, sizeof(u32));
+	nest_start(s, 2);
+	put_attr(s, 1, &u32, sizeof(u32));
+	nest_start(s, 2);
+	put_attr(s, 1, &u16, sizeof(u16));
+	nest_end(s);
+	nest_end(s);
+	/* Unknown attribute, skipped because of NLJSON_FLAG_SKIP_UNKNOWN_ATTRS */
+	put_attr(s, 20, &u32, sizeof(u32));
+}
+
+static int encode_cb(const char *buf, size_t size, void *data)
+{
+	struct cb_data *cb = (struct cb_data *) data;
+
+	if (size > sizeof(cb->buf) - cb->len)
+		return -1;
+
+	memcpy(cb->buf + cb->len, buf, size);
+	cb->len += size;
+	return 0;
+}
+
+/* Encodes s once with each encode function. Returns the length of the
+ * JSON output (or 0 on error).
+ */
+static size_t encode_all(nljson_t *hdl, const struct stream *s)
+{
+	char output[OUT_SIZE];
+	struct nljson_error error;
+	struct cb_data cb;
+	size_t consumed, produced, len;
+	char *json;
+
+	json = nljson_encode_nla_alloc(hdl, s->buf, s->len, &consumed, &len,
+				       0, &error);
+	if (!json) {
+		fprintf(stderr, "nljson_encode_nla_alloc failed: %s\n",
+			error.err_msg);
+		return 0;
+	}
+	free(json);
+
+	if (nljson_encode_nla(hdl, s->buf, s->len, output, sizeof(output),
+			      &consumed, &produced, 0, &error) ||
+	    (produced != len)) {
+		fprintf(stderr, "nljson_encode_nla failed: %s\n",
+			error.err_msg);
+		return 0;
+	}
+
+	cb.len = 0;
+	if (nljson_encode_nla_cb(hdl, s->buf, s->len, &consumed, encode_cb,
+				 &cb, 0, &error) || (cb.len != len)) {
+		fprintf(stderr, "nljson_encode_nla_cb failed: %s\n",
+			error.err_msg);
+		return 0;
+	}
+
+	return len;
+}
+
+/* Checks the counters of num_messages encoded copies of s */
+static int check_stats(nljson_t *hdl, const char *name, const struct stream *s,
+		       uint64_t num_messages, size_t json_len)
+{
+	struct nljson_stats stats;
+	unsigned int i;
+
+	if (nljson_get_stats(hdl, &stats)) {
+		fprintf(stderr, "%s: nljson_get_stats failed\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < NLJSON_STATS_DEPTH_BUCKETS; i++) {
+		if (stats.depth[i] != ((i == MSG_DEPTH_BUCKET) ?
+				       num_messages : 0))
+			break;
+	}
+
+	if ((stats.messages != num_messages) ||
+	    (stats.attrs != num_messages * MSG_ATTRS) ||
+	    (stats.unknown_attrs_skipped != num_messages * MSG_UNKNOWN) ||
+	    (stats.bytes_in != num_messages * s->len) ||
+	    (stats.bytes_out != num_messages * json_len) ||
+	    (i != NLJSON_STATS_DEPTH_BUCKETS)) {
+		fprintf(stderr, "%s: unexpected stats: messages %llu, attrs "
+			"%llu, unknown %llu, bytes in %llu, bytes out %llu\n",
+			name, (unsigned long long) stats.messages,
+			(unsigned long long) stats.attrs,
+			(unsigned long long) stats.unknown_attrs_skipped,
+			(unsigned long long) stats.bytes_in,
+			(unsigned long long) stats.bytes_out);
+		return -1;
+	}
+
+	for (i = 0; i < NLJSON_STATS_ERR_MAX; i++) {
+		if (stats.errors[i]) {
+			fprintf(stderr, "%s: unexpected errors\n", name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_errors(nljson_t *hdl, const struct stream *s)
+{
+	char output[8];
+	struct nljson_stats stats;
+	struct nljson_error error;
+	size_t consumed, produced;
+
+	nljson_reset_stats(hdl);
+	if (!nljson_encode_nla(hdl, s->buf, s->len, output, sizeof(output),
+			       &consumed, &produced, 0, &error)) {
+		fprintf(stderr, "too small output buffer not rejected\n");
+		return -1;
+	}
+
+	if (nljson_get_stats(hdl, &stats) || stats.messages ||
+	    (stats.errors[NLJSON_STATS_ERR_OUTPUT] != 1)) {
+		fprintf(stderr, "output error not counted\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+struct profile_check {
+	uint64_t num_messages;
+	unsigned int failed;
+};
+
+static int check_profile_entry(const struct nljson_profile_entry *entry,
+			       void *data)
+{
+	struct profile_check *check = (struct profile_check *) data;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(profile_tests) / sizeof(profile_tests[0]); i++) {
+		struct profile_test *t = &profile_tests[i];
+
+		if (strcmp(entry->level, t->level) ||
+		    (entry->nla_type != t->nla_type))
+			continue;
+
+		t->seen = true;
+		if (entry->hits != check->num_messages * t->hits) {
+			fprintf(stderr, "profile %s %u: %llu hits\n",
+				entry->level, (unsigned int) entry->nla_type,
+				(unsigned long long) entry->hits);
+			check->failed++;
+		}
+		return 0;
+	}
+
+	/* Policy entries that are not in the message */
+	if (entry->hits) {
+		fprintf(stderr, "profile %s %u: unexpected hits\n",
+			entry->level, (unsigned int) entry->nla_type);
+		check->failed++;
+	}
+
+	return 0;
+}
+
+/* Encodes s with profiling and the cache enabled. Every message must be
+ * parsed (and counted in the profile) instead of taken from the cache.
+ */
+static int check_profile(nljson_t *hdl, const struct stream *s,
+			 size_t json_len)
+{
+	struct nljson_cache_stats cache_stats;
+	struct profile_check check = {6, 0};
+	struct nljson_error error;
+	unsigned int i;
+
+	if (nljson_enable_encode_cache(hdl, CACHE_SIZE, &error) ||
+	    nljson_enable_profile(hdl, 1, &error)) {
+		fprintf(stderr, "enabling the profile failed: %s\n",
+			error.err_msg);
+		return -1;
+	}
+
+	nljson_reset_stats(hdl);
+	if ((encode_all(hdl, s) != json_len) ||
+	    (encode_all(hdl, s) != json_len) ||
+	    check_stats(hdl, "profile", s, check.num_messages, json_len))
+		return -1;
+
+	if (nljson_get_encode_cache_stats(hdl, &cache_stats) ||
+	    cache_stats.hits || cache_stats.misses) {
+		fprintf(stderr, "cache used while profiling\n");
+		return -1;
+	}
+
+	if (nljson_get_profile(hdl, check_profile_entry, &check) ||
+	    check.failed)
+		return -1;
+
+	for (i = 0; i < sizeof(profile_tests) / sizeof(profile_tests[0]); i++) {
+		if (!profile_tests[i].seen) {
+			fprintf(stderr, "profile %s %u: not reported\n",
+				profile_tests[i].level,
+				(unsigned int) profile_tests[i].nla_type);
+			return -1;
+		}
+	}
+
+	if (nljson_enable_profile(hdl, 0, &error) ||
+	    !nljson_get_profile(hdl, check_profile_entry, &check)) {
+		fprintf(stderr, "profile not disabled\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	struct nljson_cache_stats cache_stats;
+	struct nljson_stats stats;
+	struct nljson_error error;
+	struct stream s;
+	unsigned int failed = 0;
+	size_t json_len;
+	nljson_t *hdl;
+
+	build(&s);
+
+	if (nljson_init(&hdl, 0, NLJSON_FLAG_SKIP_UNKNOWN_ATTRS, policy,
+			&error)) {
+		fprintf(stderr, "nljson_init failed: %s\n", error.err_msg);
+		return 1;
+	}
+
+	if (!nljson_get_stats(hdl, &stats)) {
+		fprintf(stderr, "stats available before being enabled\n");
+		failed++;
+	}
+
+	if (nljson_enable_stats(hdl, 1, &error)) {
+		fprintf(stderr, "nljson_enable_stats failed: %s\n",
+			error.err_msg);
+		nljson_deinit(&hdl);
+		return 1;
+	}
+
+	json_len = encode_all(hdl, &s);
+	if (!json_len || check_stats(hdl, "no cache", &s, 3, json_len))
+		failed++;
+
+	nljson_reset_stats(hdl);
+	if (check_stats(hdl, "reset", &s, 0, 0))
+		failed++;
+
+	/* The first message is encoded, the others are taken from the
+	 * cache.
+	 */
+	if (nljson_enable_encode_cache(hdl, CACHE_SIZE, &error)) {
+		fprintf(stderr, "nljson_enable_encode_cache failed: %s\n",
+			error.err_msg);
+		failed++;
+	} else if ((encode_all(hdl, &s) != json_len) ||
+		   (encode_all(hdl, &s) != json_len) ||
+		   check_stats(hdl, "cache", &s, 6, json_len)) {
+		failed++;
+	} else if (nljson_get_encode_cache_stats(hdl, &cache_stats) ||
+		   (cache_stats.hits != 5)) {
+		fprintf(stderr, "unexpected number of cache hits\n");
+		failed++;
+	}
+
+	if (check_errors(hdl, &s))
+		failed++;
+
+	if (check_profile(hdl, &s, json_len))
+		failed++;
+
+	nljson_deinit(&hdl);
+
+	if (failed) {
+		fprintf(stderr, "%u tests failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
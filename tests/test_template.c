@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Fills a template with different slot values and compares the result
+ * with the decoder output of the same document, where the slots have been
+ * replaced with the values.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <nljson.h>
+
+#define NUM_SLOTS    (4)
+#define NUM_RANDOM   (100)
+#define MAX_DOC_LEN  (2048)
+#define MAX_NLA_LEN  (256)
+
+/* One %s per slot attribute. A and A2 share the slot "a". */
+static const char *doc_fmt =
+	"{\"A\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1, %s},"
+	" \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 2,"
+	"        \"value\": \"fixed\"},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 3, \"value\":"
+	"        {\"B\": {\"data_type\": \"NLA_U16\", \"nla_type\": 1, %s},"
+	"         \"C\": {\"data_type\": \"NLA_U32\", \"nla_type\": 2, %s},"
+	"         \"A2\": {\"data_type\": \"NLA_U8\", \"nla_type\": 3, %s}}},"
+	" \"D\": {\"data_type\": \"NLA_U64\", \"nla_type\": 4, %s},"
+	" \"U\": {\"data_type\": \"NLA_UNSPEC\", \"nla_type\": 5,"
+	"        \"nla_len\": 3, \"value\": [1, 2, 3]}}";
+
+static const char *slot_names[NUM_SLOTS] = {"a", "b", "c", "d"};
+
+/* Creates the template document (values == NULL) or the document with
+ * the slots replaced with values.
+ */
+static void make_doc(char *doc, const int64_t *values)
+{
+	char keys[NUM_SLOTS][64];
+	unsigned int i;
+
+	for (i = 0; i < NUM_SLOTS; i++) {
+		if (values)
+			snprintf(keys[i], sizeof(keys[i]), "\"value\": %lld",
+				 (long long) values[i]);
+		else
+			snprintf(keys[i], sizeof(keys[i]), "\"$slot\": \"%s\"",
+				 slot_names[i]);
+	}
+
+	snprintf(doc, MAX_DOC_LEN, doc_fmt, keys[0], keys[1], keys[2],
+		 keys[0], keys[3]);
+}
+
+static int check_fill(const nljson_template_t *tmpl, const int64_t *values)
+{
+	uint8_t nla[MAX_NLA_LEN];
+	struct nljson_error error;
+	char doc[MAX_DOC_LEN];
+	size_t consumed, produced, len;
+	void *expected;
+	int ret = -1;
+
+	make_doc(doc, values);
+	expected = nljson_decode_nla_alloc(doc, &consumed, &len, 0, &error);
+	if (!expected) {
+		fprintf(stderr, "nljson_decode_nla_alloc failed: %s\n",
+			error.err_msg);
+		return -1;
+	}
+
+	if (nljson_template_fill(tmpl, values, NUM_SLOTS, nla, sizeof(nla),
+				 &produced, &error)) {
+		fprintf(stderr, "nljson_template_fill failed: %s\n",
+			error.err_msg);
+		goto out;
+	}
+
+	if ((produced != len) || (produced != nljson_template_len(tmpl)) ||
+	    memcmp(nla, expected, len)) {
+		fprintf(stderr, "fill differs from decode (%lld %lld %lld "
+			"%lld)\n", (long long) values[0],
+			(long long) values[1], (long long) values[2],
+			(long long) values[3]);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(expected);
+	return ret;
+}
+
+static int check_errors(const nljson_template_t *tmpl)
+{
+	static const char *bad_slot =
+		"{\"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 1,"
+		"        \"$slot\": \"s\"}}";
+	int64_t values[NUM_SLOTS] = {0};
+	uint8_t nla[MAX_NLA_LEN];
+	struct nljson_error error;
+	nljson_template_t *bad;
+	size_t consumed, produced;
+
+	if (!nljson_template_fill(tmpl, values, NUM_SLOTS - 1, nla,
+				  sizeof(nla), &produced, &error) ||
+	    (error.err_code != EINVAL)) {
+		fprintf(stderr, "too few values not rejected\n");
+		return -1;
+	}
+
+	if (!nljson_template_fill(tmpl, values, NUM_SLOTS, nla,
+				  nljson_template_len(tmpl) - 1, &produced,
+				  &error) ||
+	    (error.err_code != ENOSPC)) {
+		fprintf(stderr, "too small buffer not rejected\n");
+		return -1;
+	}
+
+	if (!nljson_prepare(&bad, bad_slot, &consumed, 0, &error) ||
+	    (error.err_code != EINVAL)) {
+		fprintf(stderr, "string slot not rejected\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	static const int64_t fixed[][NUM_SLOTS] = {
+		{0, 0, 0, 0},
+		{1, 2, 3, 4},
+		{0xff, 0xffff, 0xffffffffLL, -1},
+	};
+	struct nljson_error error;
+	nljson_template_t *tmpl;
+	char doc[MAX_DOC_LEN];
+	uint64_t seed = 1;
+	size_t consumed;
+	unsigned int i;
+	int ret = 1;
+
+	make_doc(doc, NULL);
+	if (nljson_prepare(&tmpl, doc, &consumed, 0, &error)) {
+		fprintf(stderr, "nljson_prepare failed: %s\n", error.err_msg);
+		return 1;
+	}
+
+	if ((nljson_template_num_slots(tmpl) != NUM_SLOTS) ||
+	    (nljson_template_slot_index(tmpl, "c") != 2) ||
+	    (nljson_template_slot_index(tmpl, "x") != -1)) {
+		fprintf(stderr, "unexpected slots\n");
+		goto out;
+	}
+
+	for (i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+		if (check_fill(tmpl, fixed[i]))
+			goto out;
+	}
+
+	for (i = 0; i < NUM_RANDOM; i++) {
+		int64_t values[NUM_SLOTS];
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		values[0] = (seed >> 56) & 0xff;
+		values[1] = (seed >> 40) & 0xffff;
+		values[2] = (seed >> 8) & 0xffffffff;
+		values[3] = (int64_t) seed;
+		if (check_fill(tmpl, values))
+			goto out;
+	}
+
+	if (check_errors(tmpl))
+		goto out;
+
+	ret = 0;
+out:
+	nljson_template_free(&tmpl);
+	return ret;
+}
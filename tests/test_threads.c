@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Encodes and decodes with one handle from several threads at the same
+ * time, with the encode cache and the runtime statistics enabled (and
+ * with policy coverage profiling), and compares the output, the
+ * statistics and the profile with a single threaded reference.
+ * Built with -fsanitize=thread so that data races are reported.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <nljson.h>
+
+#define NUM_THREADS   (8)
+#define NUM_STREAMS   (64)
+#define NUM_LOOPS     (400)
+#define MAX_NLA_LEN   (4096)
+#define MAX_JSON_LEN  (65536)
+#define SCRATCH_SIZE  (64 * 1024)
+#define MAX_NEST      (4)
+#define ALIGN(len) (((len) + 3) & ~3)
+
+static const char *policy =
+	"{\"A\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1},"
+	" \"B\": {\"data_type\": \"NLA_U16\", \"nla_type\": 2},"
+	" \"C\": {\"data_type\": \"NLA_U32\", \"nla_type\": 3},"
+	" \"D\": {\"data_type\": \"NLA_U64\", \"nla_type\": 4},"
+	" \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 5,"
+	"        \"minlen\": 3, \"maxlen\": 20},"
+	" \"U\": {\"data_type\": \"NLA_UNSPEC\", \"nla_type\": 6,"
+	"        \"maxlen\": 100},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 9, \"nested\":"
+	"        {\"X\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	"         \"Y\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 2,"
+	"                \"nested\": {\"Z\": {\"data_type\": \"NLA_STRING\","
+	"                                    \"nla_type\": 1}}}}}}";
+
+struct stream {
+	uint8_t nla[MAX_NLA_LEN];
+	size_t nla_len;
+	size_t nest[MAX_NEST];
+	unsigned int depth;
+	char *json;
+	size_t json_len;
+	/* Number of attributes counted when encoding the stream */
+	uint64_t attrs;
+};
+
+static struct stream streams[NUM_STREAMS];
+static nljson_t *hdl;
+static volatile int done;
+static bool profile;
+
+static uint32_t next_rand(uint64_t *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (uint32_t) (*seed >> 32);
+}
+
+static void put_attr(struct stream *s, uint16_t type, const void *data,
+		     size_t len)
+{
+	uint16_t hdr[2] = {(uint16_t) (4 + len), type};
+
+	memcpy(s->nla + s->nla_len, hdr, sizeof(hdr));
+	if (len)
+		memcpy(s->nla + s->nla_len + 4, data, len);
+	memset(s->nla + s->nla_len + 4 + len, 0, ALIGN(len) - len);
+	s->nla_len += 4 + ALIGN(len);
+}
+
+static void nest_start(struct stream *s, uint16_t type)
+{
+	s->nest[s->depth++] = s->nla_len;
+	put_attr(s, type, NULL, 0);
+}
+
+static void nest_end(struct stream *s)
+{
+	size_t start = s->nest[--s->depth];
+	uint16_t len = (uint16_t) (s->nla_len - start);
+
+	memcpy(s->nla + start, &len, sizeof(len));
+}
+
+static void put_string(struct stream *s, uint16_t type, uint64_t *seed,
+		       size_t minlen, size_t maxlen)
+{
+	char str[32];
+	size_t i, len;
+
+	/* The length includes the NUL terminator */
+	len = minlen + next_rand(seed) % (maxlen - minlen + 1);
+	for (i = 0; i < len - 1; i++)
+		str[i] = 'a' + next_rand(seed) % 26;
+	str[len - 1] = '\0';
+	put_attr(s, type, str, len);
+}
+
+/* Creates a stream with random values that is valid according to the
+ * policy. Each attribute is present with a probability of 3/4.
+ */
+static void generate(struct stream *s, uint64_t *seed)
+{
+	uint8_t u8 = next_rand(seed), bytes[100];
+	uint16_t u16 = next_rand(seed);
+	uint32_t u32 = next_rand(seed);
+	uint64_t u64 = ((uint64_t) next_rand(seed) << 32) | next_rand(seed);
+	size_t i, len;
+
+	if (next_rand(seed) % 4)
+		put_attr(s, 1, &u8, sizeof(u8));
+	if (next_rand(seed) % 4)
+		put_attr(s, 2, &u16, sizeof(u16));
+	if (next_rand(seed) % 4)
+		put_attr(s, 3, &u32, sizeof(u32));
+	if (next_rand(seed) % 4)
+		put_attr(s, 4, &u64, sizeof(u64));
+	if (next_rand(seed) % 4)
+		put_string(s, 5, seed, 3, 20);
+	if (next_rand(seed) % 4) {
+		len = next_rand(seed) % sizeof(bytes);
+		for (i = 0; i < len; i++)
+			bytes[i] = next_rand(seed);
+		put_attr(s, 6, bytes, len);
+	}
+	if (next_rand(seed) % 4) {
+		nest_start(s, 9);
+		u32 = next_rand(seed);
+		put_attr(s, 1, &u32, sizeof(u32));
+		nest_start(s, 2);
+		put_string(s, 1, seed, 1, 30);
+		nest_end(s);
+		nest_end(s);
+	}
+}
+
+static int fail(const char *what, int index, struct nljson_error *error)
+{
+	fprintf(stderr, "%s failed (stream %d)", what, index);
+	if (error)
+		fprintf(stderr, ": %s", error->err_msg);
+	fprintf(stderr, "\n");
+	return -1;
+}
+
+static int check_output(const char *what, int index,
+			const char *output, size_t len)
+{
+	struct stream *stream = &streams[index];
+
+	if ((len != stream->json_len) || memcmp(output, stream->json, len)) {
+		fprintf(stderr, "%s: unexpected output (stream %d)\n",
+			what, index);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Decodes the reference JSON of a stream and encodes the result again */
+static int check_decode(nljson_ctx_t *ctx, int index, bool use_ctx)
+{
+	struct stream *stream = &streams[index];
+	struct nljson_error error;
+	size_t consumed, produced, json_len;
+	const void *nla_ctx;
+	void *nla = NULL;
+	char *json;
+	int ret = -1;
+
+	if (use_ctx) {
+		if (nljson_decode_nla_ctx(ctx, stream->json, stream->json_len,
+					  &nla_ctx, &consumed, &produced, 0,
+					  &error))
+			return fail("nljson_decode_nla_ctx", index, &error);
+	} else {
+		nla = nljson_decode_nla_alloc(stream->json, &consumed,
+					      &produced, 0, &error);
+		if (!nla)
+			return fail("nljson_decode_nla_alloc", index, &error);
+		nla_ctx = nla;
+	}
+
+	/* The output of the ctx decode is only valid until the next call
+	 * with the same context, so it is encoded without the context.
+	 */
+	json = nljson_encode_nla_alloc(hdl, nla_ctx, produced, &consumed,
+				       &json_len, 0, &error);
+	if (!json) {
+		fail("nljson_encode_nla_alloc (decoded)", index, &error);
+		goto out;
+	}
+
+	ret = check_output("decode", index, json, json_len);
+	free(json);
+out:
+	free(nla);
+	return ret;
+}
+
+static int run_op(nljson_ctx_t *ctx, char *buf, int op, int index)
+{
+	struct stream *stream = &streams[index];
+	struct nljson_error error;
+	size_t consumed, produced;
+	const char *output;
+	char *json;
+	int ret;
+
+	switch (op) {
+	case 0:
+		if (nljson_encode_nla(hdl, stream->nla, stream->nla_len, buf,
+				      MAX_JSON_LEN, &consumed, &produced, 0,
+				      &error))
+			return fail("nljson_encode_nla", index, &error);
+		return check_output("nljson_encode_nla", index, buf, produced);
+	case 1:
+		json = nljson_encode_nla_alloc(hdl, stream->nla,
+					       stream->nla_len, &consumed,
+					       &produced, 0, &error);
+		if (!json)
+			return fail("nljson_encode_nla_alloc", index, &error);
+		ret = check_output("nljson_encode_nla_alloc", index, json,
+				   produced);
+		free(json);
+		return ret;
+	case 2:
+		if (nljson_encode_nla_ctx(hdl, ctx, stream->nla,
+					  stream->nla_len, &output, &consumed,
+					  &produced, 0, &error))
+			return fail("nljson_encode_nla_ctx", index, &error);
+		return check_output("nljson_encode_nla_ctx", index, output,
+				    produced);
+	case 3:
+		return check_decode(ctx, index, true);
+	default:
+		return check_decode(ctx, index, false);
+	}
+}
+
+static void *worker(void *arg)
+{
+	unsigned int id = (unsigned int) (uintptr_t) arg;
+	struct nljson_error error;
+	nljson_ctx_t *ctx;
+	unsigned int i;
+	char *buf;
+	uintptr_t ret = 1;
+
+	buf = malloc(MAX_JSON_LEN);
+	if (!buf)
+		return (void *) ret;
+
+	if (nljson_ctx_init(&ctx, SCRATCH_SIZE, &error)) {
+		fail("nljson_ctx_init", -1, &error);
+		free(buf);
+		return (void *) ret;
+	}
+
+	/* Each thread walks through the streams in its own order so that
+	 * the threads hit the same cache entries at different times.
+	 */
+	for (i = 0; i < NUM_LOOPS * NUM_STREAMS / NUM_THREADS; i++) {
+		int index = (i * (2 * id + 1) + id) % NUM_STREAMS;
+
+		if (run_op(ctx, buf, (i + id) % 5, index))
+			goto out;
+	}
+
+	ret = 0;
+out:
+	nljson_ctx_deinit(&ctx);
+	free(buf);
+	return (void *) ret;
+}
+
+static int sum_profile(const struct nljson_profile_entry *entry, void *data)
+{
+	*(uint64_t *) data += entry->hits;
+	return 0;
+}
+
+/* Reads the statistics (and the profile) while the workers are running */
+static void *reader(void *arg)
+{
+	struct nljson_cache_stats cache_stats;
+	struct nljson_stats stats;
+	uint64_t hits;
+
+	(void) arg;
+
+	while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+		nljson_get_encode_cache_stats(hdl, &cache_stats);
+		nljson_get_stats(hdl, &stats);
+		if (profile) {
+			hits = 0;
+			nljson_get_profile(hdl, sum_profile, &hits);
+		}
+	}
+
+	return NULL;
+}
+
+static int create_streams(void)
+{
+	struct nljson_stats stats;
+	struct nljson_error error;
+	uint64_t seed = 1;
+	size_t consumed;
+	int i;
+
+	for (i = 0; i < NUM_STREAMS; i++) {
+		struct stream *stream = &streams[i];
+
+		generate(stream, &seed);
+
+		/* The reference is encoded before the cache is enabled */
+		nljson_reset_stats(hdl);
+		stream->json = nljson_encode_nla_alloc(hdl, stream->nla,
+						       stream->nla_len,
+						       &consumed,
+						       &stream->json_len, 0,
+						       &error);
+		if (!stream->json)
+			return fail("nljson_encode_nla_alloc", i, &error);
+
+		nljson_get_stats(hdl, &stats);
+		stream->attrs = stats.attrs;
+	}
+
+	return 0;
+}
+
+static int run_threads(size_t cache_budget)
+{
+	pthread_t threads[NUM_THREADS], reader_thread;
+	struct nljson_cache_stats cache_stats;
+	struct nljson_stats stats;
+	struct nljson_error error;
+	unsigned int i, j, num_started = 0;
+	uint64_t num_encodes, num_attrs = 0, hits = 0;
+	void *thread_ret;
+	int ret = 0;
+
+	if (nljson_enable_encode_cache(hdl, cache_budget, &error))
+		return fail("nljson_enable_encode_cache", -1, &error);
+
+	nljson_reset_stats(hdl);
+	nljson_reset_profile(hdl);
+
+	done = 0;
+	if (pthread_create(&reader_thread, NULL, reader, NULL)) {
+		fprintf(stderr, "pthread_create failed\n");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, worker,
+				   (void *) (uintptr_t) i)) {
+			fprintf(stderr, "pthread_create failed\n");
+			ret = -1;
+			break;
+		}
+		num_started++;
+	}
+
+	for (i = 0; i < num_started; i++) {
+		pthread_join(threads[i], &thread_ret);
+		if (thread_ret)
+			ret = -1;
+	}
+
+	__atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+	pthread_join(reader_thread, NULL);
+
+	if (ret)
+		return ret;
+
+	/* Each loop iteration encodes once (operation 0-2 directly, 3-4
+	 * after decoding)
+	 */
+	num_encodes = (uint64_t) NUM_THREADS *
+		      (NUM_LOOPS * NUM_STREAMS / NUM_THREADS);
+
+	/* The same streams as in worker */
+	for (i = 0; i < NUM_THREADS; i++) {
+		for (j = 0; j < NUM_LOOPS * NUM_STREAMS / NUM_THREADS; j++)
+			num_attrs += streams[(j * (2 * i + 1) + i) %
+					     NUM_STREAMS].attrs;
+	}
+
+	nljson_get_encode_cache_stats(hdl, &cache_stats);
+	nljson_get_stats(hdl, &stats);
+
+	printf("cache budget %zu%s: hits %llu misses %llu insertions %llu "
+	       "evictions %llu entries %llu\n", cache_budget,
+	       profile ? " (profiling)" : "",
+	       (unsigned long long) cache_stats.hits,
+	       (unsigned long long) cache_stats.misses,
+	       (unsigned long long) cache_stats.insertions,
+	       (unsigned long long) cache_stats.evictions,
+	       (unsigned long long) cache_stats.entries);
+
+	if (profile) {
+		/* The cache is bypassed while profiling */
+		if (cache_stats.hits || cache_stats.misses) {
+			fprintf(stderr, "cache used while profiling\n");
+			return -1;
+		}
+
+		nljson_get_profile(hdl, sum_profile, &hits);
+		if (hits != num_attrs) {
+			fprintf(stderr, "profile: %llu attributes, expected "
+				"%llu\n", (unsigned long long) hits,
+				(unsigned long long) num_attrs);
+			return -1;
+		}
+	} else if (cache_stats.hits + cache_stats.misses != num_encodes) {
+		fprintf(stderr, "cache: %llu lookups, expected %llu\n",
+			(unsigned long long)
+			(cache_stats.hits + cache_stats.misses),
+			(unsigned long long) num_encodes);
+		return -1;
+	}
+
+	if ((!profile && !cache_stats.hits) ||
+	    (cache_stats.mem_used > cache_budget)) {
+		fprintf(stderr, "cache: unexpected statistics\n");
+		return -1;
+	}
+
+	/* Messages taken from the cache are counted as well */
+	if ((stats.messages != num_encodes) || (stats.attrs != num_attrs)) {
+		fprintf(stderr, "stats: %llu messages, %llu attributes, "
+			"expected %llu and %llu\n",
+			(unsigned long long) stats.messages,
+			(unsigned long long) stats.attrs,
+			(unsigned long long) num_encodes,
+			(unsigned long long) num_attrs);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	struct nljson_error error;
+	int i, ret = 1;
+
+	if (nljson_init(&hdl, 0, 0, policy, &error)) {
+		fail("nljson_init", -1, &error);
+		return 1;
+	}
+
+	if (nljson_enable_stats(hdl, 1, &error)) {
+		fail("nljson_enable_stats", -1, &error);
+		goto out;
+	}
+
+	if (create_streams())
+		goto out;
+
+	/* A cache large enough for all streams (split into shards) and a
+	 * small one where entries are evicted all the time.
+	 */
+	if (run_threads(4 * 1024 * 1024) || run_threads(8 * 1024))
+		goto out;
+
+	/* Profiling with the cache enabled */
+	if (nljson_enable_profile(hdl, 1, &error)) {
+		fail("nljson_enable_profile", -1, &error);
+		goto out;
+	}
+	profile = true;
+	if (run_threads(4 * 1024 * 1024))
+		goto out;
+
+	ret = 0;
+out:
+	for (i = 0; i < NUM_STREAMS; i++)
+		free(streams[i].json);
+	nljson_deinit(&hdl);
+	return ret;
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2016  Erik Stromdahl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Validates streams with one violation of each kind and checks the
+ * reported offset and attribute path.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <nljson.h>
+
+#define BUF_SIZE   (1024)
+#define MAX_DEPTH  (40)
+#define POLICY_LEN (8192)
+/* Same as VALIDATE_MAX_DEPTH in nljson_validate.c */
+#define DEEP_LEVELS (32)
+#define ALIGN(len) (((len) + 3) & ~3)
+
+static const char *policy_fmt =
+	"{\"A\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1},"
+	" \"C\": {\"data_type\": \"NLA_U32\", \"nla_type\": 3},"
+	" \"M\": {\"data_type\": \"NLA_UNSPEC\", \"nla_type\": 4,"
+	"        \"maxlen\": 4},"
+	" \"S\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 5},"
+	" \"N\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 6, \"nested\":"
+	"        {\"X\": {\"data_type\": \"NLA_U32\", \"nla_type\": 1},"
+	"         \"T\": {\"data_type\": \"NLA_STRING\", \"nla_type\": 2}}},"
+	" %s}";
+
+/* One level of the deeply nested policy */
+static const char *deep_fmt =
+	"\"L\": {\"data_type\": \"NLA_NESTED\", \"nla_type\": 7, \"nested\": {";
+
+struct stream {
+	uint8_t buf[BUF_SIZE];
+	size_t len;
+	size_t nest[MAX_DEPTH];
+	unsigned int depth;
+};
+
+struct validate_test {
+	const char *name;
+	void (*build)(struct stream *s);
+	/* Expected path (NULL if the stream is valid) */
+	const char *path;
+	const char *what;
+	size_t offset;
+};
+
+static void put_attr(struct stream *s, uint16_t type, const void *data,
+		     size_t len)
+{
+	uint16_t hdr[2] = {(uint16_t) (4 + len), type};
+
+	memcpy(s->buf + s->len, hdr, sizeof(hdr));
+	if (len)
+		memcpy(s->buf + s->len + 4, data, len);
+	memset(s->buf + s->len + 4 + len, 0, ALIGN(len) - len);
+	s->len += 4 + ALIGN(len);
+}
+
+static void put_hdr(struct stream *s, uint16_t nla_len, uint16_t type)
+{
+	uint16_t hdr[2] = {nla_len, type};
+
+	memcpy(s->buf + s->len, hdr, sizeof(hdr));
+	s->len += sizeof(hdr);
+}
+
+static void nest_start(struct stream *s, uint16_t type)
+{
+	s->nest[s->depth++] = s->len;
+	put_attr(s, type, NULL, 0);
+}
+
+static void nest_end(struct stream *s)
+{
+	size_t start = s->nest[--s->depth];
+	uint16_t len = (uint16_t) (s->len - start);
+
+	memcpy(s->buf + start, &len, sizeof(len));
+}
+
+static void put_u8(struct stream *s, uint16_t type, uint8_t value)
+{
+	put_attr(s, type, &value, sizeof(value));
+}
+
+static void put_u32(struct stream *s, uint16_t type, uint32_t value)
+{
+	put_attr(s, type, &value, sizeof(value));
+}
+
+static void build_valid(struct stream *s)
+{
+	put_u8(s, 1, 1);
+	put_u32(s, 3, 2);
+	put_attr(s, 4, "abcd", 4);
+	put_attr(s, 5, "str", 4);
+	nest_start(s, 6);
+	put_u32(s, 1, 3);
+	put_attr(s, 2, "nested", 7);
+	nest_end(s);
+	/* Attributes not in the policy are only checked for valid headers */
+	put_attr(s, 20, "x", 1);
+}
+
+static void build_short(struct stream *s)
+{
+	put_u8(s, 1, 1);
+	put_attr(s, 3, "ab", 2);
+}
+
+static void build_maxlen(struct stream *s)
+{
+	put_attr(s, 4, "abcdef", 6);
+}
+
+static void build_string(struct stream *s)
+{
+	put_u8(s, 1, 1);
+	put_attr(s, 5, "abc", 3);
+}
+
+static void build_nested_string(struct stream *s)
+{
+	put_u8(s, 1, 1);
+	nest_start(s, 6);
+	put_u32(s, 1, 3);
+	put_attr(s, 2, "ab", 2);
+	nest_end(s);
+}
+
+static void build_hdr_short(struct stream *s)
+{
+	put_u8(s, 1, 1);
+	put_hdr(s, 2, 3);
+}
+
+static void build_hdr_long(struct stream *s)
+{
+	put_u8(s, 1, 1);
+	put_hdr(s, 100, 1);
+}
+
+static void build_nested_unknown(struct stream *s)
+{
+	nest_start(s, 6);
+	put_u32(s, 1, 3);
+	put_hdr(s, 2, 9);
+	nest_end(s);
+}
+
+static void build_nested_trailing(struct stream *s)
+{
+	nest_start(s, 6);
+	put_u32(s, 1, 3);
+	s->len += 2;
+	nest_end(s);
+	/* Padding of the nested attribute */
+	s->len += 2;
+}
+
+static void build_trailing(struct stream *s)
+{
+	put_u8(s, 1, 1);
+	s->len += 3;
+}
+
+static void build_deep(struct stream *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < DEEP_LEVELS; i++)
+		nest_start(s, 7);
+	for (i = 0; i < DEEP_LEVELS; i++)
+		nest_end(s);
+}
+
+static int run_test(nljson_t *hdl, const struct validate_test *test)
+{
+	struct nljson_error error;
+	char expected[NLJSON_ERR_STR_LEN];
+	struct stream stream;
+	size_t offset = 0;
+	int rc;
+
+	memset(&stream, 0, sizeof(stream));
+	test->build(&stream);
+
+	rc = nljson_validate_nla(hdl, stream.buf, stream.len, &offset, &error);
+	if (!test->path) {
+		if (rc) {
+			fprintf(stderr, "%s: %s\n", test->name, error.err_msg);
+			return -1;
+		}
+		return 0;
+	}
+
+	snprintf(expected, sizeof(expected), "%s: %s (offset %zu)",
+		 test->path, test->what, test->offset);
+	if (!rc || (error.err_code != EINVAL) || (offset != test->offset) ||
+	    strcmp(error.err_msg, expected)) {
+		fprintf(stderr, "%s: rc %d, offset %zu, \"%s\" (expected "
+			"\"%s\")\n", test->name, rc, offset, error.err_msg,
+			expected);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	static const struct validate_test tests[] = {
+		{"valid", build_valid, NULL, NULL, 0},
+		{"short", build_short, "C",
+		 "length 2 < minimum length 4", 8},
+		{"maxlen", build_maxlen, "M", "length 6 > maxlen 4", 0},
+		{"string", build_string, "S",
+		 "string is not NUL terminated", 8},
+		{"nested string", build_nested_string, "N/T",
+		 "string is not NUL terminated", 20},
+		{"header short", build_hdr_short, "C",
+		 "invalid attribute length", 8},
+		{"header long", build_hdr_long, "A",
+		 "invalid attribute length", 8},
+		{"nested unknown", build_nested_unknown, "N/UNKNOWN_ATTR_9",
+		 "invalid attribute length", 12},
+		{"nested trailing", build_nested_trailing, "N",
+		 "trailing bytes", 12},
+		{"trailing", build_trailing, "<top>", "trailing bytes", 8},
+	};
+	static const struct validate_test no_policy = {
+		"no policy", build_short, NULL, NULL, 0,
+	};
+	struct validate_test deep = {
+		"deep", build_deep, NULL, "too deeply nested",
+		4 * (DEEP_LEVELS - 1),
+	};
+	char deep_policy[POLICY_LEN], deep_path[POLICY_LEN];
+	char policy[POLICY_LEN];
+	struct nljson_error error;
+	unsigned int i, failed = 0;
+	size_t len = 0, path_len = 0;
+	nljson_t *hdl;
+
+	/* DEEP_LEVELS + 1 levels of nested policies, so that the innermost
+	 * attribute of build_deep has a policy.
+	 */
+	for (i = 0; i <= DEEP_LEVELS; i++)
+		len += snprintf(deep_policy + len, sizeof(deep_policy) - len,
+				"%s", deep_fmt);
+	len += snprintf(deep_policy + len, sizeof(deep_policy) - len,
+			"\"E\": {\"data_type\": \"NLA_U8\", \"nla_type\": 1}");
+	for (i = 0; i <= DEEP_LEVELS; i++)
+		len += snprintf(deep_policy + len, sizeof(deep_policy) - len,
+				"}}");
+	snprintf(policy, sizeof(policy), policy_fmt, deep_policy);
+
+	for (i = 0; i < DEEP_LEVELS; i++)
+		path_len += snprintf(deep_path + path_len,
+				     sizeof(deep_path) - path_len, "%sL",
+				     i ? "/" : "");
+	deep.path = deep_path;
+
+	if (nljson_init(&hdl, 0, 0, policy, &error)) {
+		fprintf(stderr, "nljson_init failed: %s\n", error.err_msg);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		if (run_test(hdl, &tests[i]))
+			failed++;
+	}
+
+	if (run_test(hdl, &deep))
+		failed++;
+
+	/* Without a handle, only the attribute headers are checked */
+	if (run_test(NULL, &no_policy))
+		failed++;
+
+	nljson_deinit(&hdl);
+
+	if (failed) {
+		fprintf(stderr, "%u tests failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}